@@ -0,0 +1,453 @@
+/* benchsuite.c */
+#include "fileutils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * Runs each command of Analyze over a generated corpus and reports its
+ * throughput, the allocations it made and the peak resident set of the
+ * process that ran it, so changes can be compared from run to run.
+ *
+ * The corpus is the same on every host: a large script in the manner of
+ * a startup-sequence, a log of long lines, a binary and lines of one
+ * letter for patterns that are hard on a matcher. SCALE multiplies
+ * the size of each file. Every command runs in a process of its own,
+ * which loads the file afresh like a Shell invocation does, and is timed
+ * over BENCH_RUNS runs; the best time counts.
+ *
+ * Usage: benchsuite [corpus directory] [scale]. Built by "make bench".
+ */
+
+#define BENCH_RUNS 3
+#define MB (1024.0 * 1024.0)
+
+/* A generator writes about size bytes of one kind of file */
+typedef BOOL (*CorpusWriter)(FILE *fp, ULONG size);
+
+struct CorpusFile {
+  const char *name;
+  ULONG size;               /* Bytes at scale 1 */
+  CorpusWriter write;
+  const char *pattern;      /* What FIND, FINDALL and COUNT look for */
+};
+
+/* A command, run once on a file; returns the lines it went through */
+typedef ULONG (*BenchCommand)(const char *path, const char *pattern,
+                              const char *scratch);
+
+struct BenchEntry {
+  const char *name;
+  BenchCommand run;
+};
+
+static ULONG randomState;
+
+/* xorshift32, so the corpus does not depend on the C library's rand() */
+static ULONG nextRandom(void) {
+  ULONG x;
+
+  x = randomState;
+  x ^= x << 13;
+  x &= 0xFFFFFFFFUL;
+  x ^= x >> 17;
+  x ^= x << 5;
+  x &= 0xFFFFFFFFUL;
+  randomState = x;
+  return x;
+}
+
+static ULONG pick(ULONG count) {
+  return nextRandom() % count;
+}
+
+/* Wall clock seconds; searches may run on several workers */
+static double wallClock(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Assigns, commands, blocks and comments, as a startup-sequence has them */
+static BOOL writeScript(FILE *fp, ULONG size) {
+  static const char *const volumes[] = {
+    "SYS:", "Work:", "DH1:", "RAM:", "ENVARC:", "S:", "C:", "LIBS:"
+  };
+  static const char *const dirs[] = {
+    "Prefs", "Tools", "Utilities", "Classes", "Devs/Monitors", "Storage",
+    "System", "Expansion", "Fonts", "L"
+  };
+  static const char *const commands[] = {
+    "C:Copy %s%s/#? TO RAM:T QUIET",
+    "Assign %s %s%s ADD",
+    "C:Resident >NIL: %s%s/Execute PURE",
+    "Run >NIL: %s%s/Daemon%lu",
+    "Echo \"Setting up %s%s (%lu)\"",
+    "SetEnv Workbench %s%s.%lu",
+    "Path %s%s ADD",
+    "C:MakeDir RAM:T%s%lu",
+    "Mount DEV%lu: FROM %s%s/MountList"
+  };
+  ULONG written;
+  ULONG depth;
+  ULONG n;
+  int length;
+
+  randomState = 0x2545F491UL;
+  written = 0;
+  depth = 0;
+  while (written < size) {
+    n = pick(20);
+    if (n < 2) {
+      length = fprintf(fp, "%*s; Set up %s%s for the next part\n",
+                       (int)depth * 2, "", volumes[pick(8)], dirs[pick(10)]);
+    } else if (n < 4) {
+      length = fprintf(fp, "\n");
+    } else if (n == 4 && depth < 4) {
+      length = fprintf(fp, "%*sIf EXISTS %s%s\n", (int)depth * 2, "",
+                       volumes[pick(8)], dirs[pick(10)]);
+      depth++;
+    } else if (n == 5 && depth) {
+      depth--;
+      length = fprintf(fp, "%*sEndIf\n", (int)depth * 2, "");
+    } else {
+      length = fprintf(fp, "%*s", (int)depth * 2, "");
+      n = pick(9);
+      if (n == 1) {
+        length += fprintf(fp, commands[n], dirs[pick(10)], volumes[pick(8)],
+                          dirs[pick(10)]);
+      } else if (n == 7) {
+        length += fprintf(fp, commands[n], dirs[pick(10)],
+                          (unsigned long)pick(1000));
+      } else if (n == 8) {
+        length += fprintf(fp, commands[n], (unsigned long)pick(10),
+                          volumes[pick(8)], dirs[pick(10)]);
+      } else {
+        length += fprintf(fp, commands[n], volumes[pick(8)], dirs[pick(10)],
+                          (unsigned long)pick(1000));
+      }
+      length += fprintf(fp, "\n");
+    }
+    if (length < 0) return FALSE;
+    written += length;
+  }
+  return TRUE;
+}
+
+/* Time-stamped entries of 1-16K characters, now and then an error */
+static BOOL writeLog(FILE *fp, ULONG size) {
+  static const char *const levels[] = { "INFO", "DEBUG", "WARN", "ERROR" };
+  static const char words[] = "abcdefghijklmnopqrstuvwxyz";
+  ULONG written;
+  ULONG entry;
+  ULONG length;
+  ULONG i;
+  int head;
+
+  randomState = 0x9E3779B9UL;
+  written = 0;
+  for (entry = 0; written < size; entry++) {
+    head = fprintf(fp, "2025-01-%02lu %02lu:%02lu:%02lu.%03lu [%s] task%lu:",
+                   (unsigned long)(1 + entry / 86400 % 28),
+                   (unsigned long)(entry / 3600 % 24),
+                   (unsigned long)(entry / 60 % 60),
+                   (unsigned long)(entry % 60),
+                   (unsigned long)pick(1000),
+                   levels[pick(16) ? pick(3) : 3],
+                   (unsigned long)pick(64));
+    if (head < 0) return FALSE;
+
+    length = 1024 + pick(15 * 1024);
+    for (i = 0; i < length; i++) {
+      fputc(pick(6) ? words[pick(26)] : ' ', fp);
+    }
+    if (fputc('\n', fp) == EOF) return FALSE;
+    written += head + length + 1;
+  }
+  return TRUE;
+}
+
+/* A hunk executable's magic, then code-like bytes with some strings */
+static BOOL writeBinary(FILE *fp, ULONG size) {
+  static const UBYTE hunkHeader[] = { 0x00, 0x00, 0x03, 0xF3 };
+  ULONG written;
+
+  randomState = 0x1B873593UL;
+  if (fwrite(hunkHeader, 1, sizeof(hunkHeader), fp) != sizeof(hunkHeader)) {
+    return FALSE;
+  }
+
+  written = sizeof(hunkHeader);
+  while (written < size) {
+    if (!pick(4096)) {
+      if (fputs("dos.library", fp) == EOF) return FALSE;
+      written += 11;
+    } else {
+      if (fputc((int)pick(256), fp) == EOF) return FALSE;
+      written++;
+    }
+  }
+  return TRUE;
+}
+
+/*
+ * Lines of a million a's, each but the last ending in a b, for patterns
+ * that a backtracking matcher would take quadratic or exponential time on
+ */
+static BOOL writeRuns(FILE *fp, ULONG size) {
+  ULONG written;
+  ULONG length;
+  ULONG i;
+
+  length = 1024UL * 1024;
+  for (written = 0; written < size; written += length + 1) {
+    for (i = 1; i < length; i++) {
+      if (fputc('a', fp) == EOF) return FALSE;
+    }
+    fputc(written + 2 * (length + 1) > size ? 'a' : 'b', fp);
+    if (fputc('\n', fp) == EOF) return FALSE;
+  }
+  return TRUE;
+}
+
+static const struct CorpusFile corpusFiles[] = {
+  { "startup.script", 32UL * 1024 * 1024, writeScript, "#?Assign#?" },
+  { "long.log", 32UL * 1024 * 1024, writeLog, "#?ERROR#?" },
+  { "program.exe", 8UL * 1024 * 1024, writeBinary, "#?dos.library#?" },
+  { "runs.txt", 4UL * 1024 * 1024, writeRuns, "#a" },
+  { "altruns.txt", 4UL * 1024 * 1024, writeRuns, "#(a|aa)" },
+  { NULL, 0, NULL, NULL }
+};
+
+static BOOL writeCorpusFile(const char *path, const struct CorpusFile *file,
+                            ULONG scale) {
+  FILE *fp;
+  BOOL success;
+
+  fp = fopen(path, "wb");
+  if (!fp) return FALSE;
+
+  success = file->write(fp, file->size * scale);
+  if (fclose(fp) != 0) success = FALSE;
+  return success;
+}
+
+/* Load and index, as INFO does */
+static ULONG runLoad(const char *path, const char *pattern,
+                     const char *scratch) {
+  struct FileMetadata *metadata;
+  ULONG lines;
+
+  metadata = analyzeFile(path);
+  if (!metadata) return 0;
+
+  lines = metadata->lineCount;
+  freeFileMetadata(metadata);
+  return lines;
+}
+
+static ULONG runFind(const char *path, const char *pattern,
+                     const char *scratch) {
+  struct FileMetadata *metadata;
+  struct TextLine *line;
+  ULONG lines;
+
+  metadata = analyzeFile(path);
+  if (!metadata) return 0;
+
+  /* Only the lines up to the first match were looked at */
+  line = findLineByPattern(metadata, pattern, FALSE);
+  lines = line ? line->lineNumber : metadata->lineCount;
+  freeFileMetadata(metadata);
+  return lines;
+}
+
+static ULONG runFindAll(const char *path, const char *pattern,
+                        const char *scratch) {
+  struct FileMetadata *metadata;
+  struct CompiledPattern *compiled;
+  struct LineMatches *matches;
+  ULONG lines;
+
+  metadata = analyzeFile(path);
+  if (!metadata) return 0;
+
+  compiled = obtainPattern(pattern, FALSE);
+  matches = compiled ? findAllMatches(metadata, compiled) : NULL;
+  lines = matches ? metadata->lineCount : 0;
+
+  freeLineMatches(matches);
+  freeFileMetadata(metadata);
+  return lines;
+}
+
+static ULONG runCount(const char *path, const char *pattern,
+                      const char *scratch) {
+  struct FileMetadata *metadata;
+  ULONG lines;
+
+  metadata = analyzeFile(path);
+  if (!metadata) return 0;
+
+  countLinesByPattern(metadata, pattern, FALSE);
+  lines = metadata->lineCount;
+  freeFileMetadata(metadata);
+  return lines;
+}
+
+/* Read every line without loading the file, as STREAM does */
+static ULONG runStream(const char *path, const char *pattern,
+                       const char *scratch) {
+  struct LineStream *stream;
+  ULONG lines;
+
+  stream = openLineStream(path);
+  if (!stream) return 0;
+
+  lines = 0;
+  while (nextStreamLine(stream)) lines++;
+  closeLineStream(stream);
+  return lines;
+}
+
+/* Change the first line and write the file out, as REPLACE with SAVE does */
+static ULONG runSave(const char *path, const char *pattern,
+                     const char *scratch) {
+  struct FileMetadata *metadata;
+  ULONG lines;
+
+  metadata = analyzeFile(path);
+  if (!metadata) return 0;
+
+  lines = 0;
+  if (metadata->lineCount && replaceLine(metadata, 1, "; benchsuite") &&
+      saveToFile(metadata, scratch)) {
+    lines = metadata->lineCount;
+  }
+  freeFileMetadata(metadata);
+  DeleteFile((STRPTR)scratch);
+  return lines;
+}
+
+static const struct BenchEntry benchCommands[] = {
+  { "LOAD", runLoad },
+  { "FIND", runFind },
+  { "FINDALL", runFindAll },
+  { "COUNT", runCount },
+  { "STREAM", runStream },
+  { "SAVE", runSave },
+  { NULL, NULL }
+};
+
+/* Peak resident set of this process in bytes */
+static double peakResident(void) {
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) < 0) return 0.0;
+#ifdef __APPLE__
+  return (double)usage.ru_maxrss;
+#else
+  return usage.ru_maxrss * 1024.0;
+#endif
+}
+
+/* Run one command on one file and print its row; called in a child */
+static int measure(const struct BenchEntry *entry, const char *path,
+                   const char *pattern, const char *scratch, ULONG size) {
+  struct HostMemStats before;
+  struct HostMemStats after;
+  double best;
+  double start;
+  double elapsed;
+  ULONG lines;
+  int run;
+
+  best = 0.0;
+  lines = 0;
+  for (run = 0; run < BENCH_RUNS; run++) {
+    /* Allocations are counted over the last run only */
+    resetHostMemPeak();
+    getHostMemStats(&before);
+
+    start = wallClock();
+    lines = entry->run(path, pattern, scratch);
+    elapsed = wallClock() - start;
+
+    getHostMemStats(&after);
+    if (!run || elapsed < best) best = elapsed;
+  }
+  if (best <= 0.0) best = 1e-9;
+
+  printf("%-15s %-8s %9.1f %10.2f %10lu %9.1f %9.1f\n",
+         FilePart((STRPTR)path), entry->name, size / MB / best,
+         lines / best / 1e6,
+         (unsigned long)(after.allocations - before.allocations),
+         (after.peakInUse - before.inUse) / MB, peakResident() / MB);
+  return RETURN_OK;
+}
+
+int main(int argc, char *argv[]) {
+  const struct CorpusFile *file;
+  const struct BenchEntry *entry;
+  const char *corpus;
+  char path[MAX_PATH_LEN];
+  char scratch[MAX_PATH_LEN];
+  ULONG scale;
+  pid_t child;
+  int status;
+  int failures;
+
+  corpus = argc > 1 ? argv[1] : "benchcorpus";
+  scale = argc > 2 ? strtoul(argv[2], NULL, 10) : 1;
+  if (!scale) scale = 1;
+
+  mkdir(corpus, 0755);
+  strcpy(scratch, corpus);
+  if (!AddPart(scratch, "save.tmp", MAX_PATH_LEN)) return RETURN_FAIL;
+
+  printf("Generating the corpus in %s at scale %lu\n", corpus,
+         (unsigned long)scale);
+  for (file = corpusFiles; file->name; file++) {
+    strcpy(path, corpus);
+    if (!AddPart(path, file->name, MAX_PATH_LEN) ||
+        !writeCorpusFile(path, file, scale)) {
+      printf("cannot write %s\n", path);
+      return RETURN_FAIL;
+    }
+  }
+
+  printf("\n%-15s %-8s %9s %10s %10s %9s %9s\n", "file", "command", "MB/s",
+         "Mlines/s", "allocs", "heap MB", "RSS MB");
+
+  failures = 0;
+  for (file = corpusFiles; file->name; file++) {
+    strcpy(path, corpus);
+    AddPart(path, file->name, MAX_PATH_LEN);
+
+    for (entry = benchCommands; entry->name; entry++) {
+      /* A process of its own, so the peak resident set is this command's */
+      fflush(stdout);
+      child = fork();
+      if (child == 0) {
+        exit(measure(entry, path, file->pattern, scratch,
+                     file->size * scale));
+      }
+
+      if (child < 0 || waitpid(child, &status, 0) < 0 ||
+          !WIFEXITED(status) || WEXITSTATUS(status) != RETURN_OK) {
+        printf("%-15s %-8s FAILED\n", file->name, entry->name);
+        failures++;
+      }
+    }
+  }
+
+  return failures ? RETURN_FAIL : RETURN_OK;
+}
@@ -0,0 +1,272 @@
+/* detectbench.c */
+#include "fileutils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Measures the sampled text/binary policy against a full scan on a corpus.
+ * The full scan is taken as the truth; for each file the benchmark reports
+ * what the policy decided, whether it had to fall back to a full scan, and
+ * how long each took. Files named on the command line join the built-in
+ * corpus, which covers the usual Amiga binaries, several kinds of text and
+ * the mixed cases sampling can get wrong.
+ *
+ * Build with src on the include path and link src/textdetect.c and
+ * src/bytescan.c.
+ */
+
+#define CORPUS_SIZE (4L * 1024 * 1024)
+#define SMALL_SIZE (32L * 1024)
+
+struct CorpusFile {
+  char name[64];
+  char *data;
+  ULONG size;
+};
+
+/* Fill with printable text, ending lines with LF or CRLF */
+static void fillText(char *p, ULONG size, BOOL crlf, BOOL highBytes) {
+  ULONG i;
+  int column;
+
+  column = 0;
+  for (i = 0; i < size; i++) {
+    if (column > 20 + rand() % 60) {
+      if (crlf && i + 1 < size) p[i++] = '\r';
+      p[i] = '\n';
+      column = 0;
+    } else {
+      if (highBytes && rand() % 20 == 0) p[i] = (char)(160 + rand() % 96);
+      else if (rand() % 30 == 0) p[i] = '\t';
+      else p[i] = ' ' + rand() % 95;
+      column++;
+    }
+  }
+}
+
+/* Fill with bytes that look like machine code or compressed data */
+static void fillBinary(char *p, ULONG size, int zeroPercent) {
+  ULONG i;
+
+  for (i = 0; i < size; i++) {
+    p[i] = (rand() % 100 < zeroPercent) ? 0 : (char)(rand() % 256);
+  }
+}
+
+/* Sprinkle bytes into a buffer at a given rate per thousand */
+static void sprinkle(char *p, ULONG size, char c, int perMille) {
+  ULONG i;
+
+  for (i = 0; i < size; i++) {
+    if (rand() % 1000 < perMille) p[i] = c;
+  }
+}
+
+/* Store a big-endian longword */
+static void pokeLong(char *p, ULONG value) {
+  p[0] = (char)(value >> 24);
+  p[1] = (char)(value >> 16);
+  p[2] = (char)(value >> 8);
+  p[3] = (char)value;
+}
+
+/* Add a generated file to the corpus */
+static struct CorpusFile *addFile(struct CorpusFile *files, int *count,
+                                  const char *name, ULONG size) {
+  struct CorpusFile *file;
+
+  file = &files[(*count)++];
+  strncpy(file->name, name, sizeof(file->name) - 1);
+  file->size = size;
+  file->data = malloc(size);
+  if (!file->data) {
+    printf("out of memory\n");
+    exit(RETURN_FAIL);
+  }
+  return file;
+}
+
+/* Build the synthetic corpus */
+static void buildCorpus(struct CorpusFile *files, int *count) {
+  struct CorpusFile *f;
+
+  srand(1);
+
+  f = addFile(files, count, "text LF", CORPUS_SIZE);
+  fillText(f->data, f->size, FALSE, FALSE);
+
+  f = addFile(files, count, "text CRLF", CORPUS_SIZE);
+  fillText(f->data, f->size, TRUE, FALSE);
+
+  f = addFile(files, count, "text Latin-1", CORPUS_SIZE);
+  fillText(f->data, f->size, FALSE, TRUE);
+
+  f = addFile(files, count, "text with ANSI escapes", CORPUS_SIZE);
+  fillText(f->data, f->size, FALSE, FALSE);
+  sprinkle(f->data, f->size, 0x1B, 10);
+
+  f = addFile(files, count, "text 5% control codes", CORPUS_SIZE);
+  fillText(f->data, f->size, FALSE, FALSE);
+  sprinkle(f->data, f->size, 0x01, 50);
+
+  f = addFile(files, count, "text with a stray NUL", CORPUS_SIZE);
+  fillText(f->data, f->size, FALSE, FALSE);
+  f->data[1000] = '\0';
+
+  f = addFile(files, count, "text, binary tail", CORPUS_SIZE);
+  fillText(f->data, CORPUS_SIZE / 4, FALSE, FALSE);
+  fillBinary(f->data + CORPUS_SIZE / 4, CORPUS_SIZE - CORPUS_SIZE / 4, 30);
+
+  f = addFile(files, count, "binary header, text", CORPUS_SIZE);
+  fillBinary(f->data, 8192, 30);
+  fillText(f->data + 8192, CORPUS_SIZE - 8192, FALSE, FALSE);
+
+  f = addFile(files, count, "hunk executable", CORPUS_SIZE);
+  fillBinary(f->data, f->size, 25);
+  pokeLong(f->data, 0x3F3);
+
+  f = addFile(files, count, "IFF ILBM", CORPUS_SIZE);
+  fillBinary(f->data, f->size, 5);
+  memcpy(f->data, "FORM", 4);
+  pokeLong(f->data + 4, CORPUS_SIZE - 8);
+  memcpy(f->data + 8, "ILBMBMHD", 8);
+
+  f = addFile(files, count, "LhA archive", CORPUS_SIZE);
+  fillBinary(f->data, f->size, 0);
+  memcpy(f->data + 2, "-lh5-", 5);
+
+  f = addFile(files, count, "LZX archive", CORPUS_SIZE);
+  fillBinary(f->data, f->size, 0);
+  memcpy(f->data, "LZX\0", 4);
+
+  f = addFile(files, count, "compressed data", CORPUS_SIZE);
+  fillBinary(f->data, f->size, 0);
+
+  f = addFile(files, count, "sparse binary", CORPUS_SIZE);
+  fillText(f->data, f->size, FALSE, FALSE);
+  sprinkle(f->data, f->size, 0, 400);
+
+  f = addFile(files, count, "small text", SMALL_SIZE);
+  fillText(f->data, f->size, FALSE, FALSE);
+
+  f = addFile(files, count, "small binary", SMALL_SIZE);
+  fillBinary(f->data, f->size, 25);
+}
+
+/* Load a file named on the command line */
+static BOOL loadFile(struct CorpusFile *files, int *count, const char *path) {
+  struct CorpusFile *file;
+  FILE *fp;
+  long size;
+
+  fp = fopen(path, "rb");
+  if (!fp) return FALSE;
+
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+
+  file = addFile(files, count, FilePart(path), size > 0 ? size : 1);
+  file->size = fread(file->data, 1, size, fp);
+  fclose(fp);
+  return TRUE;
+}
+
+/* The verdict of a full scan, as isTextFile() gives it */
+static BOOL fullIsBinary(const char *data, ULONG size) {
+  struct ByteScan scan;
+
+  scanFileData(NULL, data, size, NULL, &scan);
+  return scan.isBinary;
+}
+
+/* The verdict under the policy, falling back as analyzeFile() would */
+static BOOL policyIsBinary(const char *data, ULONG size, BOOL *sampled) {
+  DetectResult result;
+
+  result = sampleFileData(data, size, &detectPolicy);
+  *sampled = (BOOL)(result != DETECT_UNSURE);
+
+  if (result == DETECT_UNSURE) return fullIsBinary(data, size);
+  return (BOOL)(result == DETECT_BINARY);
+}
+
+/* Seconds per call of either detector, timed over repeated calls */
+static double timeDetect(const struct CorpusFile *file, BOOL policy) {
+  clock_t start;
+  clock_t elapsed;
+  long runs;
+  BOOL sampled;
+
+  runs = 0;
+  start = clock();
+
+  do {
+    if (policy) policyIsBinary(file->data, file->size, &sampled);
+    else fullIsBinary(file->data, file->size);
+    runs++;
+    elapsed = clock() - start;
+  } while (elapsed < CLOCKS_PER_SEC / 20);
+
+  return (double)elapsed / CLOCKS_PER_SEC / runs;
+}
+
+int main(int argc, char *argv[]) {
+  struct CorpusFile *files;
+  double fullTime;
+  double policyTime;
+  double fullTotal;
+  double policyTotal;
+  BOOL truth;
+  BOOL verdict;
+  BOOL sampled;
+  int wrong;
+  int settled;
+  int count;
+  int i;
+
+  files = calloc(32 + argc, sizeof(struct CorpusFile));
+  if (!files) return RETURN_FAIL;
+
+  count = 0;
+  buildCorpus(files, &count);
+  for (i = 1; i < argc; i++) {
+    if (!loadFile(files, &count, argv[i])) printf("cannot read %s\n", argv[i]);
+  }
+
+  printf("%-24s %9s %-6s %-6s %-7s %10s %10s\n", "file", "size", "full",
+         "policy", "by", "full", "policy");
+
+  wrong = settled = 0;
+  fullTotal = policyTotal = 0.0;
+
+  for (i = 0; i < count; i++) {
+    truth = fullIsBinary(files[i].data, files[i].size);
+    verdict = policyIsBinary(files[i].data, files[i].size, &sampled);
+
+    fullTime = timeDetect(&files[i], FALSE);
+    policyTime = timeDetect(&files[i], TRUE);
+    fullTotal += fullTime;
+    policyTotal += policyTime;
+
+    if (verdict != truth) wrong++;
+    if (sampled) settled++;
+
+    printf("%-24.24s %9ld %-6s %-6s %-7s %8.3fms %8.3fms%s\n",
+           files[i].name, (long)files[i].size,
+           truth ? "binary" : "text", verdict ? "binary" : "text",
+           sampled ? "sample" : "full", fullTime * 1e3, policyTime * 1e3,
+           verdict != truth ? "  WRONG" : "");
+  }
+
+  printf("\n%d files, %d settled by sampling, %d misclassified\n",
+         count, settled, wrong);
+  printf("detection time %.3fms full, %.3fms with policy (%.1fx)\n",
+         fullTotal * 1e3, policyTotal * 1e3, fullTotal / policyTotal);
+
+  for (i = 0; i < count; i++) free(files[i].data);
+  free(files);
+  return RETURN_OK;
+}
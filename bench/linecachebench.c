@@ -0,0 +1,238 @@
+/* linecachebench.c */
+#include "fileutils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+/*
+ * Checks that a line cache gives the same index as a scan and is dropped
+ * whenever it no longer fits the file, then times loading a large file
+ * with no cache, a cold cache and a warm one.
+ *
+ * The cache must be missed after the file is touched, after it is changed
+ * in place to the same size with its date put back, and after the cache
+ * file is cut short or has a bound broken; each miss writes it afresh.
+ *
+ * Build with src on the include path and link every source but analyze.c.
+ * The file goes to the path given, or to linecachebench.tmp, and the cache
+ * to a directory beside it.
+ */
+
+#define BENCH_LINES 1000000L
+#define BENCH_RUNS 5
+
+/* Wall clock seconds */
+static double wallClock(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Write the test file, one line of it changed by marker */
+static BOOL writeTestFile(const char *path, long lines, const char *marker) {
+  FILE *fp;
+  long line;
+
+  fp = fopen(path, "w");
+  if (!fp) return FALSE;
+
+  for (line = 1; line <= lines; line++) {
+    if (line == lines / 2) fprintf(fp, "%s\r\n", marker);
+    else if (line % 7 == 0) fprintf(fp, "; comment %ld\n", line);
+    else fprintf(fp, "echo line %ld of the bench file\n", line);
+  }
+  return (BOOL)(fclose(fp) == 0);
+}
+
+/* Whether two analyses of the same data agree in everything indexed */
+static BOOL sameMetadata(const struct FileMetadata *a,
+                         const struct FileMetadata *b) {
+  struct TextLine *x;
+  struct TextLine *y;
+  ULONG i;
+
+  if (a->fileSize != b->fileSize || a->isBinary != b->isBinary ||
+      a->lineCount != b->lineCount || a->lineEnding != b->lineEnding ||
+      a->nonPrintable != b->nonPrintable ||
+      a->lineBufferSize != b->lineBufferSize ||
+      memcmp(a->endingCounts, b->endingCounts, sizeof(a->endingCounts))) {
+    return FALSE;
+  }
+
+  for (i = 1; i <= a->lineCount; i++) {
+    x = getLine(a, i);
+    y = getLine(b, i);
+    if (x->filePosition != y->filePosition || x->length != y->length ||
+        x->rawLength != y->rawLength || x->ending != y->ending ||
+        x->type != y->type || x->lineNumber != y->lineNumber) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/* The one file in the cache directory */
+static BOOL findCacheFile(const char *directory, char *buffer) {
+  char command[MAX_PATH_LEN * 2];
+  FILE *pipe;
+  BOOL found;
+
+  sprintf(command, "ls -d %.200s/*.lidx 2>/dev/null", directory);
+  pipe = popen(command, "r");
+  if (!pipe) return FALSE;
+
+  found = (BOOL)(fgets(buffer, MAX_PATH_LEN, pipe) != NULL);
+  if (found) buffer[strcspn(buffer, "\n")] = '\0';
+  pclose(pipe);
+  return found;
+}
+
+static long fileSizeOf(const char *path) {
+  FILE *fp;
+  long size;
+
+  fp = fopen(path, "rb");
+  if (!fp) return -1;
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fclose(fp);
+  return size;
+}
+
+/* Analyze with the cache and compare against a plain scan */
+static int checkAgainstScan(const char *path, const char *what) {
+  struct FileMetadata *cached;
+  struct FileMetadata *scanned;
+  const char *directory;
+  int failures;
+
+  cached = analyzeFile(path);
+
+  directory = lineCacheDir;
+  lineCacheDir = NULL;
+  scanned = analyzeFile(path);
+  lineCacheDir = directory;
+
+  failures = (!cached || !scanned || !sameMetadata(cached, scanned));
+  printf("%-32s %s\n", what, failures ? "MISMATCH" : "ok");
+
+  freeFileMetadata(cached);
+  freeFileMetadata(scanned);
+  return failures;
+}
+
+/* Change bytes in the middle of the file without changing its size */
+static BOOL changeInPlace(const char *path, long offset, const char *bytes) {
+  FILE *fp;
+
+  fp = fopen(path, "r+b");
+  if (!fp) return FALSE;
+  fseek(fp, offset, SEEK_SET);
+  fwrite(bytes, strlen(bytes), 1, fp);
+  return (BOOL)(fclose(fp) == 0);
+}
+
+static int checkInvalidation(const char *path) {
+  char cachePath[MAX_PATH_LEN];
+  struct utimbuf times;
+  time_t date;
+  int failures;
+  long size;
+
+  failures = 0;
+  if (!writeTestFile(path, 1000, "; marker")) return 1;
+
+  failures += checkAgainstScan(path, "first load writes the cache");
+  if (!findCacheFile(lineCacheDir, cachePath)) {
+    printf("no cache file written\n");
+    return failures + 1;
+  }
+  failures += checkAgainstScan(path, "second load reads it");
+
+  /* A newer date alone makes the cache stale */
+  date = time(NULL) - 3600;
+  times.actime = times.modtime = date;
+  utime(path, &times);
+  failures += checkAgainstScan(path, "file touched");
+
+  /* Same size, same date, different lines: only the hash can tell */
+  changeInPlace(path, 100, "\n\n\n\n");
+  utime(path, &times);
+  failures += checkAgainstScan(path, "changed with the date kept");
+  changeInPlace(path, 300, "\r\r\001\001");
+  utime(path, &times);
+  failures += checkAgainstScan(path, "changed again");
+
+  /* Damaged caches are missed and written again */
+  size = fileSizeOf(cachePath);
+  if (truncate(cachePath, size - 3) < 0) failures++;
+  failures += checkAgainstScan(path, "cache cut short");
+  if (fileSizeOf(cachePath) != size) {
+    printf("cache not rewritten\n");
+    failures++;
+  }
+
+  changeInPlace(cachePath, size - 16, "\377\377\377\377");
+  failures += checkAgainstScan(path, "cache bound broken");
+
+  remove(cachePath);
+  return failures;
+}
+
+int main(int argc, char *argv[]) {
+  struct FileMetadata *metadata;
+  char cachePath[MAX_PATH_LEN];
+  char directory[MAX_PATH_LEN];
+  const char *path;
+  double start;
+  double times[3];
+  int failures;
+  int mode;
+  int run;
+
+  path = argc > 1 ? argv[1] : "linecachebench.tmp";
+  sprintf(directory, "%.200s.cache", path);
+  mkdir(directory, 0777);
+  lineCacheDir = directory;
+
+  failures = checkInvalidation(path);
+  printf("\n");
+
+  if (!writeTestFile(path, BENCH_LINES, "; marker")) {
+    printf("cannot write %s\n", path);
+    return RETURN_FAIL;
+  }
+
+  /* No cache, a cache written after each scan, and a cache read */
+  for (mode = 0; mode < 3; mode++) {
+    lineCacheDir = mode ? directory : NULL;
+
+    for (run = 0; run < BENCH_RUNS; run++) {
+      if (mode == 1 && findCacheFile(directory, cachePath)) remove(cachePath);
+
+      start = wallClock();
+      metadata = analyzeFile(path);
+      if (!run || wallClock() - start < times[mode]) {
+        times[mode] = wallClock() - start;
+      }
+      if (!metadata) failures++;
+      freeFileMetadata(metadata);
+    }
+  }
+
+  printf("%ld lines\n", BENCH_LINES);
+  printf("no cache      %8.1fms\n", times[0] * 1e3);
+  printf("cache written %8.1fms\n", times[1] * 1e3);
+  printf("cache read    %8.1fms\n", times[2] * 1e3);
+  printf("\n%d failures\n", failures);
+
+  if (findCacheFile(directory, cachePath)) remove(cachePath);
+  rmdir(directory);
+  remove(path);
+  return failures ? RETURN_FAIL : RETURN_OK;
+}
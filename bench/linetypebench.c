@@ -0,0 +1,227 @@
+/* linetypebench.c */
+#include "fileutils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Times typing lines three ways: the chain of DetectADOS* analyzers that
+ * linetype.c used to call through function pointers, each skipping the
+ * blanks again; the determineLineType() that fileutils.c hardcoded; and
+ * classifyLine() with the AmigaDOS script classifier. All three must type
+ * every line alike.
+ *
+ * The chain never compiled, so it is rebuilt here as it was meant to
+ * work, with the command test reading "a non-blank that is not ';'".
+ *
+ * Build with src on the include path and link src/linetype.c.
+ */
+
+#define BENCH_LINES 1000000L
+#define BENCH_RUNS 5
+
+typedef LineType (*AnalyzeLine)(const struct TextLine *line);
+
+static LineType detectComment(const struct TextLine *line) {
+  const char *trimmed;
+
+  trimmed = line->content;
+  while (*trimmed && (*trimmed == ' ' || *trimmed == '\t')) trimmed++;
+
+  if (*trimmed == ';') return LINE_COMMENT;
+  return LINE_UNKNOWN;
+}
+
+static LineType detectCommand(const struct TextLine *line) {
+  const char *trimmed;
+
+  trimmed = line->content;
+  while (*trimmed && (*trimmed == ' ' || *trimmed == '\t')) trimmed++;
+
+  if (*trimmed && *trimmed != ';') return LINE_COMMAND;
+  return LINE_UNKNOWN;
+}
+
+static LineType detectEmpty(const struct TextLine *line) {
+  const char *trimmed;
+
+  trimmed = line->content;
+  while (*trimmed && (*trimmed == ' ' || *trimmed == '\t')) trimmed++;
+
+  if (!*trimmed) return LINE_EMPTY;
+  return LINE_UNKNOWN;
+}
+
+/* volatile, so the calls stay indirect as they were */
+static AnalyzeLine volatile scriptAnalyzers[] = {
+  detectComment,
+  detectCommand,
+  detectEmpty,
+  NULL
+};
+
+/* The first analyzer with an answer decides */
+static LineType chainType(const struct TextLine *line) {
+  AnalyzeLine volatile *analyzer;
+  LineType type;
+
+  for (analyzer = scriptAnalyzers; *analyzer; analyzer++) {
+    type = (*analyzer)(line);
+    if (type != LINE_UNKNOWN) return type;
+  }
+  return LINE_UNKNOWN;
+}
+
+/* The hardcoded version from fileutils.c */
+static LineType branchType(const struct TextLine *line) {
+  const char *trimmed;
+  const char *end;
+
+  trimmed = line->content;
+  end = trimmed + line->length;
+  while (trimmed < end && (*trimmed == ' ' || *trimmed == '\t')) trimmed++;
+
+  if (trimmed == end) return LINE_EMPTY;
+  if (*trimmed == ';') return LINE_COMMENT;
+  return LINE_COMMAND;
+}
+
+/* Lines as a script has them: commands, some indented, comments, blanks */
+static char *makeLines(struct TextLine *lines, ULONG count) {
+  static const char *const samples[] = {
+    "echo \"Starting up\"",
+    "  if exists SYS:Prefs/Env-Archive",
+    "    copy ENVARC: ENV: ALL QUIET",
+    "  endif",
+    "; Set up the assigns",
+    "\t; indented comment",
+    "",
+    "   ",
+    "assign LIBS: SYS:Classes ADD",
+    "C:SetPatch QUIET",
+    "\tresident >NIL: C:Execute PURE"
+  };
+  char *text;
+  char *p;
+  ULONG size;
+  ULONG i;
+  ULONG n;
+
+  /* Both passes draw the same lines */
+  srand(3);
+  size = 0;
+  for (i = 0; i < count; i++) {
+    size += strlen(samples[rand() % (sizeof(samples) / sizeof(*samples))]) + 1;
+  }
+
+  text = malloc(size);
+  if (!text) return NULL;
+
+  srand(3);
+  p = text;
+  for (i = 0; i < count; i++) {
+    n = rand() % (sizeof(samples) / sizeof(*samples));
+    strcpy(p, samples[n]);
+    memset(&lines[i], 0, sizeof(struct TextLine));
+    lines[i].content = p;
+    lines[i].length = strlen(p);
+    p += lines[i].length + 1;
+  }
+  return text;
+}
+
+/* Nanoseconds per line, best of BENCH_RUNS */
+static double timeChain(struct TextLine *lines, ULONG count) {
+  clock_t start;
+  double best;
+  ULONG sum;
+  ULONG i;
+  int run;
+
+  best = 0.0;
+  sum = 0;
+  for (run = 0; run < BENCH_RUNS; run++) {
+    start = clock();
+    for (i = 0; i < count; i++) sum += chainType(&lines[i]);
+    if (!run || clock() - start < best) best = clock() - start;
+  }
+  if (sum == 1) printf(" ");
+  return best / CLOCKS_PER_SEC * 1e9 / count;
+}
+
+static double timeBranch(struct TextLine *lines, ULONG count) {
+  clock_t start;
+  double best;
+  ULONG sum;
+  ULONG i;
+  int run;
+
+  best = 0.0;
+  sum = 0;
+  for (run = 0; run < BENCH_RUNS; run++) {
+    start = clock();
+    for (i = 0; i < count; i++) sum += branchType(&lines[i]);
+    if (!run || clock() - start < best) best = clock() - start;
+  }
+  if (sum == 1) printf(" ");
+  return best / CLOCKS_PER_SEC * 1e9 / count;
+}
+
+static double timeTable(struct TextLine *lines, ULONG count,
+                        const struct LineClassifier *classifier) {
+  clock_t start;
+  double best;
+  ULONG sum;
+  ULONG i;
+  int run;
+
+  best = 0.0;
+  sum = 0;
+  for (run = 0; run < BENCH_RUNS; run++) {
+    start = clock();
+    for (i = 0; i < count; i++) {
+      sum += classifyLine(classifier, lines[i].content, lines[i].length);
+    }
+    if (!run || clock() - start < best) best = clock() - start;
+  }
+  if (sum == 1) printf(" ");
+  return best / CLOCKS_PER_SEC * 1e9 / count;
+}
+
+int main(void) {
+  const struct LineClassifier *classifier;
+  struct TextLine *lines;
+  char *text;
+  ULONG mismatches;
+  ULONG i;
+  LineType type;
+
+  lines = malloc(BENCH_LINES * sizeof(struct TextLine));
+  text = lines ? makeLines(lines, BENCH_LINES) : NULL;
+  if (!text) {
+    printf("out of memory\n");
+    return RETURN_FAIL;
+  }
+
+  /* Picked once, as it is for a file */
+  classifier = selectLineClassifier(FILE_ADOS_SCRIPT);
+
+  mismatches = 0;
+  for (i = 0; i < BENCH_LINES; i++) {
+    type = classifyLine(classifier, lines[i].content, lines[i].length);
+    if (type != chainType(&lines[i]) || type != branchType(&lines[i])) {
+      mismatches++;
+    }
+  }
+  printf("%ld lines typed, %ld mismatches\n\n", BENCH_LINES, mismatches);
+
+  printf("analyzer chain %6.2f ns/line\n", timeChain(lines, BENCH_LINES));
+  printf("hardcoded      %6.2f ns/line\n", timeBranch(lines, BENCH_LINES));
+  printf("table          %6.2f ns/line\n",
+         timeTable(lines, BENCH_LINES, classifier));
+
+  free(text);
+  free(lines);
+  return mismatches ? RETURN_FAIL : RETURN_OK;
+}
@@ -0,0 +1,207 @@
+/* patternsetbench.c */
+#include "fileutils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Looks for a list of deprecated commands in a large generated script,
+ * once with a search per pattern and once with all of them as a pattern
+ * set, and checks that both agree on every pattern's first line and count
+ * and on which lines match at all.
+ *
+ * Both are timed on one worker, so the difference is the passes saved and
+ * not the CPUs used.
+ *
+ * Build with src on the include path and link every source but analyze.c.
+ * The generated file is written to the path given, or to patternsetbench.tmp.
+ */
+
+#define BENCH_LINES 200000L
+#define BENCH_RUNS 3
+
+static const char *benchPatterns[] = {
+  "#?SetPatch#?",
+  "#?AddBuffers#?",
+  "#?BindDrivers#?",
+  "#?FastMemFirst#?",
+  "#?SetClock LOAD#?",
+  "#?IPrefs#?",
+  "#?ConClip#?",
+  "#?Mount DF#?",
+  "#?LoadWB#?",
+  "#?Resident #?PURE#?",
+  "#?(Run|RunBack) >NIL: #?Daemon#?",
+  "#?Assign #? ADD",
+  "#?MakeDir RAM:T[0-9]#?",
+  "#?Version >NIL: exec.library [0-9][0-9]#?",
+  "#?C:Stack [0-9]#?",
+  "#?FailAt#?",
+  "#?NoFastMem#?",
+  "#?Lock #? ON#?",
+  "#?PopCLI#?",
+  "#?DMouse#?",
+  "#?Blanker#?",
+  "#?ClickToFront#?",
+  "#?SetEnv Workbench#?",
+  "#?Copy ENVARC: ENV: ALL QUIET#?",
+  "#?Path #?C: #?ADD#?",
+  "#?AmigaGuide#?",
+  "#?Install DF0:#?",
+  "#?Avail FLUSH#?",
+  "#?RexxMast#?",
+  "#?CPU CACHE#?",
+  NULL
+};
+
+/* Lines as a startup script has them, a few of them deprecated */
+static const char *benchLines[] = {
+  "C:SetPatch QUIET",
+  "C:Version >NIL:",
+  "C:AddBuffers >NIL: DF0: 15",
+  "FailAt 21",
+  "Resident >NIL: C:Execute PURE",
+  "MakeDir RAM:T RAM:Clipboards RAM:ENV RAM:ENV/Sys",
+  "Copy >NIL: ENVARC: RAM:ENV ALL NOREQ",
+  "Assign >NIL: ENV: RAM:ENV",
+  "Assign >NIL: T: RAM:T",
+  "Assign LIBS: SYS:Classes ADD",
+  "Run >NIL: C:IPrefs",
+  "Run >NIL: SYS:System/Daemon",
+  "BindDrivers",
+  "C:Mount >NIL: DEVS:DOSDrivers/~(#?.info)",
+  "echo \"Starting up\"",
+  "; comment about the next step",
+  "",
+  "If EXISTS S:User-Startup",
+  "  Execute S:User-Startup",
+  "EndIf",
+  "Path >NIL: RAM: C: SYS:Utilities SYS:Rexxc ADD",
+  "SetEnv Workbench $Workbench",
+  "C:LoadWB",
+  "EndCLI >NIL:"
+};
+
+/* Wall clock seconds; clock() would add up the time of every worker */
+static double wallClock(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static BOOL writeBenchFile(const char *path) {
+  FILE *fp;
+  long line;
+
+  fp = fopen(path, "w");
+  if (!fp) return FALSE;
+
+  srand(1);
+  for (line = 0; line < BENCH_LINES; line++) {
+    fputs(benchLines[rand() % (sizeof(benchLines) / sizeof(*benchLines))], fp);
+    fputc('\n', fp);
+  }
+
+  return (BOOL)(fclose(fp) == 0);
+}
+
+int main(int argc, char *argv[]) {
+  struct FileMetadata *metadata;
+  struct CompiledPattern *compiled[sizeof(benchPatterns) / sizeof(*benchPatterns)];
+  struct LineMatches *matches;
+  struct LineMatches *any;
+  struct PatternSet *set;
+  const char *path;
+  ULONG firstLines[sizeof(benchPatterns) / sizeof(*benchPatterns)];
+  ULONG counts[sizeof(benchPatterns) / sizeof(*benchPatterns)];
+  ULONG words;
+  ULONG count;
+  ULONG failed;
+  ULONG w;
+  double start;
+  double separate;
+  double single;
+  double elapsed;
+  int mismatches;
+  int run;
+  int i;
+
+  path = argc > 1 ? argv[1] : "patternsetbench.tmp";
+  if (!writeBenchFile(path)) {
+    printf("cannot write %s\n", path);
+    return RETURN_FAIL;
+  }
+
+  metadata = analyzeFile(path);
+  if (!metadata) {
+    printf("cannot load %s\n", path);
+    return RETURN_FAIL;
+  }
+
+  for (count = 0; benchPatterns[count]; count++) {
+    compiled[count] = compilePattern(benchPatterns[count], FALSE);
+  }
+  set = compilePatternSet(benchPatterns, count, FALSE, &failed);
+  if (!set) {
+    printf("cannot compile pattern %ld\n", (long)failed);
+    return RETURN_FAIL;
+  }
+
+  searchWorkers = 1;
+  printf("%ld lines, %ld patterns, %ld automaton states\n\n",
+         (long)metadata->lineCount, (long)count, (long)set->states);
+
+  /* Every pattern alone, and the lines any of them matched */
+  any = findSetMatches(metadata, set, firstLines, counts);
+  if (!any) {
+    printf("out of memory\n");
+    return RETURN_FAIL;
+  }
+
+  mismatches = 0;
+  words = (metadata->lineCount + MATCH_WORD_BITS - 1) / MATCH_WORD_BITS;
+  for (i = 0; i < (int)count; i++) {
+    matches = findAllMatches(metadata, compiled[i]);
+    if (!matches || matches->count != counts[i] ||
+        nextMatch(matches, 0) != firstLines[i]) {
+      printf("%-40s MISMATCH\n", benchPatterns[i]);
+      mismatches++;
+    }
+    for (w = 0; matches && w < words; w++) {
+      if (matches->bits[w] & ~any->bits[w]) {
+        printf("%-40s missing from the set's lines\n", benchPatterns[i]);
+        mismatches++;
+        break;
+      }
+    }
+    freeLineMatches(matches);
+  }
+  printf("%ld lines match some pattern, %d mismatches\n\n",
+         (long)any->count, mismatches);
+  freeLineMatches(any);
+
+  separate = 0.0;
+  single = 0.0;
+  for (run = 0; run < BENCH_RUNS; run++) {
+    start = wallClock();
+    for (i = 0; i < (int)count; i++) countMatches(metadata, compiled[i]);
+    elapsed = wallClock() - start;
+    if (!run || elapsed < separate) separate = elapsed;
+
+    start = wallClock();
+    freeLineMatches(findSetMatches(metadata, set, firstLines, counts));
+    elapsed = wallClock() - start;
+    if (!run || elapsed < single) single = elapsed;
+  }
+
+  printf("one search per pattern %8.1f ms\n", separate * 1e3);
+  printf("one pattern set        %8.1f ms\n", single * 1e3);
+
+  freePatternSet(set);
+  for (i = 0; i < (int)count; i++) freeCompiledPattern(compiled[i]);
+  freeFileMetadata(metadata);
+  remove(path);
+  return mismatches ? RETURN_FAIL : RETURN_OK;
+}
@@ -0,0 +1,231 @@
+/* reanalyzebench.c */
+#include "fileutils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Checks reanalyzeFile() against analyzeFile(), then times the two on a
+ * large file that changes by a few lines.
+ *
+ * The check mutates a small file at random many times over: bytes are
+ * cut out and pasted in, weighted towards CR, LF and control characters
+ * so line ends split and join across the edges of the changed range, and
+ * now and then a line is edited in memory first. After every mutation
+ * the reanalyzed metadata must match a fresh analysis line for line.
+ *
+ * Build with src on the include path and link every source but analyze.c.
+ * The files are written to the path given, or to reanalyzebench.tmp.
+ */
+
+#define CHECK_ROUNDS 20000
+#define CHECK_SIZE 2048           /* Bytes the checked file hovers around */
+#define BENCH_LINES 1000000L
+#define BENCH_RUNS 5
+
+static char checkBuffer[CHECK_SIZE * 4];
+static ULONG checkSize;
+
+/* Wall clock seconds */
+static double wallClock(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Replace a file the way editors do, by renaming a new one over it. A file
+ * written over in place would change under the mapping of the old one.
+ */
+static BOOL writeBuffer(const char *path, const char *data, ULONG size) {
+  char newPath[MAX_PATH_LEN];
+  FILE *fp;
+
+  sprintf(newPath, "%.200s.new", path);
+  fp = fopen(newPath, "wb");
+  if (!fp) return FALSE;
+  if (size && fwrite(data, size, 1, fp) != 1) {
+    fclose(fp);
+    return FALSE;
+  }
+  if (fclose(fp) != 0) return FALSE;
+  return (BOOL)(rename(newPath, path) == 0);
+}
+
+/* A byte that is likely to move line ends around; now and then a control */
+static char randomByte(void) {
+  static const char bytes[] = "ab ;\t\r\n\r\n";
+
+  if (rand() % 64 == 0) return '\001';
+  return bytes[rand() % (sizeof(bytes) - 1)];
+}
+
+/* Cut some bytes out at one place and paste others in */
+static void mutateBuffer(void) {
+  ULONG pos;
+  ULONG cut;
+  ULONG paste;
+  ULONG i;
+
+  pos = checkSize ? rand() % (checkSize + 1) : 0;
+  cut = rand() % 8;
+  if (cut > checkSize - pos) cut = checkSize - pos;
+  paste = rand() % 8;
+
+  /* Drift back towards CHECK_SIZE */
+  if (checkSize + paste > CHECK_SIZE * 2) paste = 0;
+  if (rand() % 200 == 0) cut = checkSize - pos;
+
+  memmove(checkBuffer + pos + paste, checkBuffer + pos + cut,
+          checkSize - pos - cut);
+  for (i = 0; i < paste; i++) checkBuffer[pos + i] = randomByte();
+  checkSize += paste - cut;
+}
+
+/* Whether two analyses of the same data agree in everything indexed */
+static BOOL sameMetadata(const struct FileMetadata *a,
+                         const struct FileMetadata *b) {
+  struct TextLine *x;
+  struct TextLine *y;
+  ULONG i;
+
+  if (a->fileSize != b->fileSize || a->isBinary != b->isBinary) return FALSE;
+  if (a->isBinary) return TRUE;
+
+  if (a->lineCount != b->lineCount || a->lineEnding != b->lineEnding ||
+      a->nonPrintable != b->nonPrintable ||
+      memcmp(a->endingCounts, b->endingCounts, sizeof(a->endingCounts)) ||
+      a->lineBufferSize < b->lineBufferSize) {
+    return FALSE;
+  }
+
+  for (i = 1; i <= a->lineCount; i++) {
+    x = getLine(a, i);
+    y = getLine(b, i);
+    if (x->content || x->filePosition != y->filePosition ||
+        x->length != y->length || x->rawLength != y->rawLength ||
+        x->ending != y->ending || x->hasNewline != y->hasNewline ||
+        x->type != y->type ||
+        memcmp(lineText(x), lineText(y), x->length)) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/* Mutate a small file over and over, checking every reanalysis */
+static int checkReanalysis(const char *path) {
+  struct FileMetadata *metadata;
+  struct FileMetadata *fresh;
+  int failures;
+  int round;
+  ULONG i;
+
+  srand(2);
+  for (checkSize = 0; checkSize < CHECK_SIZE; checkSize++) {
+    checkBuffer[checkSize] = (checkSize % 40 == 39) ? '\n' : 'a' + rand() % 26;
+  }
+
+  if (!writeBuffer(path, checkBuffer, checkSize)) return 1;
+  metadata = analyzeFile(path);
+  if (!metadata) return 1;
+
+  failures = 0;
+  for (round = 0; round < CHECK_ROUNDS; round++) {
+    for (i = rand() % 3; i > 0; i--) mutateBuffer();
+
+    /* Unsaved edits are dropped, and the lines they touch parsed again */
+    if (rand() % 10 == 0 && !metadata->isBinary && metadata->lineCount) {
+      replaceLine(metadata, 1 + rand() % metadata->lineCount, "edited");
+    }
+
+    if (!writeBuffer(path, checkBuffer, checkSize) ||
+        !reanalyzeFile(metadata, path)) {
+      printf("round %d: reanalysis failed\n", round);
+      return failures + 1;
+    }
+
+    fresh = analyzeFile(path);
+    if (!fresh || !sameMetadata(metadata, fresh)) {
+      printf("round %d: MISMATCH at %ld bytes\n", round, (long)checkSize);
+      failures++;
+
+      /* Carry on from a correct index */
+      freeFileMetadata(metadata);
+      metadata = analyzeFile(path);
+      if (!metadata) return failures;
+    }
+    freeFileMetadata(fresh);
+  }
+
+  freeFileMetadata(metadata);
+  return failures;
+}
+
+/* Write the large file, with a marker line that can be changed */
+static BOOL writeBenchFile(const char *path, const char *marker) {
+  char newPath[MAX_PATH_LEN];
+  FILE *fp;
+  long line;
+
+  sprintf(newPath, "%.200s.new", path);
+  fp = fopen(newPath, "w");
+  if (!fp) return FALSE;
+
+  for (line = 1; line <= BENCH_LINES; line++) {
+    if (line == BENCH_LINES / 2) fprintf(fp, "%s\n", marker);
+    else fprintf(fp, "echo line %ld of the bench file\n", line);
+  }
+  if (fclose(fp) != 0) return FALSE;
+  return (BOOL)(rename(newPath, path) == 0);
+}
+
+int main(int argc, char *argv[]) {
+  struct FileMetadata *metadata;
+  struct FileMetadata *fresh;
+  const char *path;
+  double start;
+  double full;
+  double incremental;
+  int failures;
+  int run;
+
+  path = argc > 1 ? argv[1] : "reanalyzebench.tmp";
+
+  failures = checkReanalysis(path);
+  printf("%d rounds checked, %d mismatches\n\n", CHECK_ROUNDS, failures);
+
+  if (!writeBenchFile(path, "; marker") || !(metadata = analyzeFile(path))) {
+    printf("cannot write %s\n", path);
+    return RETURN_FAIL;
+  }
+
+  full = incremental = 0.0;
+  for (run = 0; run < BENCH_RUNS; run++) {
+    writeBenchFile(path, run % 2 ? "; marker" : "; changed marker line");
+
+    start = wallClock();
+    fresh = analyzeFile(path);
+    if (!run || wallClock() - start < full) full = wallClock() - start;
+
+    start = wallClock();
+    if (!reanalyzeFile(metadata, path)) failures++;
+    if (!run || wallClock() - start < incremental) {
+      incremental = wallClock() - start;
+    }
+
+    if (!fresh || !sameMetadata(metadata, fresh)) failures++;
+    freeFileMetadata(fresh);
+  }
+
+  printf("%ld lines, one changed in the middle\n", (long)metadata->lineCount);
+  printf("analyzeFile   %8.1fms\n", full * 1e3);
+  printf("reanalyzeFile %8.1fms\n", incremental * 1e3);
+  printf("\n%d failures\n", failures);
+
+  freeFileMetadata(metadata);
+  remove(path);
+  return failures ? RETURN_FAIL : RETURN_OK;
+}
@@ -0,0 +1,308 @@
+/* scanbench.c */
+#include "fileutils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Checks scanFileData() and findLineEnd() against the byte-at-a-time code
+ * they replaced, then times both over a large generated text file.
+ *
+ * The differential pass feeds random buffers at every alignment, mixing
+ * LF, CR, CRLF, blanks, semicolons, other control characters and bytes
+ * above 127. The text/binary verdict, every line's end, terminator and
+ * type, and every line end findLineEnd() finds must all be identical.
+ *
+ * Build with src on the include path and link src/bytescan.c and
+ * src/linetype.c. Build it again with NO_SIMD defined to check the
+ * word-at-a-time fallback.
+ */
+
+#define RANDOM_ROUNDS 200000
+#define MAX_RANDOM_SIZE 300
+#define BENCH_SIZE (64L * 1024 * 1024)
+#define BENCH_RUNS 5
+
+/* The scalar binary check this benchmark replaces */
+static BOOL scalarIsTextFile(const char *data, ULONG size) {
+  ULONG i;
+  ULONG nonPrintable;
+  ULONG threshold;
+  unsigned char c;
+
+  nonPrintable = 0;
+  threshold = size / 10;
+
+  for (i = 0; i < size; i++) {
+    c = data[i];
+    if (c < 32 && c != '\n' && c != '\r' && c != '\t') {
+      nonPrintable++;
+      if (nonPrintable > threshold) return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/* The scalar end of line search from parseLine() */
+static const char *scalarLineEnd(const char *p, const char *end) {
+  while (p < end && *p != '\n' && *p != '\r') p++;
+  return p;
+}
+
+/* The old determineLineType() on a line of the buffer */
+static UBYTE scalarLineType(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t')) p++;
+
+  if (p == end) return LINE_EMPTY;
+  if (*p == ';') return LINE_COMMENT;
+  return LINE_COMMAND;
+}
+
+/*
+ * Split a buffer into lines the way the old countLines() and parseLine()
+ * loop did, typing each one. Returns the number of bounds stored.
+ */
+static ULONG scalarBounds(const char *data, ULONG size,
+                          struct LineBound *bounds) {
+  const char *p;
+  const char *end;
+  const char *lineEnd;
+  ULONG count;
+  ULONG rawLength;
+
+  count = 0;
+  p = data;
+  end = data + size;
+
+  while (p < end) {
+    lineEnd = scalarLineEnd(p, end);
+    rawLength = lineEnd - p;
+
+    bounds[count].end = lineEnd - data;
+    bounds[count].type = scalarLineType(p, lineEnd);
+
+    if (lineEnd == end) {
+      bounds[count].ending = EOL_NONE;
+    } else if (*lineEnd == '\r' && lineEnd + 1 < end && *(lineEnd + 1) == '\n') {
+      bounds[count].ending = EOL_CRLF;
+      rawLength += 2;
+    } else {
+      bounds[count].ending = (*lineEnd == '\r') ? EOL_CR : EOL_LF;
+      rawLength += 1;
+    }
+
+    p += rawLength;
+    count++;
+  }
+
+  return count;
+}
+
+/* Compare two bound tables field by field */
+static BOOL sameBounds(const struct LineBound *a, const struct LineBound *b,
+                       ULONG count) {
+  ULONG i;
+
+  for (i = 0; i < count; i++) {
+    if (a[i].end != b[i].end || a[i].ending != b[i].ending ||
+        a[i].type != b[i].type) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/* Fill a buffer with bytes biased towards the interesting cases */
+static void randomBytes(char *buf, ULONG size, int flavour) {
+  static const char specials[] = "\n\r\t ;\001\033\177";
+  ULONG i;
+  int r;
+
+  for (i = 0; i < size; i++) {
+    r = rand() % 100;
+
+    if (flavour == 0 && r < 16) buf[i] = specials[rand() % 5];
+    else if (flavour == 1 && r < 30) buf[i] = specials[rand() % 8];
+    else if (flavour == 2 && r < 40) buf[i] = (char)(rand() % 256);
+    else if (r < 2) buf[i] = (char)(128 + rand() % 128);
+    else buf[i] = 'a' + rand() % 26;
+  }
+}
+
+/* Compare the new kernels with the scalar code; returns mismatches */
+static long crossCheck(APTR pool) {
+  struct ByteScan scan;
+  struct ByteScan countOnly;
+  char *block;
+  char *data;
+  struct LineBound *bounds;
+  ULONG count;
+  ULONG size;
+  ULONG start;
+  long mismatches;
+  long round;
+  BOOL text;
+
+  block = malloc(MAX_RANDOM_SIZE + 64);
+  bounds = malloc((MAX_RANDOM_SIZE + 1) * sizeof(struct LineBound));
+  if (!block || !bounds) {
+    free(block);
+    free(bounds);
+    return 1;
+  }
+
+  mismatches = 0;
+  srand(1);
+
+  for (round = 0; round < RANDOM_ROUNDS && mismatches < 10; round++) {
+    data = block + rand() % 32;
+    size = rand() % (MAX_RANDOM_SIZE + 1);
+    randomBytes(data, size, (int)(round % 3));
+
+    text = scalarIsTextFile(data, size);
+    count = scalarBounds(data, size, bounds);
+
+    if (!scanFileData(pool, data, size,
+                      selectLineClassifier(FILE_ADOS_SCRIPT), &scan)) {
+      printf("out of memory\n");
+      mismatches++;
+      break;
+    }
+    scanFileData(NULL, data, size, NULL, &countOnly);
+
+    if (scan.isBinary == text || countOnly.isBinary == text) {
+      printf("round %ld: binary verdict differs\n", round);
+      mismatches++;
+    }
+    else if (text && (scan.lineCount != count ||
+                      !sameBounds(scan.bounds, bounds, count))) {
+      printf("round %ld: line bounds differ\n", round);
+      mismatches++;
+    }
+
+    freeByteScan(pool, &scan);
+
+    /* Every possible line start within the buffer */
+    for (start = 0; start <= size; start++) {
+      if (findLineEnd(data + start, data + size) !=
+          scalarLineEnd(data + start, data + size)) {
+        printf("round %ld: findLineEnd differs at %ld\n", round, start);
+        mismatches++;
+        break;
+      }
+    }
+  }
+
+  free(block);
+  free(bounds);
+  return mismatches;
+}
+
+/* Generate text with lines of 1 to 119 characters */
+static void generateText(char *data, ULONG size, BOOL crlf) {
+  ULONG i;
+  int column;
+  int width;
+
+  column = 0;
+  width = 1 + rand() % 119;
+
+  for (i = 0; i < size; i++) {
+    if (column == width) {
+      if (crlf && i + 1 < size) data[i++] = '\r';
+      data[i] = '\n';
+      column = 0;
+      width = 1 + rand() % 119;
+    } else {
+      data[i] = (rand() % 16) ? ' ' + rand() % 95 : '\t';
+      column++;
+    }
+  }
+}
+
+/* Seconds taken by the old loader: isTextFile, then parse and type lines */
+static double timeScalar(const char *data, ULONG size,
+                         struct LineBound *bounds) {
+  clock_t start;
+
+  start = clock();
+  if (scalarIsTextFile(data, size)) scalarBounds(data, size, bounds);
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* Seconds taken by the single pass */
+static double timeScan(APTR pool, const char *data, ULONG size) {
+  struct ByteScan scan;
+  clock_t start;
+
+  start = clock();
+  scanFileData(pool, data, size, selectLineClassifier(FILE_ADOS_SCRIPT),
+               &scan);
+  freeByteScan(pool, &scan);
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* Best of several runs of each, in megabytes per second */
+static void benchText(APTR pool, char *data, struct LineBound *bounds,
+                      BOOL crlf) {
+  double scalar;
+  double scanned;
+  double t;
+  int run;
+
+  generateText(data, BENCH_SIZE, crlf);
+
+  scalar = scanned = 1e9;
+  for (run = 0; run < BENCH_RUNS; run++) {
+    t = timeScalar(data, BENCH_SIZE, bounds);
+    if (t < scalar) scalar = t;
+    t = timeScan(pool, data, BENCH_SIZE);
+    if (t < scanned) scanned = t;
+  }
+
+  printf("%-6s %10.1f MB/s %10.1f MB/s %8.2fx\n", crlf ? "CRLF" : "LF",
+         BENCH_SIZE / scalar / 1e6, BENCH_SIZE / scanned / 1e6,
+         scalar / scanned);
+}
+
+int main(void) {
+  APTR pool;
+  char *data;
+  struct LineBound *bounds;
+  long mismatches;
+
+  pool = CreatePool(MEMF_ANY, POOL_PUDDLE_SIZE, POOL_THRESH_SIZE);
+  if (!pool) return RETURN_FAIL;
+
+#if defined(SIMD_AVX2)
+  printf("kernel: AVX2\n");
+#elif defined(SIMD_SSE2)
+  printf("kernel: SSE2\n");
+#else
+  printf("kernel: %d-byte words\n", (int)sizeof(ULONG));
+#endif
+
+  mismatches = crossCheck(pool);
+  printf("cross-check: %ld random buffers, %ld mismatches\n",
+         (long)RANDOM_ROUNDS, mismatches);
+  if (mismatches) {
+    DeletePool(pool);
+    return RETURN_FAIL;
+  }
+
+  data = malloc(BENCH_SIZE);
+  bounds = malloc((BENCH_SIZE / 2 + 1) * sizeof(struct LineBound));
+  if (data && bounds) {
+    printf("\n%-6s %15s %15s %9s\n", "text", "scalar", "single pass", "speedup");
+    benchText(pool, data, bounds, FALSE);
+    benchText(pool, data, bounds, TRUE);
+  }
+
+  free(data);
+  free(bounds);
+  DeletePool(pool);
+  return RETURN_OK;
+}
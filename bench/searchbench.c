@@ -0,0 +1,209 @@
+/* searchbench.c */
+#include "fileutils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Checks the chunked line search against a plain loop over the lines, then
+ * times both on a large generated file with one worker and with more.
+ *
+ * Every pattern is searched for its first match, its count and all of its
+ * matches, and each must agree with the loop at every worker count. The
+ * patterns cover a common match, rare matches, a match only on the last
+ * line and no match at all, so first-match cancellation is exercised from
+ * both ends. At least MIN_WORKERS_CHECKED workers are tried, so stealing
+ * is checked on small hosts too.
+ *
+ * Build with src on the include path and link every source but analyze.c.
+ * The generated file is written to the path given, or to searchbench.tmp.
+ */
+
+#define BENCH_LINES 2000000L
+#define NEEDLE_EVERY 50000
+#define BENCH_RUNS 3
+#define MIN_WORKERS_CHECKED 4     /* Steal between workers even on one CPU */
+
+static const char *benchPatterns[] = {
+  "#?a#?",            /* Nearly every line */
+  "#?needle#?",       /* Every NEEDLE_EVERY lines or so */
+  "#?lastmark#?",     /* The last line only */
+  "#?zzzz#?",         /* Nothing */
+  NULL
+};
+
+/* Wall clock seconds; clock() would add up the time of every worker */
+static double wallClock(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Write lines of random words that none of the markers can turn up in */
+static BOOL writeBenchFile(const char *path) {
+  static const char letters[] = "abcfghijkmopqrstuvwxy";
+  FILE *fp;
+  long line;
+  int words;
+  int length;
+
+  fp = fopen(path, "w");
+  if (!fp) return FALSE;
+
+  srand(1);
+  for (line = 1; line <= BENCH_LINES; line++) {
+    for (words = 2 + rand() % 8; words > 0; words--) {
+      for (length = 1 + rand() % 8; length > 0; length--) {
+        fputc(letters[rand() % (sizeof(letters) - 1)], fp);
+      }
+      fputc(' ', fp);
+    }
+
+    if (rand() % NEEDLE_EVERY == 0) fputs("needle ", fp);
+    if (line == BENCH_LINES) fputs("lastmark", fp);
+    fputc('\n', fp);
+  }
+
+  return (BOOL)(fclose(fp) == 0);
+}
+
+/* The loop the chunked search replaced; fills ref with every match */
+static ULONG referenceSearch(const struct FileMetadata *metadata,
+                             const struct CompiledPattern *compiled,
+                             UBYTE *ref, ULONG *first) {
+  ULONG count;
+  ULONG i;
+
+  count = 0;
+  *first = 0;
+  for (i = 1; i <= metadata->lineCount; i++) {
+    ref[i] = (UBYTE)matchCompiledPattern(compiled,
+                                         lineString(getLine(metadata, i)));
+    if (ref[i]) {
+      if (!count) *first = i;
+      count++;
+    }
+  }
+  return count;
+}
+
+/* Check all three searches against the reference at the current workers */
+static BOOL checkSearch(const struct FileMetadata *metadata,
+                        const struct CompiledPattern *compiled,
+                        const UBYTE *ref, ULONG refCount, ULONG refFirst) {
+  struct LineMatches *matches;
+  ULONG line;
+  ULONG seen;
+  BOOL same;
+
+  if (findFirstMatch(metadata, compiled) != refFirst) return FALSE;
+  if (countMatches(metadata, compiled) != refCount) return FALSE;
+
+  matches = findAllMatches(metadata, compiled);
+  if (!matches) return FALSE;
+
+  same = (BOOL)(matches->count == refCount);
+  seen = 0;
+  line = 0;
+  while (same && (line = nextMatch(matches, line))) {
+    same = (BOOL)(ref[line] != 0);
+    seen++;
+  }
+
+  freeLineMatches(matches);
+  return (BOOL)(same && seen == refCount);
+}
+
+/* Best of a few runs of one kind of search, in milliseconds */
+static double timeSearch(const struct FileMetadata *metadata,
+                         const struct CompiledPattern *compiled, int kind) {
+  double best;
+  double start;
+  double elapsed;
+  int run;
+
+  best = 0.0;
+  for (run = 0; run < BENCH_RUNS; run++) {
+    start = wallClock();
+    if (kind == 0) findFirstMatch(metadata, compiled);
+    else if (kind == 1) countMatches(metadata, compiled);
+    else freeLineMatches(findAllMatches(metadata, compiled));
+    elapsed = wallClock() - start;
+
+    if (!run || elapsed < best) best = elapsed;
+  }
+  return best * 1e3;
+}
+
+int main(int argc, char *argv[]) {
+  struct FileMetadata *metadata;
+  struct CompiledPattern *compiled;
+  const char *path;
+  UBYTE *ref;
+  ULONG refCount;
+  ULONG refFirst;
+  ULONG maxWorkers;
+  ULONG workers;
+  double start;
+  double loop;
+  int failures;
+  int i;
+
+  path = argc > 1 ? argv[1] : "searchbench.tmp";
+  if (!writeBenchFile(path)) {
+    printf("cannot write %s\n", path);
+    return RETURN_FAIL;
+  }
+
+  metadata = analyzeFile(path);
+  ref = malloc(BENCH_LINES + 1);
+  if (!metadata || !ref) {
+    printf("cannot load %s\n", path);
+    return RETURN_FAIL;
+  }
+
+  maxWorkers = defaultWorkerCount();
+  if (maxWorkers < MIN_WORKERS_CHECKED) maxWorkers = MIN_WORKERS_CHECKED;
+  printf("%ld lines, up to %ld workers\n\n", (long)metadata->lineCount,
+         (long)maxWorkers);
+  printf("%-14s %7s %8s %9s %9s %9s %9s\n", "pattern", "matches", "workers",
+         "loop", "first", "count", "all");
+
+  failures = 0;
+  for (i = 0; benchPatterns[i]; i++) {
+    compiled = compilePattern(benchPatterns[i], FALSE);
+    if (!compiled) continue;
+
+    start = wallClock();
+    refCount = referenceSearch(metadata, compiled, ref, &refFirst);
+    loop = (wallClock() - start) * 1e3;
+
+    for (workers = 1; workers <= maxWorkers; workers *= 2) {
+      searchWorkers = workers;
+
+      if (!checkSearch(metadata, compiled, ref, refCount, refFirst)) {
+        printf("%-14s MISMATCH with %ld workers\n", benchPatterns[i],
+               (long)workers);
+        failures++;
+        continue;
+      }
+
+      printf("%-14s %7ld %8ld %7.1fms %7.1fms %7.1fms %7.1fms\n",
+             benchPatterns[i], (long)refCount, (long)workers, loop,
+             timeSearch(metadata, compiled, 0),
+             timeSearch(metadata, compiled, 1),
+             timeSearch(metadata, compiled, 2));
+    }
+
+    freeCompiledPattern(compiled);
+  }
+
+  printf("\n%d mismatches\n", failures);
+
+  free(ref);
+  freeFileMetadata(metadata);
+  remove(path);
+  return failures ? RETURN_FAIL : RETURN_OK;
+}
@@ -0,0 +1,188 @@
+/* streambench.c */
+#include "fileutils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Checks the line stream against a loaded file, then times streaming and
+ * loading a large file of long lines.
+ *
+ * The check writes random files whose lines run from empty to several
+ * times STREAM_BUFFER_SIZE, ending in LF, CR or CRLF, so lines and CR/LF
+ * pairs straddle chunks and some lines outgrow the first carry buffer.
+ * Every line the stream hands out must have the text, length, position,
+ * terminator and type of the loaded line, and the stream must not stop
+ * early.
+ *
+ * Build with src on the include path and link every source but analyze.c.
+ * The files are written to the path given, or to streambench.tmp.
+ */
+
+#define CHECK_FILES 40
+#define CHECK_LINES 200
+#define BENCH_LINES 4000
+#define BENCH_RUNS 3
+
+static ULONG randomState;
+
+/* xorshift32, so the files do not depend on the C library's rand() */
+static ULONG nextRandom(void) {
+  ULONG x;
+
+  x = randomState;
+  x ^= x << 13;
+  x &= 0xFFFFFFFFUL;
+  x ^= x >> 17;
+  x ^= x << 5;
+  x &= 0xFFFFFFFFUL;
+  randomState = x;
+  return x;
+}
+
+static ULONG pick(ULONG count) {
+  return nextRandom() % count;
+}
+
+/* Wall clock seconds */
+static double wallClock(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* A line length: mostly short, now and then past one or more chunks */
+static ULONG lineLength(ULONG longest) {
+  if (pick(8)) return pick(80);
+  return pick(longest);
+}
+
+static BOOL writeLines(const char *path, ULONG lines, ULONG longest) {
+  static const char *const endings[] = { "\n", "\r", "\r\n" };
+  FILE *fp;
+  ULONG length;
+  ULONG line;
+  ULONG i;
+
+  fp = fopen(path, "wb");
+  if (!fp) return FALSE;
+
+  for (line = 0; line < lines; line++) {
+    length = lineLength(longest);
+    for (i = 0; i < length; i++) fputc(pick(7) ? 'a' + pick(26) : ' ', fp);
+
+    /* The last line goes without a terminator now and then */
+    if (line + 1 < lines || pick(2)) fputs(endings[pick(3)], fp);
+  }
+
+  return (BOOL)(fclose(fp) == 0);
+}
+
+/* Stream a file and compare each line with the loaded one */
+static int checkFile(const char *path) {
+  struct FileMetadata *metadata;
+  struct LineStream *stream;
+  struct TextLine *loaded;
+  struct TextLine *line;
+  ULONG count;
+  int errors;
+
+  metadata = analyzeFile(path);
+  stream = openLineStream(path);
+  if (!metadata || !stream) {
+    printf("cannot open %s\n", path);
+    freeFileMetadata(metadata);
+    closeLineStream(stream);
+    return 1;
+  }
+
+  errors = 0;
+  count = 0;
+  while (!errors && (line = nextStreamLine(stream))) {
+    count++;
+    loaded = count <= metadata->lineCount ? getLine(metadata, count) : NULL;
+    if (!loaded || line->length != loaded->length ||
+        memcmp(line->content, lineText(loaded), line->length) != 0 ||
+        line->content[line->length] != '\0' ||
+        line->filePosition != loaded->filePosition ||
+        line->rawLength != loaded->rawLength ||
+        line->ending != loaded->ending || line->type != loaded->type) {
+      printf("line %ld differs (%ld bytes streamed)\n", (long)count,
+             (long)line->length);
+      errors++;
+    }
+  }
+
+  if (!errors && (stream->outOfMemory || count != metadata->lineCount)) {
+    printf("stream gave %ld lines, file has %ld\n", (long)count,
+           (long)metadata->lineCount);
+    errors++;
+  }
+
+  closeLineStream(stream);
+  freeFileMetadata(metadata);
+  return errors;
+}
+
+int main(int argc, char *argv[]) {
+  struct FileMetadata *metadata;
+  struct LineStream *stream;
+  const char *path;
+  double start;
+  double streamed;
+  double loaded;
+  double elapsed;
+  ULONG lines;
+  ULONG seed;
+  int errors;
+  int run;
+
+  path = argc > 1 ? argv[1] : "streambench.tmp";
+
+  /* Lines up to four chunks long make the carry grow more than once */
+  errors = 0;
+  for (seed = 1; seed <= CHECK_FILES; seed++) {
+    randomState = seed * 0x9E3779B9UL;
+    if (!writeLines(path, CHECK_LINES, STREAM_BUFFER_SIZE * 4)) {
+      printf("cannot write %s\n", path);
+      return RETURN_FAIL;
+    }
+    errors += checkFile(path);
+  }
+  printf("%d files checked, %d errors\n\n", CHECK_FILES, errors);
+
+  randomState = 1;
+  if (!writeLines(path, BENCH_LINES, STREAM_BUFFER_SIZE * 4)) {
+    printf("cannot write %s\n", path);
+    return RETURN_FAIL;
+  }
+
+  streamed = 0.0;
+  loaded = 0.0;
+  lines = 0;
+  for (run = 0; run < BENCH_RUNS; run++) {
+    start = wallClock();
+    stream = openLineStream(path);
+    lines = 0;
+    while (stream && nextStreamLine(stream)) lines++;
+    closeLineStream(stream);
+    elapsed = wallClock() - start;
+    if (!run || elapsed < streamed) streamed = elapsed;
+
+    start = wallClock();
+    metadata = analyzeFile(path);
+    freeFileMetadata(metadata);
+    elapsed = wallClock() - start;
+    if (!run || elapsed < loaded) loaded = elapsed;
+  }
+
+  printf("%ld lines of up to %ld bytes\n", (long)lines,
+         (long)STREAM_BUFFER_SIZE * 4);
+  printf("streamed %8.1f ms\n", streamed * 1e3);
+  printf("loaded   %8.1f ms\n", loaded * 1e3);
+
+  remove(path);
+  return errors ? RETURN_FAIL : RETURN_OK;
+}
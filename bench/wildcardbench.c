@@ -0,0 +1,381 @@
+/* wildcardbench.c */
+#include "patternutil.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Times matchCompiledPattern() on AmigaDOS patterns that make a
+ * backtracking matcher slow: "#a" recurses once per character, "#(a|aa)"
+ * tries every way of splitting the text, and each "#?" in a row retries
+ * every remaining suffix, so k of them cost about n^k / k! steps.
+ *
+ * A backtracking matcher is kept below as a reference. It is
+ * cross-checked against matchCompiledPattern() on random patterns and
+ * input, then both are timed on longer and longer lines until the
+ * reference runs out of its step or depth budget.
+ *
+ * Built by "make benches".
+ */
+
+#define RANDOM_ROUNDS 100000
+#define REFERENCE_STEPS 50000000L  /* Steps before the reference gives up */
+#define REFERENCE_DEPTH 20000      /* Nesting before it would blow the stack */
+#define MAX_TEXT_LEN 262144
+
+/* What is left to match once an item is done */
+struct Continuation {
+  const char *p;
+  const char *end;
+  const char *loopText;   /* Text where a # loop began, or NULL */
+  const struct Continuation *next;
+};
+
+static long referenceSteps;
+static int referenceDepth;
+static BOOL referenceGaveUp;
+
+/* One item of a pattern: a character, 'x, [class], (group), #item, ~item */
+static const char *nextItem(const char *p, const char *end) {
+  int depth;
+
+  switch (*p) {
+    case '\'':
+      return p + 1 < end ? p + 2 : end;
+    case '#':
+    case '~':
+      return p + 1 < end ? nextItem(p + 1, end) : end;
+    case '[':
+      for (p++; p < end && *p != ']'; p++) {
+        if (*p == '\'' && p + 1 < end) p++;
+      }
+      return p < end ? p + 1 : end;
+    case '(':
+      depth = 0;
+      for (; p < end; p++) {
+        if (*p == '\'' && p + 1 < end) p++;
+        else if (*p == '(') depth++;
+        else if (*p == ')' && --depth == 0) return p + 1;
+      }
+      return end;
+    default:
+      return p + 1;
+  }
+}
+
+static BOOL classMatch(const char *p, const char *end, char c) {
+  BOOL negate;
+  BOOL found;
+  char low;
+  char high;
+
+  p++;
+  if (end[-1] == ']') end--;
+  negate = (BOOL)(p < end && *p == '~');
+  if (negate) p++;
+
+  found = FALSE;
+  while (p < end) {
+    if (*p == '\'' && p + 1 < end) p++;
+    low = high = *p++;
+    if (p + 1 < end && *p == '-') {
+      p++;
+      if (*p == '\'' && p + 1 < end) p++;
+      high = *p++;
+    }
+    if (c >= low && c <= high) found = TRUE;
+  }
+  return (BOOL)(found != negate);
+}
+
+static BOOL referenceMatch(const char *p, const char *end, const char *text,
+                           const struct Continuation *rest);
+
+/* Match the items p..end, then rest, against text; counts the budget */
+static BOOL referenceSequence(const char *p, const char *end,
+                              const char *text,
+                              const struct Continuation *rest) {
+  BOOL matched;
+
+  if (referenceGaveUp) return FALSE;
+  if (++referenceSteps > REFERENCE_STEPS ||
+      referenceDepth >= REFERENCE_DEPTH) {
+    referenceGaveUp = TRUE;
+    return FALSE;
+  }
+
+  referenceDepth++;
+  matched = referenceMatch(p, end, text, rest);
+  referenceDepth--;
+  return matched;
+}
+
+/* Try each choice of the first item in turn */
+static BOOL referenceMatch(const char *p, const char *end, const char *text,
+                           const struct Continuation *rest) {
+  struct Continuation after;
+  const char *itemEnd;
+  const char *alternative;
+  char *span;
+  size_t length;
+  BOOL matched;
+  int depth;
+
+  if (p == end) {
+    if (!rest) return (BOOL)(*text == '\0');
+    /* A # item that matched nothing would loop for ever */
+    if (rest->loopText == text) return FALSE;
+    return referenceSequence(rest->p, rest->end, text, rest->next);
+  }
+
+  itemEnd = nextItem(p, end);
+  after.p = itemEnd;
+  after.end = end;
+  after.loopText = NULL;
+  after.next = rest;
+
+  switch (*p) {
+    case '?':
+      return (BOOL)(*text && referenceSequence(itemEnd, end, text + 1, rest));
+    case '%':
+      return referenceSequence(itemEnd, end, text, rest);
+    case '\'':
+      if (p + 1 >= end) return FALSE;
+      return (BOOL)(*text == p[1] &&
+                    referenceSequence(itemEnd, end, text + 1, rest));
+    case '[':
+      return (BOOL)(*text && classMatch(p, itemEnd, *text) &&
+                    referenceSequence(itemEnd, end, text + 1, rest));
+    case '#':
+      /* Once more, coming back here, or not again */
+      if (p + 1 < itemEnd) {
+        after.p = p;
+        after.loopText = text;
+        if (referenceSequence(p + 1, itemEnd, text, &after)) return TRUE;
+      }
+      return referenceSequence(itemEnd, end, text, rest);
+    case '~':
+      /* Every span the item does not match exactly */
+      span = malloc(strlen(text) + 1);
+      if (!span) {
+        referenceGaveUp = TRUE;
+        return FALSE;
+      }
+      matched = FALSE;
+      for (length = 0; !matched && !referenceGaveUp; length++) {
+        memcpy(span, text, length);
+        span[length] = '\0';
+        matched = (BOOL)((p + 1 == itemEnd ||
+                          !referenceSequence(p + 1, itemEnd, span, NULL)) &&
+                         referenceSequence(itemEnd, end, text + length, rest));
+        if (!text[length]) break;
+      }
+      free(span);
+      return matched;
+    case '(':
+      depth = 0;
+      alternative = p + 1;
+      if (itemEnd[-1] == ')') itemEnd--;
+      for (p++; p <= itemEnd; p++) {
+        if (p == itemEnd || (*p == '|' && depth == 0)) {
+          if (referenceSequence(alternative, p, text, &after)) return TRUE;
+          alternative = p + 1;
+        } else if (*p == '\'' && p + 1 < itemEnd) {
+          p++;
+        } else if (*p == '(') {
+          depth++;
+        } else if (*p == ')') {
+          depth--;
+        }
+      }
+      return FALSE;
+    default:
+      return (BOOL)(*text == *p &&
+                    referenceSequence(itemEnd, end, text + 1, rest));
+  }
+}
+
+/* The backtracking matcher, case sensitive; FALSE too if it gave up */
+static BOOL backtrackMatch(const char *pattern, const char *text) {
+  referenceSteps = 0;
+  referenceDepth = 0;
+  referenceGaveUp = FALSE;
+  return referenceSequence(pattern, pattern + strlen(pattern), text, NULL);
+}
+
+/* Append a random item nested at most depth levels to buf */
+static void randomItem(char *buf, int depth) {
+  static const char *const atoms[] = {
+    "a", "b", "?", "%", "'#", "[ab]", "[~a]", "[a-b]"
+  };
+  int n;
+
+  n = rand() % (depth > 0 ? 11 : 8);
+  if (n < 8) {
+    strcat(buf, atoms[n]);
+  } else if (n == 8) {
+    strcat(buf, "#");
+    randomItem(buf, depth - 1);
+  } else if (n == 9) {
+    strcat(buf, "~");
+    randomItem(buf, depth - 1);
+  } else {
+    strcat(buf, "(");
+    randomItem(buf, depth - 1);
+    if (rand() % 2) randomItem(buf, depth - 1);
+    strcat(buf, "|");
+    randomItem(buf, depth - 1);
+    strcat(buf, ")");
+  }
+}
+
+/* Compare both matchers on short random strings; returns mismatches */
+static long crossCheck(void) {
+  struct CompiledPattern *compiled;
+  char pattern[256];
+  char text[16];
+  long mismatches;
+  long rounds;
+  int length;
+  int i;
+
+  mismatches = 0;
+  srand(1);
+
+  for (rounds = 0; rounds < RANDOM_ROUNDS; rounds++) {
+    pattern[0] = '\0';
+    for (i = rand() % 5; i >= 0; i--) randomItem(pattern, 2);
+
+    length = rand() % 10;
+    for (i = 0; i < length; i++) text[i] = "abc"[rand() % 3];
+    text[length] = '\0';
+
+    compiled = compilePattern(pattern, FALSE);
+    if (!compiled) return -1;
+
+    if (matchCompiledPattern(compiled, text) != backtrackMatch(pattern, text)
+        && !referenceGaveUp) {
+      if (mismatches < 10) {
+        printf("MISMATCH pattern \"%s\" text \"%s\"\n", pattern, text);
+      }
+      mismatches++;
+    }
+    freeCompiledPattern(compiled);
+  }
+
+  return mismatches;
+}
+
+/* Seconds per call of matchCompiledPattern() */
+static double timeCompiled(const struct CompiledPattern *compiled,
+                           char *text) {
+  clock_t start;
+  clock_t elapsed;
+  long runs;
+
+  runs = 0;
+  start = clock();
+
+  do {
+    matchCompiledPattern(compiled, text);
+    runs++;
+    elapsed = clock() - start;
+  } while (elapsed < CLOCKS_PER_SEC / 10);
+
+  return (double)elapsed / CLOCKS_PER_SEC / runs;
+}
+
+/* Seconds per call of the reference, or less than 0 if it gave up */
+static double timeReference(const char *pattern, const char *text) {
+  clock_t start;
+  clock_t elapsed;
+  long runs;
+
+  runs = 0;
+  start = clock();
+
+  do {
+    backtrackMatch(pattern, text);
+    if (referenceGaveUp) return -1.0;
+    runs++;
+    elapsed = clock() - start;
+  } while (elapsed < CLOCKS_PER_SEC / 10);
+
+  return (double)elapsed / CLOCKS_PER_SEC / runs;
+}
+
+/* Time both matchers on one pattern over growing runs of 'a' and a 'c' */
+static BOOL benchPattern(const char *pattern, char *text) {
+  struct CompiledPattern *compiled;
+  double iterative;
+  double reference;
+  BOOL useReference;
+  int length;
+
+  compiled = compilePattern(pattern, FALSE);
+  if (!compiled) return FALSE;
+
+  printf("\npattern \"%s\"\n", pattern);
+  printf("%10s %14s %14s\n", "length", "compiled", "backtracking");
+
+  useReference = TRUE;
+
+  for (length = 16; length <= MAX_TEXT_LEN; length *= 4) {
+    memset(text, 'a', length - 1);
+    text[length - 1] = 'c';
+    text[length] = '\0';
+
+    iterative = timeCompiled(compiled, text);
+
+    reference = useReference ? timeReference(pattern, text) : -1.0;
+    if (reference >= 0.0) {
+      printf("%10d %12.3fus %12.3fus\n", length,
+             iterative * 1e6, reference * 1e6);
+    } else {
+      printf("%10d %12.3fus %14s\n", length, iterative * 1e6, "-");
+      useReference = FALSE;
+    }
+  }
+
+  freeCompiledPattern(compiled);
+  return TRUE;
+}
+
+int main(void) {
+  static const char *patterns[] = {
+    "#a",
+    "#ab",
+    "#(a|aa)",
+    "#(a|aa)b",
+    "#?a#?a#?b",
+    "#?a#?a#?a#?a#?a#?b",
+    "#(#a)b",
+    "#[a-z]#[~b]b",
+    "~(#?c)",
+    "#?~(a)#?b",
+    NULL
+  };
+  char *text;
+  long mismatches;
+  int i;
+
+  mismatches = crossCheck();
+  printf("cross-check: %ld random cases, %ld mismatches\n",
+         (long)RANDOM_ROUNDS, mismatches);
+  if (mismatches) return RETURN_FAIL;
+
+  text = malloc(MAX_TEXT_LEN + 1);
+  if (!text) return RETURN_FAIL;
+
+  for (i = 0; patterns[i]; i++) {
+    if (!benchPattern(patterns[i], text)) {
+      free(text);
+      return RETURN_FAIL;
+    }
+  }
+
+  free(text);
+  return RETURN_OK;
+}
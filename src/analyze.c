@@ -1,8 +1,9 @@
 /* analyze.c */
 #include "fileutils.h"
+#ifndef PLATFORM_POSIX
 #include <workbench/startup.h>
 #include <proto/icon.h>
-#include <proto/dos.h>
+#endif
 #include <stdio.h>
 #include <string.h>
 
@@ -10,8 +11,11 @@
 int _WBargc;
 char **_WBargv;
 
+/* Name errors are reported under, for requests as well */
+static const char *programName;
+
 /* Argument template */
-const char *TEMPLATE = "HELP/S,COMMAND/A,FILE/A,PATTERN/K,LINE/N,TEXT/K,OUTPUT/K";
+const char *TEMPLATE = "HELP/S,COMMAND/A,FILE/M,PATTERN/K,LINE/N,TEXT/K,OUTPUT/K,STREAM/S,DETECT/K,EDITS/K,ALL/S,WORKERS/K/N,LIMIT/K/N,OFFSET/K/N,CACHE/K,STATS/S,PATTERNS/K,PORT/K";
 const char *VERSTAG = "\0$VER: Analyze 1.0 (1.1.2025)\0";
 
 enum {
@@ -22,6 +26,17 @@ enum {
   ARG_LINE,
   ARG_TEXT,
   ARG_OUTPUT,
+  ARG_STREAM,
+  ARG_DETECT,
+  ARG_EDITS,
+  ARG_ALL,
+  ARG_WORKERS,
+  ARG_LIMIT,
+  ARG_OFFSET,
+  ARG_CACHE,
+  ARG_STATS,
+  ARG_PATTERNS,
+  ARG_PORT,
   TOTAL_ARGS
 };
 
@@ -29,33 +44,517 @@ void printUsage(void) {
   Printf("\nAnalyze - Text file manipulation utility\n");
   Printf("© 2025 Your Name\n\n");
   Printf("FORMAT:\n");
-  Printf("  ANALYZE COMMAND FILE [PATTERN pattern] [LINE n] [TEXT string] [OUTPUT file]\n\n");
+  Printf("  ANALYZE COMMAND FILE [FILE ...] [ALL] [PATTERN pattern] [LINE n] [TEXT string]\n");
+  Printf("          [OUTPUT file] [STREAM] [DETECT FULL|SAMPLE] [EDITS file] [WORKERS n]\n");
+  Printf("          [LIMIT n] [OFFSET n] [CACHE dir] [STATS] [PATTERNS file]\n");
+  Printf("          [PORT name]\n\n");
   Printf("COMMAND:\n");
   Printf("  INFO    - Show file information\n");
   Printf("  FIND    - Find lines matching pattern\n");
+  Printf("  FINDALL - List every line matching pattern\n");
+  Printf("  COUNT   - Count lines, or lines matching pattern\n");
   Printf("  INSERT  - Insert a line at position\n");
   Printf("  DELETE  - Delete a line by number\n");
-  Printf("  REMOVE  - Remove lines matching pattern\n");
+  Printf("  REMOVE  - Remove the first line matching pattern\n");
+  Printf("  REMOVEALL - Remove every line matching pattern\n");
   Printf("  REPLACE - Replace line(s) with new text\n");
-  Printf("  SAVE    - Save modifications to new file\n\n");
+  Printf("  SAVE    - Save the file to OUTPUT, or in place\n");
+  Printf("  BATCH   - Apply a script of edits and save the result\n");
+  Printf("  SERVE   - Stay resident on PORT, running the commands sent to\n");
+  Printf("            it and keeping the files they load between them\n");
+  Printf("  QUIT    - Stop the server on PORT\n\n");
   Printf("ARGUMENTS:\n");
-  Printf("  FILE    - Source file to analyze\n");
+  Printf("  FILE    - Source file to analyze; INFO, FIND, FINDALL and COUNT take\n");
+  Printf("            several files or directories\n");
+  Printf("  ALL     - Also analyze the files in subdirectories\n");
+  Printf("  WORKERS - Tasks loading several files, or searching one large\n");
+  Printf("            file, at once\n");
   Printf("  PATTERN - Pattern to match (* and ? wildcards supported)\n");
+  Printf("  PATTERNS - File of patterns, one per line, that FIND, FINDALL\n");
+  Printf("            and COUNT match in a single pass over each file,\n");
+  Printf("            reporting which of them hit; PATTERN is matched too\n");
   Printf("  LINE    - Line number for operations\n");
   Printf("  TEXT    - Text content for insert/replace\n");
-  Printf("  OUTPUT  - Destination file for save\n\n");
+  Printf("  OUTPUT  - Destination file for SAVE and BATCH; without it the\n");
+  Printf("            source is replaced safely, keeping its protection and date\n");
+  Printf("  STREAM  - Read the file in chunks instead of loading it (INFO,\n");
+  Printf("            FIND, FINDALL and COUNT only; used automatically for\n");
+  Printf("            huge files)\n");
+  Printf("  DETECT  - How to tell text from binary: SAMPLE (default) samples\n");
+  Printf("            large files, FULL always reads every byte\n");
+  Printf("  EDITS   - Edit script for BATCH, one edit per line:\n");
+  Printf("            INSERT n text, DELETE n or REPLACE n text, where n\n");
+  Printf("            is a line number in the original file\n");
+  Printf("  LIMIT   - Most matches FINDALL lists per file\n");
+  Printf("  OFFSET  - Matches FINDALL skips in each file before listing\n");
+  Printf("  CACHE   - Directory to keep line indexes in; files that have not\n");
+  Printf("            changed since are loaded without being scanned again\n");
+  Printf("  STATS   - After the command, print the time spent loading,\n");
+  Printf("            classifying, parsing, matching and saving, the bytes\n");
+  Printf("            read and written, and memory used, one name=value\n");
+  Printf("            per line\n");
+  Printf("  PORT    - Port of a server started with SERVE; the command is\n");
+  Printf("            run there, on files it may have loaded already, and\n");
+  Printf("            edits stay there until SAVE\n\n");
   Printf("EXAMPLE:\n");
   Printf("  ANALYZE INFO \"script.txt\"\n");
   Printf("  ANALYZE FIND \"script.txt\" PATTERN \"echo *\"\n");
   Printf("  ANALYZE INSERT \"script.txt\" LINE 5 TEXT \"echo \\\"Hello\\\"\"\n");
   Printf("  ANALYZE REPLACE \"script.txt\" PATTERN \"echo *\" TEXT \"print \\\"Hello\\\"\"\n");
   Printf("  ANALYZE SAVE \"script.txt\" OUTPUT \"script.new\"\n");
+  Printf("  ANALYZE BATCH \"script.txt\" EDITS \"edits.txt\" OUTPUT \"script.new\"\n");
+  Printf("  ANALYZE BATCH S:Startup-Sequence EDITS \"edits.txt\"\n");
+  Printf("  ANALYZE COUNT \"huge.log\" PATTERN \"#?error#?\" STREAM\n");
+  Printf("  ANALYZE FINDALL \"huge.log\" PATTERN \"#?error#?\" OFFSET 100 LIMIT 50\n");
+  Printf("  ANALYZE FIND S: Devs: ALL PATTERN \"#?Assign#?\"\n");
+  Printf("  ANALYZE FINDALL S: ALL PATTERN \"#?Assign#?\" CACHE T:\n");
+  Printf("  ANALYZE COUNT S:Startup-Sequence PATTERNS \"deprecated.txt\"\n");
+  Printf("  RUN ANALYZE SERVE PORT ANALYZE\n");
+  Printf("  ANALYZE INSERT \"script.txt\" LINE 5 TEXT \"echo\" PORT ANALYZE\n");
+  Printf("  ANALYZE SAVE \"script.txt\" PORT ANALYZE\n");
+  Printf("  ANALYZE QUIT PORT ANALYZE\n");
+}
+
+/* Commands that can run on a stream without loading the whole file */
+BOOL isStreamCommand(const char *command) {
+  return (BOOL)(stricmp(command, "INFO") == 0 ||
+                stricmp(command, "FIND") == 0 ||
+                stricmp(command, "FINDALL") == 0 ||
+                stricmp(command, "COUNT") == 0);
+}
+
+/* Print one line FINDALL lists */
+static void putMatch(struct OutStream *out, ULONG lineNumber,
+                     const char *text) {
+  putNumber(out, lineNumber, 4);
+  putChars(out, ": ", 2);
+  putString(out, text);
+  putChars(out, "\n", 1);
+}
+
+/* List the lines of a loaded file matching a pattern, from offset on */
+static LONG printAllMatches(const struct FileMetadata *metadata,
+                            STRPTR pattern, ULONG offset, ULONG limit) {
+  struct CompiledPattern *compiled;
+  struct LineMatches *matches;
+  struct OutStream *out;
+  StatsPhase phase;
+  ULONG lineNumber;
+  ULONG skipped;
+  ULONG printed;
+  BOOL success;
+
+  if (metadata->isBinary) {
+    Printf("Pattern not found\n");
+    return RETURN_OK;
+  }
+
+  ENTER_PHASE(PHASE_MATCH, phase);
+  compiled = obtainPattern(pattern, FALSE);
+  LEAVE_PHASE(phase);
+  if (!compiled) {
+    Printf("Invalid pattern %s\n", pattern);
+    return RETURN_ERROR;
+  }
+
+  /* All the matching is done before the first line is printed */
+  ENTER_PHASE(PHASE_MATCH, phase);
+  matches = findAllMatches(metadata, compiled);
+  LEAVE_PHASE(phase);
+  out = matches ? openOutStream(Output()) : NULL;
+  if (!out) {
+    freeLineMatches(matches);
+    Printf("Not enough memory to list matches\n");
+    return RETURN_FAIL;
+  }
+
+  lineNumber = 0;
+  skipped = 0;
+  printed = 0;
+  while (printed < limit && (lineNumber = nextMatch(matches, lineNumber))) {
+    if (skipped < offset) {
+      skipped++;
+      continue;
+    }
+    putMatch(out, lineNumber, lineString(getLine(metadata, lineNumber)));
+    printed++;
+  }
+
+  success = closeOutStream(out);
+  if (!matches->count) Printf("Pattern not found\n");
+  freeLineMatches(matches);
+
+  return success ? RETURN_OK : RETURN_ERROR;
+}
+
+/* A stream that ran out of memory for a line ends early; say so instead */
+static BOOL streamFailed(const struct LineStream *stream) {
+  if (!stream->outOfMemory) return FALSE;
+
+  Printf("Not enough memory for line %ld of %s\n", stream->lineNumber + 1,
+         stream->fullPath);
+  return TRUE;
+}
+
+/* Execute a read-only command over a file streamed in chunks */
+LONG executeStreamCommand(const char *command, const char *filename,
+                          STRPTR pattern, ULONG offset, ULONG limit) {
+  struct CompiledPattern *compiled;
+  struct LineStream *stream;
+  struct TextLine *line;
+  struct OutStream *out;
+  StatsPhase phase;
+  ULONG count;
+  ULONG printed;
+  LONG result;
+
+  if (!isStreamCommand(command)) {
+    Printf("STREAM only supports INFO, FIND, FINDALL and COUNT\n");
+    return RETURN_ERROR;
+  }
+
+  if ((stricmp(command, "FIND") == 0 || stricmp(command, "FINDALL") == 0) &&
+      !pattern) {
+    Printf("PATTERN argument required for %s command\n", command);
+    return RETURN_ERROR;
+  }
+
+  compiled = NULL;
+  if (pattern) {
+    ENTER_PHASE(PHASE_MATCH, phase);
+    compiled = obtainPattern(pattern, FALSE);
+    LEAVE_PHASE(phase);
+    if (!compiled) {
+      Printf("Invalid pattern %s\n", pattern);
+      return RETURN_ERROR;
+    }
+  }
+
+  stream = openLineStream(filename);
+  if (!stream) {
+    Printf("Could not analyze file %s\n", filename);
+    return RETURN_ERROR;
+  }
+
+  result = RETURN_OK;
+  if (stricmp(command, "INFO") == 0) {
+    printStreamInfo(stream);
+    if (streamFailed(stream)) result = RETURN_FAIL;
+  } else if (stricmp(command, "FIND") == 0) {
+    /* Splitting lines off the stream counts as matching; reads do not */
+    line = NULL;
+    ENTER_PHASE(PHASE_MATCH, phase);
+    if (!stream->isBinary) {
+      while ((line = nextStreamLine(stream))) {
+        if (matchCompiledPattern(compiled, line->content)) break;
+      }
+    }
+    LEAVE_PHASE(phase);
+
+    if (streamFailed(stream)) {
+      result = RETURN_FAIL;
+    } else if (line) {
+      Printf("Found at line %ld: %s\n", line->lineNumber, line->content);
+    } else {
+      Printf("Pattern not found\n");
+    }
+  } else if (stricmp(command, "FINDALL") == 0) {
+    out = openOutStream(Output());
+    if (!out) {
+      closeLineStream(stream);
+      Printf("Not enough memory to list matches\n");
+      return RETURN_FAIL;
+    }
+
+    /* Matches are printed as they stream past, and reading stops at limit */
+    count = 0;
+    printed = 0;
+    ENTER_PHASE(PHASE_MATCH, phase);
+    if (!stream->isBinary) {
+      while (printed < limit && (line = nextStreamLine(stream))) {
+        if (!matchCompiledPattern(compiled, line->content)) continue;
+        if (count++ < offset) continue;
+
+        putMatch(out, line->lineNumber, line->content);
+        printed++;
+      }
+    }
+    LEAVE_PHASE(phase);
+
+    result = closeOutStream(out) ? RETURN_OK : RETURN_ERROR;
+    if (streamFailed(stream)) result = RETURN_FAIL;
+    else if (!count) Printf("Pattern not found\n");
+    closeLineStream(stream);
+    return result;
+  } else {
+    count = 0;
+    ENTER_PHASE(PHASE_MATCH, phase);
+    if (!stream->isBinary) {
+      while ((line = nextStreamLine(stream))) {
+        if (!compiled || matchCompiledPattern(compiled, line->content)) count++;
+      }
+    }
+    LEAVE_PHASE(phase);
+
+    if (streamFailed(stream)) result = RETURN_FAIL;
+    else Printf(pattern ? "%ld matching lines\n" : "%ld lines\n", count);
+  }
+
+  closeLineStream(stream);
+  return result;
+}
+
+/* Print one line FINDALL lists for a pattern set, with the patterns it hit */
+static void putSetMatch(struct OutStream *out, ULONG lineNumber,
+                        const struct PatternSet *set, const ULONG *hits,
+                        const char *text) {
+  ULONG listed;
+  ULONG i;
+
+  putNumber(out, lineNumber, 4);
+  putChars(out, " [", 2);
+  listed = 0;
+  for (i = 0; i < set->count; i++) {
+    if (!IS_PATTERN_HIT(hits, i)) continue;
+    if (listed++) putChars(out, ",", 1);
+    putNumber(out, i + 1, 0);
+  }
+  putChars(out, "]: ", 3);
+  putString(out, text);
+  putChars(out, "\n", 1);
+}
+
+/* Report where a pattern of a set was first found */
+static void printSetFind(const struct PatternSet *set, ULONG i,
+                         ULONG lineNumber, const char *text) {
+  if (lineNumber) {
+    Printf("%s found at line %ld: %s\n", set->patterns[i]->source,
+           lineNumber, text);
+  } else {
+    Printf("%s not found\n", set->patterns[i]->source);
+  }
+}
+
+static void printSetCounts(const struct PatternSet *set, ULONG count,
+                           const ULONG *counts) {
+  ULONG i;
+
+  Printf("%ld matching lines\n", count);
+  for (i = 0; i < set->count; i++) {
+    Printf("%ld matching %s\n", counts[i], set->patterns[i]->source);
+  }
+}
+
+/*
+ * Run FIND, FINDALL or COUNT with a pattern set over a loaded file. One
+ * search matches every pattern; FINDALL matches the lines it lists again
+ * to name the patterns they hit.
+ */
+static LONG executeSetCommand(const char *command,
+                              const struct FileMetadata *metadata,
+                              const struct PatternSet *set, ULONG offset,
+                              ULONG limit) {
+  struct LineMatches *matches;
+  struct OutStream *out;
+  StatsPhase phase;
+  STRPTR text;
+  ULONG *firstLines;
+  ULONG *counts;
+  ULONG *hits;
+  ULONG allocSize;
+  ULONG lineNumber;
+  ULONG skipped;
+  ULONG printed;
+  ULONG i;
+  LONG result;
+
+  allocSize = (set->count * 2 + set->words) * sizeof(ULONG);
+  firstLines = AllocMem(allocSize, MEMF_CLEAR);
+  if (!firstLines) {
+    Printf("Not enough memory to match patterns\n");
+    return RETURN_FAIL;
+  }
+  counts = firstLines + set->count;
+  hits = counts + set->count;
+
+  /* A binary file matches nothing */
+  matches = NULL;
+  if (!metadata->isBinary) {
+    ENTER_PHASE(PHASE_MATCH, phase);
+    matches = findSetMatches(metadata, set, firstLines, counts);
+    LEAVE_PHASE(phase);
+    if (!matches) {
+      FreeMem(firstLines, allocSize);
+      Printf("Not enough memory to match patterns\n");
+      return RETURN_FAIL;
+    }
+  }
+
+  result = RETURN_OK;
+  if (stricmp(command, "FIND") == 0) {
+    for (i = 0; i < set->count; i++) {
+      text = firstLines[i] ? lineString(getLine(metadata, firstLines[i])) :
+                             NULL;
+      printSetFind(set, i, firstLines[i], text);
+    }
+  } else if (stricmp(command, "FINDALL") == 0) {
+    out = matches ? openOutStream(Output()) : NULL;
+    if (matches && !out) {
+      freeLineMatches(matches);
+      FreeMem(firstLines, allocSize);
+      Printf("Not enough memory to list matches\n");
+      return RETURN_FAIL;
+    }
+
+    lineNumber = 0;
+    skipped = 0;
+    printed = 0;
+    while (out && printed < limit &&
+           (lineNumber = nextMatch(matches, lineNumber))) {
+      if (skipped < offset) {
+        skipped++;
+        continue;
+      }
+
+      text = lineString(getLine(metadata, lineNumber));
+      matchPatternSet(set, text, hits);
+      putSetMatch(out, lineNumber, set, hits, text);
+      printed++;
+    }
+
+    if (out && !closeOutStream(out)) result = RETURN_ERROR;
+    if (!matches || !matches->count) Printf("Pattern not found\n");
+  } else {
+    printSetCounts(set, matches ? matches->count : 0, counts);
+  }
+
+  freeLineMatches(matches);
+  FreeMem(firstLines, allocSize);
+  return result;
+}
+
+/*
+ * As executeSetCommand(), over a file streamed in chunks. FIND keeps a
+ * copy of each pattern's first line, as the stream moves on, and stops
+ * reading once every pattern has been found.
+ */
+static LONG executeStreamSetCommand(const char *command, const char *filename,
+                                    const struct PatternSet *set,
+                                    ULONG offset, ULONG limit) {
+  struct LineStream *stream;
+  struct TextLine *line;
+  struct OutStream *out;
+  StatsPhase phase;
+  STRPTR *texts;
+  ULONG *firstLines;
+  ULONG *counts;
+  ULONG *hits;
+  ULONG allocSize;
+  ULONG found;
+  ULONG count;
+  ULONG printed;
+  ULONG i;
+  LONG result;
+  BOOL find;
+  BOOL findAll;
+  APTR pool;
+
+  stream = openLineStream(filename);
+  if (!stream) {
+    Printf("Could not analyze file %s\n", filename);
+    return RETURN_ERROR;
+  }
+
+  /* First lines, counts, a line's hits and the copies of first lines */
+  allocSize = (set->count * 2 + set->words) * sizeof(ULONG) +
+              set->count * sizeof(STRPTR);
+  firstLines = AllocMem(allocSize, MEMF_CLEAR);
+  pool = CreatePool(MEMF_ANY, POOL_PUDDLE_SIZE, POOL_THRESH_SIZE);
+  out = openOutStream(Output());
+  if (!firstLines || !pool || !out) {
+    if (out) closeOutStream(out);
+    if (pool) DeletePool(pool);
+    if (firstLines) FreeMem(firstLines, allocSize);
+    closeLineStream(stream);
+    Printf("Not enough memory to match patterns\n");
+    return RETURN_FAIL;
+  }
+  counts = firstLines + set->count;
+  hits = counts + set->count;
+  texts = (STRPTR *)(hits + set->words);
+
+  find = (BOOL)(stricmp(command, "FIND") == 0);
+  findAll = (BOOL)(stricmp(command, "FINDALL") == 0);
+
+  result = RETURN_OK;
+  found = 0;
+  count = 0;
+  printed = 0;
+  ENTER_PHASE(PHASE_MATCH, phase);
+  while (!stream->isBinary && (!find || found < set->count) &&
+         (!findAll || printed < limit) &&
+         (line = nextStreamLine(stream))) {
+    if (!matchPatternSet(set, line->content, hits)) continue;
+
+    if (findAll) {
+      if (count++ >= offset) {
+        putSetMatch(out, line->lineNumber, set, hits, line->content);
+        printed++;
+      }
+      continue;
+    }
+
+    count++;
+    for (i = 0; i < set->count; i++) {
+      if (!IS_PATTERN_HIT(hits, i)) continue;
+
+      counts[i]++;
+      if (!find || firstLines[i]) continue;
+
+      texts[i] = AllocPooled(pool, line->length + 1);
+      if (!texts[i]) {
+        result = RETURN_FAIL;
+        break;
+      }
+      strcpy(texts[i], line->content);
+      firstLines[i] = line->lineNumber;
+      found++;
+    }
+    if (result != RETURN_OK) break;
+  }
+  LEAVE_PHASE(phase);
+
+  if (!closeOutStream(out) && result == RETURN_OK) result = RETURN_ERROR;
+
+  if (result == RETURN_FAIL) {
+    Printf("Not enough memory to match patterns\n");
+  } else if (streamFailed(stream)) {
+    result = RETURN_FAIL;
+  } else if (find) {
+    for (i = 0; i < set->count; i++) {
+      printSetFind(set, i, firstLines[i], texts[i]);
+    }
+  } else if (findAll) {
+    if (!count) Printf("Pattern not found\n");
+  } else {
+    printSetCounts(set, count, counts);
+  }
+
+  DeletePool(pool);
+  FreeMem(firstLines, allocSize);
+  closeLineStream(stream);
+  return result;
 }
 
 /* Execute the requested command */
 LONG executeCommand(const char *command, struct FileMetadata *metadata,
-                   STRPTR pattern, LONG *line, STRPTR text, STRPTR output) {
+                   STRPTR pattern, LONG *line, STRPTR text, STRPTR output,
+                   STRPTR edits, ULONG offset, ULONG limit) {
+  struct CompiledPattern *compiled;
   struct TextLine *foundLine;
+  struct EditBatch *batch;
+  StatsPhase phase;
+  ULONG count;
   BOOL success;
 
   if (stricmp(command, "INFO") == 0) {
@@ -69,15 +568,44 @@ LONG executeCommand(const char *command, struct FileMetadata *metadata,
       return RETURN_ERROR;
     }
 
-    foundLine = findLineByPattern(metadata, pattern);
-    if (foundLine) {
-      Printf("Found at line %ld: %s\n", foundLine->lineNumber, foundLine->content);
+    /* Not findLineByPattern(), which cannot tell a miss from no memory */
+    ENTER_PHASE(PHASE_MATCH, phase);
+    compiled = obtainPattern(pattern, FALSE);
+    count = findFirstMatch(metadata, compiled);
+    LEAVE_PHASE(phase);
+    if (count == SEARCH_FAILED) {
+      Printf("Not enough memory to find matches\n");
+      return RETURN_FAIL;
+    }
+
+    if (count) {
+      foundLine = getLine(metadata, count);
+      Printf("Found at line %ld: %s\n", foundLine->lineNumber, lineString(foundLine));
     } else {
       Printf("Pattern not found\n");
     }
     return RETURN_OK;
   }
 
+  if (stricmp(command, "FINDALL") == 0) {
+    if (!pattern) {
+      Printf("PATTERN argument required for FINDALL command\n");
+      return RETURN_ERROR;
+    }
+
+    return printAllMatches(metadata, pattern, offset, limit);
+  }
+
+  if (stricmp(command, "COUNT") == 0) {
+    count = countLinesByPattern(metadata, pattern, FALSE);
+    if (count == SEARCH_FAILED) {
+      Printf("Not enough memory to count matches\n");
+      return RETURN_FAIL;
+    }
+    Printf(pattern ? "%ld matching lines\n" : "%ld lines\n", count);
+    return RETURN_OK;
+  }
+
   if (stricmp(command, "INSERT") == 0) {
     if (!line || !text) {
       Printf("LINE and TEXT arguments required for INSERT command\n");
@@ -114,7 +642,7 @@ LONG executeCommand(const char *command, struct FileMetadata *metadata,
       return RETURN_ERROR;
     }
 
-    if (removeLineByPattern(metadata, pattern)) {
+    if (removeLineByPattern(metadata, pattern, FALSE)) {
       Printf("Line removed\n");
       return RETURN_OK;
     } else {
@@ -123,6 +651,18 @@ LONG executeCommand(const char *command, struct FileMetadata *metadata,
     }
   }
 
+  if (stricmp(command, "REMOVEALL") == 0) {
+    if (!pattern) {
+      Printf("PATTERN argument required for REMOVEALL command\n");
+      return RETURN_ERROR;
+    }
+
+    /* One search and one sweep of the index, however many lines go */
+    count = removeLinesByPattern(metadata, pattern, FALSE);
+    Printf("%ld lines removed\n", count);
+    return RETURN_OK;
+  }
+
   if (stricmp(command, "REPLACE") == 0) {
     /* Replace can work with either LINE or PATTERN */
     if ((!line && !pattern) || !text) {
@@ -132,13 +672,13 @@ LONG executeCommand(const char *command, struct FileMetadata *metadata,
 
     /* Prioritize LINE if both are specified */
     if (line) {
-      if (removeLine(metadata, *line) && insertLine(metadata, *line, text)) {
+      if (replaceLine(metadata, *line, text)) {
         Printf("Line replaced\n");
         return RETURN_OK;
       }
     } else {
-      if (removeLineByPattern(metadata, pattern) &&
-          insertLine(metadata, 1, text)) {
+      foundLine = findLineByPattern(metadata, pattern, FALSE);
+      if (foundLine && setLineContent(foundLine, text)) {
         Printf("Line replaced\n");
         return RETURN_OK;
       }
@@ -148,14 +688,10 @@ LONG executeCommand(const char *command, struct FileMetadata *metadata,
   }
 
   if (stricmp(command, "SAVE") == 0) {
-    if (!output) {
-      Printf("OUTPUT argument required for SAVE command\n");
-      return RETURN_ERROR;
-    }
-
-    success = saveToFile(metadata, output);
+    /* Without OUTPUT the file is replaced in place */
+    success = output ? saveToFile(metadata, output) : saveInPlace(metadata);
     if (success) {
-      Printf("File saved to %s\n", output);
+      Printf("File saved to %s\n", output ? output : metadata->fullPath);
       return RETURN_OK;
     } else {
       Printf("Failed to save file\n");
@@ -163,13 +699,396 @@ LONG executeCommand(const char *command, struct FileMetadata *metadata,
     }
   }
 
+  if (stricmp(command, "BATCH") == 0) {
+    if (!edits) {
+      Printf("EDITS argument required for BATCH command\n");
+      return RETURN_ERROR;
+    }
+
+    batch = loadEditBatch(edits);
+    if (!batch) return RETURN_ERROR;
+
+    /* All edits or none; the file is written once at the end */
+    success = applyEditBatch(metadata, batch);
+    if (success) Printf("Applied %ld edits\n", batch->count);
+    else Printf("Failed to apply edits\n");
+    freeEditBatch(batch);
+
+    if (success) {
+      success = output ? saveToFile(metadata, output) : saveInPlace(metadata);
+      if (success) {
+        Printf("File saved to %s\n", output ? output : metadata->fullPath);
+        return RETURN_OK;
+      }
+      Printf("Failed to save file\n");
+    }
+    return RETURN_ERROR;
+  }
+
   Printf("Unknown command: %s\n", command);
   return RETURN_ERROR;
 }
 
+/* One file of a multi-file run; a worker loads it, then it is reported */
+struct FileJob {
+  struct WorkItem item;               /* Must come first */
+  STRPTR path;                        /* File to load */
+  BOOL stream;                        /* Stream the file instead of loading */
+  BOOL done;                          /* Whether the worker is through */
+  struct FileMetadata *metadata;      /* The loaded file, or NULL */
+};
+
+/* Runs on a worker: load the file unless it has to be streamed */
+static void loadFileJob(struct WorkItem *item) {
+  struct FileJob *job;
+
+  job = (struct FileJob *)item;
+  if (!job->stream) job->stream = shouldStreamFile(job->path);
+  if (!job->stream) job->metadata = analyzeFile(job->path);
+}
+
+/* Run the command on a file a worker is through with */
+static LONG reportFileJob(const char *command, struct FileJob *job,
+                          STRPTR pattern, const struct PatternSet *set,
+                          ULONG offset, ULONG limit, BOOL first) {
+  LONG result;
+
+  /* INFO names the file itself; the other commands get a heading */
+  if (!first) Printf("\n");
+  if (stricmp(command, "INFO") != 0) Printf("%s\n", job->path);
+
+  if (job->stream && set) {
+    return executeStreamSetCommand(command, job->path, set, offset, limit);
+  }
+  if (job->stream) {
+    return executeStreamCommand(command, job->path, pattern, offset, limit);
+  }
+
+  if (!job->metadata) {
+    Printf("Could not analyze file %s\n", job->path);
+    return RETURN_ERROR;
+  }
+
+  if (set) {
+    result = executeSetCommand(command, job->metadata, set, offset, limit);
+  } else {
+    result = executeCommand(command, job->metadata, pattern,
+                            NULL, NULL, NULL, NULL, offset, limit);
+  }
+  freeFileMetadata(job->metadata);
+  job->metadata = NULL;
+  return result;
+}
+
+/*
+ * Run a read-only command over a list of files. Workers load the files
+ * while this task matches and prints, in list order whatever order the
+ * loads finish in. Only a few loads run ahead of the output, so memory
+ * stays bounded however long the list is.
+ */
+LONG executeFileList(const char *command, struct FileList *list,
+                     STRPTR pattern, const struct PatternSet *set,
+                     ULONG offset, ULONG limit, BOOL stream,
+                     ULONG workers) {
+  struct WorkPool *pool;
+  struct FileJob *jobs;
+  StatsPhase phase;
+  ULONG submitted;
+  ULONG reported;
+  LONG result;
+  LONG fileResult;
+
+  if (!isStreamCommand(command)) {
+    Printf("Only INFO, FIND, FINDALL and COUNT take several files\n");
+    return RETURN_ERROR;
+  }
+
+  if ((stricmp(command, "FIND") == 0 || stricmp(command, "FINDALL") == 0) &&
+      !pattern && !set) {
+    Printf("PATTERN argument required for %s command\n", command);
+    return RETURN_ERROR;
+  }
+
+  if (!list->count) return RETURN_OK;
+  if (workers > list->count) workers = list->count;
+
+  jobs = AllocPooled(list->pool, list->count * sizeof(struct FileJob));
+  pool = jobs ? createWorkPool(workers) : NULL;
+  if (!pool) {
+    Printf("Could not start workers\n");
+    return RETURN_FAIL;
+  }
+
+  result = RETURN_OK;
+  submitted = 0;
+
+  for (reported = 0; reported < list->count; reported++) {
+    while (submitted < list->count && submitted < reported + workers * 2) {
+      jobs[submitted].path = list->paths[submitted];
+      jobs[submitted].stream = stream;
+      submitWork(pool, &jobs[submitted].item, loadFileJob);
+      submitted++;
+    }
+
+    /* Waiting on the workers counts as loading */
+    ENTER_PHASE(PHASE_LOAD, phase);
+    while (!jobs[reported].done) {
+      ((struct FileJob *)waitWork(pool))->done = TRUE;
+    }
+    LEAVE_PHASE(phase);
+
+    fileResult = reportFileJob(command, &jobs[reported], pattern, set,
+                               offset, limit, (BOOL)(reported == 0));
+    if (fileResult > result) result = fileResult;
+  }
+
+  deleteWorkPool(pool);
+  return result;
+}
+
+/* Apply the settings a command line gives; FALSE if one is wrong */
+static BOOL applySettings(LONG *args) {
+  if (args[ARG_DETECT]) {
+    if (stricmp((STRPTR)args[ARG_DETECT], "FULL") == 0) {
+      detectPolicy.sampled = FALSE;
+    } else if (stricmp((STRPTR)args[ARG_DETECT], "SAMPLE") != 0) {
+      Printf("DETECT must be FULL or SAMPLE\n");
+      return FALSE;
+    }
+  }
+
+  if (args[ARG_CACHE]) lineCacheDir = (STRPTR)args[ARG_CACHE];
+  if (args[ARG_WORKERS]) searchWorkers = *(LONG *)args[ARG_WORKERS];
+  return TRUE;
+}
+
+/* Run the command a parsed command line names */
+static LONG runCommand(LONG *args) {
+  struct FileMetadata *metadata;
+  struct FileList *list;
+  struct PatternSet *patternList;     /* Patterns from PATTERNS, or NULL */
+  struct PatternSet *set;             /* The list, if it holds several */
+  StatsPhase phase;
+  STRPTR pattern;
+  STRPTR filename;
+  ULONG workers;
+  ULONG offset;
+  ULONG limit;
+  LONG result;
+
+  /* FILE is only optional for the commands that take none */
+  if (!args[ARG_FILE] && stricmp((STRPTR)args[ARG_COMMAND], "SERVE") != 0 &&
+      stricmp((STRPTR)args[ARG_COMMAND], "QUIT") != 0) {
+    PrintFault(ERROR_REQUIRED_ARG_MISSING, programName);
+    return RETURN_ERROR;
+  }
+
+  /* Check for help request */
+  if (args[ARG_HELP]) {
+    printUsage();
+    return RETURN_OK;
+  }
+
+  /* Only reached inside a server; a client's PORT was sent here */
+  if (stricmp((STRPTR)args[ARG_COMMAND], "SERVE") == 0) {
+    Printf("Already serving\n");
+    return RETURN_ERROR;
+  }
+
+  if (stricmp((STRPTR)args[ARG_COMMAND], "QUIT") == 0) {
+    if (!isServing()) {
+      Printf("PORT argument required for QUIT command\n");
+      return RETURN_ERROR;
+    }
+    stopServing();
+    Printf("Server stopped\n");
+    return RETURN_OK;
+  }
+
+  /* Counting starts once the arguments are read */
+  if (args[ARG_STATS] && !startRunStats()) {
+    Printf("Could not start STATS\n");
+    return RETURN_FAIL;
+  }
+
+  /* Choose how text is told from binary, and where indexes are kept */
+  if (!applySettings(args)) {
+    stopRunStats();
+    return RETURN_ERROR;
+  }
+
+  /* Expand directories into the files they hold */
+  list = collectFiles((STRPTR *)args[ARG_FILE], (BOOL)(args[ARG_ALL] != 0));
+  if (!list) {
+    Printf("Not enough memory for the file list\n");
+    stopRunStats();
+    return RETURN_FAIL;
+  }
+
+  /* Without LIMIT every match is listed */
+  offset = args[ARG_OFFSET] ? *(LONG *)args[ARG_OFFSET] : 0;
+  limit = args[ARG_LIMIT] ? *(LONG *)args[ARG_LIMIT] : ~0UL;
+
+  /* A pattern list is matched in one pass; a list of one is just a pattern */
+  pattern = (STRPTR)args[ARG_PATTERN];
+  patternList = NULL;
+  set = NULL;
+  if (args[ARG_PATTERNS]) {
+    ENTER_PHASE(PHASE_MATCH, phase);
+    patternList = loadPatternSet((STRPTR)args[ARG_PATTERNS], pattern, FALSE);
+    LEAVE_PHASE(phase);
+    if (!patternList) {
+      freeFileList(list);
+      stopRunStats();
+      return RETURN_ERROR;
+    }
+
+    if (patternList->count == 1) pattern = patternList->patterns[0]->source;
+    else set = patternList;
+  }
+
+  if (set && stricmp((STRPTR)args[ARG_COMMAND], "FIND") != 0 &&
+      stricmp((STRPTR)args[ARG_COMMAND], "FINDALL") != 0 &&
+      stricmp((STRPTR)args[ARG_COMMAND], "COUNT") != 0) {
+    Printf("Only FIND, FINDALL and COUNT take several patterns\n");
+    freePatternSet(patternList);
+    freeFileList(list);
+    stopRunStats();
+    return RETURN_ERROR;
+  }
+
+  if (list->count != 1 || list->expanded) {
+    /* Several files are loaded on a pool of workers */
+    workers = args[ARG_WORKERS] ? *(LONG *)args[ARG_WORKERS] :
+                                  defaultWorkerCount();
+    result = executeFileList(
+      (STRPTR)args[ARG_COMMAND],
+      list,
+      pattern,
+      set,
+      offset,
+      limit,
+      (BOOL)(args[ARG_STREAM] != 0),
+      workers
+    );
+  } else {
+    filename = list->paths[0];
+
+    /* Stream read-only commands when asked to, or when the file is too big */
+    if (set && (args[ARG_STREAM] || shouldStreamFile(filename))) {
+      result = executeStreamSetCommand(
+        (STRPTR)args[ARG_COMMAND],
+        filename,
+        set,
+        offset,
+        limit
+      );
+    } else if (args[ARG_STREAM] ||
+               (isStreamCommand((STRPTR)args[ARG_COMMAND]) &&
+                shouldStreamFile(filename))) {
+      result = executeStreamCommand(
+        (STRPTR)args[ARG_COMMAND],
+        filename,
+        pattern,
+        offset,
+        limit
+      );
+    } else {
+      /* Load and analyze the file; a server may have it loaded already */
+      metadata = isServing() ? obtainServedFile(filename) :
+                               analyzeFile(filename);
+      if (metadata && set) {
+        result = executeSetCommand(
+          (STRPTR)args[ARG_COMMAND],
+          metadata,
+          set,
+          offset,
+          limit
+        );
+        if (!isServing()) freeFileMetadata(metadata);
+      } else if (metadata) {
+        /* Execute the requested command */
+        result = executeCommand(
+          (STRPTR)args[ARG_COMMAND],
+          metadata,
+          pattern,
+          (LONG *)args[ARG_LINE],
+          (STRPTR)args[ARG_TEXT],
+          (STRPTR)args[ARG_OUTPUT],
+          (STRPTR)args[ARG_EDITS],
+          offset,
+          limit
+        );
+        if (!isServing()) freeFileMetadata(metadata);
+      } else {
+        Printf("Could not analyze file %s\n", filename);
+        result = RETURN_ERROR;
+      }
+    }
+  }
+
+  /* Clean up */
+  freePatternSet(patternList);
+  freeFileList(list);
+  if (!isServing()) flushPatternCache();
+
+  /* Printed last, so nothing the run freed is still counted */
+  printRunStats();
+  stopRunStats();
+
+  return result;
+}
+
+/*
+ * Run one command line sent to the server. Settings it gives apply to it
+ * alone, so the next request starts from those the server was started with.
+ */
+static LONG runRequest(struct RDArgs *source) {
+  struct RDArgs *rdargs;
+  struct DetectPolicy detect;
+  const char *cacheDir;
+  ULONG workers;
+  LONG result;
+  LONG args[TOTAL_ARGS] = {0};
+
+  rdargs = ReadArgs(TEMPLATE, args, source);
+  if (!rdargs) {
+    PrintFault(IoErr(), programName);
+    return RETURN_ERROR;
+  }
+
+  detect = detectPolicy;
+  cacheDir = lineCacheDir;
+  workers = searchWorkers;
+
+  result = runCommand(args);
+
+  detectPolicy = detect;
+  lineCacheDir = cacheDir;
+  searchWorkers = workers;
+
+  FreeArgs(rdargs);
+  return result;
+}
+
+/* Stay resident, with the settings given here as every request's default */
+static LONG serve(LONG *args) {
+  LONG result;
+
+  if (!args[ARG_PORT]) {
+    Printf("PORT argument required for SERVE command\n");
+    return RETURN_ERROR;
+  }
+
+  if (!applySettings(args)) return RETURN_ERROR;
+
+  result = serveRequests((STRPTR)args[ARG_PORT], runRequest);
+  flushPatternCache();
+  return result;
+}
+
 int main(int argc, char *argv[]) {
   struct RDArgs *rdargs;
-  struct FileMetadata *metadata;
   LONG result;
   LONG args[TOTAL_ARGS] = {0};
 
@@ -179,6 +1098,13 @@ int main(int argc, char *argv[]) {
     return RETURN_FAIL;
   }
 
+  programName = argv[0];
+
+#ifdef PLATFORM_POSIX
+  /* No Shell hands the command line to ReadArgs() */
+  setHostArgs(argc, argv);
+#endif
+
   /* Parse arguments */
   rdargs = ReadArgs(TEMPLATE, args, NULL);
   if (!rdargs) {
@@ -186,34 +1112,17 @@ int main(int argc, char *argv[]) {
     return RETURN_ERROR;
   }
 
-  /* Check for help request */
   if (args[ARG_HELP]) {
-    FreeArgs(rdargs);
-    printUsage();
-    return RETURN_OK;
-  }
-
-  /* Load and analyze the file */
-  metadata = analyzeFile((STRPTR)args[ARG_FILE]);
-  if (!metadata) {
-    Printf("Could not analyze file %s\n", (STRPTR)args[ARG_FILE]);
-    FreeArgs(rdargs);
-    return RETURN_ERROR;
+    result = runCommand(args);
+  } else if (stricmp((STRPTR)args[ARG_COMMAND], "SERVE") == 0) {
+    result = serve(args);
+  } else if (args[ARG_PORT]) {
+    /* The whole command line goes to the server, which prints the result */
+    result = sendRequest((STRPTR)args[ARG_PORT], argc, argv);
+  } else {
+    result = runCommand(args);
   }
 
-  /* Execute the requested command */
-  result = executeCommand(
-    (STRPTR)args[ARG_COMMAND],
-    metadata,
-    (STRPTR)args[ARG_PATTERN],
-    (LONG *)args[ARG_LINE],
-    (STRPTR)args[ARG_TEXT],
-    (STRPTR)args[ARG_OUTPUT]
-  );
-
-  /* Clean up */
-  freeFileMetadata(metadata);
   FreeArgs(rdargs);
-
   return result;
 }
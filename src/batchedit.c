@@ -0,0 +1,186 @@
+/* batchedit.c */
+#include "fileutils.h"
+
+/* Order edits from the end of the file back, as they must be applied */
+static int compareEdits(const void *a, const void *b) {
+  const struct EditOp *x;
+  const struct EditOp *y;
+
+  x = (const struct EditOp *)a;
+  y = (const struct EditOp *)b;
+
+  if (x->line != y->line) return (x->line > y->line) ? -1 : 1;
+  if (x->kind != y->kind) return (x->kind < y->kind) ? -1 : 1;
+
+  /* Inserts at one line go in last first, so they end up in script order */
+  if (x->source != y->source) return (x->source > y->source) ? -1 : 1;
+  return 0;
+}
+
+/* Parse one script line into op; returns FALSE on a syntax error */
+static BOOL parseEdit(struct EditBatch *batch, const char *text,
+                      struct EditOp *op) {
+  const char *p;
+  ULONG length;
+
+  /* Command word */
+  for (p = text; *p && *p != ' ' && *p != '\t'; p++);
+  length = p - text;
+
+  if (length == 6 && strnicmp(text, "INSERT", 6) == 0) {
+    op->kind = EDIT_INSERT;
+  } else if (length == 6 && strnicmp(text, "DELETE", 6) == 0) {
+    op->kind = EDIT_DELETE;
+  } else if (length == 7 && strnicmp(text, "REPLACE", 7) == 0) {
+    op->kind = EDIT_REPLACE;
+  } else {
+    return FALSE;
+  }
+
+  /* Line number */
+  while (*p == ' ' || *p == '\t') p++;
+  if (*p < '0' || *p > '9') return FALSE;
+
+  op->line = 0;
+  while (*p >= '0' && *p <= '9') op->line = op->line * 10 + (*p++ - '0');
+  if (op->line < 1) return FALSE;
+
+  /* Text, after exactly one separator so indentation survives */
+  if (*p == ' ' || *p == '\t') p++;
+  else if (*p) return FALSE;
+
+  if (op->kind == EDIT_DELETE) {
+    op->text = NULL;
+    return (BOOL)(*p == '\0');
+  }
+
+  length = strlen(p);
+  op->text = AllocPooled(batch->pool, length + 1);
+  if (!op->text) return FALSE;
+
+  strcpy(op->text, p);
+  return TRUE;
+}
+
+/* Read an edit script; reports the first bad line and returns NULL */
+struct EditBatch *loadEditBatch(const char *filename) {
+  struct FileMetadata *script;
+  struct EditBatch *batch;
+  struct TextLine *line;
+  const char *text;
+  APTR pool;
+  ULONG i;
+
+  script = analyzeFile(filename);
+  if (!script) {
+    Printf("Could not read edit script %s\n", filename);
+    return NULL;
+  }
+
+  if (script->isBinary) {
+    Printf("Edit script %s is not a text file\n", filename);
+    freeFileMetadata(script);
+    return NULL;
+  }
+
+  pool = CreatePool(MEMF_CLEAR, POOL_PUDDLE_SIZE, POOL_THRESH_SIZE);
+  batch = pool ? AllocPooled(pool, sizeof(struct EditBatch)) : NULL;
+  if (batch) {
+    batch->pool = pool;
+    strncpy(batch->name, filename, MAX_PATH_LEN - 1);
+    batch->ops = AllocPooled(pool, (script->lineCount + 1) *
+                                   sizeof(struct EditOp));
+  }
+
+  if (!batch || !batch->ops) {
+    Printf("Not enough memory for edit script %s\n", filename);
+    if (pool) DeletePool(pool);
+    freeFileMetadata(script);
+    return NULL;
+  }
+
+  for (i = 1; i <= script->lineCount; i++) {
+    line = getLine(script, i);
+    if (line->type == LINE_EMPTY || line->type == LINE_COMMENT) continue;
+
+    /* Leading blanks are not part of the command */
+    text = lineString(line);
+    while (*text == ' ' || *text == '\t') text++;
+
+    batch->ops[batch->count].source = i;
+    if (!parseEdit(batch, text, &batch->ops[batch->count])) {
+      Printf("%s line %ld: cannot understand \"%s\"\n", filename, i, text);
+      DeletePool(pool);
+      freeFileMetadata(script);
+      return NULL;
+    }
+    batch->count++;
+  }
+
+  freeFileMetadata(script);
+  return batch;
+}
+
+/*
+ * Apply a batch to a loaded file. Every edit is checked against the
+ * original numbering before any of them is made, so a bad script leaves
+ * the file untouched.
+ */
+BOOL applyEditBatch(struct FileMetadata *metadata, struct EditBatch *batch) {
+  struct EditOp *op;
+  ULONG lastLine;
+  ULONG i;
+  BOOL success;
+
+  if (!metadata || !batch || metadata->isBinary) return FALSE;
+
+  for (i = 0; i < batch->count; i++) {
+    op = &batch->ops[i];
+    lastLine = metadata->lineCount + (op->kind == EDIT_INSERT ? 1 : 0);
+
+    if (op->line > lastLine) {
+      Printf("%s line %ld: there is no line %ld\n",
+             batch->name, op->source, op->line);
+      return FALSE;
+    }
+  }
+
+  qsort(batch->ops, batch->count, sizeof(struct EditOp), compareEdits);
+
+  /* Sorting puts any second delete or replace of a line right after the first */
+  for (i = 1; i < batch->count; i++) {
+    op = &batch->ops[i];
+
+    if (op->kind != EDIT_INSERT && op->line == batch->ops[i - 1].line &&
+        batch->ops[i - 1].kind != EDIT_INSERT) {
+      Printf("%s line %ld: line %ld is already changed on line %ld\n",
+             batch->name, op->source, op->line, batch->ops[i - 1].source);
+      return FALSE;
+    }
+  }
+
+  /* Working back from the end, no edit moves a line a later one refers to */
+  success = TRUE;
+  for (i = 0; i < batch->count && success; i++) {
+    op = &batch->ops[i];
+
+    switch (op->kind) {
+      case EDIT_INSERT:
+        success = insertLine(metadata, op->line, op->text);
+        break;
+      case EDIT_DELETE:
+        success = removeLine(metadata, op->line);
+        break;
+      default:
+        success = replaceLine(metadata, op->line, op->text);
+        break;
+    }
+  }
+
+  return success;
+}
+
+/* Free a batch and everything it holds */
+void freeEditBatch(struct EditBatch *batch) {
+  if (batch) DeletePool(batch->pool);
+}
@@ -0,0 +1,46 @@
+#ifndef BATCHEDIT_H
+#define BATCHEDIT_H
+
+/* Forward declarations */
+struct FileMetadata;
+
+/* Kinds of edit; deletes and replaces sort ahead of inserts on a line */
+#define EDIT_DELETE  0
+#define EDIT_REPLACE 1
+#define EDIT_INSERT  2
+
+/* One operation from an edit script */
+struct EditOp {
+  ULONG line;            /* Line number in the original file */
+  ULONG source;          /* Line of the edit script it came from */
+  UBYTE kind;            /* EDIT_DELETE, EDIT_REPLACE or EDIT_INSERT */
+  char *text;            /* New text for inserts and replaces */
+};
+
+/*
+ * An edit script holds one operation per line:
+ *
+ *   INSERT n text    insert text before original line n (n may be one past
+ *                    the last line to append)
+ *   DELETE n         delete original line n
+ *   REPLACE n text   replace original line n with text
+ *
+ * The text is everything after the single space that follows n. Blank
+ * lines and lines starting with ; are ignored.
+ *
+ * Every n refers to the file as it was loaded, so edits never shift each
+ * other. Several inserts at the same n keep their script order; a line can
+ * be deleted or replaced only once.
+ */
+struct EditBatch {
+  APTR pool;             /* Memory pool owning the batch */
+  char name[MAX_PATH_LEN]; /* Edit script the batch was read from */
+  struct EditOp *ops;    /* Operations in script order until applied */
+  ULONG count;           /* Number of operations */
+};
+
+struct EditBatch *loadEditBatch(const char *filename);
+BOOL applyEditBatch(struct FileMetadata *metadata, struct EditBatch *batch);
+void freeEditBatch(struct EditBatch *batch);
+
+#endif
@@ -0,0 +1,355 @@
+/* bytescan.c */
+#include "fileutils.h"
+
+#if defined(SIMD_AVX2)
+#include <immintrin.h>
+#define VECTOR_SIZE 32
+#define ALL_LANES 0xFFFFFFFFu
+#elif defined(SIMD_SSE2)
+#include <emmintrin.h>
+#define VECTOR_SIZE 16
+#define ALL_LANES 0xFFFFu
+#endif
+
+#define MIN_BOUNDS 64
+
+/* Word-at-a-time helpers, valid for any width of ULONG */
+#define WORD_SIZE sizeof(ULONG)
+#define WORD_ONES (~(ULONG)0 / 255)
+#define WORD_LOWS (WORD_ONES * 127)
+#define WORD_HIGHS (WORD_ONES * 128)
+
+/* High bit set in exactly the bytes below 32, and the bytes that are zero */
+#define LOW_BYTES(w) (~((((w) & WORD_LOWS) + WORD_ONES * 96) | (w)) & WORD_HIGHS)
+#define ZERO_BYTES(w) (~((((w) & WORD_LOWS) + WORD_LOWS) | (w)) & WORD_HIGHS)
+
+/* Nonzero if the word holds a byte below 32 other than TAB */
+#define HAS_CONTROL(w) (LOW_BYTES(w) & ~ZERO_BYTES((w) ^ (WORD_ONES * '\t')))
+
+#ifdef VECTOR_SIZE
+/* One bit per byte of a vector */
+struct VectorMasks {
+  unsigned int ends;        /* CR and LF */
+  unsigned int controls;    /* Other bytes below 32 except TAB */
+  unsigned int blankless;   /* Anything but space and TAB */
+};
+#endif
+
+/* Close the current line with a bound, doubling the table when it is full */
+static BOOL addBound(APTR pool, struct ByteScan *scan, ULONG end,
+                     UBYTE ending) {
+  struct LineBound *grown;
+  struct LineBound *bound;
+  ULONG capacity;
+
+  if (scan->lineCount == scan->capacity) {
+    capacity = scan->capacity * 2;
+    if (capacity < MIN_BOUNDS) capacity = MIN_BOUNDS;
+
+    grown = AllocPooled(pool, capacity * sizeof(struct LineBound));
+    if (!grown) return FALSE;
+
+    if (scan->bounds) {
+      memcpy(grown, scan->bounds, scan->lineCount * sizeof(struct LineBound));
+      FreePooled(pool, scan->bounds, scan->capacity * sizeof(struct LineBound));
+    }
+
+    scan->bounds = grown;
+    scan->capacity = capacity;
+  }
+
+  bound = &scan->bounds[scan->lineCount++];
+  bound->end = end;
+  bound->ending = ending;
+  bound->type = scan->typing ? LINE_EMPTY : scan->lineType;
+
+  scan->endings[ending]++;
+  scan->typing = TRUE;
+  return TRUE;
+}
+
+/* Style of the terminator at data[i], which is a CR or LF */
+static UBYTE endingAt(const char *data, ULONG size, ULONG i) {
+  if (data[i] == '\n') return EOL_LF;
+  return (i + 1 < size && data[i + 1] == '\n') ? EOL_CRLF : EOL_CR;
+}
+
+/* Classify one byte the same way parseLine() and isTextFile() always have */
+static BOOL scanByte(APTR pool, const char *data, ULONG size, ULONG i,
+                     struct ByteScan *scan) {
+  unsigned char c;
+
+  c = data[i];
+  if (c > ' ') {
+    if (scan->typing) {
+      scan->lineType = scan->classifier->firstByte[c];
+      scan->typing = FALSE;
+    }
+    return TRUE;
+  }
+
+  if (c == ' ' || c == '\t') return TRUE;
+
+  if (c == '\n' || c == '\r') {
+    if (!pool) return TRUE;
+
+    /* The LF of a CRLF belongs to the line the CR ended */
+    if (c == '\n' && i > 0 && data[i - 1] == '\r') return TRUE;
+    return addBound(pool, scan, i, endingAt(data, size, i));
+  }
+
+  /* Any other control character counts against the file being text */
+  if (scan->typing) {
+    scan->lineType = scan->classifier->firstByte[c];
+    scan->typing = FALSE;
+  }
+
+  scan->nonPrintable++;
+  return TRUE;
+}
+
+#ifdef VECTOR_SIZE
+/*
+ * Classify one vector of input. Unless force is set, returns FALSE without
+ * filling in the masks when no byte is below 32, which is most vectors of
+ * a text file.
+ */
+static BOOL classifyVector(const char *p, BOOL force,
+                           struct VectorMasks *masks) {
+#if defined(SIMD_AVX2)
+  __m256i v;
+  __m256i low;
+  __m256i ends;
+  __m256i tabs;
+  __m256i blanks;
+
+  v = _mm256_loadu_si256((const __m256i *)p);
+  low = _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(31)),
+                          _mm256_set1_epi8(31));
+  if (!force && !_mm256_movemask_epi8(low)) return FALSE;
+
+  ends = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                         _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+  tabs = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'));
+  blanks = _mm256_or_si256(tabs, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+
+  masks->ends = (unsigned int)_mm256_movemask_epi8(ends);
+  masks->controls = (unsigned int)_mm256_movemask_epi8(
+    _mm256_andnot_si256(_mm256_or_si256(ends, tabs), low));
+  masks->blankless = ~(unsigned int)_mm256_movemask_epi8(blanks) & ALL_LANES;
+#else
+  __m128i v;
+  __m128i low;
+  __m128i ends;
+  __m128i tabs;
+  __m128i blanks;
+
+  v = _mm_loadu_si128((const __m128i *)p);
+  low = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(31)),
+                       _mm_set1_epi8(31));
+  if (!force && !_mm_movemask_epi8(low)) return FALSE;
+
+  ends = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                      _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+  tabs = _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'));
+  blanks = _mm_or_si128(tabs, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+
+  masks->ends = (unsigned int)_mm_movemask_epi8(ends);
+  masks->controls = (unsigned int)_mm_movemask_epi8(
+    _mm_andnot_si128(_mm_or_si128(ends, tabs), low));
+  masks->blankless = ~(unsigned int)_mm_movemask_epi8(blanks) & ALL_LANES;
+#endif
+  return TRUE;
+}
+
+/* Type the current line by its first non-blank in lanes from..to-1 of p */
+static void typeLine(struct ByteScan *scan, const char *p,
+                     const struct VectorMasks *masks,
+                     unsigned int from, unsigned int to) {
+  unsigned int found;
+  unsigned int first;
+
+  found = (masks->blankless >> from) << from;
+  if (to < VECTOR_SIZE) found &= (1u << to) - 1;
+  if (!found) return;
+
+  first = __builtin_ctz(found);
+  scan->lineType = scan->classifier->firstByte[(UBYTE)p[first]];
+  scan->typing = FALSE;
+}
+#endif
+
+/*
+ * Scan a buffer for lines and non-printable bytes together, giving up once
+ * more than threshold non-printable bytes have been seen
+ */
+static BOOL scanBytes(APTR pool, const char *data, ULONG size,
+                      ULONG threshold,
+                      const struct LineClassifier *classifier,
+                      struct ByteScan *scan) {
+  ULONG i;
+#ifdef VECTOR_SIZE
+  struct VectorMasks masks;
+  unsigned int startBit;
+  unsigned int carry;
+  unsigned int bit;
+  UBYTE ending;
+  ULONG pos;
+#else
+  ULONG word;
+  ULONG j;
+#endif
+
+  memset(scan, 0, sizeof(struct ByteScan));
+  i = 0;
+
+  /* Only lines that are recorded need typing */
+  scan->classifier = classifier;
+  scan->typing = (BOOL)(pool != NULL);
+
+#ifdef VECTOR_SIZE
+  /* startBit is where the current line starts within the vector */
+  carry = 0;
+
+  for (; i + VECTOR_SIZE <= size; i += VECTOR_SIZE) {
+    startBit = carry;
+    carry = 0;
+
+    if (!classifyVector(data + i, scan->typing, &masks)) continue;
+
+    if (masks.controls) {
+      scan->nonPrintable += __builtin_popcount(masks.controls);
+      if (scan->nonPrintable > threshold) break;
+    }
+
+    if (!pool) continue;
+
+    for (; masks.ends; masks.ends &= masks.ends - 1) {
+      bit = __builtin_ctz(masks.ends);
+      pos = i + bit;
+      if (data[pos] == '\n' && pos > 0 && data[pos - 1] == '\r') continue;
+
+      if (scan->typing) typeLine(scan, data + i, &masks, startBit, bit);
+
+      ending = endingAt(data, size, pos);
+      if (!addBound(pool, scan, pos, ending)) return FALSE;
+      startBit = bit + ENDING_LENGTH(ending);
+    }
+
+    /* The line that runs on into the next vector */
+    if (scan->typing) {
+      if (startBit < VECTOR_SIZE) {
+        typeLine(scan, data + i, &masks, startBit, VECTOR_SIZE);
+      } else {
+        carry = startBit - VECTOR_SIZE;
+      }
+    }
+  }
+#else
+  /* Bytes up to the first word boundary */
+  for (; i < size && ((ULONG)(data + i) & (WORD_SIZE - 1)); i++) {
+    if (!scanByte(pool, data, size, i, scan)) return FALSE;
+  }
+
+  /*
+   * Whole words; only those holding a control character, or the start of
+   * a line not yet typed, are looked into
+   */
+  for (; i + WORD_SIZE <= size; i += WORD_SIZE) {
+    word = *(const ULONG *)(data + i);
+    if (!scan->typing && !HAS_CONTROL(word)) continue;
+
+    for (j = 0; j < WORD_SIZE; j++) {
+      if (!scanByte(pool, data, size, i + j, scan)) return FALSE;
+    }
+    if (scan->nonPrintable > threshold) break;
+  }
+#endif
+
+  /* Trailing bytes */
+  if (scan->nonPrintable <= threshold) {
+    for (; i < size; i++) {
+      if (!scanByte(pool, data, size, i, scan)) return FALSE;
+    }
+  }
+
+  scan->isBinary = (BOOL)(scan->nonPrintable > threshold);
+  if (!pool || scan->isBinary) return TRUE;
+
+  /* Trailing text without a newline is a line too */
+  if (size && data[size - 1] != '\n' && data[size - 1] != '\r') {
+    return addBound(pool, scan, size, EOL_NONE);
+  }
+
+  return TRUE;
+}
+
+/* Scan a buffer for lines and non-printable bytes together */
+BOOL scanFileData(APTR pool, const char *data, ULONG size,
+                  const struct LineClassifier *classifier,
+                  struct ByteScan *scan) {
+  return scanBytes(pool, data, size, BINARY_THRESHOLD(size), classifier,
+                   scan);
+}
+
+/*
+ * Scan part of a file. It counts as binary once more than threshold
+ * non-printable bytes are seen, so the rest of the file can be allowed for.
+ */
+BOOL scanFileRange(APTR pool, const char *data, ULONG size, ULONG threshold,
+                   const struct LineClassifier *classifier,
+                   struct ByteScan *scan) {
+  return scanBytes(pool, data, size, threshold, classifier, scan);
+}
+
+/* Count every non-printable byte of a buffer */
+ULONG countNonPrintable(const char *data, ULONG size) {
+  struct ByteScan scan;
+
+  scanBytes(NULL, data, size, size, NULL, &scan);
+  return scan.nonPrintable;
+}
+
+/* Give the bounds back to the pool */
+void freeByteScan(APTR pool, struct ByteScan *scan) {
+  if (scan->bounds) {
+    FreePooled(pool, scan->bounds, scan->capacity * sizeof(struct LineBound));
+  }
+  scan->bounds = NULL;
+  scan->lineCount = 0;
+  scan->capacity = 0;
+}
+
+/* Find the first CR or LF at or after p, or end if there is none */
+const char *findLineEnd(const char *p, const char *end) {
+#ifdef VECTOR_SIZE
+  struct VectorMasks masks;
+#else
+  ULONG j;
+#endif
+
+#ifdef VECTOR_SIZE
+  for (; end - p >= VECTOR_SIZE; p += VECTOR_SIZE) {
+    if (classifyVector(p, FALSE, &masks) && masks.ends) {
+      return p + __builtin_ctz(masks.ends);
+    }
+  }
+#else
+  while (p < end && ((ULONG)p & (WORD_SIZE - 1))) {
+    if (*p == '\n' || *p == '\r') return p;
+    p++;
+  }
+
+  /* Only words holding a control character are looked into */
+  for (; (ULONG)(end - p) >= WORD_SIZE; p += WORD_SIZE) {
+    if (!HAS_CONTROL(*(const ULONG *)p)) continue;
+
+    for (j = 0; j < WORD_SIZE; j++) {
+      if (p[j] == '\n' || p[j] == '\r') return p + j;
+    }
+  }
+#endif
+
+  while (p < end && *p != '\n' && *p != '\r') p++;
+  return p;
+}
@@ -0,0 +1,53 @@
+#ifndef BYTESCAN_H
+#define BYTESCAN_H
+
+/* A file is binary when more than a tenth of its bytes are non-printable */
+#define BINARY_THRESHOLD(size) ((size) / 10)
+
+/* Where a line ends, how, and what kind of line it is */
+struct LineBound {
+  ULONG end;                /* Offset of the terminator or end of data */
+  UBYTE ending;             /* LineEnding of the line */
+  UBYTE type;               /* LineType of the line */
+};
+
+/*
+ * Result of one pass over a file buffer. Every line gets a bound, including
+ * trailing text without a terminator. A line's type is decided by its first
+ * character other than a space or TAB, as it is seen by the pass, so no
+ * byte is read twice.
+ *
+ * The pass stops as soon as the file is known to be binary, so the bounds
+ * and counts are only complete for text files.
+ */
+struct ByteScan {
+  struct LineBound *bounds; /* One entry per line */
+  ULONG lineCount;          /* Entries used in bounds */
+  ULONG capacity;           /* Entries allocated in bounds */
+  ULONG endings[4];         /* Lines seen with each LineEnding */
+  ULONG nonPrintable;       /* Control characters other than TAB, LF, CR */
+  BOOL isBinary;            /* Over BINARY_THRESHOLD non-printable bytes */
+  const struct LineClassifier *classifier;  /* Types the lines */
+  BOOL typing;              /* First non-blank of this line not seen yet */
+  UBYTE lineType;           /* Type of this line once typing is FALSE */
+};
+
+/*
+ * Scan a buffer for lines and non-printable bytes together. The bounds are
+ * allocated from pool and typed by classifier; with no pool only the
+ * non-printable count is taken, and classifier may be NULL. Returns FALSE
+ * if the bounds could not be allocated.
+ */
+BOOL scanFileData(APTR pool, const char *data, ULONG size,
+                  const struct LineClassifier *classifier,
+                  struct ByteScan *scan);
+BOOL scanFileRange(APTR pool, const char *data, ULONG size, ULONG threshold,
+                   const struct LineClassifier *classifier,
+                   struct ByteScan *scan);
+void freeByteScan(APTR pool, struct ByteScan *scan);
+ULONG countNonPrintable(const char *data, ULONG size);
+
+/* Find the first CR or LF at or after p, or end if there is none */
+const char *findLineEnd(const char *p, const char *end);
+
+#endif
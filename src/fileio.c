@@ -0,0 +1,255 @@
+/* fileio.c */
+#include "fileutils.h"
+
+#ifdef PLATFORM_POSIX
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Seconds between the Unix epoch and the AmigaDOS epoch (1 Jan 1978) */
+#define AMIGA_EPOCH_OFFSET 252460800L
+
+/* Translate host file attributes into AmigaDOS protection and date */
+static void copyFileAttributes(struct FileMetadata *metadata,
+                               const struct stat *st) {
+  ULONG protection;
+  ULONG seconds;
+
+  /* The RWED bits are set when the action is not allowed */
+  protection = 0;
+  if (!(st->st_mode & S_IRUSR)) protection |= FIBF_READ;
+  if (!(st->st_mode & S_IWUSR)) protection |= FIBF_WRITE | FIBF_DELETE;
+  if (!(st->st_mode & S_IXUSR)) protection |= FIBF_EXECUTE;
+  metadata->protection = protection;
+
+  seconds = 0;
+  if (st->st_mtime > AMIGA_EPOCH_OFFSET) {
+    seconds = st->st_mtime - AMIGA_EPOCH_OFFSET;
+  }
+  metadata->dateStamp.ds_Days = seconds / 86400;
+  metadata->dateStamp.ds_Minute = (seconds % 86400) / 60;
+  metadata->dateStamp.ds_Tick = (seconds % 60) * TICKS_PER_SECOND;
+}
+
+/* Map the file read-only; the kernel pages it in as it is touched */
+BOOL loadFileData(struct FileMetadata *metadata, const char *filename) {
+  struct FileMapping *mapping;
+  struct stat st;
+  void *address;
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) return FALSE;
+
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return FALSE;
+  }
+
+  metadata->fileSize = st.st_size;
+  copyFileAttributes(metadata, &st);
+
+  /* An empty file has nothing to map */
+  if (!metadata->fileSize) {
+    close(fd);
+    metadata->fileData = AllocPooled(metadata->pool, 1);
+    return (BOOL)(metadata->fileData != NULL);
+  }
+
+  mapping = AllocPooled(metadata->pool, sizeof(struct FileMapping));
+  if (!mapping) {
+    close(fd);
+    return FALSE;
+  }
+
+  /* The mapping stays valid after the descriptor is closed */
+  address = mmap(NULL, metadata->fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) return FALSE;
+
+  /* STATS counts the mapping as one read of the whole file */
+  COUNT_READ(metadata->fileSize);
+
+  /* Loading walks the file front to back */
+  posix_madvise(address, metadata->fileSize, POSIX_MADV_SEQUENTIAL);
+
+  mapping->address = address;
+  mapping->size = metadata->fileSize;
+  mapping->device = st.st_dev;
+  mapping->inode = st.st_ino;
+
+  metadata->mapping = mapping;
+  metadata->fileData = address;
+  return TRUE;
+}
+
+/* Unmap the file, so a file reloaded in place does not pile up mappings */
+void releaseFileData(struct FileMetadata *metadata) {
+  if (metadata->mapping) {
+    munmap(metadata->mapping->address, metadata->mapping->size);
+    FreePooled(metadata->pool, metadata->mapping, sizeof(struct FileMapping));
+    metadata->mapping = NULL;
+  } else if (metadata->fileData) {
+    FreePooled(metadata->pool, metadata->fileData, 1);
+  }
+  metadata->fileData = NULL;
+}
+
+/*
+ * Whether the loaded data stays as it was while the file at a path is
+ * changed. A mapping shows whatever is written into the file it maps, so
+ * it only stays if the path now names another file, as it does after a
+ * save that renames a new file into place.
+ */
+BOOL isFileDataStable(const struct FileMetadata *metadata, const char *path) {
+  struct stat st;
+
+  if (!metadata->mapping || stat(path, &st) < 0) return TRUE;
+
+  return (BOOL)!(st.st_dev == metadata->mapping->device &&
+                 st.st_ino == metadata->mapping->inode);
+}
+
+/* The one path that names a file, whatever links led to it */
+BOOL canonicalPath(const char *path, char *buffer) {
+  char *real;
+  BOOL success;
+
+  real = realpath(path, NULL);
+  if (!real) return FALSE;
+
+  success = (BOOL)(strlen(real) < MAX_PATH_LEN);
+  if (success) strcpy(buffer, real);
+  free(real);
+  return success;
+}
+
+BOOL readFileVersion(const char *path, struct FileVersion *version) {
+  struct FileMetadata stamp;
+  struct stat st;
+
+  if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) return FALSE;
+
+  /* The date as loadFileData() gives it */
+  copyFileAttributes(&stamp, &st);
+
+  version->size = st.st_size;
+  version->date = stamp.dateStamp;
+  version->device = st.st_dev;
+  version->inode = st.st_ino;
+  version->changeSeconds = st.st_ctim.tv_sec;
+  version->changeNanoseconds = st.st_ctim.tv_nsec;
+  return TRUE;
+}
+
+BOOL sameFileVersion(const struct FileVersion *a, const struct FileVersion *b) {
+  return (BOOL)(a->size == b->size &&
+                a->date.ds_Days == b->date.ds_Days &&
+                a->date.ds_Minute == b->date.ds_Minute &&
+                a->date.ds_Tick == b->date.ds_Tick &&
+                a->device == b->device && a->inode == b->inode &&
+                a->changeSeconds == b->changeSeconds &&
+                a->changeNanoseconds == b->changeNanoseconds);
+}
+
+#else
+
+/* Read the entire file into the metadata's pool */
+BOOL loadFileData(struct FileMetadata *metadata, const char *filename) {
+  struct FileInfoBlock *fib;
+  BPTR fh;
+  BOOL success;
+
+  success = FALSE;
+
+  /* Open the file */
+  fh = Open(filename, MODE_OLDFILE);
+  if (!fh) return FALSE;
+
+  /* Get file size */
+  Seek(fh, 0, OFFSET_END);
+  metadata->fileSize = Seek(fh, 0, OFFSET_BEGINNING);
+
+  /* Read entire file into memory */
+  metadata->fileData = AllocPooled(metadata->pool, metadata->fileSize + 1);
+  if (metadata->fileData) {
+    if (Read(fh, metadata->fileData, metadata->fileSize) == metadata->fileSize) {
+      success = TRUE;
+    }
+    COUNT_READ(metadata->fileSize);
+  }
+
+  /* Get file protection bits */
+  fib = AllocDosObject(DOS_FIB, NULL);
+  if (fib) {
+    if (ExamineFH(fh, fib)) {
+      metadata->protection = fib->fib_Protection;
+      metadata->dateStamp = fib->fib_Date;
+    }
+    FreeDosObject(DOS_FIB, fib);
+  }
+
+  Close(fh);
+  return success;
+}
+
+/* Give the data back to the pool, so a file reloaded in place does not grow it */
+void releaseFileData(struct FileMetadata *metadata) {
+  if (metadata->fileData) {
+    FreePooled(metadata->pool, metadata->fileData, metadata->fileSize + 1);
+    metadata->fileData = NULL;
+  }
+}
+
+/* The data is a copy in memory, which nothing written to the file touches */
+BOOL isFileDataStable(const struct FileMetadata *metadata, const char *path) {
+  return TRUE;
+}
+
+/* The full name of a file, starting from its volume */
+BOOL canonicalPath(const char *path, char *buffer) {
+  BPTR lock;
+  BOOL success;
+
+  lock = Lock((STRPTR)path, SHARED_LOCK);
+  if (!lock) return FALSE;
+
+  success = (BOOL)NameFromLock(lock, buffer, MAX_PATH_LEN);
+  UnLock(lock);
+  return success;
+}
+
+BOOL readFileVersion(const char *path, struct FileVersion *version) {
+  struct FileInfoBlock *fib;
+  BPTR lock;
+  BOOL success;
+
+  lock = Lock((STRPTR)path, SHARED_LOCK);
+  if (!lock) return FALSE;
+
+  success = FALSE;
+  fib = AllocDosObject(DOS_FIB, NULL);
+  if (fib) {
+    if (Examine(lock, fib) && fib->fib_DirEntryType < 0) {
+      version->size = fib->fib_Size;
+      version->date = fib->fib_Date;
+      success = TRUE;
+    }
+    FreeDosObject(DOS_FIB, fib);
+  }
+
+  UnLock(lock);
+  return success;
+}
+
+BOOL sameFileVersion(const struct FileVersion *a, const struct FileVersion *b) {
+  return (BOOL)(a->size == b->size &&
+                a->date.ds_Days == b->date.ds_Days &&
+                a->date.ds_Minute == b->date.ds_Minute &&
+                a->date.ds_Tick == b->date.ds_Tick);
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+/* Forward declarations */
+struct FileMetadata;
+
+/* A read-only view of a file mapped into memory (POSIX hosts only) */
+struct FileMapping {
+  APTR address;                     /* Start of the mapping */
+  ULONG size;                       /* Length of the mapping */
+  ULONG device;                     /* Device of the mapped file */
+  ULONG inode;                      /* Inode of the mapped file */
+};
+
+/*
+ * What a file was like when it was looked at, to tell whether it has been
+ * written to or replaced since. On AmigaOS that is the size and the date
+ * stamp, which counts ticks; POSIX hosts also compare the file itself and
+ * its change time, as the modification time can be set back, as SAVE
+ * does, and its seconds may not tell two writes apart.
+ */
+struct FileVersion {
+  ULONG size;
+  struct DateStamp date;
+#ifdef PLATFORM_POSIX
+  ULONG device;
+  ULONG inode;
+  ULONG changeSeconds;
+  ULONG changeNanoseconds;
+#endif
+};
+
+/*
+ * Loading of the raw file data behind analyzeFile(). On AmigaOS the file
+ * is read into the metadata's pool; POSIX hosts map it read-only instead,
+ * so pages come in on demand and nothing is copied. Either way fileData
+ * stays valid until releaseFileData() is called from freeFileMetadata().
+ * Saving over the source is safe: the saved file replaces it by rename,
+ * and the mapping keeps the old one alive until it is released.
+ */
+BOOL loadFileData(struct FileMetadata *metadata, const char *filename);
+void releaseFileData(struct FileMetadata *metadata);
+BOOL isFileDataStable(const struct FileMetadata *metadata, const char *path);
+
+/* Name a file by one path however it was reached; buffer holds MAX_PATH_LEN */
+BOOL canonicalPath(const char *path, char *buffer);
+
+BOOL readFileVersion(const char *path, struct FileVersion *version);
+BOOL sameFileVersion(const struct FileVersion *a, const struct FileVersion *b);
+
+#endif
@@ -0,0 +1,297 @@
+/* filelist.c */
+#include "fileutils.h"
+
+#define MIN_FILES 32          /* First allocation of a list's path table */
+#define MIN_ENTRIES 32        /* First allocation of a directory's entries */
+
+/* One entry of a directory being walked */
+struct DirEntry {
+  STRPTR path;                /* Path of the entry, allocated from the list */
+  BOOL isDirectory;           /* Whether the entry is a directory */
+};
+
+/* The entries read from one directory */
+struct DirEntries {
+  struct DirEntry *entries;   /* Entries in the order they were read */
+  ULONG count;                /* Entries used */
+  ULONG capacity;             /* Entries allocated */
+};
+
+/* Copy dir and name joined into a path allocated from the list */
+static STRPTR joinPath(struct FileList *list, const char *dir,
+                       const char *name) {
+  char buffer[MAX_PATH_LEN];
+  STRPTR path;
+
+  strncpy(buffer, dir, MAX_PATH_LEN - 1);
+  buffer[MAX_PATH_LEN - 1] = '\0';
+
+  if (!AddPart(buffer, name, MAX_PATH_LEN)) {
+    Printf("Path too long, skipping %s in %s\n", name, dir);
+    return NULL;
+  }
+
+  path = AllocPooled(list->pool, strlen(buffer) + 1);
+  if (path) strcpy(path, buffer);
+  return path;
+}
+
+/* Add an entry to the entries of a directory */
+static BOOL addEntry(struct FileList *list, struct DirEntries *dir,
+                     STRPTR path, BOOL isDirectory) {
+  struct DirEntry *grown;
+  ULONG capacity;
+
+  if (dir->count == dir->capacity) {
+    capacity = dir->capacity * 2;
+    if (capacity < MIN_ENTRIES) capacity = MIN_ENTRIES;
+
+    grown = AllocPooled(list->pool, capacity * sizeof(struct DirEntry));
+    if (!grown) return FALSE;
+
+    if (dir->entries) {
+      memcpy(grown, dir->entries, dir->count * sizeof(struct DirEntry));
+      FreePooled(list->pool, dir->entries,
+                 dir->capacity * sizeof(struct DirEntry));
+    }
+
+    dir->entries = grown;
+    dir->capacity = capacity;
+  }
+
+  dir->entries[dir->count].path = path;
+  dir->entries[dir->count].isDirectory = isDirectory;
+  dir->count++;
+  return TRUE;
+}
+
+#ifdef PLATFORM_POSIX
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+/* Check whether a name given on the command line is a directory */
+static BOOL isDirectory(const char *path) {
+  struct stat st;
+
+  return (BOOL)(stat(path, &st) == 0 && S_ISDIR(st.st_mode));
+}
+
+/* Read a directory with readdir(); links to files are followed */
+static BOOL readDirectory(struct FileList *list, const char *path,
+                          struct DirEntries *dir) {
+  struct dirent *entry;
+  struct stat st;
+  STRPTR entryPath;
+  DIR *handle;
+  BOOL success;
+
+  handle = opendir(path);
+  if (!handle) return FALSE;
+
+  success = TRUE;
+  while (success && (entry = readdir(handle))) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+
+    entryPath = joinPath(list, path, entry->d_name);
+    if (!entryPath || lstat(entryPath, &st) < 0) continue;
+
+    if (S_ISDIR(st.st_mode)) {
+      success = addEntry(list, dir, entryPath, TRUE);
+    } else if (S_ISREG(st.st_mode) ||
+               (S_ISLNK(st.st_mode) && stat(entryPath, &st) == 0 &&
+                S_ISREG(st.st_mode))) {
+      success = addEntry(list, dir, entryPath, FALSE);
+    }
+  }
+
+  closedir(handle);
+  return success;
+}
+
+#else
+
+#include <dos/exall.h>
+
+#define EXALL_BUFFER_SIZE 4096  /* Bytes of entries fetched per ExAll() */
+
+/* Check whether a name given on the command line is a directory */
+static BOOL isDirectory(const char *path) {
+  struct FileInfoBlock *fib;
+  BPTR lock;
+  BOOL directory;
+
+  directory = FALSE;
+
+  lock = Lock(path, ACCESS_READ);
+  if (!lock) return FALSE;
+
+  fib = AllocDosObject(DOS_FIB, NULL);
+  if (fib) {
+    if (Examine(lock, fib)) directory = (BOOL)(fib->fib_DirEntryType > 0);
+    FreeDosObject(DOS_FIB, fib);
+  }
+
+  UnLock(lock);
+  return directory;
+}
+
+/*
+ * Read a directory with ExAll(). Hard links to files count as files; soft
+ * links are skipped, as ED_TYPE cannot tell what they point to.
+ */
+static BOOL readDirectory(struct FileList *list, const char *path,
+                          struct DirEntries *dir) {
+  struct ExAllControl *control;
+  struct ExAllData *data;
+  STRPTR entryPath;
+  APTR buffer;
+  BPTR lock;
+  BOOL more;
+  BOOL success;
+
+  lock = Lock(path, ACCESS_READ);
+  if (!lock) return FALSE;
+
+  control = AllocDosObject(DOS_EXALLCONTROL, NULL);
+  buffer = AllocMem(EXALL_BUFFER_SIZE, MEMF_ANY);
+
+  success = (BOOL)(control && buffer);
+  if (success) {
+    control->eac_LastKey = 0;
+
+    do {
+      more = ExAll(lock, buffer, EXALL_BUFFER_SIZE, ED_TYPE, control);
+      if (!more && IoErr() != ERROR_NO_MORE_ENTRIES) success = FALSE;
+      if (!control->eac_Entries) continue;
+
+      for (data = buffer; data && success; data = data->ed_Next) {
+        if (data->ed_Type != ST_USERDIR && data->ed_Type != ST_FILE &&
+            data->ed_Type != ST_LINKFILE) {
+          continue;
+        }
+
+        entryPath = joinPath(list, path, data->ed_Name);
+        if (!entryPath) continue;
+
+        success = addEntry(list, dir, entryPath,
+                           (BOOL)(data->ed_Type == ST_USERDIR));
+      }
+
+      /* Stopping early has to tell the file system we are done */
+      if (!success && more) {
+        ExAllEnd(lock, buffer, EXALL_BUFFER_SIZE, ED_TYPE, control);
+        more = FALSE;
+      }
+    } while (more);
+  }
+
+  if (buffer) FreeMem(buffer, EXALL_BUFFER_SIZE);
+  if (control) FreeDosObject(DOS_EXALLCONTROL, control);
+  UnLock(lock);
+  return success;
+}
+
+#endif
+
+/* Add a path allocated from the list */
+static BOOL addPath(struct FileList *list, STRPTR path) {
+  STRPTR *grown;
+  ULONG capacity;
+
+  if (list->count == list->capacity) {
+    capacity = list->capacity * 2;
+    if (capacity < MIN_FILES) capacity = MIN_FILES;
+
+    grown = AllocPooled(list->pool, capacity * sizeof(STRPTR));
+    if (!grown) return FALSE;
+
+    if (list->paths) {
+      memcpy(grown, list->paths, list->count * sizeof(STRPTR));
+      FreePooled(list->pool, list->paths, list->capacity * sizeof(STRPTR));
+    }
+
+    list->paths = grown;
+    list->capacity = capacity;
+  }
+
+  list->paths[list->count++] = path;
+  return TRUE;
+}
+
+/* Order the entries of one directory by name */
+static int compareEntries(const void *a, const void *b) {
+  return strcmp(((const struct DirEntry *)a)->path,
+                ((const struct DirEntry *)b)->path);
+}
+
+/* Add the files of a directory, and with all those of its subdirectories */
+static BOOL walkDirectory(struct FileList *list, const char *path, BOOL all) {
+  struct DirEntries dir;
+  ULONG i;
+  BOOL success;
+
+  memset(&dir, 0, sizeof(struct DirEntries));
+
+  /* An unreadable directory is reported and the walk goes on */
+  if (!readDirectory(list, path, &dir)) {
+    Printf("Could not read directory %s\n", path);
+  }
+
+  qsort(dir.entries, dir.count, sizeof(struct DirEntry), compareEntries);
+
+  success = TRUE;
+  for (i = 0; i < dir.count && success; i++) {
+    if (!dir.entries[i].isDirectory) {
+      success = addPath(list, dir.entries[i].path);
+    } else if (all) {
+      success = walkDirectory(list, dir.entries[i].path, all);
+    }
+  }
+
+  if (dir.entries) {
+    FreePooled(list->pool, dir.entries, dir.capacity * sizeof(struct DirEntry));
+  }
+  return success;
+}
+
+/* Gather the files named, expanding directories */
+struct FileList *collectFiles(STRPTR *names, BOOL all) {
+  struct FileList *list;
+  APTR pool;
+  BOOL success;
+
+  pool = CreatePool(MEMF_CLEAR, POOL_PUDDLE_SIZE, POOL_THRESH_SIZE);
+  if (!pool) return NULL;
+
+  list = AllocPooled(pool, sizeof(struct FileList));
+  if (!list) {
+    DeletePool(pool);
+    return NULL;
+  }
+  list->pool = pool;
+
+  success = TRUE;
+  for (; *names && success; names++) {
+    if (isDirectory(*names)) {
+      list->expanded = TRUE;
+      success = walkDirectory(list, *names, all);
+    } else {
+      success = addPath(list, *names);
+    }
+  }
+
+  if (!success) {
+    freeFileList(list);
+    return NULL;
+  }
+  return list;
+}
+
+/* Free a list and all of its paths */
+void freeFileList(struct FileList *list) {
+  if (list) DeletePool(list->pool);
+}
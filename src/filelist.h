@@ -0,0 +1,24 @@
+#ifndef FILELIST_H
+#define FILELIST_H
+
+/*
+ * The files named by FILE/M, with directories expanded to the files they
+ * hold. With ALL, subdirectories are entered as well; links to directories
+ * are never followed, so a walk cannot loop. Entries of a directory are
+ * taken in name order, so a walk gives the same list every time.
+ *
+ * Names that cannot be examined are kept, so the error for them comes out
+ * in its place among the results.
+ */
+struct FileList {
+  APTR pool;                /* Memory pool owning the list and its paths */
+  STRPTR *paths;            /* Paths of the files, in walk order */
+  ULONG count;              /* Entries used in paths */
+  ULONG capacity;           /* Entries allocated in paths */
+  BOOL expanded;            /* Whether any name was a directory */
+};
+
+struct FileList *collectFiles(STRPTR *names, BOOL all);
+void freeFileList(struct FileList *list);
+
+#endif
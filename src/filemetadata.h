@@ -5,21 +5,34 @@
 
 /* Main structure for file metadata and content */
 struct FileMetadata {
+  APTR pool;                        /* Memory pool owning all of the below */
   char filename[MAX_FILENAME_LEN];  /* File name */
   char fullPath[MAX_PATH_LEN];      /* Full path */
   ULONG fileSize;                   /* Size in bytes */
   ULONG protection;                 /* AmigaDOS protection bits */
   BOOL isBinary;                    /* Binary or text flag */
+  FileType fileType;                /* What kind of file it is */
+  const struct LineClassifier *classifier;  /* Types its lines */
   char *fileData;                   /* Raw file data */
+  struct FileMapping *mapping;      /* Mapping behind fileData, if any */
   struct DateStamp dateStamp;       /* File date stamp */
 
   /* Text file specific data */
-  struct TextLine *lines;           /* Array of line structures */
+  struct TextLine *lines;           /* Gap buffer of line structures */
   ULONG lineCount;                  /* Number of lines */
+  ULONG lineCapacity;               /* Entries allocated in lines */
+  ULONG gapStart;                   /* Index of the first unused entry */
+  char *lineBuffer;                 /* Scratch for lineString() copies */
+  ULONG lineBufferSize;             /* Size of lineBuffer in bytes */
+  LineEnding lineEnding;            /* Most common newline, for new lines */
+  ULONG endingCounts[4];            /* Lines read with each LineEnding */
+  ULONG nonPrintable;               /* Control bytes in the data read */
+  ULONG editedLines;                /* Lines given text of their own */
 };
 
 /* File analysis functions */
 struct FileMetadata *analyzeFile(const char *filename);
+BOOL reanalyzeFile(struct FileMetadata *metadata, const char *filename);
 void freeFileMetadata(struct FileMetadata *metadata);
 BOOL isTextFile(const char *data, ULONG size);
 void printFileInfo(const struct FileMetadata *metadata);
@@ -1,8 +1,278 @@
-#include "filetype.h"
-#include "filemetadata.h"
-#include "linetype.h"
-#include "textline.h"
-
-FileTypeAnalyzer *ADOSShellScriptIdentifier(struct FileMetadata *metadata) {
-  
-}
\ No newline at end of file
+/* filetype.c */
+#include "fileutils.h"
+
+#define HUNK_HEADER "\000\000\003\363"  /* 0x000003F3 starts every executable */
+
+/*
+ * One known file type. The prefilter is cheap: a file is only shown to the
+ * analyzer if it starts with the magic bytes or, for types without magic,
+ * if it is text and has one of the extensions or starts with one of the
+ * lead bytes. A type with neither list is plausible for any text file.
+ */
+struct FileTypeEntry {
+  FileType type;
+  const char *magic;                /* Bytes the file starts with, or NULL */
+  ULONG magicLength;
+  const char *const *extensions;    /* Usual suffixes, or NULL */
+  const char *leadBytes;            /* Usual first non-blank bytes, or NULL */
+  FileTypeAnalyzer analyze;         /* Confirms the type, or NULL */
+};
+
+static const char *const typeNames[] = {
+  "Unknown",
+  "AmigaDOS script",
+  "Text",
+  "Binary",
+  "ARexx script",
+  "C source",
+  "Installer script",
+  "IFF file",
+  "Hunk executable"
+};
+
+static const char *const cExtensions[] = {
+  ".c", ".h", ".cc", ".cpp", ".cxx", ".hpp", NULL
+};
+static const char *const rexxExtensions[] = { ".rexx", ".rx", NULL };
+static const char *const installerExtensions[] = {
+  ".install", ".installer", NULL
+};
+
+/* Preprocessor directives only C opens a line with */
+static const char *const cDirectives[] = {
+  "include", "define", "ifdef", "ifndef", "if", "pragma", NULL
+};
+
+/* Installer functions hardly any other Lisp-like script calls */
+static const char *const installerCalls[] = {
+  "welcome", "copyfiles", "copylib", "startup", "askdir", "askchoice",
+  "askoptions", "askbool", "askfile", "makeassign", "complete", "working",
+  NULL
+};
+
+/* Commands a script is likely to start a line with */
+static const char *const scriptCommands[] = {
+  "addbuffers", "ask", "assign", "avail", "binddrivers", "cd", "copy",
+  "delete", "dir", "echo", "else", "endcli", "endif", "endshell", "endskip",
+  "execute", "failat", "getenv", "if", "info", "iprefs", "lab", "list",
+  "loadwb", "makedir", "makelink", "mount", "newcli", "newshell", "path",
+  "protect", "quit", "rename", "resident", "run", "set", "setenv",
+  "setpatch", "skip", "stack", "type", "unset", "unsetenv", "version",
+  "wait", "which", NULL
+};
+
+/* Names the system gives its own scripts */
+static const char *const scriptNames[] = {
+  "Startup-Sequence", "User-Startup", "Shell-Startup", "CLI-Startup", NULL
+};
+
+/* Whether a string is in a list, ignoring case */
+static BOOL inList(const char *string, const char *const *list) {
+  for (; *list; list++) {
+    if (stricmp(string, *list) == 0) return TRUE;
+  }
+  return FALSE;
+}
+
+/* Letters, digits and the marks that join words in command names */
+static BOOL isWordChar(UBYTE c) {
+  return (BOOL)(((c | 0x20) >= 'a' && (c | 0x20) <= 'z') ||
+                (c >= '0' && c <= '9') || c == '_' || c == '-');
+}
+
+/* First byte at or after p that is not a space, TAB, CR or LF */
+static const UBYTE *skipBlanks(const UBYTE *p, const UBYTE *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+    p++;
+  }
+  return p;
+}
+
+/* Start of the line after the one p is in */
+static const UBYTE *nextLine(const UBYTE *p, const UBYTE *end) {
+  while (p < end && *p != '\n' && *p != '\r') p++;
+  return p < end ? p + 1 : end;
+}
+
+/* Whether the text at p is a word from a list, followed by no more of it */
+static BOOL startsWithWord(const UBYTE *p, const UBYTE *end,
+                           const char *const *words) {
+  ULONG length;
+
+  for (; *words; words++) {
+    length = strlen(*words);
+    if ((ULONG)(end - p) >= length &&
+        strnicmp((const char *)p, *words, length) == 0 &&
+        ((ULONG)(end - p) == length || !isWordChar(p[length]))) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/* An IFF FORM names its type with four printable characters */
+static BOOL isIffForm(const struct FileSample *sample) {
+  ULONG i;
+
+  if (sample->size < 12 || sample->data[8] == ' ') return FALSE;
+
+  for (i = 8; i < 12; i++) {
+    if (sample->data[i] < 0x20 || sample->data[i] > 0x7E) return FALSE;
+  }
+  return TRUE;
+}
+
+/* C by name, or by a preprocessor directive at the start of a line */
+static BOOL isCSource(const struct FileSample *sample) {
+  const UBYTE *end;
+  const UBYTE *p;
+
+  if (sample->extension && inList(sample->extension, cExtensions)) {
+    return TRUE;
+  }
+
+  end = sample->data + sample->size;
+  for (p = sample->data; p < end; p = nextLine(p, end)) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    if (p == end || *p != '#') continue;
+
+    p = skipBlanks(p + 1, end);
+    if (startsWithWord(p, end, cDirectives)) return TRUE;
+  }
+  return FALSE;
+}
+
+/* ARexx only runs a script that opens with a comment */
+static BOOL isARexx(const struct FileSample *sample) {
+  const UBYTE *end;
+  const UBYTE *p;
+
+  if (sample->extension && inList(sample->extension, rexxExtensions)) {
+    return TRUE;
+  }
+
+  end = sample->data + sample->size;
+  p = skipBlanks(sample->data, end);
+  return (BOOL)(end - p >= 2 && p[0] == '/' && p[1] == '*');
+}
+
+/* A line opening with a call to an Installer function */
+static BOOL isInstaller(const struct FileSample *sample) {
+  const UBYTE *end;
+  const UBYTE *p;
+
+  end = sample->data + sample->size;
+  for (p = sample->data; p < end; p = nextLine(p, end)) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    if (p == end || *p != '(') continue;
+
+    p = skipBlanks(p + 1, end);
+    if (startsWithWord(p, end, installerCalls)) return TRUE;
+  }
+  return FALSE;
+}
+
+/*
+ * A script by name, by a dot directive such as .KEY opening it, or because
+ * at least half the lines other than comments start with a command
+ */
+static BOOL isADOSScript(const struct FileSample *sample) {
+  const UBYTE *end;
+  const UBYTE *p;
+  ULONG commands;
+  ULONG lines;
+
+  if (inList(sample->name, scriptNames)) return TRUE;
+
+  end = sample->data + sample->size;
+  p = skipBlanks(sample->data, end);
+  if (end - p >= 2 && p[0] == '.' && isWordChar(p[1])) return TRUE;
+
+  commands = 0;
+  lines = 0;
+  for (; p < end; p = nextLine(p, end)) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    if (p == end || *p == '\n' || *p == '\r' || *p == ';') continue;
+
+    /* Commands are often called by their full path */
+    if (end - p > 2 && (p[0] == 'c' || p[0] == 'C') && p[1] == ':') p += 2;
+
+    lines++;
+    if (startsWithWord(p, end, scriptCommands)) commands++;
+  }
+  return (BOOL)(commands && commands * 2 >= lines);
+}
+
+/* Most specific first; the first type confirmed is the one taken */
+static const struct FileTypeEntry fileTypes[] = {
+  { FILE_IFF, "FORM", 4, NULL, NULL, isIffForm },
+  { FILE_HUNK_EXE, HUNK_HEADER, 4, NULL, NULL, NULL },
+  { FILE_C_SOURCE, NULL, 0, cExtensions, "#/", isCSource },
+  { FILE_AREXX, NULL, 0, rexxExtensions, "/", isARexx },
+  { FILE_INSTALLER, NULL, 0, installerExtensions, "(;", isInstaller },
+  { FILE_ADOS_SCRIPT, NULL, 0, NULL, NULL, isADOSScript }
+};
+
+#define FILE_TYPE_COUNT (sizeof(fileTypes) / sizeof(fileTypes[0]))
+
+/* Whether a type is worth asking its analyzer about */
+static BOOL isPlausible(const struct FileTypeEntry *entry,
+                        const struct FileSample *sample, UBYTE lead) {
+  if (entry->magic) {
+    return (BOOL)(sample->size >= entry->magicLength &&
+                  memcmp(sample->data, entry->magic, entry->magicLength) == 0);
+  }
+
+  if (sample->isBinary) return FALSE;
+  if (!entry->extensions && !entry->leadBytes) return TRUE;
+
+  if (entry->extensions && sample->extension &&
+      inList(sample->extension, entry->extensions)) {
+    return TRUE;
+  }
+  return (BOOL)(entry->leadBytes && lead && strchr(entry->leadBytes, lead));
+}
+
+FileType detectFileType(const char *name, const char *data, ULONG size,
+                        BOOL isBinary) {
+  struct FileSample sample;
+  const UBYTE *lead;
+  ULONG i;
+
+  sample.name = name;
+  sample.extension = strrchr(name, '.');
+  sample.data = (const UBYTE *)data;
+  sample.size = size < FILETYPE_SAMPLE_SIZE ? size : FILETYPE_SAMPLE_SIZE;
+  sample.isBinary = isBinary;
+
+  lead = skipBlanks(sample.data, sample.data + sample.size);
+
+  for (i = 0; i < FILE_TYPE_COUNT; i++) {
+    if (!isPlausible(&fileTypes[i], &sample,
+                     lead < sample.data + sample.size ? *lead : 0)) {
+      continue;
+    }
+    if (!fileTypes[i].analyze || fileTypes[i].analyze(&sample)) {
+      return fileTypes[i].type;
+    }
+  }
+
+  return isBinary ? FILE_BINARY : FILE_TEXT;
+}
+
+const char *fileTypeName(FileType type) {
+  if ((ULONG)type >= sizeof(typeNames) / sizeof(typeNames[0])) {
+    return typeNames[FILE_UNKNOWN];
+  }
+  return typeNames[type];
+}
+
+/* The INFO line for a file's type, naming its kind when it has a known one */
+void printFileType(BOOL isBinary, FileType type) {
+  if (type == FILE_TEXT || type == FILE_BINARY || type == FILE_UNKNOWN) {
+    Printf("Type: %s\n", isBinary ? "Binary" : "Text");
+  } else {
+    Printf("Type: %s (%s)\n", isBinary ? "Binary" : "Text",
+           fileTypeName(type));
+  }
+}
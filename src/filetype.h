@@ -1,8 +1,8 @@
 #ifndef FILETYPE_H
 #define FILETYPE_H
 
-/** Forward declaration */
-struct FileMetadata;
+/** Bytes from the head of a file that file-type analyzers get to see */
+#define FILETYPE_SAMPLE_SIZE 2048
 
 /**
  * \brief The FileType struct provides some metadata around the type of file
@@ -14,16 +14,51 @@ struct FileMetadata;
  * - \c FILE_ADOS_SCRIPT an AmigaDOS Shell script
  * - \c FILE_TEXT a text document of undetermined type (non-binary)
  * - \c FILE_BINARY a file that contains binary, non-printable, characters
+ * - \c FILE_AREXX an ARexx script, which must open with a comment
+ * - \c FILE_C_SOURCE C or C++ source or header
+ * - \c FILE_INSTALLER a script for the Amiga Installer
+ * - \c FILE_IFF an IFF FORM, such as an ILBM picture or 8SVX sample
+ * - \c FILE_HUNK_EXE an AmigaOS executable in hunk format
  */
 typedef enum FileType {
   FILE_UNKNOWN,
   FILE_ADOS_SCRIPT,
   FILE_TEXT,
-  FILE_BINARY
+  FILE_BINARY,
+  FILE_AREXX,
+  FILE_C_SOURCE,
+  FILE_INSTALLER,
+  FILE_IFF,
+  FILE_HUNK_EXE
 } FileType;
 
-typedef FileType (*FileTypeAnalyzer)(struct FileMetadata *metadata);
+/**
+ * \brief What an analyzer is shown of a file: its name and no more than
+ * FILETYPE_SAMPLE_SIZE bytes from its start.
+ */
+struct FileSample {
+  const char *name;        /* File name without its path */
+  const char *extension;   /* Suffix of name from the last dot, or NULL */
+  const UBYTE *data;       /* Start of the file */
+  ULONG size;              /* Bytes in data */
+  BOOL isBinary;           /* Verdict on the whole file */
+};
 
-const FileTypeAnalyzer *ADOSShellScriptIdentifier;
+/**
+ * \brief A FileTypeAnalyzer confirms that a sample is of its type. It is
+ * only called once the registry's prefilter has found the file plausible,
+ * so it can look at the sample as closely as it needs.
+ */
+typedef BOOL (*FileTypeAnalyzer)(const struct FileSample *sample);
+
+/**
+ * \brief Work out the type of a file from its name and first bytes. Types
+ * with a magic number are tried on any file, the others on text only;
+ * text and binary files of no known type get FILE_TEXT and FILE_BINARY.
+ */
+FileType detectFileType(const char *name, const char *data, ULONG size,
+                        BOOL isBinary);
+const char *fileTypeName(FileType type);
+void printFileType(BOOL isBinary, FileType type);
 
-#endif
\ No newline at end of file
+#endif
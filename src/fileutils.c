@@ -1,442 +1,792 @@
 /* fileutils.c */
 #include "fileutils.h"
 
+#define COMPARE_BLOCK 256   /* Bytes compared at once between file versions */
+
+static BOOL indexFileData(struct FileMetadata *metadata);
+static BOOL buildLineIndex(struct FileMetadata *metadata,
+                           const struct ByteScan *scan);
+static void setLine(struct TextLine *line, ULONG lineNum, ULONG filePos,
+                    ULONG length, LineEnding ending);
+static void pickLineEnding(struct FileMetadata *metadata);
+static void setFileType(struct FileMetadata *metadata, BOOL isBinary);
+
 /* Analyze a file and create metadata structure */
 struct FileMetadata *analyzeFile(const char *filename) {
   struct FileMetadata *metadata;
-  struct FileInfoBlock *fib;
-  BPTR fh;
+  StatsPhase phase;
+  APTR pool;
   BOOL success;
-  char *lineStart;
-  ULONG lineNum;
-  ULONG filePos;
-  struct TextLine *currentLine;
-  struct TextLine *line;
 
-  success = FALSE;
-  metadata = AllocMem(sizeof(struct FileMetadata), MEMF_CLEAR);
-  if (!metadata) return NULL;
+  /* Everything belonging to the file is carved from one pool */
+  pool = CreatePool(MEMF_CLEAR, POOL_PUDDLE_SIZE, POOL_THRESH_SIZE);
+  if (!pool) return NULL;
+
+  metadata = AllocPooled(pool, sizeof(struct FileMetadata));
+  if (!metadata) {
+    DeletePool(pool);
+    return NULL;
+  }
+  metadata->pool = pool;
 
   /* Copy filename and get full path */
   strncpy(metadata->filename, FilePart(filename), MAX_FILENAME_LEN - 1);
   strncpy(metadata->fullPath, filename, MAX_PATH_LEN - 1);
 
-  /* Open the file */
-  fh = Open(filename, MODE_OLDFILE);
-  if (!fh) {
-    FreeMem(metadata, sizeof(struct FileMetadata));
+  /* Read or map the file contents */
+  ENTER_PHASE(PHASE_LOAD, phase);
+  success = loadFileData(metadata, filename);
+  LEAVE_PHASE(phase);
+  if (!success) {
+    freeFileMetadata(metadata);
+    return NULL;
+  }
+
+  ENTER_PHASE(PHASE_PARSE, phase);
+  success = indexFileData(metadata);
+  LEAVE_PHASE(phase);
+  if (!success) {
+    freeFileMetadata(metadata);
     return NULL;
   }
 
-  /* Get file size */
-  Seek(fh, 0, OFFSET_END);
-  metadata->fileSize = Seek(fh, 0, OFFSET_BEGINNING);
+  return metadata;
+}
+
+/* Judge the loaded data text or binary, and index the lines of text */
+static BOOL indexFileData(struct FileMetadata *metadata) {
+  struct LineCache *cache;
+  struct ByteScan scan;
+  DetectResult result;
+  StatsPhase phase;
+  BOOL success;
+
+  /* A cache of the same file from an earlier run saves the scan */
+  cache = openLineCache(metadata, &scan);
+  if (cache) {
+    metadata->isBinary = scan.isBinary;
+    setFileType(metadata, metadata->isBinary);
+    success = (BOOL)(metadata->isBinary || buildLineIndex(metadata, &scan));
+    closeLineCache(cache);
+    return success;
+  }
+
+  /* Large files that samples already show to be binary need no full scan */
+  ENTER_PHASE(PHASE_CLASSIFY, phase);
+  result = sampleFileData(metadata->fileData, metadata->fileSize,
+                          &detectPolicy);
+  LEAVE_PHASE(phase);
+  if (result == DETECT_BINARY) {
+    metadata->isBinary = TRUE;
+    setFileType(metadata, TRUE);
+    return TRUE;
+  }
+
+  /* Lines are typed as they are found, so the type is settled first */
+  setFileType(metadata, FALSE);
+
+  /*
+   * One pass over the data judges text or binary and finds where every
+   * line ends, how, and what type it is
+   */
+  if (!scanFileData(metadata->pool, metadata->fileData, metadata->fileSize,
+                    metadata->classifier, &scan)) {
+    return FALSE;
+  }
+  metadata->isBinary = scan.isBinary;
+  if (metadata->isBinary) setFileType(metadata, TRUE);
+
+  /* If text file, index lines in place */
+  success = (BOOL)(metadata->isBinary || buildLineIndex(metadata, &scan));
+  if (success && lineCacheDir) {
+    ENTER_PHASE(PHASE_SAVE, phase);
+    writeLineCache(metadata, &scan);
+    LEAVE_PHASE(phase);
+  }
+  freeByteScan(metadata->pool, &scan);
+  return success;
+}
+
+/* The data a file is indexed against, while another version is loaded */
+struct FileData {
+  char *fileData;
+  struct FileMapping *mapping;
+  ULONG fileSize;
+};
+
+/* Trade the loaded data for the data held aside */
+static void swapFileData(struct FileMetadata *metadata,
+                         struct FileData *data) {
+  struct FileData held;
+
+  held = *data;
+  data->fileData = metadata->fileData;
+  data->mapping = metadata->mapping;
+  data->fileSize = metadata->fileSize;
+  metadata->fileData = held.fileData;
+  metadata->mapping = held.mapping;
+  metadata->fileSize = held.fileSize;
+}
+
+/* Length of the bytes two buffers start with in common */
+static ULONG commonPrefix(const char *a, const char *b, ULONG size) {
+  ULONG i;
+
+  /* Whole blocks go through memcmp(), which is far faster than a loop */
+  for (i = 0; i + COMPARE_BLOCK <= size; i += COMPARE_BLOCK) {
+    if (memcmp(a + i, b + i, COMPARE_BLOCK)) break;
+  }
+  while (i < size && a[i] == b[i]) i++;
+  return i;
+}
+
+/* Length of the bytes two buffers end with in common; both end at a, b */
+static ULONG commonSuffix(const char *a, const char *b, ULONG size) {
+  ULONG i;
+
+  for (i = 0; i + COMPARE_BLOCK <= size; i += COMPARE_BLOCK) {
+    if (memcmp(a - i - COMPARE_BLOCK, b - i - COMPARE_BLOCK, COMPARE_BLOCK)) {
+      break;
+    }
+  }
+  while (i < size && a[-(LONG)i - 1] == b[-(LONG)i - 1]) i++;
+  return i;
+}
 
-  /* Read entire file into memory */
-  metadata->fileData = AllocMem(metadata->fileSize + 1, MEMF_CLEAR);
-  if (metadata->fileData) {
-    if (Read(fh, metadata->fileData, metadata->fileSize) == metadata->fileSize) {
-      success = TRUE;
+/* Count the terminators of whole lines in a range, as a scan would */
+static void countEndings(const char *data, const char *end, ULONG *counts) {
+  const char *p;
+
+  for (p = data; p < end; p++) {
+    p = findLineEnd(p, end);
+    if (p == end) {
+      counts[EOL_NONE]++;
+    } else if (*p == '\n') {
+      counts[EOL_LF]++;
+    } else if (p + 1 < end && p[1] == '\n') {
+      counts[EOL_CRLF]++;
+      p++;
+    } else {
+      counts[EOL_CR]++;
     }
   }
+}
+
+/* Whether a new line starts at an offset of the data */
+static BOOL isLineStart(const char *data, ULONG size, ULONG pos) {
+  if (pos == 0 || data[pos - 1] == '\n') return TRUE;
+  return (BOOL)(data[pos - 1] == '\r' && (pos == size || data[pos] != '\n'));
+}
 
-  /* Get file protection bits */
-  fib = AllocDosObject(DOS_FIB, NULL);
-  if (fib) {
-    if (ExamineFH(fh, fib)) {
-      metadata->protection = fib->fib_Protection;
-      metadata->dateStamp = fib->fib_Date;
+/*
+ * Bring the index up to date with new data, given the data it was built
+ * from. Lines at either end that lie in bytes both versions share are
+ * kept as they are; only the lines in between are scanned again. Lines
+ * kept at the end are moved by the difference in size. Returns FALSE
+ * when the index has to be built again from scratch instead.
+ */
+static BOOL updateLineIndex(struct FileMetadata *metadata,
+                            const struct FileData *old) {
+  const char *data;
+  struct TextLine *line;
+  struct ByteScan scan;
+  ULONG oldCounts[4];
+  ULONG size;
+  ULONG prefix;
+  ULONG suffix;
+  ULONG front;
+  ULONG back;
+  ULONG start;
+  ULONG end;
+  ULONG oldEnd;
+  ULONG oldNonPrintable;
+  ULONG filePos;
+  ULONG longest;
+  ULONG i;
+
+  data = metadata->fileData;
+  size = metadata->fileSize;
+
+  prefix = commonPrefix(old->fileData, data,
+                        old->fileSize < size ? old->fileSize : size);
+  suffix = commonSuffix(old->fileData + old->fileSize, data + size,
+                        (old->fileSize < size ? old->fileSize : size) -
+                        prefix);
+
+  /*
+   * Lines kept at the front must lie wholly in the shared prefix. A CR or
+   * the end of the data only ends a line the same way if the byte after it
+   * is shared as well, or both versions end there.
+   */
+  start = 0;
+  for (front = 0; front < metadata->lineCount; front++) {
+    line = getLine(metadata, front + 1);
+    end = start + line->rawLength;
+    if (line->content || line->filePosition != start || end > prefix) break;
+    if (end == prefix && end < size &&
+        (line->ending == EOL_CR || line->ending == EOL_NONE)) {
+      break;
     }
-    FreeDosObject(DOS_FIB, fib);
+    start = end;
   }
 
-  Close(fh);
+  /* Lines kept at the back must lie wholly in the shared suffix */
+  oldEnd = old->fileSize;
+  for (back = 0; front + back < metadata->lineCount; back++) {
+    line = getLine(metadata, metadata->lineCount - back);
+    if (line->content || line->filePosition + line->rawLength != oldEnd ||
+        line->filePosition < old->fileSize - suffix) {
+      break;
+    }
+    oldEnd = line->filePosition;
+  }
 
+  /*
+   * The first of them must still start a line in the new data; if it does
+   * not, the one after it does, since the byte before that is shared
+   */
+  end = size;
+  while (back) {
+    line = getLine(metadata, metadata->lineCount - back + 1);
+    end = line->filePosition + size - old->fileSize;
+    if (isLineStart(data, size, end)) break;
+
+    oldEnd = line->filePosition + line->rawLength;
+    end = size;
+    back--;
+  }
+  if (!back) oldEnd = old->fileSize;
+
+  /* Take the lines dropped out of the totals, then scan what replaces them */
+  oldNonPrintable = countNonPrintable(old->fileData + start, oldEnd - start);
+  if (metadata->nonPrintable - oldNonPrintable > BINARY_THRESHOLD(size)) {
+    return FALSE;
+  }
+
+  if (!scanFileRange(metadata->pool, data + start, end - start,
+                     BINARY_THRESHOLD(size) -
+                     (metadata->nonPrintable - oldNonPrintable),
+                     metadata->classifier, &scan)) {
+    return FALSE;
+  }
+  if (scan.isBinary) {
+    freeByteScan(metadata->pool, &scan);
+    return FALSE;
+  }
+
+  line = replaceLineRange(metadata, front + 1,
+                          metadata->lineCount - front - back, scan.lineCount);
+  if (!line) {
+    freeByteScan(metadata->pool, &scan);
+    return FALSE;
+  }
+
+  /* Bounds are offsets into the range scanned */
+  filePos = start;
+  longest = metadata->lineBufferSize - 1;
+  for (i = 0; i < scan.lineCount; i++, line++) {
+    setLine(line, front + i + 1, filePos,
+            start + scan.bounds[i].end - filePos, scan.bounds[i].ending);
+    line->type = scan.bounds[i].type;
+
+    if (line->length > longest) longest = line->length;
+    filePos += line->rawLength;
+  }
+
+  /* Kept lines at the back move with the end of the file */
+  for (i = metadata->lineCount - back + 1; i <= metadata->lineCount; i++) {
+    getLine(metadata, i)->filePosition += size - old->fileSize;
+  }
+
+  memset(oldCounts, 0, sizeof(oldCounts));
+  countEndings(old->fileData + start, old->fileData + oldEnd, oldCounts);
+  for (i = 0; i < 4; i++) {
+    metadata->endingCounts[i] += scan.endings[i] - oldCounts[i];
+  }
+  metadata->nonPrintable += scan.nonPrintable - oldNonPrintable;
+  pickLineEnding(metadata);
+  freeByteScan(metadata->pool, &scan);
+
+  /* The scratch buffer must hold the longest line */
+  if (longest + 1 > metadata->lineBufferSize) {
+    FreePooled(metadata->pool, metadata->lineBuffer,
+               metadata->lineBufferSize);
+    metadata->lineBufferSize = longest + 1;
+    metadata->lineBuffer = AllocPooled(metadata->pool,
+                                       metadata->lineBufferSize);
+    if (!metadata->lineBuffer) return FALSE;
+  }
+
+  return TRUE;
+}
+
+/*
+ * Bring the metadata of a file up to date with a new version of it, such
+ * as the same file after a change on disk. Only the lines in the range
+ * that changed are parsed again; the rest are kept, and any edits not
+ * saved are lost. On POSIX hosts that holds when the file was replaced,
+ * as editors and saveToFile() do; one written over in place is indexed
+ * from scratch, since its mapping already shows the new contents. If the
+ * new version cannot be read the metadata is left as it was; if it cannot
+ * be indexed the metadata is only fit for freeFileMetadata().
+ */
+BOOL reanalyzeFile(struct FileMetadata *metadata, const char *filename) {
+  const struct LineClassifier *classifier;
+  struct FileData old;
+  StatsPhase phase;
+  BOOL stable;
+  BOOL success;
+
+  if (!metadata || !filename) return FALSE;
+
+  /* A mapped file written over in place cannot be compared with itself */
+  stable = isFileDataStable(metadata, filename);
+
+  /* Load the new version with the old one held aside */
+  memset(&old, 0, sizeof(struct FileData));
+  swapFileData(metadata, &old);
+  ENTER_PHASE(PHASE_LOAD, phase);
+  success = loadFileData(metadata, filename);
+  LEAVE_PHASE(phase);
   if (!success) {
-    freeFileMetadata(metadata);
-    return NULL;
+    releaseFileData(metadata);
+    swapFileData(metadata, &old);
+    return FALSE;
   }
 
-  /* Determine if file is binary or text */
-  metadata->isBinary = !isTextFile(metadata->fileData, metadata->fileSize);
+  if (filename != metadata->fullPath) {
+    strncpy(metadata->filename, FilePart((STRPTR)filename),
+            MAX_FILENAME_LEN - 1);
+    strncpy(metadata->fullPath, filename, MAX_PATH_LEN - 1);
+  }
 
-  /* If text file, parse lines */
-  if (!metadata->isBinary) {
-    lineStart = metadata->fileData;
-    lineNum = 1;
-    filePos = 0;
-    currentLine = NULL;
-
-    while (lineStart < metadata->fileData + metadata->fileSize) {
-      line = parseLine(lineStart, lineNum, filePos);
-
-      if (!line) break;
-
-      /* Link the line into our list */
-      if (!metadata->lines) {
-        metadata->lines = line;
-      } else if (currentLine) {
-        currentLine->next = line;
-      }
-      currentLine = line;
-
-      filePos += line->rawLength;
-      lineStart += line->rawLength;
-      lineNum++;
-      metadata->lineCount++;
+  /* Lines kept were typed for the old type, so it must type them the same */
+  ENTER_PHASE(PHASE_PARSE, phase);
+  classifier = metadata->classifier;
+  setFileType(metadata, FALSE);
+
+  success = (BOOL)(stable && !metadata->isBinary && metadata->lines &&
+                   metadata->classifier == classifier &&
+                   updateLineIndex(metadata, &old));
+
+  /* Otherwise index the new version from scratch */
+  if (!success) {
+    freeLineIndex(metadata);
+    if (metadata->lineBuffer) {
+      FreePooled(metadata->pool, metadata->lineBuffer,
+                 metadata->lineBufferSize);
     }
+    metadata->lineBuffer = NULL;
+    metadata->lineBufferSize = 0;
+    metadata->isBinary = FALSE;
+    success = indexFileData(metadata);
   }
+  LEAVE_PHASE(phase);
 
-  return metadata;
+  /* Either way every line is a view of the new data again */
+  if (success) metadata->editedLines = 0;
+
+  /* The old version is no longer needed */
+  swapFileData(metadata, &old);
+  releaseFileData(metadata);
+  swapFileData(metadata, &old);
+  return success;
 }
 
 /* Determine if a file is text or binary */
 BOOL isTextFile(const char *data, ULONG size) {
-  ULONG i;
-  ULONG nonPrintable;
-  const ULONG threshold;
-  unsigned char c;
-
-  nonPrintable = 0;
-  threshold = size / 10;  /* 10% threshold for binary determination */
-
-  for (i = 0; i < size; i++) {
-    c = data[i];
-    if (c < 32 && c != '\n' && c != '\r' && c != '\t') {
-      nonPrintable++;
-      if (nonPrintable > threshold) return FALSE;
-    }
-  }
+  struct ByteScan scan;
 
-  return TRUE;
+  scanFileData(NULL, data, size, NULL, &scan);
+  return (BOOL)!scan.isBinary;
 }
 
-/* Parse a single line of text */
-struct TextLine *parseLine(const char *lineStart, ULONG lineNum, ULONG filePos) {
+/* Build the line index from the bounds found by the scan */
+static BOOL buildLineIndex(struct FileMetadata *metadata,
+                           const struct ByteScan *scan) {
+  const struct LineBound *bound;
+  struct TextLine *lines;
   struct TextLine *line;
-  const char *lineEnd;
-  ULONG len;
-  ULONG rawLen;
+  ULONG filePos;
+  ULONG longest;
+  ULONG i;
+
+  /* Leave some slack so the first few edits don't have to grow the index */
+  if (!allocLineIndex(metadata, scan->lineCount + scan->lineCount / 8)) {
+    return FALSE;
+  }
+
+  /* Every slot is taken at once and written once, gap left at the end */
+  lines = appendLineSlots(metadata, scan->lineCount);
+  if (!lines) return FALSE;
 
-  /* Find end of line */
-  lineEnd = lineStart;
-  while (*lineEnd && *lineEnd != '\n' && *lineEnd != '\r') lineEnd++;
+  filePos = 0;
+  longest = 0;
 
-  len = lineEnd - lineStart;
-  if (len > MAX_LINE_LEN) len = MAX_LINE_LEN;
+  for (i = 0; i < scan->lineCount; i++) {
+    bound = &scan->bounds[i];
+    line = &lines[i];
 
-  /* Calculate raw length including newline characters */
-  rawLen = len;
-  if (*lineEnd == '\r' && *(lineEnd + 1) == '\n') {
-    rawLen += 2;  /* CRLF */
-  } else if (*lineEnd == '\n' || *lineEnd == '\r') {
-    rawLen += 1;  /* LF or CR */
+    line->parent = metadata;
+    setLine(line, i + 1, filePos, bound->end - filePos, bound->ending);
+    line->type = bound->type;
+
+    if (line->length > longest) longest = line->length;
+    filePos += line->rawLength;
   }
 
-  line = AllocMem(sizeof(struct TextLine), MEMF_CLEAR);
-  if (!line) return NULL;
+  /* Totals are kept so reanalyzeFile() can update them */
+  memcpy(metadata->endingCounts, scan->endings, sizeof(scan->endings));
+  metadata->nonPrintable = scan->nonPrintable;
+  pickLineEnding(metadata);
 
-  line->content = AllocMem(len + 1, MEMF_CLEAR);
-  if (!line->content) {
-    FreeMem(line, sizeof(struct TextLine));
-    return NULL;
+  /* One scratch buffer serves every lineString() call on this file */
+  metadata->lineBufferSize = longest + 1;
+  metadata->lineBuffer = AllocPooled(metadata->pool, metadata->lineBufferSize);
+  return (BOOL)(metadata->lineBuffer != NULL);
+}
+
+/* Lines added later end the way most of the file does */
+static void pickLineEnding(struct FileMetadata *metadata) {
+  const ULONG *counts;
+
+  counts = metadata->endingCounts;
+  metadata->lineEnding = EOL_LF;
+  if (counts[EOL_CRLF] > counts[metadata->lineEnding]) {
+    metadata->lineEnding = EOL_CRLF;
+  }
+  if (counts[EOL_CR] > counts[metadata->lineEnding]) {
+    metadata->lineEnding = EOL_CR;
+  }
+}
+
+/* Settle what kind of file the loaded data is, and how its lines are typed */
+static void setFileType(struct FileMetadata *metadata, BOOL isBinary) {
+  StatsPhase phase;
+
+  ENTER_PHASE(PHASE_CLASSIFY, phase);
+  metadata->fileType = detectFileType(metadata->filename, metadata->fileData,
+                                      metadata->fileSize, isBinary);
+  metadata->classifier = selectLineClassifier(metadata->fileType);
+  LEAVE_PHASE(phase);
+}
+
+/* Parse a single line of text into an index entry */
+void parseLine(struct TextLine *line, const char *lineStart,
+               const char *dataEnd, ULONG lineNum, ULONG filePos) {
+  const char *lineEnd;
+  LineEnding ending;
+
+  lineEnd = findLineEnd(lineStart, dataEnd);
+
+  if (lineEnd == dataEnd) {
+    ending = EOL_NONE;
+  } else if (*lineEnd == '\n') {
+    ending = EOL_LF;
+  } else if (lineEnd + 1 < dataEnd && *(lineEnd + 1) == '\n') {
+    ending = EOL_CRLF;
+  } else {
+    ending = EOL_CR;
   }
 
-  /* Copy line content */
-  strncpy(line->content, lineStart, len);
-  line->content[len] = '\0';
+  setLine(line, lineNum, filePos, lineEnd - lineStart, ending);
+  line->type = classifyLine(line->parent->classifier, lineStart, line->length);
+}
 
+/* Fill in where an unmodified line lies in the file data */
+static void setLine(struct TextLine *line, ULONG lineNum, ULONG filePos,
+                    ULONG length, LineEnding ending) {
+  line->content = NULL;
   line->lineNumber = lineNum;
-  line->length = len;
+  line->length = length;
   line->filePosition = filePos;
-  line->rawLength = rawLen;
-  line->hasNewline = (*lineEnd == '\n' || *lineEnd == '\r');
+  line->rawLength = length + ENDING_LENGTH(ending);
+  line->hasNewline = (BOOL)(ending != EOL_NONE);
+  line->ending = ending;
+}
 
-  determineLineType(line);
+/* Point at the text of a line; not NUL terminated for unmodified lines */
+const char *lineText(const struct TextLine *line) {
+  if (line->content) return line->content;
+  return line->parent->fileData + line->filePosition;
+}
 
-  return line;
+/*
+ * Get a NUL terminated copy of a line. Unmodified lines are copied into the
+ * file's scratch buffer, so the result is only valid until the next call.
+ */
+STRPTR lineString(const struct TextLine *line) {
+  /* Streamed lines have their text but no parent */
+  if (line->content) return line->content;
+  return copyLineString(line, line->parent->lineBuffer);
 }
 
-/* Determine the type of a line (for script files) */
-void determineLineType(struct TextLine *line) {
-  char *trimmed;
+/*
+ * As lineString(), into a buffer of at least lineBufferSize bytes. Tasks
+ * reading one file at once each bring their own buffer.
+ */
+STRPTR copyLineString(const struct TextLine *line, char *buffer) {
+  if (line->content) return line->content;
 
-  trimmed = line->content;
-  /* Skip leading whitespace */
-  while (*trimmed && (*trimmed == ' ' || *trimmed == '\t')) trimmed++;
+  memcpy(buffer, line->parent->fileData + line->filePosition, line->length);
+  buffer[line->length] = '\0';
+  return buffer;
+}
 
-  if (!*trimmed) {
-    line->type = LINE_EMPTY;
-  } else if (*trimmed == ';') {
-    line->type = LINE_COMMENT;
-  } else {
-    line->type = LINE_COMMAND;
-  }
+/*
+ * Give a line its own copy of new content (copy-on-write). Replaced copies
+ * stay in the file's pool until the whole file is freed.
+ */
+BOOL setLineContent(struct TextLine *line, const char *content) {
+  char *copy;
+  ULONG len;
+
+  len = strlen(content);
+  copy = AllocPooled(line->parent->pool, len + 1);
+  if (!copy) return FALSE;
+
+  strcpy(copy, content);
+
+  /* Searches read unedited files straight from the data */
+  if (!line->content) line->parent->editedLines++;
+  line->content = copy;
+  line->length = len;
+  line->rawLength = len + ENDING_LENGTH(line->ending);
+  line->type = classifyLine(line->parent->classifier, copy, len);
+  return TRUE;
 }
 
 /* Free all allocated memory for file metadata */
 void freeFileMetadata(struct FileMetadata *metadata) {
-  struct TextLine *line;
-  struct TextLine *next;
-
   if (!metadata) return;
 
-  if (metadata->fileData) {
-    FreeMem(metadata->fileData, metadata->fileSize + 1);
-  }
+  releaseFileData(metadata);
 
-  if (metadata->lines) {
-    line = metadata->lines;
-    while (line) {
-      next = line->next;
-      if (line->content) FreeMem(line->content, strlen(line->content) + 1);
-      FreeMem(line, sizeof(struct TextLine));
-      line = next;
-    }
-  }
-
-  FreeMem(metadata, sizeof(struct FileMetadata));
+  /* The metadata itself lives in the pool, so this releases everything */
+  DeletePool(metadata->pool);
 }
 
 /* Print file information */
 void printFileInfo(const struct FileMetadata *metadata) {
-  struct TextLine *line;
+  ULONG i;
 
   if (!metadata) return;
 
   Printf("File: %s\n", metadata->filename);
   Printf("Path: %s\n", metadata->fullPath);
   Printf("Size: %ld bytes\n", metadata->fileSize);
-  Printf("Type: %s\n", metadata->isBinary ? "Binary" : "Text");
+  printFileType(metadata->isBinary, metadata->fileType);
 
   if (!metadata->isBinary) {
     Printf("Lines: %ld\n", metadata->lineCount);
 
-    line = metadata->lines;
-    while (line) {
-      Printf("%4ld (@%08lx): [%s] %s\n",
-        line->lineNumber,
-        line->filePosition,
-        line->type == LINE_EMPTY ? "EMPTY" :
-        line->type == LINE_COMMENT ? "COMMENT" :
-        line->type == LINE_COMMAND ? "COMMAND" : "UNKNOWN",
-        line->content);
-      line = line->next;
+    for (i = 1; i <= metadata->lineCount; i++) {
+      printLineInfo(getLine(metadata, i));
     }
   }
 }
 
-/* Wildcard pattern matching (supports * and ? wildcards) */
-BOOL wildcardMatch(const char *pattern, const char *text) {
-  while (*pattern != '\0' && *text != '\0') {
-    if (*pattern == '*') {
-      pattern++;
-      /* Skip multiple asterisks */
-      while (*pattern == '*') pattern++;
-
-      if (*pattern == '\0') return TRUE;
-
-      while (*text != '\0') {
-        if (wildcardMatch(pattern, text)) return TRUE;
-        text++;
-      }
-      return FALSE;
-    }
-    else if (*pattern == '?' || *pattern == *text) {
-      pattern++;
-      text++;
-    }
-    else return FALSE;
-  }
-
-  /* Skip remaining asterisks */
-  while (*pattern == '*') pattern++;
-
-  return (*pattern == '\0' && *text == '\0');
+/* Print one line as listed by INFO */
+void printLineInfo(const struct TextLine *line) {
+  Printf("%4ld (@%08lx): [%s] %s\n",
+    line->lineNumber,
+    line->filePosition,
+    line->type == LINE_EMPTY ? "EMPTY" :
+    line->type == LINE_COMMENT ? "COMMENT" :
+    line->type == LINE_COMMAND ? "COMMAND" : "UNKNOWN",
+    lineString(line));
 }
 
 /* Find first line matching a wildcard pattern */
 struct TextLine *findLineByPattern(const struct FileMetadata *metadata,
                                  const char *pattern, BOOL noCase) {
-  struct TextLine *line;
+  struct CompiledPattern *compiled;
+  StatsPhase phase;
+  ULONG lineNumber;
 
   if (!metadata || !pattern || metadata->isBinary) return NULL;
 
-  line = metadata->lines;
-  while (line) {
-    if (noCase ? MatchStringNoCase(pattern, line->content)
-               : MatchString(pattern, line->content)) {
-      return line;
-    }
-    line = line->next;
-  }
+  /* Parse the pattern once for the whole scan */
+  ENTER_PHASE(PHASE_MATCH, phase);
+  compiled = obtainPattern(pattern, noCase);
+  lineNumber = compiled ? findFirstMatch(metadata, compiled) : 0;
+  LEAVE_PHASE(phase);
+  if (lineNumber == SEARCH_FAILED) return NULL;
+  return lineNumber ? getLine(metadata, lineNumber) : NULL;
+}
 
-  return NULL;
+/*
+ * Count lines matching a wildcard pattern, or all lines without one.
+ * Returns SEARCH_FAILED when there is no memory to search with.
+ */
+ULONG countLinesByPattern(const struct FileMetadata *metadata,
+                          const char *pattern, BOOL noCase) {
+  struct CompiledPattern *compiled;
+  StatsPhase phase;
+  ULONG count;
+
+  if (!metadata || metadata->isBinary) return 0;
+  if (!pattern) return metadata->lineCount;
+
+  ENTER_PHASE(PHASE_MATCH, phase);
+  compiled = obtainPattern(pattern, noCase);
+  count = compiled ? countMatches(metadata, compiled) : 0;
+  LEAVE_PHASE(phase);
+  return count;
 }
 
 /* Insert a new line at the specified position (1-based) */
 BOOL insertLine(struct FileMetadata *metadata, ULONG position, const char *content) {
   struct TextLine *newLine;
-  struct TextLine *current;
-  struct TextLine *prev;
-  ULONG currentPos;
 
   if (!metadata || !content || metadata->isBinary || position < 1) return FALSE;
 
-  /* Create new line structure */
-  newLine = AllocMem(sizeof(struct TextLine), MEMF_CLEAR);
+  /* Position was beyond end of file */
+  if (position > metadata->lineCount + 1) return FALSE;
+
+  /* Open a slot for the new line; later lines renumber lazily */
+  newLine = insertLineSlot(metadata, position);
   if (!newLine) return FALSE;
 
-  newLine->content = AllocMem(strlen(content) + 1, MEMF_CLEAR);
-  if (!newLine->content) {
-    FreeMem(newLine, sizeof(struct TextLine));
+  if (!setLineContent(newLine, content)) {
+    removeLineSlot(metadata, position);
     return FALSE;
   }
 
-  strcpy(newLine->content, content);
-  newLine->length = strlen(content);
-  newLine->rawLength = newLine->length + 1; /* Assume single newline */
+  /* New lines end the way most of the file does */
+  newLine->ending = metadata->lineEnding ? metadata->lineEnding : EOL_LF;
+  newLine->rawLength = newLine->length + ENDING_LENGTH(newLine->ending);
   newLine->hasNewline = TRUE;
-  determineLineType(newLine);
-
-  /* Handle insertion at beginning */
-  if (position == 1) {
-    newLine->next = metadata->lines;
-    metadata->lines = newLine;
-    metadata->lineCount++;
-    return TRUE;
-  }
-
-  /* Find insertion point */
-  prev = NULL;
-  current = metadata->lines;
-  currentPos = 1;
-
-  while (current && currentPos < position) {
-    prev = current;
-    current = current->next;
-    currentPos++;
-  }
-
-  /* Insert the new line */
-  if (prev) {
-    prev->next = newLine;
-    newLine->next = current;
-    metadata->lineCount++;
-    return TRUE;
-  }
-
-  /* Position was beyond end of file */
-  FreeMem(newLine->content, strlen(content) + 1);
-  FreeMem(newLine, sizeof(struct TextLine));
-  return FALSE;
+  return TRUE;
 }
 
 /* Remove line by line number (1-based) */
 BOOL removeLine(struct FileMetadata *metadata, ULONG lineNumber) {
-  struct TextLine *current;
-  struct TextLine *prev;
-  ULONG currentPos;
-
   if (!metadata || metadata->isBinary || lineNumber < 1 ||
       lineNumber > metadata->lineCount) {
     return FALSE;
   }
 
-  prev = NULL;
-  current = metadata->lines;
-  currentPos = 1;
-
-  /* Find the line to remove */
-  while (current && currentPos < lineNumber) {
-    prev = current;
-    current = current->next;
-    currentPos++;
-  }
+  removeLineSlot(metadata, lineNumber);
+  return TRUE;
+}
 
-  if (!current) return FALSE;
+/* Replace the content of a line (1-based); only this line is copied */
+BOOL replaceLine(struct FileMetadata *metadata, ULONG lineNumber,
+                 const char *content) {
+  struct TextLine *line;
 
-  /* Remove the line */
-  if (prev) {
-    prev->next = current->next;
-  } else {
-    metadata->lines = current->next;
-  }
+  if (!metadata || !content || metadata->isBinary) return FALSE;
 
-  /* Free the removed line */
-  FreeMem(current->content, current->length + 1);
-  FreeMem(current, sizeof(struct TextLine));
+  line = getLine(metadata, lineNumber);
+  if (!line) return FALSE;
 
-  metadata->lineCount--;
-  return TRUE;
+  return setLineContent(line, content);
 }
 
 /* Remove first line matching pattern */
-BOOL removeLineByPattern(struct FileMetadata *metadata, const char *pattern) {
-  struct TextLine *current;
-  struct TextLine *prev;
-
-  if (!metadata || !pattern || metadata->isBinary) return FALSE;
-
-  prev = NULL;
-  current = metadata->lines;
-
-  while (current) {
-    if (wildcardMatch(pattern, current->content)) {
-      if (prev) {
-        prev->next = current->next;
-      } else {
-        metadata->lines = current->next;
-      }
-
-      FreeMem(current->content, current->length + 1);
-      FreeMem(current, sizeof(struct TextLine));
-      metadata->lineCount--;
-      return TRUE;
-    }
-    prev = current;
-    current = current->next;
-  }
+BOOL removeLineByPattern(struct FileMetadata *metadata, const char *pattern,
+                         BOOL noCase) {
+  struct TextLine *line;
 
-  return FALSE;
+  line = findLineByPattern(metadata, pattern, noCase);
+  if (!line) return FALSE;
+
+  return removeLine(metadata, line->lineNumber);
 }
 
-/* Save current state to a new file */
-BOOL saveToFile(const struct FileMetadata *metadata, const char *outputPath) {
-  BPTR file;
-  struct TextLine *line;
-  const char newline = '\n';
-  BOOL success;
+/* Remove every line matching a pattern in one sweep; returns how many */
+ULONG removeLinesByPattern(struct FileMetadata *metadata, const char *pattern,
+                           BOOL noCase) {
+  struct CompiledPattern *compiled;
+  struct LineMatches *matches;
+  StatsPhase phase;
+  ULONG removed;
+
+  if (!metadata || !pattern || metadata->isBinary) return 0;
+
+  ENTER_PHASE(PHASE_MATCH, phase);
+  compiled = obtainPattern(pattern, noCase);
+  matches = compiled ? findAllMatches(metadata, compiled) : NULL;
+  LEAVE_PHASE(phase);
+  if (!matches) return 0;
+
+  removed = matches->count ? removeLineSet(metadata, matches) : 0;
+  freeLineMatches(matches);
+  return removed;
+}
 
-  if (!metadata || !outputPath) return FALSE;
+/* Terminator bytes; EOL_CR and EOL_LF are the two halves of EOL_CRLF */
+static const char endingBytes[] = "\r\n";
 
-  success = TRUE;
-  file = Open(outputPath, MODE_NEWFILE);
-  if (!file) return FALSE;
+static const char *endingText(LineEnding ending) {
+  return ending == EOL_LF ? endingBytes + 1 : endingBytes;
+}
+
+/*
+ * Write the current state to a path. Every line keeps the terminator it
+ * was read with; one without any that is no longer last gets the file's
+ * usual one. Unmodified lines are saved straight from fileData with their
+ * terminators, so runs of them leave as single blocks. The path is only
+ * replaced once the whole file is safely written.
+ */
+static BOOL writeLines(const struct FileMetadata *metadata, const char *path,
+                       BOOL inPlace) {
+  struct SaveWriter *writer;
+  struct TextLine *line;
+  LineEnding ending;
+  ULONG i;
+
+  writer = openSaveWriter(path, inPlace ? metadata : NULL);
+  if (!writer) return FALSE;
 
   if (metadata->isBinary) {
-    /* Write binary data directly */
-    if (Write(file, metadata->fileData, metadata->fileSize) != metadata->fileSize) {
-      success = FALSE;
+    writeSpan(writer, metadata->fileData, metadata->fileSize);
+    return closeSaveWriter(writer);
+  }
+
+  for (i = 1; i <= metadata->lineCount; i++) {
+    line = getLine(metadata, i);
+
+    ending = line->ending;
+    if (ending == EOL_NONE && i < metadata->lineCount) {
+      ending = metadata->lineEnding ? metadata->lineEnding : EOL_LF;
     }
-  } else {
-    /* Write text data line by line */
-    line = metadata->lines;
-    while (line && success) {
-      if (Write(file, line->content, line->length) != line->length) {
-        success = FALSE;
-        break;
-      }
-
-      if (line->hasNewline && Write(file, &newline, 1) != 1) {
-        success = FALSE;
-        break;
-      }
-
-      line = line->next;
+
+    if (!line->content && ending == line->ending) {
+      writeSpan(writer, metadata->fileData + line->filePosition,
+                line->rawLength);
+    } else {
+      writeSpan(writer, lineText(line), line->length);
+      writeSpan(writer, endingText(ending), ENDING_LENGTH(ending));
     }
   }
 
-  Close(file);
+  return closeSaveWriter(writer);
+}
+
+/* Write the current state, timed as saving */
+static BOOL writeFile(const struct FileMetadata *metadata, const char *path,
+                      BOOL inPlace) {
+  StatsPhase phase;
+  BOOL success;
+
+  ENTER_PHASE(PHASE_SAVE, phase);
+  success = writeLines(metadata, path, inPlace);
+  LEAVE_PHASE(phase);
   return success;
 }
+
+/* Save current state to a file, which may be the one it was loaded from */
+BOOL saveToFile(const struct FileMetadata *metadata, const char *outputPath) {
+  if (!metadata || !outputPath) return FALSE;
+
+  return writeFile(metadata, outputPath, FALSE);
+}
+
+/* Save current state over the file it was loaded from, keeping its date */
+BOOL saveInPlace(const struct FileMetadata *metadata) {
+  if (!metadata) return FALSE;
+
+  return writeFile(metadata, metadata->fullPath, TRUE);
+}
@@ -2,38 +2,65 @@
 #ifndef FILEUTILS_H
 #define FILEUTILS_H
 
-#include <exec/types.h>
-#include <dos/dos.h>
-#include <proto/exec.h>
-#include <proto/dos.h>
+#include "platform.h"
+
 #include <string.h>
 #include <stdlib.h>
 
-#include <clib/alib_protos.h>
-#include <clib/exec_protos.h>
-#include <clib/dos_protos.h>
-
 #define MAX_FILENAME_LEN 108  /* AmigaDOS max filename length */
 #define MAX_PATH_LEN    256   /* Reasonable path length limit */
 #define MAX_LINE_LEN    1024  /* Maximum line length for text files */
 #define PATTERN_NOMATCH 0     /* Pattern does not match */
 #define PATTERN_MATCH   1     /* Pattern matches */
+#define POOL_PUDDLE_SIZE 8192 /* Puddle size for per-file memory pools */
+#define POOL_THRESH_SIZE 2048 /* Larger allocations get their own puddle */
 
-#include "linetype.h"
 #include "filetype.h"
+#include "linetype.h"
 #include "filemetadata.h"
 #include "textline.h"
+#include "lineindex.h"
+#include "bytescan.h"
+#include "textdetect.h"
+#include "linestream.h"
+#include "fileio.h"
+#include "patternutil.h"
+#include "patternset.h"
+#include "batchedit.h"
+#include "filelist.h"
+#include "workpool.h"
+#include "linesearch.h"
+#include "outstream.h"
+#include "savewriter.h"
+#include "linecache.h"
+#include "runstats.h"
+#include "server.h"
 
-/* Pattern matching and line manipulation functions */
+/* Line manipulation functions */
 
-BOOL wildcardMatch(const char *pattern, const char *text);
 BOOL insertLine(struct FileMetadata *metadata, ULONG position, const char *content);
 BOOL removeLine(struct FileMetadata *metadata, ULONG lineNumber);
+BOOL replaceLine(
+  struct FileMetadata *metadata,
+  ULONG lineNumber,
+  const char *content
+);
 BOOL removeLineByPattern(
   struct FileMetadata *metadata,
   const char *pattern,
   BOOL noCase
 );
+ULONG removeLinesByPattern(
+  struct FileMetadata *metadata,
+  const char *pattern,
+  BOOL noCase
+);
+ULONG countLinesByPattern(
+  const struct FileMetadata *metadata,
+  const char *pattern,
+  BOOL noCase
+);
 BOOL saveToFile(const struct FileMetadata *metadata, const char *outputPath);
+BOOL saveInPlace(const struct FileMetadata *metadata);
 
 #endif /* FILEUTILS_H */
@@ -0,0 +1,1719 @@
+/* hostdos.c */
+#include "fileutils.h"
+
+#ifdef PLATFORM_POSIX
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Seconds between the Unix epoch and the AmigaDOS epoch (1 Jan 1978) */
+#define AMIGA_EPOCH_OFFSET 252460800L
+
+/* IoErr() codes above this are a host errno */
+#define HOST_ERRNO_BASE 1000
+
+#define MAX_TEMPLATE_ITEMS 32
+
+/* Template item modifiers */
+#define ARGF_SWITCH   (1 << 0)    /* /S */
+#define ARGF_KEYWORD  (1 << 1)    /* /K */
+#define ARGF_NUMBER   (1 << 2)    /* /N */
+#define ARGF_REQUIRED (1 << 3)    /* /A */
+#define ARGF_MULTIPLE (1 << 4)    /* /M */
+
+/* First byte of a parsed pattern */
+#define PARSED_NOCASE (1 << 0)    /* Match without regard to case */
+#define PARSED_SIMPLE (1 << 1)    /* Only literals, '?' and "#?" */
+
+/* Operations of a compiled pattern */
+#define OP_CHAR  0                /* One character, c */
+#define OP_ANY   1                /* Any one character */
+#define OP_CLASS 2                /* One character of the [class] at item */
+#define OP_FAIL  3                /* Nothing */
+#define OP_SPLIT 4                /* Both next and alt */
+#define OP_NOT   5                /* Text the item at alt does not match */
+#define OP_MATCH 6                /* End of the pattern, or of a ~ item */
+
+#define MATCH_LOCAL_SIZE 4096     /* Patterns compiled on the stack */
+#define MATCH_CACHE_SIZE 8        /* Programs each thread keeps */
+#define MATCH_DFA_STATES 64       /* States a program keeps, then starts over */
+#define MATCH_UNKNOWN 0xFF        /* Transition not worked out yet */
+
+/* What a DFA state says about the text taken so far */
+#define MATCH_DEAD   (1 << 0)     /* No text after it can match */
+#define MATCH_ACCEPT (1 << 1)     /* It matches if the text ends here */
+#define MATCH_REST   (1 << 2)     /* It matches whatever follows */
+
+/* Secondary error of each thread, as each AmigaDOS process has its own */
+static __thread LONG ioError;
+
+static ULONG memAllocations;
+static ULONG memAllocated;
+static ULONG memInUse;
+static ULONG memPeak;
+
+static pthread_key_t matchCacheKey;
+static pthread_once_t matchCacheOnce = PTHREAD_ONCE_INIT;
+
+static int hostArgc;
+static char **hostArgv;
+
+/* Header in front of every pooled block; a multiple of 16 bytes on LP64 */
+struct PoolBlock {
+  struct PoolBlock *next;
+  struct PoolBlock *prev;
+  ULONG size;
+  ULONG pad;
+};
+
+/* A pool owns its blocks, so DeletePool() can free what is left */
+struct HostPool {
+  struct PoolBlock *blocks;
+  ULONG flags;
+};
+
+/* Memory ReadArgs() allocated, freed by FreeArgs() */
+struct ArgMemory {
+  struct ArgMemory *next;
+  LONG data[1];
+};
+
+struct RDArgs {
+  struct ArgMemory *memory;
+};
+
+/* A template item: its names, up to the first '/', and its modifiers */
+struct ArgItem {
+  const char *names;
+  ULONG namesLength;
+  ULONG modifiers;
+};
+
+/* One operation of a compiled pattern */
+struct PatternOp {
+  UBYTE type;                       /* OP_ kind */
+  char c;                           /* OP_CHAR: the character */
+  const char *item;                 /* OP_CLASS: the [class] */
+  const char *itemEnd;
+  LONG next;                        /* Operation after this one */
+  LONG alt;                         /* OP_SPLIT: other branch; OP_NOT: item */
+  LONG accept;                      /* OP_NOT: the OP_MATCH ending its item */
+  LONG negation;                    /* OP_NOT: which ~ of the pattern */
+};
+
+/* A state of an automaton: its operations, then each ~ item's states */
+struct MatchState {
+  ULONG *data;
+  ULONG length;
+  ULONG size;
+  BOOL allocated;                   /* Data from malloc(), not the block */
+};
+
+/* Where a state is built, one level for each ~ it is nested in */
+struct MatchLevel {
+  ULONG *set;                       /* Operations reached */
+  LONG *stack;                      /* Operations still to follow */
+  struct MatchState *groups;        /* Per ~: its item's states */
+  ULONG *groupCounts;               /* Per ~: how many */
+  BOOL *rejecting;                  /* Per ~: one of them does not match */
+  BOOL *fired;                      /* Per ~: what follows it is reached */
+  struct MatchState out;            /* The state built */
+};
+
+/*
+ * A pattern without ~, compiled once. A state is only a set of operations,
+ * and each operation's closure is the set it reaches without taking text.
+ * The sets met while matching become states of a DFA as they turn up,
+ * with a row of transitions each, filled in as characters come.
+ */
+struct MatchProgram {
+  char *parsed;                     /* The parsed pattern, flags and all */
+  ULONG parsedLength;
+  struct PatternOp *ops;
+  LONG opCount;
+  ULONG words;                      /* Words in a set of operations */
+  ULONG *closures;                  /* Per operation, a set */
+  ULONG *takers;                    /* Operations that take a character */
+  ULONG *next;                      /* Set being built */
+  LONG entry;
+  LONG accept;
+  LONG rest;                        /* "#?" it ends with, or -1 */
+  ULONG *sets;                      /* Per DFA state, its set */
+  UBYTE *stateFlags;                /* Per DFA state, MATCH_ flags */
+  UBYTE *transitions;               /* Per DFA state, 256 states or unknown */
+  ULONG stateCount;
+  ULONG lastUsed;
+};
+
+/* The programs of one thread, so workers never share one */
+struct MatchCache {
+  struct MatchProgram *programs[MATCH_CACHE_SIZE];
+  ULONG clock;
+};
+
+/* A pattern being matched: its operations and where states are built */
+struct PatternMatch {
+  BOOL noCase;
+  BOOL failed;                      /* Out of memory */
+  struct PatternOp *ops;
+  LONG opCount;
+  const char **items;               /* Starts of items while compiling */
+  LONG itemCount;
+  LONG *negations;                  /* The OP_NOT of each ~ */
+  LONG negationCount;
+  ULONG words;                      /* Words in a set of operations */
+  struct MatchLevel *levels;
+  struct MatchState current;        /* State before the next character */
+};
+
+static void setHostError(int error) {
+  switch (error) {
+    case ENOENT:
+    case ENOTDIR:
+      ioError = ERROR_OBJECT_NOT_FOUND;
+      break;
+    case ENOMEM:
+      ioError = ERROR_NO_FREE_STORE;
+      break;
+    case EEXIST:
+      ioError = ERROR_OBJECT_EXISTS;
+      break;
+    default:
+      ioError = HOST_ERRNO_BASE + error;
+  }
+}
+
+/* Count a block handed out and keep the high-water mark */
+static void countAlloc(ULONG size) {
+  ULONG inUse;
+  ULONG peak;
+
+  __atomic_add_fetch(&memAllocations, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&memAllocated, size, __ATOMIC_RELAXED);
+  inUse = __atomic_add_fetch(&memInUse, size, __ATOMIC_RELAXED);
+
+  peak = __atomic_load_n(&memPeak, __ATOMIC_RELAXED);
+  while (inUse > peak &&
+         !__atomic_compare_exchange_n(&memPeak, &peak, inUse, TRUE,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    /* peak now holds the latest value; try again */
+  }
+}
+
+static void countFree(ULONG size) {
+  __atomic_sub_fetch(&memInUse, size, __ATOMIC_RELAXED);
+}
+
+APTR AllocMem(ULONG size, ULONG flags) {
+  APTR memory;
+
+  memory = (flags & MEMF_CLEAR) ? calloc(1, size ? size : 1)
+                                : malloc(size ? size : 1);
+  if (memory) countAlloc(size);
+  return memory;
+}
+
+void FreeMem(APTR memory, ULONG size) {
+  if (!memory) return;
+  countFree(size);
+  free(memory);
+}
+
+/* Free physical memory, which is what decides whether to stream a file */
+ULONG AvailMem(ULONG flags) {
+  long pages;
+  long pageSize;
+
+#ifdef _SC_AVPHYS_PAGES
+  pages = sysconf(_SC_AVPHYS_PAGES);
+#else
+  pages = sysconf(_SC_PHYS_PAGES);
+#endif
+  pageSize = sysconf(_SC_PAGESIZE);
+  if (pages < 0 || pageSize < 0) return 0x7FFFFFFFUL;
+
+  (void)flags;
+  return (ULONG)pages * (ULONG)pageSize;
+}
+
+/*
+ * Pools hand out blocks from the C heap, each linked into its pool. The
+ * puddle sizes only matter to exec's allocator, so they are not used.
+ */
+APTR CreatePool(ULONG flags, ULONG puddleSize, ULONG threshSize) {
+  struct HostPool *pool;
+
+  pool = calloc(1, sizeof(struct HostPool));
+  if (pool) pool->flags = flags;
+
+  (void)puddleSize;
+  (void)threshSize;
+  return pool;
+}
+
+APTR AllocPooled(APTR pool, ULONG size) {
+  struct HostPool *hostPool;
+  struct PoolBlock *block;
+
+  hostPool = pool;
+  block = (hostPool->flags & MEMF_CLEAR)
+            ? calloc(1, sizeof(struct PoolBlock) + size)
+            : malloc(sizeof(struct PoolBlock) + size);
+  if (!block) return NULL;
+
+  block->size = size;
+  block->prev = NULL;
+  block->next = hostPool->blocks;
+  if (block->next) block->next->prev = block;
+  hostPool->blocks = block;
+
+  countAlloc(size);
+  return block + 1;
+}
+
+void FreePooled(APTR pool, APTR memory, ULONG size) {
+  struct HostPool *hostPool;
+  struct PoolBlock *block;
+
+  if (!memory) return;
+
+  hostPool = pool;
+  block = (struct PoolBlock *)memory - 1;
+  if (block->prev) block->prev->next = block->next;
+  else hostPool->blocks = block->next;
+  if (block->next) block->next->prev = block->prev;
+
+  countFree(block->size);
+  free(block);
+  (void)size;
+}
+
+void DeletePool(APTR pool) {
+  struct HostPool *hostPool;
+  struct PoolBlock *block;
+  struct PoolBlock *next;
+
+  hostPool = pool;
+  if (!hostPool) return;
+
+  for (block = hostPool->blocks; block; block = next) {
+    next = block->next;
+    countFree(block->size);
+    free(block);
+  }
+  free(hostPool);
+}
+
+void getHostMemStats(struct HostMemStats *stats) {
+  stats->allocations = __atomic_load_n(&memAllocations, __ATOMIC_RELAXED);
+  stats->allocated = __atomic_load_n(&memAllocated, __ATOMIC_RELAXED);
+  stats->inUse = __atomic_load_n(&memInUse, __ATOMIC_RELAXED);
+  stats->peakInUse = __atomic_load_n(&memPeak, __ATOMIC_RELAXED);
+}
+
+/* Start a new high-water mark from what is in use now */
+void resetHostMemPeak(void) {
+  __atomic_store_n(&memPeak, __atomic_load_n(&memInUse, __ATOMIC_RELAXED),
+                   __ATOMIC_RELAXED);
+}
+
+/* Files are descriptors plus one, so that no file is 0 */
+#define FILE_FD(file) ((int)(file) - 1)
+
+BPTR Open(CONST_STRPTR name, LONG mode) {
+  int fd;
+
+  if (mode == MODE_NEWFILE) {
+    fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  } else if (mode == MODE_READWRITE) {
+    fd = open(name, O_RDWR | O_CREAT, 0644);
+  } else {
+    fd = open(name, O_RDONLY);
+  }
+
+  if (fd < 0) {
+    setHostError(errno);
+    return 0;
+  }
+  return (BPTR)fd + 1;
+}
+
+LONG Close(BPTR file) {
+  if (!file) return TRUE;
+  return (LONG)(close(FILE_FD(file)) == 0);
+}
+
+/* Read until length bytes or the end of the file, as AmigaDOS does */
+LONG Read(BPTR file, APTR buffer, LONG length) {
+  LONG total;
+  ssize_t count;
+
+  total = 0;
+  while (total < length) {
+    count = read(FILE_FD(file), (char *)buffer + total, length - total);
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      setHostError(errno);
+      return -1;
+    }
+    if (count == 0) break;
+    total += count;
+  }
+  return total;
+}
+
+LONG Write(BPTR file, CONST void *buffer, LONG length) {
+  LONG total;
+  ssize_t count;
+
+  /* Keep the order of what Printf() has buffered */
+  if (file == Output()) fflush(stdout);
+
+  total = 0;
+  while (total < length) {
+    count = write(FILE_FD(file), (const char *)buffer + total,
+                  length - total);
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      setHostError(errno);
+      return -1;
+    }
+    total += count;
+  }
+  return total;
+}
+
+/* Returns the old position, like the AmigaDOS call */
+LONG Seek(BPTR file, LONG position, LONG mode) {
+  off_t old;
+  int whence;
+
+  whence = mode == OFFSET_BEGINNING ? SEEK_SET :
+           mode == OFFSET_END ? SEEK_END : SEEK_CUR;
+
+  old = lseek(FILE_FD(file), 0, SEEK_CUR);
+  if (old < 0 || lseek(FILE_FD(file), position, whence) < 0) {
+    setHostError(errno);
+    return -1;
+  }
+  return (LONG)old;
+}
+
+LONG Flush(BPTR file) {
+  if (file == Output()) fflush(stdout);
+  return TRUE;
+}
+
+/* A lock is a descriptor too; directories open read-only as well */
+BPTR Lock(CONST_STRPTR name, LONG mode) {
+  (void)mode;
+  return Open(name, MODE_OLDFILE);
+}
+
+void UnLock(BPTR lock) {
+  Close(lock);
+}
+
+BOOL ExamineFH(BPTR file, struct FileInfoBlock *fib) {
+  struct stat st;
+  ULONG seconds;
+  LONG protection;
+
+  if (fstat(FILE_FD(file), &st) < 0) {
+    setHostError(errno);
+    return FALSE;
+  }
+
+  /* The RWED bits are set when the action is not allowed */
+  protection = 0;
+  if (!(st.st_mode & S_IRUSR)) protection |= FIBF_READ;
+  if (!(st.st_mode & S_IWUSR)) protection |= FIBF_WRITE | FIBF_DELETE;
+  if (!(st.st_mode & S_IXUSR)) protection |= FIBF_EXECUTE;
+
+  seconds = 0;
+  if (st.st_mtime > AMIGA_EPOCH_OFFSET) {
+    seconds = st.st_mtime - AMIGA_EPOCH_OFFSET;
+  }
+
+  fib->fib_DirEntryType = S_ISDIR(st.st_mode) ? 2 : -3;
+  fib->fib_EntryType = fib->fib_DirEntryType;
+  fib->fib_Protection = protection;
+  fib->fib_Size = (LONG)st.st_size;
+  fib->fib_NumBlocks = (LONG)st.st_blocks;
+  fib->fib_Date.ds_Days = seconds / 86400;
+  fib->fib_Date.ds_Minute = (seconds % 86400) / 60;
+  fib->fib_Date.ds_Tick = (seconds % 60) * TICKS_PER_SECOND;
+  return TRUE;
+}
+
+BOOL Examine(BPTR lock, struct FileInfoBlock *fib) {
+  return ExamineFH(lock, fib);
+}
+
+/* Unlike rename(), Rename() will not replace a file */
+LONG Rename(CONST_STRPTR oldName, CONST_STRPTR newName) {
+  struct stat st;
+
+  if (lstat(newName, &st) == 0) {
+    ioError = ERROR_OBJECT_EXISTS;
+    return FALSE;
+  }
+
+  if (rename(oldName, newName) < 0) {
+    setHostError(errno);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Files and empty directories alike */
+LONG DeleteFile(CONST_STRPTR name) {
+  if (remove(name) < 0) {
+    setHostError(errno);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+APTR AllocDosObject(ULONG type, void *tags) {
+  (void)tags;
+  if (type != DOS_FIB) return NULL;
+  return calloc(1, sizeof(struct FileInfoBlock));
+}
+
+void FreeDosObject(ULONG type, APTR object) {
+  (void)type;
+  free(object);
+}
+
+STRPTR FilePart(CONST_STRPTR path) {
+  const char *slash;
+
+  slash = strrchr(path, '/');
+  return (STRPTR)(slash ? slash + 1 : path);
+}
+
+BOOL AddPart(STRPTR dirname, CONST_STRPTR filename, ULONG size) {
+  ULONG length;
+
+  /* An absolute name replaces the directory */
+  if (*filename == '/') {
+    if (strlen(filename) >= size) return FALSE;
+    strcpy(dirname, filename);
+    return TRUE;
+  }
+
+  length = strlen(dirname);
+  if (length && dirname[length - 1] != '/') {
+    if (length + 1 >= size) return FALSE;
+    dirname[length++] = '/';
+    dirname[length] = '\0';
+  }
+
+  if (length + strlen(filename) >= size) return FALSE;
+  strcpy(dirname + length, filename);
+  return TRUE;
+}
+
+BPTR Output(void) {
+  return (BPTR)STDOUT_FILENO + 1;
+}
+
+LONG Printf(CONST_STRPTR format, ...) {
+  va_list args;
+  LONG count;
+
+  va_start(args, format);
+  count = vprintf(format, args);
+  va_end(args);
+  return count;
+}
+
+LONG IoErr(void) {
+  return ioError;
+}
+
+/* Print what went wrong the way the Shell words it */
+BOOL PrintFault(LONG code, CONST_STRPTR header) {
+  const char *message;
+  char unknown[32];
+
+  switch (code) {
+    case ERROR_NO_FREE_STORE: message = "not enough memory available"; break;
+    case ERROR_BAD_NUMBER: message = "bad number"; break;
+    case ERROR_REQUIRED_ARG_MISSING: message = "required argument missing"; break;
+    case ERROR_TOO_MANY_ARGS: message = "wrong number of arguments"; break;
+    case ERROR_OBJECT_EXISTS: message = "object already exists"; break;
+    case ERROR_OBJECT_NOT_FOUND: message = "object not found"; break;
+    case ERROR_BUFFER_OVERFLOW: message = "buffer overflow"; break;
+    default:
+      if (code > HOST_ERRNO_BASE) {
+        message = strerror(code - HOST_ERRNO_BASE);
+      } else {
+        sprintf(unknown, "Error %ld", (long)code);
+        message = unknown;
+      }
+  }
+
+  if (header) Printf("%s: %s\n", header, message);
+  else Printf("%s\n", message);
+  return TRUE;
+}
+
+struct DateStamp *DateStamp(struct DateStamp *date) {
+  struct timespec now;
+  ULONG seconds;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  seconds = 0;
+  if (now.tv_sec > AMIGA_EPOCH_OFFSET) {
+    seconds = now.tv_sec - AMIGA_EPOCH_OFFSET;
+  }
+
+  date->ds_Days = seconds / 86400;
+  date->ds_Minute = (seconds % 86400) / 60;
+  date->ds_Tick = (seconds % 60) * TICKS_PER_SECOND +
+                  now.tv_nsec / (1000000000L / TICKS_PER_SECOND);
+  return date;
+}
+
+void setHostArgs(int argc, char **argv) {
+  hostArgc = argc;
+  hostArgv = argv;
+}
+
+/* Split a template into its items; FALSE if it has too many */
+static BOOL parseTemplate(CONST_STRPTR argTemplate, struct ArgItem *items,
+                          ULONG *count) {
+  const char *p;
+  struct ArgItem *item;
+
+  *count = 0;
+  p = argTemplate;
+  while (*p) {
+    if (*count == MAX_TEMPLATE_ITEMS) return FALSE;
+    item = &items[(*count)++];
+
+    item->names = p;
+    while (*p && *p != '/' && *p != ',') p++;
+    item->namesLength = p - item->names;
+
+    item->modifiers = 0;
+    while (*p == '/') {
+      switch (toupper((UBYTE)p[1])) {
+        case 'S': item->modifiers |= ARGF_SWITCH; break;
+        case 'K': item->modifiers |= ARGF_KEYWORD; break;
+        case 'N': item->modifiers |= ARGF_NUMBER; break;
+        case 'A': item->modifiers |= ARGF_REQUIRED; break;
+        case 'M': item->modifiers |= ARGF_MULTIPLE; break;
+      }
+      p += p[1] ? 2 : 1;
+    }
+
+    if (*p == ',') p++;
+  }
+  return TRUE;
+}
+
+/* Whether a word is one of an item's names, which '=' separates */
+static BOOL isItemName(const struct ArgItem *item, const char *word,
+                       ULONG length) {
+  const char *name;
+  const char *end;
+  const char *next;
+
+  name = item->names;
+  end = item->names + item->namesLength;
+  while (name < end) {
+    for (next = name; next < end && *next != '='; next++);
+    if ((ULONG)(next - name) == length &&
+        strnicmp(name, word, length) == 0) {
+      return TRUE;
+    }
+    name = next + 1;
+  }
+  return FALSE;
+}
+
+static APTR allocArgMemory(struct RDArgs *rdargs, ULONG size) {
+  struct ArgMemory *memory;
+
+  memory = calloc(1, sizeof(struct ArgMemory) + size);
+  if (!memory) return NULL;
+
+  memory->next = rdargs->memory;
+  rdargs->memory = memory;
+  return memory->data;
+}
+
+/* Store a value in an item's slot: a string, a number or one more of many */
+static BOOL storeArg(struct RDArgs *rdargs, const struct ArgItem *item,
+                     LONG *slot, char *value) {
+  STRPTR *values;
+  LONG *number;
+  char *end;
+  ULONG count;
+
+  if (item->modifiers & ARGF_NUMBER) {
+    number = allocArgMemory(rdargs, sizeof(LONG));
+    if (!number) {
+      ioError = ERROR_NO_FREE_STORE;
+      return FALSE;
+    }
+
+    *number = strtol(value, &end, 10);
+    if (!*value || *end) {
+      ioError = ERROR_BAD_NUMBER;
+      return FALSE;
+    }
+    *slot = (LONG)number;
+  } else if (item->modifiers & ARGF_MULTIPLE) {
+    /* Room for every word of the command line and the terminating NULL */
+    values = (STRPTR *)*slot;
+    if (!values) {
+      values = allocArgMemory(rdargs, hostArgc * sizeof(STRPTR));
+      if (!values) {
+        ioError = ERROR_NO_FREE_STORE;
+        return FALSE;
+      }
+      *slot = (LONG)values;
+    }
+
+    for (count = 0; values[count]; count++);
+    values[count] = value;
+  } else {
+    *slot = (LONG)value;
+  }
+  return TRUE;
+}
+
+/* Unfilled required items after an item that take words without a keyword */
+static ULONG requiredAfter(const struct ArgItem *items, ULONG count,
+                           const LONG *array, ULONG item) {
+  ULONG required;
+
+  required = 0;
+  for (item++; item < count; item++) {
+    if ((items[item].modifiers & ARGF_REQUIRED) &&
+        !(items[item].modifiers & (ARGF_KEYWORD | ARGF_SWITCH)) &&
+        !array[item]) {
+      required++;
+    }
+  }
+  return required;
+}
+
+/*
+ * Take the word at *index if it is a keyword, with its value joined by '='
+ * or in the next word. Returns 1 if it was taken, 0 if it is no keyword
+ * and -1 on an error, which is left in IoErr().
+ */
+static int takeKeyword(struct RDArgs *rdargs, const struct ArgItem *items,
+                       ULONG count, LONG *array, int *index) {
+  const char *equals;
+  char *word;
+  ULONG item;
+
+  word = hostArgv[*index];
+  equals = strchr(word, '=');
+
+  for (item = 0; item < count; item++) {
+    if (equals && !(items[item].modifiers & ARGF_SWITCH) &&
+        isItemName(&items[item], word, equals - word)) {
+      return storeArg(rdargs, &items[item], &array[item], (char *)equals + 1)
+               ? 1 : -1;
+    }
+
+    if (isItemName(&items[item], word, strlen(word))) {
+      if (items[item].modifiers & ARGF_SWITCH) {
+        array[item] = -1;
+        return 1;
+      }
+
+      if (*index + 1 == hostArgc) {
+        ioError = ERROR_REQUIRED_ARG_MISSING;
+        return -1;
+      }
+      return storeArg(rdargs, &items[item], &array[item], hostArgv[++*index])
+               ? 1 : -1;
+    }
+  }
+  return 0;
+}
+
+/* The first free item that takes a word without a keyword, or count */
+static ULONG freeItem(const struct ArgItem *items, ULONG count,
+                      const LONG *array, ULONG wordsLeft) {
+  ULONG item;
+
+  for (item = 0; item < count; item++) {
+    if (items[item].modifiers & (ARGF_SWITCH | ARGF_KEYWORD)) continue;
+
+    /* Many words go to a /M item, but not those the /A items after need */
+    if (items[item].modifiers & ARGF_MULTIPLE) {
+      if (!array[item] ||
+          requiredAfter(items, count, array, item) < wordsLeft) {
+        break;
+      }
+    } else if (!array[item]) {
+      break;
+    }
+  }
+  return item;
+}
+
+/*
+ * Fill array from the command line given to setHostArgs(). Keywords may
+ * be followed by their value or joined to it with '='; other words fill
+ * the items that take no keyword in template order.
+ */
+struct RDArgs *ReadArgs(CONST_STRPTR argTemplate, LONG *array,
+                        struct RDArgs *args) {
+  struct ArgItem items[MAX_TEMPLATE_ITEMS];
+  struct RDArgs *rdargs;
+  ULONG count;
+  ULONG item;
+  int taken;
+  int i;
+
+  (void)args;
+
+  rdargs = calloc(1, sizeof(struct RDArgs));
+  if (!rdargs) {
+    ioError = ERROR_NO_FREE_STORE;
+    return NULL;
+  }
+
+  if (!parseTemplate(argTemplate, items, &count)) {
+    ioError = ERROR_TOO_MANY_ARGS;
+    FreeArgs(rdargs);
+    return NULL;
+  }
+
+  for (i = 1; i < hostArgc; i++) {
+    taken = takeKeyword(rdargs, items, count, array, &i);
+    if (taken < 0) {
+      FreeArgs(rdargs);
+      return NULL;
+    }
+    if (taken) continue;
+
+    item = freeItem(items, count, array, hostArgc - i);
+    if (item == count) {
+      ioError = ERROR_TOO_MANY_ARGS;
+      FreeArgs(rdargs);
+      return NULL;
+    }
+
+    if (!storeArg(rdargs, &items[item], &array[item], hostArgv[i])) {
+      FreeArgs(rdargs);
+      return NULL;
+    }
+  }
+
+  for (item = 0; item < count; item++) {
+    if ((items[item].modifiers & ARGF_REQUIRED) && !array[item]) {
+      ioError = ERROR_REQUIRED_ARG_MISSING;
+      FreeArgs(rdargs);
+      return NULL;
+    }
+  }
+
+  return rdargs;
+}
+
+void FreeArgs(struct RDArgs *args) {
+  struct ArgMemory *memory;
+  struct ArgMemory *next;
+
+  if (!args) return;
+
+  for (memory = args->memory; memory; memory = next) {
+    next = memory->next;
+    free(memory);
+  }
+  free(args);
+}
+
+/*
+ * AmigaDOS patterns, as with dos.library's WILDSTAR flag set, so '*' is
+ * "#?" unless quoted. The parsed form is a flags byte followed by the
+ * pattern itself, '*' spelt "#?" and lower-cased for case-insensitive
+ * matching; patterns of literals, '?' and "#?" alone are matched without
+ * backtracking.
+ */
+static LONG parsePattern(CONST_STRPTR pattern, STRPTR buffer, LONG bufferSize,
+                         BOOL noCase) {
+  const char *p;
+  char *out;
+  BOOL wild;
+  BOOL simple;
+
+  if (!buffer || bufferSize < (LONG)strlen(pattern) * 2 + 2) {
+    ioError = ERROR_BUFFER_OVERFLOW;
+    return -1;
+  }
+
+  wild = FALSE;
+  simple = TRUE;
+  out = buffer + 1;
+  for (p = pattern; *p; p++) {
+    if (*p == '*') {
+      *out++ = '#';
+      *out++ = '?';
+      wild = TRUE;
+      continue;
+    }
+
+    if (strchr("?#()|~[]%'", *p)) wild = TRUE;
+    if (strchr("()|~[]%'", *p) || (*p == '#' && p[1] != '?')) simple = FALSE;
+    *out++ = noCase ? tolower((UBYTE)*p) : *p;
+
+    /* A quoted character is copied as it is, '*' too */
+    if (*p == '\'' && p[1]) {
+      p++;
+      *out++ = noCase ? tolower((UBYTE)*p) : *p;
+    }
+  }
+  *out = '\0';
+
+  buffer[0] = (char)((noCase ? PARSED_NOCASE : 0) |
+                     (simple ? PARSED_SIMPLE : 0));
+  return wild ? 1 : 0;
+}
+
+LONG ParsePattern(CONST_STRPTR pattern, STRPTR buffer, LONG bufferSize) {
+  return parsePattern(pattern, buffer, bufferSize, FALSE);
+}
+
+LONG ParsePatternNoCase(CONST_STRPTR pattern, STRPTR buffer, LONG bufferSize) {
+  return parsePattern(pattern, buffer, bufferSize, TRUE);
+}
+
+static BOOL sameChar(const struct PatternMatch *match, char p, char c) {
+  if (match->noCase) c = tolower((UBYTE)c);
+  return (BOOL)(p == c);
+}
+
+/* End of the pattern item that starts at p */
+static const char *itemEnd(const char *p, const char *end) {
+  int depth;
+
+  switch (*p) {
+    case '\'':
+      return p + 1 < end ? p + 2 : end;
+    case '#':
+    case '~':
+      return p + 1 < end ? itemEnd(p + 1, end) : end;
+    case '[':
+      for (p++; p < end && *p != ']'; p++) {
+        if (*p == '\'' && p + 1 < end) p++;
+      }
+      return p < end ? p + 1 : end;
+    case '(':
+      depth = 0;
+      for (; p < end; p++) {
+        if (*p == '\'' && p + 1 < end) p++;
+        else if (*p == '(') depth++;
+        else if (*p == ')' && --depth == 0) return p + 1;
+      }
+      return end;
+    default:
+      return p + 1;
+  }
+}
+
+/* Whether a character is in a [class], which ~ after the bracket negates */
+static BOOL inClass(const struct PatternMatch *match, const char *p,
+                    const char *end, char c) {
+  BOOL negate;
+  BOOL found;
+  char low;
+  char high;
+
+  if (match->noCase) c = tolower((UBYTE)c);
+
+  p++;
+  if (end[-1] == ']') end--;
+  negate = (BOOL)(p < end && *p == '~');
+  if (negate) p++;
+
+  found = FALSE;
+  while (p < end) {
+    if (*p == '\'' && p + 1 < end) p++;
+    low = high = *p++;
+    if (p + 1 < end && *p == '-') {
+      p++;
+      if (*p == '\'' && p + 1 < end) p++;
+      high = *p++;
+    }
+    if (c >= low && c <= high) found = TRUE;
+  }
+  return (BOOL)(found != negate);
+}
+
+static LONG compileSequence(struct PatternMatch *match,
+                            const char *p, const char *pEnd, LONG next);
+
+static LONG addOp(struct PatternMatch *match, UBYTE type, LONG next) {
+  struct PatternOp *op;
+
+  op = &match->ops[match->opCount];
+  memset(op, 0, sizeof(struct PatternOp));
+  op->type = type;
+  op->next = next;
+  return match->opCount++;
+}
+
+/* Operations for the item p..pEnd, going on to next; returns the first */
+static LONG compileItem(struct PatternMatch *match,
+                        const char *p, const char *pEnd, LONG next) {
+  const char *alternative;
+  LONG branch;
+  LONG entry;
+  LONG op;
+  int depth;
+
+  switch (*p) {
+    case '?':
+      return addOp(match, OP_ANY, next);
+    case '%':
+      return next;
+    case '\'':
+      if (p + 1 >= pEnd) return addOp(match, OP_FAIL, next);
+      op = addOp(match, OP_CHAR, next);
+      match->ops[op].c = p[1];
+      return op;
+    case '[':
+      op = addOp(match, OP_CLASS, next);
+      match->ops[op].item = p;
+      match->ops[op].itemEnd = pEnd;
+      return op;
+    case '#':
+      /* Any number of the item after it, which loops back to the split */
+      if (p + 1 >= pEnd) return next;
+      op = addOp(match, OP_SPLIT, next);
+      match->ops[op].alt = next;
+      match->ops[op].next = compileItem(match, p + 1, pEnd, op);
+      return op;
+    case '~':
+      /* The item is an automaton of its own, ending in its own match */
+      op = addOp(match, OP_NOT, next);
+      match->ops[op].accept = addOp(match, OP_MATCH, -1);
+      match->ops[op].alt = p + 1 < pEnd ?
+        compileItem(match, p + 1, pEnd, match->ops[op].accept) :
+        addOp(match, OP_FAIL, match->ops[op].accept);
+      match->ops[op].negation = match->negationCount;
+      match->negations[match->negationCount++] = op;
+      return op;
+    case '(':
+      /* Each alternative, split at the '|' outside inner parentheses */
+      if (pEnd[-1] == ')') pEnd--;
+      entry = -1;
+      depth = 0;
+      for (alternative = ++p; p <= pEnd; p++) {
+        if (p == pEnd || (*p == '|' && depth == 0)) {
+          branch = compileSequence(match, alternative, p, next);
+          if (entry < 0) {
+            entry = branch;
+          } else {
+            op = addOp(match, OP_SPLIT, branch);
+            match->ops[op].alt = entry;
+            entry = op;
+          }
+          alternative = p + 1;
+        } else if (*p == '\'' && p + 1 < pEnd) {
+          p++;
+        } else if (*p == '(') {
+          depth++;
+        } else if (*p == ')') {
+          depth--;
+        }
+      }
+      return entry;
+    default:
+      op = addOp(match, OP_CHAR, next);
+      match->ops[op].c = *p;
+      return op;
+  }
+}
+
+/* Operations for the items p..pEnd, compiled from the last one back */
+static LONG compileSequence(struct PatternMatch *match,
+                            const char *p, const char *pEnd, LONG next) {
+  LONG first;
+  LONG i;
+
+  first = match->itemCount;
+  for (; p < pEnd; p = itemEnd(p, pEnd)) match->items[match->itemCount++] = p;
+
+  for (i = match->itemCount - 1; i >= first; i--) {
+    next = compileItem(match, match->items[i],
+                       i + 1 < match->itemCount ? match->items[i + 1] : pEnd,
+                       next);
+  }
+
+  match->itemCount = first;
+  return next;
+}
+
+static BOOL hasOp(const ULONG *set, LONG op) {
+  return (BOOL)((set[op >> 5] & (1UL << (op & 31))) != 0);
+}
+
+static void orSet(ULONG *set, const ULONG *other, ULONG words) {
+  ULONG i;
+
+  for (i = 0; i < words; i++) set[i] |= other[i];
+}
+
+/* Whether an operation that takes a character takes c */
+static BOOL takesChar(const struct PatternMatch *match,
+                      const struct PatternOp *op, char c) {
+  switch (op->type) {
+    case OP_CHAR:
+      return sameChar(match, op->c, c);
+    case OP_ANY:
+      return TRUE;
+    case OP_CLASS:
+      return inClass(match, op->item, op->itemEnd, c);
+    default:
+      return FALSE;
+  }
+}
+
+static BOOL growState(struct PatternMatch *match, struct MatchState *state,
+                      ULONG words) {
+  ULONG *data;
+  ULONG size;
+
+  if (state->length + words <= state->size) return TRUE;
+
+  size = state->size ? state->size * 2 : 64;
+  while (size < state->length + words) size *= 2;
+  data = state->allocated ? realloc(state->data, size * sizeof(ULONG)) :
+                            malloc(size * sizeof(ULONG));
+  if (!data) {
+    match->failed = TRUE;
+    return FALSE;
+  }
+
+  if (!state->allocated) {
+    memcpy(data, state->data, state->length * sizeof(ULONG));
+  }
+  state->data = data;
+  state->size = size;
+  state->allocated = TRUE;
+  return TRUE;
+}
+
+/* Add a state of a ~ item to a level's groups, once */
+static void addGroup(struct PatternMatch *match, struct MatchLevel *level,
+                     LONG negation, const struct MatchState *group) {
+  struct MatchState *groups;
+  ULONG at;
+  ULONG i;
+
+  if (match->failed) return;
+
+  groups = &level->groups[negation];
+  for (at = 0, i = 0; i < level->groupCounts[negation]; i++) {
+    if (groups->data[at] == group->length &&
+        memcmp(groups->data + at + 1, group->data,
+               group->length * sizeof(ULONG)) == 0) {
+      return;
+    }
+    at += groups->data[at] + 1;
+  }
+
+  if (!growState(match, groups, group->length + 1)) return;
+  groups->data[groups->length] = group->length;
+  memcpy(groups->data + groups->length + 1, group->data,
+         group->length * sizeof(ULONG));
+  groups->length += group->length + 1;
+  level->groupCounts[negation]++;
+
+  /* The item not matching the text so far lets the ~ go on */
+  if (!hasOp(group->data, match->ops[match->negations[negation]].accept)) {
+    level->rejecting[negation] = TRUE;
+  }
+}
+
+static void startItem(struct PatternMatch *match, ULONG depth, LONG entry);
+
+/* Reach an operation and every one it leads to without taking text */
+static void followOp(struct PatternMatch *match, ULONG depth, LONG start) {
+  struct MatchLevel *level;
+  struct PatternOp *op;
+  LONG count;
+  LONG index;
+
+  level = &match->levels[depth];
+  count = 0;
+  level->stack[count++] = start;
+
+  while (count) {
+    index = level->stack[--count];
+    if (hasOp(level->set, index)) continue;
+    level->set[index >> 5] |= 1UL << (index & 31);
+
+    op = &match->ops[index];
+    if (op->type == OP_SPLIT) {
+      level->stack[count++] = op->next;
+      level->stack[count++] = op->alt;
+    } else if (op->type == OP_NOT) {
+      /* The ~ item starts over here, on text of its own */
+      startItem(match, depth + 1, op->alt);
+      addGroup(match, level, op->negation, &match->levels[depth + 1].out);
+    }
+  }
+}
+
+static void beginLevel(struct PatternMatch *match, ULONG depth) {
+  struct MatchLevel *level;
+  LONG i;
+
+  level = &match->levels[depth];
+  memset(level->set, 0, match->words * sizeof(ULONG));
+  for (i = 0; i < match->negationCount; i++) {
+    level->groups[i].length = 0;
+    level->groupCounts[i] = 0;
+    level->rejecting[i] = FALSE;
+    level->fired[i] = FALSE;
+  }
+}
+
+/* Go on after every ~ whose item fails some text, then write the state */
+static void finishLevel(struct PatternMatch *match, ULONG depth) {
+  struct MatchLevel *level;
+  struct MatchState *out;
+  BOOL changed;
+  LONG i;
+
+  level = &match->levels[depth];
+  do {
+    changed = FALSE;
+    for (i = 0; i < match->negationCount; i++) {
+      if (level->fired[i] || !level->rejecting[i]) continue;
+      level->fired[i] = TRUE;
+      followOp(match, depth, match->ops[match->negations[i]].next);
+      changed = TRUE;
+    }
+  } while (changed);
+
+  /* The operations reached, then each ~ item's count and states */
+  out = &level->out;
+  out->length = 0;
+  if (!growState(match, out, match->words)) return;
+  memcpy(out->data, level->set, match->words * sizeof(ULONG));
+  out->length = match->words;
+
+  for (i = 0; i < match->negationCount; i++) {
+    if (!growState(match, out, level->groups[i].length + 1)) return;
+    out->data[out->length++] = level->groupCounts[i];
+    memcpy(out->data + out->length, level->groups[i].data,
+           level->groups[i].length * sizeof(ULONG));
+    out->length += level->groups[i].length;
+  }
+}
+
+/* The state of an automaton before it has taken any text */
+static void startItem(struct PatternMatch *match, ULONG depth, LONG entry) {
+  beginLevel(match, depth);
+  followOp(match, depth, entry);
+  finishLevel(match, depth);
+}
+
+/* The state after an automaton in a state has taken c */
+static void stepState(struct PatternMatch *match, ULONG depth,
+                      const ULONG *state, char c) {
+  struct MatchLevel *level;
+  ULONG count;
+  ULONG word;
+  ULONG bits;
+  ULONG at;
+  LONG i;
+
+  level = &match->levels[depth];
+  beginLevel(match, depth);
+
+  /* Each ~ item takes c in each of the places it started */
+  at = match->words;
+  for (i = 0; i < match->negationCount; i++) {
+    for (count = state[at++]; count; count--) {
+      stepState(match, depth + 1, state + at + 1, c);
+      addGroup(match, level, i, &match->levels[depth + 1].out);
+      at += state[at] + 1;
+    }
+  }
+
+  for (word = 0; word < match->words; word++) {
+    for (bits = state[word]; bits; bits &= bits - 1) {
+      i = word * 32 + __builtin_ctz(bits);
+      if (takesChar(match, &match->ops[i], c)) {
+        followOp(match, depth, match->ops[i].next);
+      }
+    }
+  }
+
+  finishLevel(match, depth);
+}
+
+/* Whether a state can still take text, or already matches */
+static BOOL isStateLive(const struct MatchState *state) {
+  ULONG i;
+
+  for (i = 0; i < state->length; i++) {
+    if (state->data[i]) return TRUE;
+  }
+  return FALSE;
+}
+
+/* Room taken from a block, kept aligned for what follows */
+static APTR carveBlock(UBYTE **block, ULONG size) {
+  APTR start;
+
+  start = *block;
+  *block += (size + 7) & ~7UL;
+  return start;
+}
+
+/* The "#?" at ops[at], if that is what is there: a split into a loop of ? */
+static BOOL isAnyLoop(const struct PatternOp *ops, LONG at) {
+  return (BOOL)(ops[at].type == OP_SPLIT && ops[ops[at].next].type == OP_ANY &&
+                ops[ops[at].next].next == at);
+}
+
+/*
+ * Run the pattern as an NFA over the text: the set of operations reached
+ * is carried along one character at a time, so no text is tried twice
+ * and nothing recurses on its length. A ~ item keeps a state of its own
+ * for each place it started, merged when they come to the same state;
+ * the ~ goes on wherever one of them does not match.
+ */
+static BOOL matchCompiled(struct PatternMatch *match, const char *p,
+                          const char *s) {
+  struct MatchState swap;
+  struct MatchState *current;
+  LONG accept;
+  LONG entry;
+  LONG rest;
+  LONG i;
+
+  accept = addOp(match, OP_MATCH, -1);
+  entry = compileSequence(match, p, p + strlen(p), accept);
+  match->words = (match->opCount + 31) / 32;
+
+  /* A "#?" the pattern ends in takes whatever is left, so reaching it wins */
+  rest = -1;
+  for (i = 0; i < match->opCount; i++) {
+    if (match->ops[i].alt == accept && isAnyLoop(match->ops, i)) rest = i;
+  }
+
+  current = &match->current;
+  startItem(match, 0, entry);
+  for (;;) {
+    swap = *current;
+    *current = match->levels[0].out;
+    match->levels[0].out = swap;
+    if (match->failed || !isStateLive(current)) return FALSE;
+    if (rest >= 0 && hasOp(current->data, rest)) return TRUE;
+    if (!*s) break;
+
+    stepState(match, 0, current->data, *s++);
+  }
+
+  return hasOp(current->data, accept);
+}
+
+static void freeMatchCache(void *data) {
+  struct MatchCache *cache;
+  ULONG i;
+
+  cache = data;
+  for (i = 0; i < MATCH_CACHE_SIZE; i++) free(cache->programs[i]);
+  free(cache);
+}
+
+static void createMatchCache(void) {
+  pthread_key_create(&matchCacheKey, freeMatchCache);
+}
+
+static void resetStates(struct MatchProgram *program);
+
+/* Compile a pattern without ~ into one block, closures and all */
+static struct MatchProgram *buildProgram(CONST_STRPTR parsed,
+                                         ULONG parsedLength) {
+  struct MatchProgram *program;
+  struct PatternMatch match;
+  UBYTE *block;
+  UBYTE *next;
+  LONG *stack;
+  ULONG *set;
+  ULONG maxOps;
+  ULONG words;
+  ULONG size;
+  LONG count;
+  LONG i;
+  LONG j;
+
+  /* An item adds at most one operation, and the end one more */
+  maxOps = parsedLength;
+  words = (maxOps + 31) / 32;
+  size = sizeof(struct MatchProgram) + 8 + parsedLength + 8 +
+         maxOps * sizeof(struct PatternOp) + 8 +
+         maxOps * sizeof(const char *) + 8 +
+         (maxOps * 2 + 1) * sizeof(LONG) + 8 +
+         (maxOps + 2) * words * sizeof(ULONG) + 24 +
+         MATCH_DFA_STATES * (words * sizeof(ULONG) + 1 + 256) + 24;
+
+  block = malloc(size);
+  if (!block) return NULL;
+
+  next = block;
+  program = carveBlock(&next, sizeof(struct MatchProgram));
+  program->parsed = carveBlock(&next, parsedLength);
+  memcpy(program->parsed, parsed, parsedLength);
+  program->parsedLength = parsedLength;
+
+  /* Compiled from the copy, so [classes] point into what the program keeps */
+  memset(&match, 0, sizeof(match));
+  match.ops = carveBlock(&next, maxOps * sizeof(struct PatternOp));
+  match.items = carveBlock(&next, maxOps * sizeof(const char *));
+  program->accept = addOp(&match, OP_MATCH, -1);
+  program->entry = compileSequence(&match, program->parsed + 1,
+                                   program->parsed + parsedLength,
+                                   program->accept);
+  program->ops = match.ops;
+  program->opCount = match.opCount;
+  program->words = words;
+
+  stack = carveBlock(&next, (maxOps * 2 + 1) * sizeof(LONG));
+  program->closures = carveBlock(&next, maxOps * words * sizeof(ULONG));
+  program->takers = carveBlock(&next, words * sizeof(ULONG));
+  program->next = carveBlock(&next, words * sizeof(ULONG));
+  program->sets = carveBlock(&next, MATCH_DFA_STATES * words * sizeof(ULONG));
+  program->stateFlags = carveBlock(&next, MATCH_DFA_STATES);
+  program->transitions = carveBlock(&next, MATCH_DFA_STATES * 256);
+  memset(program->closures, 0, maxOps * words * sizeof(ULONG));
+  memset(program->takers, 0, words * sizeof(ULONG));
+
+  program->rest = -1;
+  for (i = 0; i < program->opCount; i++) {
+    set = program->closures + i * words;
+    count = 0;
+    stack[count++] = i;
+    while (count) {
+      j = stack[--count];
+      if (hasOp(set, j)) continue;
+      set[j >> 5] |= 1UL << (j & 31);
+      if (program->ops[j].type == OP_SPLIT) {
+        stack[count++] = program->ops[j].next;
+        stack[count++] = program->ops[j].alt;
+      }
+    }
+
+    if (program->ops[i].type <= OP_CLASS) {
+      program->takers[i >> 5] |= 1UL << (i & 31);
+    }
+    if (isAnyLoop(program->ops, i) && program->ops[i].alt == program->accept) {
+      program->rest = i;
+    }
+  }
+
+  resetStates(program);
+  return program;
+}
+
+/* The program for a parsed pattern, compiled on the first match with it */
+static struct MatchProgram *obtainProgram(CONST_STRPTR parsed) {
+  struct MatchProgram *program;
+  struct MatchCache *cache;
+  ULONG length;
+  ULONG slot;
+  ULONG i;
+
+  pthread_once(&matchCacheOnce, createMatchCache);
+  cache = pthread_getspecific(matchCacheKey);
+  if (!cache) {
+    cache = calloc(1, sizeof(struct MatchCache));
+    if (!cache || pthread_setspecific(matchCacheKey, cache) != 0) {
+      free(cache);
+      return NULL;
+    }
+  }
+
+  /* The flags byte may be 0, so the length is taken after it */
+  length = strlen(parsed + 1) + 1;
+  slot = 0;
+  for (i = 0; i < MATCH_CACHE_SIZE; i++) {
+    program = cache->programs[i];
+    if (program && program->parsedLength == length &&
+        memcmp(program->parsed, parsed, length) == 0) {
+      program->lastUsed = ++cache->clock;
+      return program;
+    }
+
+    /* Remember a free entry, or else the least recently used one */
+    if (!cache->programs[slot]) continue;
+    if (!program || program->lastUsed < cache->programs[slot]->lastUsed) {
+      slot = i;
+    }
+  }
+
+  program = buildProgram(parsed, length);
+  if (!program) return NULL;
+
+  free(cache->programs[slot]);
+  cache->programs[slot] = program;
+  program->lastUsed = ++cache->clock;
+  return program;
+}
+
+/* Make a set a DFA state, or find the one it already is */
+static ULONG internState(struct MatchProgram *program, const ULONG *set) {
+  ULONG *stateSet;
+  ULONG words;
+  ULONG state;
+  ULONG i;
+  UBYTE flags;
+
+  words = program->words;
+  for (state = 0; state < program->stateCount; state++) {
+    if (memcmp(program->sets + state * words, set,
+               words * sizeof(ULONG)) == 0) {
+      return state;
+    }
+  }
+
+  stateSet = program->sets + state * words;
+  memcpy(stateSet, set, words * sizeof(ULONG));
+  memset(program->transitions + state * 256, MATCH_UNKNOWN, 256);
+
+  flags = MATCH_DEAD;
+  for (i = 0; i < words; i++) {
+    if (set[i]) flags = 0;
+  }
+  if (hasOp(set, program->accept)) flags |= MATCH_ACCEPT;
+  if (program->rest >= 0 && hasOp(set, program->rest)) flags |= MATCH_REST;
+  program->stateFlags[state] = flags;
+
+  program->stateCount++;
+  return state;
+}
+
+/* Forget every DFA state but the first, which is always state 0 */
+static void resetStates(struct MatchProgram *program) {
+  program->stateCount = 0;
+  internState(program, program->closures + program->entry * program->words);
+}
+
+/* Work out where a state goes on c, the NFA way, and remember it */
+static ULONG stepProgram(const struct PatternMatch *match,
+                         struct MatchProgram *program, ULONG state, char c) {
+  const ULONG *set;
+  ULONG *next;
+  ULONG words;
+  ULONG word;
+  ULONG bits;
+  ULONG target;
+  LONG i;
+
+  words = program->words;
+  set = program->sets + state * words;
+  next = program->next;
+  memset(next, 0, words * sizeof(ULONG));
+
+  for (word = 0; word < words; word++) {
+    for (bits = set[word] & program->takers[word]; bits; bits &= bits - 1) {
+      i = word * 32 + __builtin_ctz(bits);
+      if (takesChar(match, &program->ops[i], c)) {
+        orSet(next, program->closures + program->ops[i].next * words, words);
+      }
+    }
+  }
+
+  /* A full table starts over; the text matched so far is all in next */
+  if (program->stateCount == MATCH_DFA_STATES) {
+    resetStates(program);
+    return internState(program, next);
+  }
+
+  target = internState(program, next);
+  program->transitions[state * 256 + (UBYTE)c] = (UBYTE)target;
+  return target;
+}
+
+/* Follow the DFA over the text, working out transitions not seen yet */
+static BOOL matchProgram(const struct PatternMatch *match,
+                         struct MatchProgram *program, const char *s) {
+  ULONG state;
+  ULONG next;
+  UBYTE flags;
+
+  state = 0;
+  for (;;) {
+    flags = program->stateFlags[state];
+    if (flags & (MATCH_DEAD | MATCH_REST)) return (BOOL)!(flags & MATCH_DEAD);
+    if (!*s) return (BOOL)((flags & MATCH_ACCEPT) != 0);
+
+    next = program->transitions[state * 256 + (UBYTE)*s];
+    if (next == MATCH_UNKNOWN) next = stepProgram(match, program, state, *s);
+    state = next;
+    s++;
+  }
+}
+
+/* Literals, '?' and "#?": on a mismatch only the last "#?" is widened */
+static BOOL matchSimple(const struct PatternMatch *match,
+                        const char *p, const char *s) {
+  const char *starPattern;
+  const char *starText;
+
+  starPattern = NULL;
+  starText = NULL;
+
+  while (*s) {
+    if (p[0] == '#' && p[1] == '?') {
+      while (p[0] == '#' && p[1] == '?') p += 2;
+      if (!*p) return TRUE;
+      starPattern = p;
+      starText = s;
+    } else if (*p && (*p == '?' || sameChar(match, *p, *s))) {
+      p++;
+      s++;
+    } else if (starPattern) {
+      p = starPattern;
+      s = ++starText;
+    } else {
+      return FALSE;
+    }
+  }
+
+  while (p[0] == '#' && p[1] == '?') p += 2;
+  return (BOOL)(*p == '\0');
+}
+
+/* Room for the state a pattern starts with, which is all most ever need */
+static void carveState(UBYTE **block, struct MatchState *state, ULONG words) {
+  state->data = carveBlock(block, words * sizeof(ULONG));
+  state->length = 0;
+  state->size = words;
+  state->allocated = FALSE;
+}
+
+/*
+ * Patterns of literals, '?' and "#?" take the simple matcher. Others
+ * without a ~ are compiled once per thread; with one, they are compiled
+ * for each match, into a block sized from the pattern, on the stack when
+ * it is small. An item adds at most one operation, and a ~ two more
+ * along with a level its item's states are built on.
+ */
+static BOOL matchParsed(CONST_STRPTR parsed, STRPTR string) {
+  APTR local[MATCH_LOCAL_SIZE / sizeof(APTR)];
+  struct MatchProgram *program;
+  struct PatternMatch match;
+  struct MatchLevel *level;
+  const char *p;
+  UBYTE *block;
+  UBYTE *next;
+  ULONG length;
+  ULONG levels;
+  ULONG maxOps;
+  ULONG words;
+  ULONG size;
+  ULONG i;
+  ULONG j;
+  BOOL matched;
+
+  memset(&match, 0, sizeof(match));
+  match.noCase = (BOOL)((parsed[0] & PARSED_NOCASE) != 0);
+  p = parsed + 1;
+
+  if (parsed[0] & PARSED_SIMPLE) return matchSimple(&match, p, string);
+
+  length = strlen(p);
+  levels = 1;
+  for (i = 0; i < length; i++) {
+    if (p[i] == '~') levels++;
+  }
+
+  if (levels == 1) {
+    program = obtainProgram(parsed);
+    if (!program) {
+      ioError = ERROR_NO_FREE_STORE;
+      return FALSE;
+    }
+    return matchProgram(&match, program, string);
+  }
+
+  /* Every size here is an upper bound on what compiling uses */
+  maxOps = length + (levels - 1) * 2 + 1;
+  words = (maxOps + 31) / 32;
+  size = maxOps * sizeof(struct PatternOp) + 8 +
+         length * sizeof(const char *) + 8 +
+         levels * sizeof(LONG) + 8 +
+         levels * sizeof(struct MatchLevel) + 8 +
+         words * sizeof(ULONG) + 8 +
+         levels * (words * sizeof(ULONG) * 2 + 16 +
+                   (maxOps * 2 + 1) * sizeof(LONG) + 8 +
+                   levels * sizeof(struct MatchState) + 8 +
+                   levels * sizeof(ULONG) + 8 +
+                   levels * sizeof(BOOL) * 2 + 16);
+
+  block = size <= sizeof(local) ? (UBYTE *)local : malloc(size);
+  if (!block) {
+    ioError = ERROR_NO_FREE_STORE;
+    return FALSE;
+  }
+
+  next = block;
+  match.ops = carveBlock(&next, maxOps * sizeof(struct PatternOp));
+  match.items = carveBlock(&next, length * sizeof(const char *));
+  match.negations = carveBlock(&next, levels * sizeof(LONG));
+  match.levels = carveBlock(&next, levels * sizeof(struct MatchLevel));
+  carveState(&next, &match.current, words);
+  for (i = 0; i < levels; i++) {
+    level = &match.levels[i];
+    level->set = carveBlock(&next, words * sizeof(ULONG));
+    level->stack = carveBlock(&next, (maxOps * 2 + 1) * sizeof(LONG));
+    level->groups = carveBlock(&next, levels * sizeof(struct MatchState));
+    level->groupCounts = carveBlock(&next, levels * sizeof(ULONG));
+    level->rejecting = carveBlock(&next, levels * sizeof(BOOL));
+    level->fired = carveBlock(&next, levels * sizeof(BOOL));
+    carveState(&next, &level->out, words);
+    for (j = 0; j < levels; j++) carveState(&next, &level->groups[j], 0);
+  }
+
+  matched = matchCompiled(&match, p, string);
+  if (match.failed) ioError = ERROR_NO_FREE_STORE;
+
+  if (match.current.allocated) free(match.current.data);
+  for (i = 0; i < levels; i++) {
+    level = &match.levels[i];
+    if (level->out.allocated) free(level->out.data);
+    for (j = 0; j < levels; j++) {
+      if (level->groups[j].allocated) free(level->groups[j].data);
+    }
+  }
+  if (block != (UBYTE *)local) free(block);
+  return matched;
+}
+
+BOOL MatchPattern(CONST_STRPTR parsed, STRPTR string) {
+  return matchParsed(parsed, string);
+}
+
+BOOL MatchPatternNoCase(CONST_STRPTR parsed, STRPTR string) {
+  return matchParsed(parsed, string);
+}
+
+#endif
@@ -0,0 +1,162 @@
+/* hostdos.h */
+#ifndef HOSTDOS_H
+#define HOSTDOS_H
+
+/*
+ * The part of exec.library and dos.library that Analyze calls, for host
+ * builds. Types and constants have their AmigaOS names and values; the
+ * calls behave as documented in the autodocs, as far as a POSIX system
+ * can follow them. Only platform.h includes this.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+
+typedef unsigned char UBYTE;
+typedef signed char BYTE;
+typedef unsigned short UWORD;
+typedef short WORD;
+typedef long LONG;              /* Wide enough for a pointer, as ReadArgs() */
+typedef unsigned long ULONG;    /* stores them in LONG slots */
+typedef short BOOL;
+typedef char *STRPTR;
+typedef const char *CONST_STRPTR;
+typedef void *APTR;
+typedef long BPTR;              /* File descriptor plus one; 0 is no file */
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+#define CONST const
+
+struct DateStamp {
+  LONG ds_Days;                 /* Days since 1 January 1978 */
+  LONG ds_Minute;               /* Minutes past midnight */
+  LONG ds_Tick;                 /* Ticks past the minute */
+};
+
+#define TICKS_PER_SECOND 50
+
+struct FileInfoBlock {
+  LONG fib_DiskKey;
+  LONG fib_DirEntryType;        /* Positive for directories */
+  char fib_FileName[108];
+  LONG fib_Protection;
+  LONG fib_EntryType;
+  LONG fib_Size;
+  LONG fib_NumBlocks;
+  struct DateStamp fib_Date;
+  char fib_Comment[80];
+};
+
+/* Opaque; holds what ReadArgs() allocated */
+struct RDArgs;
+
+#define DOS_FIB 2
+
+#define MODE_OLDFILE 1005
+#define MODE_NEWFILE 1006
+#define MODE_READWRITE 1004
+
+#define OFFSET_BEGINNING -1
+#define OFFSET_CURRENT 0
+#define OFFSET_END 1
+
+#define SHARED_LOCK -2
+#define ACCESS_READ -2
+#define EXCLUSIVE_LOCK -1
+#define ACCESS_WRITE -1
+
+#define RETURN_OK 0
+#define RETURN_WARN 5
+#define RETURN_ERROR 10
+#define RETURN_FAIL 20
+
+#define MEMF_ANY 0L
+#define MEMF_PUBLIC (1L << 0)
+#define MEMF_CLEAR (1L << 16)
+#define MEMF_LARGEST (1L << 17)
+
+#define ERROR_NO_FREE_STORE 103
+#define ERROR_BAD_NUMBER 115
+#define ERROR_REQUIRED_ARG_MISSING 116
+#define ERROR_TOO_MANY_ARGS 118
+#define ERROR_OBJECT_EXISTS 203
+#define ERROR_OBJECT_NOT_FOUND 205
+#define ERROR_BUFFER_OVERFLOW 303
+
+/* Protection bits; the low four are set to deny */
+#define FIBF_DELETE (1 << 0)
+#define FIBF_EXECUTE (1 << 1)
+#define FIBF_WRITE (1 << 2)
+#define FIBF_READ (1 << 3)
+#define FIBF_ARCHIVE (1 << 4)
+#define FIBF_PURE (1 << 5)
+#define FIBF_SCRIPT (1 << 6)
+
+#define stricmp strcasecmp
+#define strnicmp strncasecmp
+
+/* Memory, counted for the benchmarks */
+struct HostMemStats {
+  ULONG allocations;            /* AllocMem() and AllocPooled() calls */
+  ULONG allocated;              /* Bytes they asked for */
+  ULONG inUse;                  /* Bytes not yet freed */
+  ULONG peakInUse;              /* Most bytes ever in use at once */
+};
+
+APTR AllocMem(ULONG size, ULONG flags);
+void FreeMem(APTR memory, ULONG size);
+ULONG AvailMem(ULONG flags);
+APTR CreatePool(ULONG flags, ULONG puddleSize, ULONG threshSize);
+void DeletePool(APTR pool);
+APTR AllocPooled(APTR pool, ULONG size);
+void FreePooled(APTR pool, APTR memory, ULONG size);
+void getHostMemStats(struct HostMemStats *stats);
+void resetHostMemPeak(void);
+
+/* Files */
+BPTR Open(CONST_STRPTR name, LONG mode);
+LONG Close(BPTR file);
+LONG Read(BPTR file, APTR buffer, LONG length);
+LONG Write(BPTR file, CONST void *buffer, LONG length);
+LONG Seek(BPTR file, LONG position, LONG mode);
+LONG Flush(BPTR file);
+BPTR Lock(CONST_STRPTR name, LONG mode);
+void UnLock(BPTR lock);
+BOOL Examine(BPTR lock, struct FileInfoBlock *fib);
+BOOL ExamineFH(BPTR file, struct FileInfoBlock *fib);
+LONG Rename(CONST_STRPTR oldName, CONST_STRPTR newName);
+LONG DeleteFile(CONST_STRPTR name);
+APTR AllocDosObject(ULONG type, void *tags);
+void FreeDosObject(ULONG type, APTR object);
+
+/* Paths */
+STRPTR FilePart(CONST_STRPTR path);
+BOOL AddPart(STRPTR dirname, CONST_STRPTR filename, ULONG size);
+
+/* Console and errors */
+BPTR Output(void);
+LONG Printf(CONST_STRPTR format, ...);
+LONG IoErr(void);
+BOOL PrintFault(LONG code, CONST_STRPTR header);
+
+/* Time */
+struct DateStamp *DateStamp(struct DateStamp *date);
+
+/* Arguments; main() hands the command line over first */
+void setHostArgs(int argc, char **argv);
+struct RDArgs *ReadArgs(CONST_STRPTR argTemplate, LONG *array,
+                        struct RDArgs *args);
+void FreeArgs(struct RDArgs *args);
+
+/* AmigaDOS patterns */
+LONG ParsePattern(CONST_STRPTR pattern, STRPTR buffer, LONG bufferSize);
+LONG ParsePatternNoCase(CONST_STRPTR pattern, STRPTR buffer, LONG bufferSize);
+BOOL MatchPattern(CONST_STRPTR parsed, STRPTR string);
+BOOL MatchPatternNoCase(CONST_STRPTR parsed, STRPTR string);
+
+#endif
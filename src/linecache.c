@@ -0,0 +1,316 @@
+/* linecache.c */
+#include "fileutils.h"
+
+#define CACHE_MAGIC 0x4C494458UL   /* "LIDX" */
+#define CACHE_VERSION 2
+#define CACHE_SUFFIX ".lidx"
+#define HASH_PRIME 0x9E3779B1UL     /* Odd, so every hash step is reversible */
+#define HASH_LANES 4                /* Words hashed side by side */
+
+const char *lineCacheDir = NULL;
+
+/*
+ * Start of a cache file. The canonical path follows, padded to a whole
+ * number of ULONGs, then lineCount bounds. The layout is that of the host
+ * that wrote it; another host's caches fail the magic or bound size check.
+ */
+struct CacheHeader {
+  ULONG magic;                      /* CACHE_MAGIC */
+  UWORD version;                    /* CACHE_VERSION */
+  UWORD boundSize;                  /* sizeof(struct LineBound) */
+  ULONG fileSize;                   /* Size of the file indexed */
+  struct DateStamp dateStamp;       /* Its date stamp */
+  ULONG hash;                       /* hashData() of its contents */
+  ULONG lineCount;                  /* Bounds after the path; 0 if binary */
+  ULONG endings[4];                 /* Lines with each LineEnding */
+  ULONG nonPrintable;               /* Control characters in the file */
+  UWORD pathSize;                   /* Bytes of path, padding included */
+  UBYTE isBinary;
+  UBYTE pad;
+};
+
+/* A cache file in memory */
+struct LineCache {
+  APTR address;
+  ULONG size;
+};
+
+/*
+ * Hash file contents a word at a time. Each step is reversible, so a
+ * single changed word always changes the hash; several lanes keep the
+ * multiplies from waiting on each other. fileData is always aligned.
+ */
+static ULONG hashData(const char *data, ULONG size) {
+  const ULONG *words;
+  ULONG lanes[HASH_LANES];
+  ULONG count;
+  ULONG tail;
+  ULONG hash;
+  ULONG i;
+
+  words = (const ULONG *)data;
+  count = size / sizeof(ULONG);
+  for (i = 0; i < HASH_LANES; i++) lanes[i] = i + 1;
+
+  for (i = 0; i + HASH_LANES <= count; i += HASH_LANES) {
+    lanes[0] = (lanes[0] ^ words[i]) * HASH_PRIME;
+    lanes[1] = (lanes[1] ^ words[i + 1]) * HASH_PRIME;
+    lanes[2] = (lanes[2] ^ words[i + 2]) * HASH_PRIME;
+    lanes[3] = (lanes[3] ^ words[i + 3]) * HASH_PRIME;
+  }
+
+  hash = size;
+  for (; i < count; i++) hash = (hash ^ words[i]) * HASH_PRIME;
+
+  tail = 0;
+  memcpy(&tail, data + count * sizeof(ULONG), size % sizeof(ULONG));
+  hash = (hash ^ tail) * HASH_PRIME;
+
+  for (i = 0; i < HASH_LANES; i++) hash = (hash ^ lanes[i]) * HASH_PRIME;
+  return hash;
+}
+
+/* Name a path's cache file in lineCacheDir */
+static BOOL cacheFileName(const char *canonical, char *buffer) {
+  static const char digits[] = "0123456789abcdef";
+  char name[16];
+  ULONG hash;
+  int i;
+
+  /* FNV-1a */
+  hash = 0x811C9DC5UL;
+  while (*canonical) {
+    hash = ((hash ^ (UBYTE)*canonical++) * 0x01000193UL) & 0xFFFFFFFFUL;
+  }
+
+  for (i = 7; i >= 0; i--) {
+    name[i] = digits[hash & 15];
+    hash >>= 4;
+  }
+  strcpy(name + 8, CACHE_SUFFIX);
+
+  if (strlen(lineCacheDir) >= MAX_PATH_LEN) return FALSE;
+  strcpy(buffer, lineCacheDir);
+  return (BOOL)AddPart(buffer, name, MAX_PATH_LEN);
+}
+
+#ifdef PLATFORM_POSIX
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Map a cache file; only the pages read are brought in */
+static BOOL loadCache(const char *path, struct LineCache *cache) {
+  struct stat st;
+  void *address;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return FALSE;
+
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct CacheHeader)) {
+    close(fd);
+    return FALSE;
+  }
+
+  address = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) return FALSE;
+  COUNT_READ(st.st_size);
+
+  cache->address = address;
+  cache->size = st.st_size;
+  return TRUE;
+}
+
+static void unloadCache(struct LineCache *cache) {
+  munmap(cache->address, cache->size);
+}
+
+#else
+
+/* Read a cache file into memory */
+static BOOL loadCache(const char *path, struct LineCache *cache) {
+  BPTR fh;
+  LONG size;
+
+  fh = Open((STRPTR)path, MODE_OLDFILE);
+  if (!fh) return FALSE;
+
+  Seek(fh, 0, OFFSET_END);
+  size = Seek(fh, 0, OFFSET_BEGINNING);
+  if (size < (LONG)sizeof(struct CacheHeader)) {
+    Close(fh);
+    return FALSE;
+  }
+
+  cache->address = AllocMem(size, MEMF_ANY);
+  cache->size = size;
+  if (cache->address && Read(fh, cache->address, size) != size) {
+    FreeMem(cache->address, size);
+    cache->address = NULL;
+  }
+  COUNT_READ(size);
+
+  Close(fh);
+  return (BOOL)(cache->address != NULL);
+}
+
+static void unloadCache(struct LineCache *cache) {
+  FreeMem(cache->address, cache->size);
+}
+
+#endif
+
+/* Whether every line starts where the last one ended, up to the end */
+static BOOL checkBounds(const struct LineBound *bounds, ULONG count,
+                        ULONG fileSize) {
+  ULONG start;
+  ULONG i;
+
+  start = 0;
+  for (i = 0; i < count; i++) {
+    if (bounds[i].end < start || bounds[i].end > fileSize ||
+        bounds[i].ending > EOL_CRLF) {
+      return FALSE;
+    }
+    start = bounds[i].end + ENDING_LENGTH(bounds[i].ending);
+  }
+  return (BOOL)(start == fileSize);
+}
+
+/* Whether a cache was written for the data now loaded from a path */
+static BOOL checkCache(const struct LineCache *cache,
+                       const struct FileMetadata *metadata,
+                       const char *canonical) {
+  const struct CacheHeader *header;
+  const char *path;
+  ULONG room;
+
+  header = cache->address;
+  if (header->magic != CACHE_MAGIC || header->version != CACHE_VERSION ||
+      header->boundSize != sizeof(struct LineBound)) {
+    return FALSE;
+  }
+
+  if (header->fileSize != metadata->fileSize ||
+      header->dateStamp.ds_Days != metadata->dateStamp.ds_Days ||
+      header->dateStamp.ds_Minute != metadata->dateStamp.ds_Minute ||
+      header->dateStamp.ds_Tick != metadata->dateStamp.ds_Tick) {
+    return FALSE;
+  }
+
+  /* The path and bounds must fill the rest of the file exactly */
+  room = cache->size - sizeof(struct CacheHeader);
+  if (header->pathSize > room ||
+      header->lineCount > (room - header->pathSize) / sizeof(struct LineBound) ||
+      header->pathSize + header->lineCount * sizeof(struct LineBound) != room) {
+    return FALSE;
+  }
+
+  path = (const char *)(header + 1);
+  if (strlen(canonical) >= header->pathSize || strcmp(path, canonical) != 0) {
+    return FALSE;
+  }
+
+  if (!header->isBinary &&
+      !checkBounds((const struct LineBound *)(path + header->pathSize),
+                   header->lineCount, metadata->fileSize)) {
+    return FALSE;
+  }
+
+  /* Only this reads the whole file, so it comes last */
+  return (BOOL)(header->hash == hashData(metadata->fileData,
+                                         metadata->fileSize));
+}
+
+struct LineCache *openLineCache(const struct FileMetadata *metadata,
+                                struct ByteScan *scan) {
+  const struct CacheHeader *header;
+  struct LineCache *cache;
+  char canonical[MAX_PATH_LEN];
+  char cachePath[MAX_PATH_LEN];
+
+  if (!lineCacheDir) return NULL;
+  if (!canonicalPath(metadata->fullPath, canonical) ||
+      !cacheFileName(canonical, cachePath)) {
+    return NULL;
+  }
+
+  cache = AllocMem(sizeof(struct LineCache), MEMF_ANY | MEMF_CLEAR);
+  if (!cache) return NULL;
+
+  if (!loadCache(cachePath, cache)) {
+    FreeMem(cache, sizeof(struct LineCache));
+    return NULL;
+  }
+
+  if (!checkCache(cache, metadata, canonical)) {
+    closeLineCache(cache);
+    return NULL;
+  }
+
+  header = cache->address;
+  memset(scan, 0, sizeof(struct ByteScan));
+  scan->bounds = (struct LineBound *)((char *)(header + 1) + header->pathSize);
+  scan->lineCount = header->lineCount;
+  scan->capacity = header->lineCount;
+  memcpy(scan->endings, header->endings, sizeof(scan->endings));
+  scan->nonPrintable = header->nonPrintable;
+  scan->isBinary = (BOOL)header->isBinary;
+  return cache;
+}
+
+void closeLineCache(struct LineCache *cache) {
+  if (cache) {
+    unloadCache(cache);
+    FreeMem(cache, sizeof(struct LineCache));
+  }
+}
+
+/* Record what a full scan of a loaded file found */
+BOOL writeLineCache(const struct FileMetadata *metadata,
+                    const struct ByteScan *scan) {
+  struct CacheHeader header;
+  struct SaveWriter *writer;
+  char canonical[MAX_PATH_LEN + sizeof(ULONG)];
+  char cachePath[MAX_PATH_LEN];
+
+  if (!lineCacheDir) return FALSE;
+
+  memset(canonical, 0, sizeof(canonical));
+  if (!canonicalPath(metadata->fullPath, canonical) ||
+      !cacheFileName(canonical, cachePath)) {
+    return FALSE;
+  }
+
+  memset(&header, 0, sizeof(struct CacheHeader));
+  header.magic = CACHE_MAGIC;
+  header.version = CACHE_VERSION;
+  header.boundSize = sizeof(struct LineBound);
+  header.fileSize = metadata->fileSize;
+  header.dateStamp = metadata->dateStamp;
+  header.hash = hashData(metadata->fileData, metadata->fileSize);
+  header.pathSize = (strlen(canonical) + sizeof(ULONG)) &
+                    ~(sizeof(ULONG) - 1);
+  header.isBinary = (UBYTE)scan->isBinary;
+
+  /* A binary file's scan stopped early, so only the verdict is kept */
+  if (!scan->isBinary) {
+    header.lineCount = scan->lineCount;
+    memcpy(header.endings, scan->endings, sizeof(header.endings));
+    header.nonPrintable = scan->nonPrintable;
+  }
+
+  writer = openSaveWriter(cachePath, NULL);
+  if (!writer) return FALSE;
+
+  writeSpan(writer, (const char *)&header, sizeof(struct CacheHeader));
+  writeSpan(writer, canonical, header.pathSize);
+  writeSpan(writer, (const char *)scan->bounds,
+            header.lineCount * sizeof(struct LineBound));
+  return closeSaveWriter(writer);
+}
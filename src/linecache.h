@@ -0,0 +1,35 @@
+#ifndef LINECACHE_H
+#define LINECACHE_H
+
+/* Forward declarations */
+struct LineCache;
+struct ByteScan;
+struct FileMetadata;
+
+/*
+ * Line indexes kept on disk between runs. With lineCacheDir set, indexing
+ * a file leaves a cache file there holding what the scan found: whether
+ * the file is binary, its ending and non-printable counts, and the bound
+ * and type of every line. The next run that loads the same file maps the
+ * cache instead of scanning, and builds the index straight from it.
+ *
+ * Cache files are named after a hash of the file's canonical path, which
+ * is kept in full inside to tell clashes apart. A cache only counts when
+ * the file still has the size, date stamp and content hash it had when
+ * the cache was written; anything else is a miss, and the cache is
+ * written afresh after the file is scanned again. Caches are written the
+ * way files are saved, so a reader never sees one half done.
+ */
+extern const char *lineCacheDir;    /* Directory for cache files, or NULL */
+
+/*
+ * Look for a valid cache of a loaded file. On a hit scan is filled in with
+ * bounds that point into the cache, which stay valid until it is closed.
+ */
+struct LineCache *openLineCache(const struct FileMetadata *metadata,
+                                struct ByteScan *scan);
+void closeLineCache(struct LineCache *cache);
+BOOL writeLineCache(const struct FileMetadata *metadata,
+                    const struct ByteScan *scan);
+
+#endif
@@ -0,0 +1,218 @@
+/* lineindex.c */
+#include "fileutils.h"
+
+#define MIN_INDEX_CAPACITY 16
+
+/* Number of unused slots between the two halves of the buffer */
+#define GAP_LENGTH(m) ((m)->lineCapacity - (m)->lineCount)
+
+/* Slide the gap so that it starts before the given 0-based line index */
+static void moveGap(struct FileMetadata *metadata, ULONG index) {
+  struct TextLine *lines;
+  ULONG gapLength;
+
+  lines = metadata->lines;
+  gapLength = GAP_LENGTH(metadata);
+
+  if (index < metadata->gapStart) {
+    memmove(&lines[index + gapLength], &lines[index],
+            (metadata->gapStart - index) * sizeof(struct TextLine));
+  } else if (index > metadata->gapStart) {
+    memmove(&lines[metadata->gapStart], &lines[metadata->gapStart + gapLength],
+            (index - metadata->gapStart) * sizeof(struct TextLine));
+  }
+
+  metadata->gapStart = index;
+}
+
+/* Double the buffer, keeping the gap where it is */
+static BOOL growLineIndex(struct FileMetadata *metadata) {
+  struct TextLine *lines;
+  ULONG capacity;
+  ULONG tail;
+
+  capacity = metadata->lineCapacity * 2;
+  if (capacity < MIN_INDEX_CAPACITY) capacity = MIN_INDEX_CAPACITY;
+
+  lines = AllocPooled(metadata->pool, capacity * sizeof(struct TextLine));
+  if (!lines) return FALSE;
+
+  if (metadata->lines) {
+    tail = metadata->lineCount - metadata->gapStart;
+    memcpy(lines, metadata->lines, metadata->gapStart * sizeof(struct TextLine));
+    memcpy(&lines[capacity - tail],
+           &metadata->lines[metadata->lineCapacity - tail],
+           tail * sizeof(struct TextLine));
+    FreePooled(metadata->pool, metadata->lines,
+               metadata->lineCapacity * sizeof(struct TextLine));
+  }
+
+  metadata->lines = lines;
+  metadata->lineCapacity = capacity;
+  return TRUE;
+}
+
+/* Allocate an empty index with room for the given number of lines */
+BOOL allocLineIndex(struct FileMetadata *metadata, ULONG capacity) {
+  if (capacity < MIN_INDEX_CAPACITY) capacity = MIN_INDEX_CAPACITY;
+
+  metadata->lines = AllocPooled(metadata->pool,
+                                capacity * sizeof(struct TextLine));
+  if (!metadata->lines) return FALSE;
+
+  metadata->lineCapacity = capacity;
+  metadata->lineCount = 0;
+  metadata->gapStart = 0;
+  return TRUE;
+}
+
+/* Give the index back to the pool */
+void freeLineIndex(struct FileMetadata *metadata) {
+  if (metadata->lines) {
+    FreePooled(metadata->pool, metadata->lines,
+               metadata->lineCapacity * sizeof(struct TextLine));
+  }
+
+  metadata->lines = NULL;
+  metadata->lineCapacity = 0;
+  metadata->lineCount = 0;
+  metadata->gapStart = 0;
+}
+
+/*
+ * Look up a line by number (1-based). The line number is stored on the
+ * way out, so lines handed out are always numbered correctly without
+ * renumbering the rest of the file after an edit.
+ */
+struct TextLine *getLine(const struct FileMetadata *metadata,
+                         ULONG lineNumber) {
+  struct TextLine *line;
+  ULONG index;
+
+  if (!metadata || lineNumber < 1 || lineNumber > metadata->lineCount) {
+    return NULL;
+  }
+
+  index = lineNumber - 1;
+  if (index >= metadata->gapStart) index += GAP_LENGTH(metadata);
+
+  line = &metadata->lines[index];
+  line->lineNumber = lineNumber;
+  return line;
+}
+
+/* Open a cleared slot so that it becomes the given line number */
+struct TextLine *insertLineSlot(struct FileMetadata *metadata,
+                                ULONG lineNumber) {
+  struct TextLine *line;
+
+  if (lineNumber < 1 || lineNumber > metadata->lineCount + 1) return NULL;
+
+  if (!GAP_LENGTH(metadata) && !growLineIndex(metadata)) return NULL;
+
+  moveGap(metadata, lineNumber - 1);
+
+  line = &metadata->lines[metadata->gapStart];
+  memset(line, 0, sizeof(struct TextLine));
+  line->parent = metadata;
+  line->lineNumber = lineNumber;
+
+  metadata->gapStart++;
+  metadata->lineCount++;
+  return line;
+}
+
+/* Drop a slot; any content it owned goes back with the file's pool */
+void removeLineSlot(struct FileMetadata *metadata, ULONG lineNumber) {
+  if (lineNumber < 1 || lineNumber > metadata->lineCount) return;
+
+  /* Park the gap right after the line, then swallow it */
+  moveGap(metadata, lineNumber);
+  metadata->gapStart--;
+  metadata->lineCount--;
+}
+
+/*
+ * Drop every line set in a bit map in one sweep: the gap is parked at the
+ * end and the lines kept slide down over the ones dropped. Returns the
+ * number of lines dropped.
+ */
+ULONG removeLineSet(struct FileMetadata *metadata,
+                    const struct LineMatches *matches) {
+  struct TextLine *lines;
+  ULONG kept;
+  ULONG n;
+
+  if (matches->lineCount != metadata->lineCount) return 0;
+
+  moveGap(metadata, metadata->lineCount);
+
+  lines = metadata->lines;
+  kept = 0;
+  for (n = 1; n <= metadata->lineCount; n++) {
+    if (IS_MATCH(matches->bits, n)) continue;
+    if (kept != n - 1) lines[kept] = lines[n - 1];
+    kept++;
+  }
+
+  n = metadata->lineCount - kept;
+  metadata->lineCount = kept;
+  metadata->gapStart = kept;
+  return n;
+}
+
+/*
+ * Drop count lines from a line number on and open newCount cleared slots
+ * in their place, with one move of the gap. The new slots follow each
+ * other in the array; the first is returned. If the index cannot grow
+ * enough, NULL is returned and nothing is changed.
+ */
+struct TextLine *replaceLineRange(struct FileMetadata *metadata,
+                                  ULONG lineNumber, ULONG count,
+                                  ULONG newCount) {
+  struct TextLine *lines;
+  ULONG i;
+
+  if (lineNumber < 1 || lineNumber - 1 + count > metadata->lineCount) {
+    return NULL;
+  }
+
+  while (metadata->lineCapacity < metadata->lineCount - count + newCount) {
+    if (!growLineIndex(metadata)) return NULL;
+  }
+
+  /* Park the gap after the lines dropped, then swallow them */
+  moveGap(metadata, lineNumber - 1 + count);
+  metadata->gapStart -= count;
+  metadata->lineCount -= count;
+
+  lines = &metadata->lines[metadata->gapStart];
+  memset(lines, 0, newCount * sizeof(struct TextLine));
+  for (i = 0; i < newCount; i++) {
+    lines[i].parent = metadata;
+    lines[i].lineNumber = lineNumber + i;
+  }
+
+  metadata->gapStart += newCount;
+  metadata->lineCount += newCount;
+  return lines;
+}
+
+/*
+ * Open count slots after the last line, left as they are for the caller
+ * to fill in every field of, parent included. Loading fills a new index
+ * this way in a single pass over it. NULL if the index cannot grow.
+ */
+struct TextLine *appendLineSlots(struct FileMetadata *metadata, ULONG count) {
+  struct TextLine *lines;
+
+  while (metadata->lineCapacity < metadata->lineCount + count) {
+    if (!growLineIndex(metadata)) return NULL;
+  }
+
+  moveGap(metadata, metadata->lineCount);
+  lines = &metadata->lines[metadata->gapStart];
+  metadata->gapStart += count;
+  metadata->lineCount += count;
+  return lines;
+}
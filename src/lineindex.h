@@ -0,0 +1,30 @@
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+/* Forward declarations */
+struct TextLine;
+struct FileMetadata;
+struct LineMatches;
+
+/*
+ * The lines of a file are kept in a gap buffer: one contiguous array of
+ * struct TextLine with a run of unused slots parked at the last edit
+ * position. Lookup by line number is O(1) and edits close to each other
+ * only move the lines between them.
+ *
+ * Entries move when lines are inserted or removed, so a pointer returned
+ * by getLine() is only valid until the next edit of the same file.
+ */
+BOOL allocLineIndex(struct FileMetadata *metadata, ULONG capacity);
+void freeLineIndex(struct FileMetadata *metadata);
+struct TextLine *getLine(const struct FileMetadata *metadata, ULONG lineNumber);
+struct TextLine *insertLineSlot(struct FileMetadata *metadata, ULONG lineNumber);
+void removeLineSlot(struct FileMetadata *metadata, ULONG lineNumber);
+ULONG removeLineSet(struct FileMetadata *metadata,
+                    const struct LineMatches *matches);
+struct TextLine *replaceLineRange(struct FileMetadata *metadata,
+                                  ULONG lineNumber, ULONG count,
+                                  ULONG newCount);
+struct TextLine *appendLineSlots(struct FileMetadata *metadata, ULONG count);
+
+#endif
@@ -0,0 +1,515 @@
+/* linesearch.c */
+#include "fileutils.h"
+
+#define NO_CHUNK (~0UL)           /* No chunk left to take */
+#define NO_MATCH (~0UL)           /* No first match found yet */
+#define CANCEL_CHECK_LINES 256    /* Lines between checks for a lower match */
+
+ULONG searchWorkers = 0;
+
+/* The chunks one worker has been dealt and not yet matched */
+struct SearchRun {
+  WorkLock lock;                  /* Guards head and tail */
+  ULONG head;                     /* Next chunk the owner takes */
+  ULONG tail;                     /* One past the last; thieves take here */
+};
+
+/* One worker's part of a search */
+struct SearchJob {
+  struct WorkItem item;           /* Must come first */
+  struct LineSearch *search;      /* The search it works on */
+  ULONG run;                      /* Index of the worker's own run */
+  char *buffer;                   /* Line copies for matching */
+  ULONG count;                    /* Lines this worker matched */
+  ULONG *hits;                    /* With a set, the patterns a line hit */
+  ULONG *firstLines;              /* and per pattern, its lowest line */
+  ULONG *counts;                  /* and the lines it matched */
+};
+
+/* A search in progress */
+struct LineSearch {
+  const struct FileMetadata *metadata;
+  const struct CompiledPattern *compiled;
+  const struct PatternSet *set;   /* Patterns matched at once instead */
+  BOOL firstOnly;                 /* Stop at the lowest matching line */
+  ULONG *bits;                    /* Bit map of matches, or NULL */
+  ULONG runCount;                 /* Workers, each with a run of chunks */
+  struct SearchRun *runs;
+  struct SearchJob *jobs;
+  WorkLock resultLock;            /* Guards firstMatch */
+  ULONG firstMatch;               /* Lowest matching line found so far */
+  ULONG *firstLines;              /* With a set, the caller's results */
+  ULONG *counts;
+};
+
+/* Read the lowest match found so far */
+static ULONG readFirstMatch(struct LineSearch *search) {
+  ULONG line;
+
+  obtainWorkLock(&search->resultLock);
+  line = search->firstMatch;
+  releaseWorkLock(&search->resultLock);
+  return line;
+}
+
+/* Record a match and cancel every chunk above the one it is in */
+static void recordFirstMatch(struct LineSearch *search, ULONG line) {
+  struct SearchRun *run;
+  ULONG chunk;
+  ULONG i;
+
+  obtainWorkLock(&search->resultLock);
+  if (line < search->firstMatch) search->firstMatch = line;
+  releaseWorkLock(&search->resultLock);
+
+  chunk = (line - 1) / SEARCH_CHUNK_LINES;
+  for (i = 0; i < search->runCount; i++) {
+    run = &search->runs[i];
+    obtainWorkLock(&run->lock);
+    if (run->tail > chunk) run->tail = chunk;
+    releaseWorkLock(&run->lock);
+  }
+}
+
+/* Take the next chunk of a worker's own run, or steal another's last one */
+static ULONG takeChunk(struct LineSearch *search, ULONG own) {
+  struct SearchRun *run;
+  ULONG chunk;
+  ULONG i;
+
+  for (i = 0; i < search->runCount; i++) {
+    run = &search->runs[(own + i) % search->runCount];
+    chunk = NO_CHUNK;
+
+    obtainWorkLock(&run->lock);
+    if (run->head < run->tail) chunk = i ? --run->tail : run->head++;
+    releaseWorkLock(&run->lock);
+
+    if (chunk != NO_CHUNK) return chunk;
+  }
+
+  return NO_CHUNK;
+}
+
+/* Match a line against the search's pattern set, noting what each hit */
+static BOOL matchSetLine(struct SearchJob *job, ULONG n, STRPTR string) {
+  const struct PatternSet *set;
+  ULONG word;
+  ULONG bits;
+  ULONG i;
+
+  set = job->search->set;
+  if (!matchPatternSet(set, string, job->hits)) return FALSE;
+
+  for (word = 0; word < set->words; word++) {
+    for (bits = job->hits[word], i = word * MATCH_WORD_BITS; bits;
+         bits >>= 1, i++) {
+      if (!(bits & 1)) continue;
+
+      /* Stolen chunks come from the top, so lines do not always rise */
+      job->counts[i]++;
+      if (!job->firstLines[i] || n < job->firstLines[i]) {
+        job->firstLines[i] = n;
+      }
+    }
+  }
+  return TRUE;
+}
+
+/* Note a matching line; TRUE when the chunk needs no more matching */
+static BOOL recordMatch(struct SearchJob *job, ULONG n) {
+  struct LineSearch *search;
+
+  search = job->search;
+  job->count++;
+  if (search->firstOnly) {
+    recordFirstMatch(search, n);
+    return TRUE;
+  }
+  if (search->bits) {
+    search->bits[(n - 1) / MATCH_WORD_BITS] |=
+      1UL << ((n - 1) % MATCH_WORD_BITS);
+  }
+  return FALSE;
+}
+
+/* The last line from n to last starting at or before a file position */
+static ULONG lineAtPosition(const struct FileMetadata *metadata, ULONG n,
+                            ULONG last, ULONG position) {
+  ULONG middle;
+
+  while (n < last) {
+    middle = n + (last - n + 1) / 2;
+    if (getLine(metadata, middle)->filePosition <= position) n = middle;
+    else last = middle - 1;
+  }
+  return n;
+}
+
+/* The last byte of the next find of the search's literals, or NULL */
+static const char *findLiteralEnd(const struct LineSearch *search,
+                                  const char *data, const char *end) {
+  const char *p;
+
+  if (search->set) return findSetLiteral(search->set, data, end);
+
+  p = findPatternLiteral(search->compiled, data, end);
+  return p ? p + search->compiled->literalLength - 1 : NULL;
+}
+
+/*
+ * Match a chunk of an unedited file by its literals. Unedited lines lie in
+ * the file data in line order, so the literals are looked for in the data
+ * of the whole chunk at once, and only a line a find ends in is matched in
+ * full; the lines in between are never looked at. A find ending on a line
+ * end, or in the bytes of a removed line, is in no line at all.
+ */
+static void scanChunk(struct SearchJob *job, ULONG first, ULONG last) {
+  const struct FileMetadata *metadata;
+  struct LineSearch *search;
+  struct TextLine *line;
+  const char *data;
+  const char *end;
+  const char *p;
+  STRPTR string;
+  ULONG checked;
+  ULONG n;
+
+  search = job->search;
+  metadata = search->metadata;
+  data = metadata->fileData;
+
+  line = getLine(metadata, last);
+  end = data + line->filePosition + line->length;
+  p = data + getLine(metadata, first)->filePosition;
+  n = first;
+  checked = first;
+
+  while ((p = findLiteralEnd(search, p, end)) != NULL) {
+    n = lineAtPosition(metadata, n, last, p - data);
+    line = getLine(metadata, n);
+
+    if (p < data + line->filePosition + line->length) {
+      if (search->firstOnly && n - checked >= CANCEL_CHECK_LINES) {
+        if (readFirstMatch(search) < first) return;
+        checked = n;
+      }
+
+      string = copyLineString(line, job->buffer);
+      if ((search->set ? matchSetLine(job, n, string) :
+                         matchCompiledPattern(search->compiled, string)) &&
+          recordMatch(job, n)) {
+        return;
+      }
+    }
+
+    /* The line is settled either way; go on from the next */
+    if (n == last) return;
+    p = data + getLine(metadata, ++n)->filePosition;
+  }
+}
+
+/* Match the lines of one chunk */
+static void matchChunk(struct SearchJob *job, ULONG chunk) {
+  struct LineSearch *search;
+  struct TextLine *line;
+  STRPTR string;
+  ULONG first;
+  ULONG last;
+  ULONG n;
+
+  search = job->search;
+  first = chunk * SEARCH_CHUNK_LINES + 1;
+  last = first + SEARCH_CHUNK_LINES - 1;
+  if (last > search->metadata->lineCount) last = search->metadata->lineCount;
+
+  /*
+   * Edited lines have their text elsewhere, and patterns without a literal
+   * can match anywhere, so then each line is matched in turn
+   */
+  if (!search->metadata->editedLines &&
+      (search->set ? !search->set->literalFree :
+                     search->compiled->literalLength != 0)) {
+    scanChunk(job, first, last);
+    return;
+  }
+
+  for (n = first; n <= last; n++) {
+    /* Give up on the chunk once a match is known below it */
+    if (search->firstOnly && (n - first) % CANCEL_CHECK_LINES == 0 &&
+        readFirstMatch(search) < first) {
+      return;
+    }
+
+    line = getLine(search->metadata, n);
+    string = copyLineString(line, job->buffer);
+    if (search->set ? !matchSetLine(job, n, string) :
+                      !matchCompiledPattern(search->compiled, string)) {
+      continue;
+    }
+
+    if (recordMatch(job, n)) return;
+  }
+}
+
+/* Worker body: match chunks until none are left anywhere */
+static void searchChunks(struct WorkItem *item) {
+  struct SearchJob *job;
+  ULONG chunk;
+
+  job = (struct SearchJob *)item;
+  while ((chunk = takeChunk(job->search, job->run)) != NO_CHUNK) {
+    matchChunk(job, chunk);
+  }
+}
+
+/* How many workers a file is worth searching with */
+static ULONG searchWorkerCount(ULONG lineCount, ULONG chunkCount) {
+  ULONG workers;
+
+  workers = searchWorkers;
+  if (!workers) {
+#ifdef PLATFORM_POSIX
+    workers = defaultWorkerCount();
+#else
+    workers = 1;
+#endif
+  }
+
+  if (lineCount < PARALLEL_MIN_LINES) workers = 1;
+  if (workers > chunkCount) workers = chunkCount;
+  return workers ? workers : 1;
+}
+
+/*
+ * Deal the chunks out and match them. The calling task works the first run
+ * itself, so one worker needs no pool at all. Returns the number of lines
+ * matched, or with firstOnly the lowest matching line (0 for none), or
+ * SEARCH_FAILED when there is not even memory for one worker.
+ */
+static ULONG runSearch(struct LineSearch *search) {
+  const struct FileMetadata *metadata;
+  struct WorkPool *pool;
+  struct SearchJob *job;
+  ULONG *setArea;
+  ULONG chunkCount;
+  ULONG workers;
+  ULONG setSize;
+  ULONG allocSize;
+  ULONG count;
+  ULONG i;
+  ULONG p;
+
+  metadata = search->metadata;
+  chunkCount = (metadata->lineCount + SEARCH_CHUNK_LINES - 1) /
+               SEARCH_CHUNK_LINES;
+  if (!chunkCount) return 0;
+
+  workers = searchWorkerCount(metadata->lineCount, chunkCount);
+
+  /* With a set each worker also keeps hits and results of its own */
+  setSize = search->set ? search->set->words + search->set->count * 2 : 0;
+
+  /* Runs, jobs, set results and line buffers share one allocation */
+  allocSize = workers * (sizeof(struct SearchRun) + sizeof(struct SearchJob) +
+                         setSize * sizeof(ULONG) + metadata->lineBufferSize);
+  search->runs = AllocMem(allocSize, MEMF_PUBLIC | MEMF_CLEAR);
+  if (!search->runs && workers > 1) {
+    /* Short of memory the calling task searches alone, with one buffer */
+    workers = 1;
+    allocSize = sizeof(struct SearchRun) + sizeof(struct SearchJob) +
+                setSize * sizeof(ULONG) + metadata->lineBufferSize;
+    search->runs = AllocMem(allocSize, MEMF_PUBLIC | MEMF_CLEAR);
+  }
+  if (!search->runs) return SEARCH_FAILED;
+
+  search->jobs = (struct SearchJob *)(search->runs + workers);
+  setArea = (ULONG *)(search->jobs + workers);
+  search->runCount = workers;
+  search->firstMatch = NO_MATCH;
+  initWorkLock(&search->resultLock);
+
+  for (i = 0; i < workers; i++) {
+    initWorkLock(&search->runs[i].lock);
+    search->runs[i].head = chunkCount * i / workers;
+    search->runs[i].tail = chunkCount * (i + 1) / workers;
+
+    search->jobs[i].search = search;
+    search->jobs[i].run = i;
+    search->jobs[i].buffer = (char *)(setArea + workers * setSize) +
+                             i * metadata->lineBufferSize;
+
+    if (search->set) {
+      search->jobs[i].hits = setArea + i * setSize;
+      search->jobs[i].firstLines = search->jobs[i].hits + search->set->words;
+      search->jobs[i].counts = search->jobs[i].firstLines +
+                               search->set->count;
+    }
+  }
+
+  pool = workers > 1 ? createWorkPool(workers - 1) : NULL;
+  for (i = 1; pool && i < workers; i++) {
+    submitWork(pool, &search->jobs[i].item, searchChunks);
+  }
+
+  /* Without a pool the calling task steals every other run in turn */
+  searchChunks(&search->jobs[0].item);
+
+  for (i = 1; pool && i < workers; i++) waitWork(pool);
+  deleteWorkPool(pool);
+
+  count = 0;
+  for (i = 0; i < workers; i++) {
+    job = &search->jobs[i];
+    count += job->count;
+    freeWorkLock(&search->runs[i].lock);
+
+    for (p = 0; search->set && p < search->set->count; p++) {
+      search->counts[p] += job->counts[p];
+      if (job->firstLines[p] && (!search->firstLines[p] ||
+                                 job->firstLines[p] < search->firstLines[p])) {
+        search->firstLines[p] = job->firstLines[p];
+      }
+    }
+  }
+  freeWorkLock(&search->resultLock);
+
+  if (search->firstOnly) {
+    count = search->firstMatch != NO_MATCH ? search->firstMatch : 0;
+  }
+
+  FreeMem(search->runs, allocSize);
+  return count;
+}
+
+/* Number of the first line matching a compiled pattern, 0 for none */
+ULONG findFirstMatch(const struct FileMetadata *metadata,
+                     const struct CompiledPattern *compiled) {
+  struct LineSearch search;
+
+  if (!metadata || !compiled || metadata->isBinary) return 0;
+
+  memset(&search, 0, sizeof(struct LineSearch));
+  search.metadata = metadata;
+  search.compiled = compiled;
+  search.firstOnly = TRUE;
+  return runSearch(&search);
+}
+
+/* Number of lines matching a compiled pattern */
+ULONG countMatches(const struct FileMetadata *metadata,
+                   const struct CompiledPattern *compiled) {
+  struct LineSearch search;
+
+  if (!metadata || !compiled || metadata->isBinary) return 0;
+
+  memset(&search, 0, sizeof(struct LineSearch));
+  search.metadata = metadata;
+  search.compiled = compiled;
+  return runSearch(&search);
+}
+
+/* Every line matching a compiled pattern, as a bit map */
+struct LineMatches *findAllMatches(const struct FileMetadata *metadata,
+                                   const struct CompiledPattern *compiled) {
+  struct LineMatches *matches;
+  struct LineSearch search;
+  ULONG allocSize;
+  ULONG words;
+
+  if (!metadata || !compiled || metadata->isBinary) return NULL;
+
+  words = (metadata->lineCount + MATCH_WORD_BITS - 1) / MATCH_WORD_BITS;
+  allocSize = sizeof(struct LineMatches) + words * sizeof(ULONG);
+
+  matches = AllocMem(allocSize, MEMF_PUBLIC | MEMF_CLEAR);
+  if (!matches) return NULL;
+
+  matches->bits = (ULONG *)(matches + 1);
+  matches->lineCount = metadata->lineCount;
+  matches->allocSize = allocSize;
+
+  memset(&search, 0, sizeof(struct LineSearch));
+  search.metadata = metadata;
+  search.compiled = compiled;
+  search.bits = matches->bits;
+  matches->count = runSearch(&search);
+  if (matches->count == SEARCH_FAILED) {
+    freeLineMatches(matches);
+    return NULL;
+  }
+
+  return matches;
+}
+
+/*
+ * Every line matching any pattern of a set, as a bit map. Per pattern,
+ * firstLines gets the lowest line it matched (0 for none) and counts the
+ * number of lines; both need room for every pattern in the set.
+ */
+struct LineMatches *findSetMatches(const struct FileMetadata *metadata,
+                                   const struct PatternSet *set,
+                                   ULONG *firstLines, ULONG *counts) {
+  struct LineMatches *matches;
+  struct LineSearch search;
+  ULONG allocSize;
+  ULONG words;
+
+  if (!metadata || !set || metadata->isBinary) return NULL;
+
+  words = (metadata->lineCount + MATCH_WORD_BITS - 1) / MATCH_WORD_BITS;
+  allocSize = sizeof(struct LineMatches) + words * sizeof(ULONG);
+
+  matches = AllocMem(allocSize, MEMF_PUBLIC | MEMF_CLEAR);
+  if (!matches) return NULL;
+
+  matches->bits = (ULONG *)(matches + 1);
+  matches->lineCount = metadata->lineCount;
+  matches->allocSize = allocSize;
+
+  memset(firstLines, 0, set->count * sizeof(ULONG));
+  memset(counts, 0, set->count * sizeof(ULONG));
+
+  memset(&search, 0, sizeof(struct LineSearch));
+  search.metadata = metadata;
+  search.set = set;
+  search.bits = matches->bits;
+  search.firstLines = firstLines;
+  search.counts = counts;
+  matches->count = runSearch(&search);
+  if (matches->count == SEARCH_FAILED) {
+    freeLineMatches(matches);
+    return NULL;
+  }
+
+  return matches;
+}
+
+/* The first matching line after a given one, or 0 when there is none */
+ULONG nextMatch(const struct LineMatches *matches, ULONG after) {
+  ULONG index;
+  ULONG word;
+
+  /* Bit index of the line after `after' */
+  index = after;
+
+  while (index < matches->lineCount) {
+    word = matches->bits[index / MATCH_WORD_BITS] >> (index % MATCH_WORD_BITS);
+    if (!word) {
+      index = (index / MATCH_WORD_BITS + 1) * MATCH_WORD_BITS;
+      continue;
+    }
+
+    while (!(word & 1)) {
+      word >>= 1;
+      index++;
+    }
+    return index + 1;
+  }
+
+  return 0;
+}
+
+void freeLineMatches(struct LineMatches *matches) {
+  if (matches) FreeMem(matches, matches->allocSize);
+}
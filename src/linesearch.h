@@ -0,0 +1,59 @@
+#ifndef LINESEARCH_H
+#define LINESEARCH_H
+
+/* Forward declarations */
+struct FileMetadata;
+struct CompiledPattern;
+struct PatternSet;
+
+#define SEARCH_CHUNK_LINES 4096   /* Lines matched per scheduling step */
+#define PARALLEL_MIN_LINES 65536  /* Smaller files are searched on one task */
+
+#define SEARCH_FAILED (~0UL)      /* Out of memory, from a search of lines */
+
+#define MATCH_WORD_BITS (sizeof(ULONG) * 8)
+
+/* Whether line n is set in a bit map of matches */
+#define IS_MATCH(bits, n) \
+  (((bits)[((n) - 1) / MATCH_WORD_BITS] >> (((n) - 1) % MATCH_WORD_BITS)) & 1)
+
+/* Matching lines of a file, one bit per line in line order */
+struct LineMatches {
+  ULONG *bits;                    /* Bit n-1 is set when line n matched */
+  ULONG lineCount;                /* Lines the bits cover */
+  ULONG count;                    /* Lines that matched */
+  ULONG allocSize;                /* Size of the whole allocation */
+};
+
+/*
+ * Searches of a loaded file. The line index is cut into chunks of
+ * SEARCH_CHUNK_LINES and each worker is dealt a run of them, which it
+ * matches front to back. A worker that runs out steals the last chunk of
+ * another worker's run. Workers match through the compiled pattern into
+ * a buffer of their own, so nothing is allocated while matching.
+ *
+ * Looking for the first match, a worker drops what is left of its run as
+ * soon as a match is known at a lower line. Looking for all matches, each
+ * chunk owns whole words of the bit map, so workers never share a word.
+ *
+ * searchWorkers caps the workers; 0 picks one per CPU on POSIX hosts and
+ * a single task on AmigaOS, where there is one CPU to share. Short of
+ * memory for them all, the calling task searches alone; short even of
+ * that, findFirstMatch() and countMatches() return SEARCH_FAILED and the
+ * others NULL.
+ */
+extern ULONG searchWorkers;
+
+ULONG findFirstMatch(const struct FileMetadata *metadata,
+                     const struct CompiledPattern *compiled);
+ULONG countMatches(const struct FileMetadata *metadata,
+                   const struct CompiledPattern *compiled);
+struct LineMatches *findAllMatches(const struct FileMetadata *metadata,
+                                   const struct CompiledPattern *compiled);
+struct LineMatches *findSetMatches(const struct FileMetadata *metadata,
+                                   const struct PatternSet *set,
+                                   ULONG *firstLines, ULONG *counts);
+ULONG nextMatch(const struct LineMatches *matches, ULONG after);
+void freeLineMatches(struct LineMatches *matches);
+
+#endif
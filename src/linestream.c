@@ -0,0 +1,340 @@
+/* linestream.c */
+#include "fileutils.h"
+
+/* Read from the file, timed and counted as loading */
+static LONG readStream(struct LineStream *stream, char *buffer, LONG length) {
+  StatsPhase phase;
+  LONG bytesRead;
+
+  ENTER_PHASE(PHASE_LOAD, phase);
+  bytesRead = Read(stream->file, buffer, length);
+  LEAVE_PHASE(phase);
+  if (bytesRead > 0) COUNT_READ(bytesRead);
+  return bytesRead;
+}
+
+/* Read the next chunk of the file; FALSE at end of file */
+static BOOL fillChunk(struct LineStream *stream) {
+  LONG bytesRead;
+
+  stream->chunkPos = 0;
+  stream->chunkLength = 0;
+
+  bytesRead = readStream(stream, stream->chunk, STREAM_BUFFER_SIZE);
+  if (bytesRead <= 0) return FALSE;
+
+  stream->chunkLength = bytesRead;
+  return TRUE;
+}
+
+/* Append text to the carried line, growing the buffer to fit it */
+static BOOL carryText(struct LineStream *stream, ULONG *carried,
+                      const char *text, ULONG length) {
+  char *buffer;
+  ULONG size;
+
+  /* Doubling keeps a long line from being copied over and over */
+  if (*carried + length >= stream->lineBufferSize) {
+    size = stream->lineBufferSize * 2;
+    if (size <= *carried + length) size = *carried + length + 1;
+
+    buffer = AllocMem(size, MEMF_ANY);
+    if (!buffer) {
+      stream->outOfMemory = TRUE;
+      return FALSE;
+    }
+
+    memcpy(buffer, stream->lineBuffer, *carried);
+    FreeMem(stream->lineBuffer, stream->lineBufferSize);
+    stream->lineBuffer = buffer;
+    stream->lineBufferSize = size;
+  }
+
+  memcpy(stream->lineBuffer + *carried, text, length);
+  *carried += length;
+  return TRUE;
+}
+
+/* Count non-printable bytes through the whole file, stopping once binary */
+static BOOL scanStream(struct LineStream *stream) {
+  ULONG threshold;
+  ULONG nonPrintable;
+  LONG bytesRead;
+
+  threshold = BINARY_THRESHOLD(stream->fileSize);
+  nonPrintable = countNonPrintable(stream->chunk, stream->chunkLength);
+
+  while (nonPrintable <= threshold) {
+    bytesRead = readStream(stream, stream->lineBuffer, STREAM_BUFFER_SIZE);
+    if (bytesRead <= 0) break;
+    nonPrintable += countNonPrintable(stream->lineBuffer, bytesRead);
+  }
+
+  return (BOOL)(nonPrintable > threshold);
+}
+
+/* Sample the file under the detection policy, then seek back */
+static DetectResult sampleStream(struct LineStream *stream) {
+  struct DetectSample sample;
+  DetectResult result;
+  ULONG blockSize;
+  ULONG i;
+  LONG bytesRead;
+
+  if (!worthSampling(stream->fileSize, &detectPolicy)) return DETECT_UNSURE;
+
+  result = checkSignature(stream->chunk, stream->chunkLength,
+                          stream->fileSize);
+  if (result != DETECT_UNSURE) return result;
+
+  /* The head sample is the first chunk, and no block outgrows a chunk */
+  memset(&sample, 0, sizeof(struct DetectSample));
+  addDetectSample(&sample, stream->chunk,
+                  stream->chunkLength < detectPolicy.headSize ?
+                  stream->chunkLength : detectPolicy.headSize);
+
+  blockSize = detectPolicy.sampleSize < STREAM_BUFFER_SIZE ?
+              detectPolicy.sampleSize : STREAM_BUFFER_SIZE;
+
+  for (i = 0; i < detectPolicy.sampleCount; i++) {
+    if (Seek(stream->file, sampleOffset(stream->fileSize, i, &detectPolicy),
+             OFFSET_BEGINNING) < 0) break;
+
+    bytesRead = readStream(stream, stream->lineBuffer, blockSize);
+    if (bytesRead <= 0) break;
+    addDetectSample(&sample, stream->lineBuffer, bytesRead);
+  }
+
+  if (Seek(stream->file, stream->chunkLength, OFFSET_BEGINNING) < 0) {
+    return DETECT_UNSURE;
+  }
+
+  return judgeDetectSample(&sample, &detectPolicy);
+}
+
+/* Judge text or binary, reading the whole file if samples leave it open */
+static BOOL judgeStream(struct LineStream *stream) {
+  DetectResult result;
+
+  result = sampleStream(stream);
+  if (result != DETECT_UNSURE) {
+    stream->isBinary = (BOOL)(result == DETECT_BINARY);
+    return TRUE;
+  }
+
+  stream->isBinary = scanStream(stream);
+  return (BOOL)(Seek(stream->file, stream->chunkLength, OFFSET_BEGINNING) >= 0);
+}
+
+/* Open a file for streaming analysis */
+struct LineStream *openLineStream(const char *filename) {
+  struct LineStream *stream;
+  StatsPhase phase;
+  BOOL judged;
+
+  stream = AllocMem(sizeof(struct LineStream), MEMF_CLEAR);
+  if (!stream) return NULL;
+
+  stream->lineBufferSize = STREAM_BUFFER_SIZE + 1;
+  stream->lineBuffer = AllocMem(stream->lineBufferSize, MEMF_ANY);
+  if (!stream->lineBuffer) {
+    FreeMem(stream, sizeof(struct LineStream));
+    return NULL;
+  }
+
+  strncpy(stream->filename, FilePart(filename), MAX_FILENAME_LEN - 1);
+  strncpy(stream->fullPath, filename, MAX_PATH_LEN - 1);
+
+  stream->file = Open(filename, MODE_OLDFILE);
+  if (!stream->file) {
+    closeLineStream(stream);
+    return NULL;
+  }
+
+  /* Get file size */
+  Seek(stream->file, 0, OFFSET_END);
+  stream->fileSize = Seek(stream->file, 0, OFFSET_BEGINNING);
+
+  ENTER_PHASE(PHASE_CLASSIFY, phase);
+  judged = (BOOL)(rewindLineStream(stream) && judgeStream(stream));
+
+  /* The first chunk is still there to tell what kind of file it is */
+  if (judged) {
+    stream->fileType = detectFileType(stream->filename, stream->chunk,
+                                      stream->chunkLength, stream->isBinary);
+    stream->classifier = selectLineClassifier(stream->fileType);
+  }
+  LEAVE_PHASE(phase);
+
+  if (!judged) {
+    closeLineStream(stream);
+    return NULL;
+  }
+  return stream;
+}
+
+/* Close the file and free the stream */
+void closeLineStream(struct LineStream *stream) {
+  if (!stream) return;
+
+  if (stream->file) Close(stream->file);
+  if (stream->lineBuffer) FreeMem(stream->lineBuffer, stream->lineBufferSize);
+  FreeMem(stream, sizeof(struct LineStream));
+}
+
+/* Start over from the first line */
+BOOL rewindLineStream(struct LineStream *stream) {
+  if (Seek(stream->file, 0, OFFSET_BEGINNING) < 0) return FALSE;
+
+  stream->filePosition = 0;
+  stream->lineNumber = 0;
+  stream->outOfMemory = FALSE;
+  fillChunk(stream);
+  return TRUE;
+}
+
+/*
+ * Hand out the next line, or NULL at end of file or when a line could not
+ * be carried (see outOfMemory). The line and its content are only valid
+ * until the next call.
+ */
+struct TextLine *nextStreamLine(struct LineStream *stream) {
+  struct TextLine *line;
+  char *start;
+  char *end;
+  char *p;
+  ULONG carried;
+  ULONG lineLength;
+  ULONG termLength;
+  LineEnding ending;
+  BOOL carrying;
+
+  line = &stream->line;
+  carried = 0;
+  lineLength = 0;
+  termLength = 0;
+  ending = EOL_NONE;
+  carrying = FALSE;
+
+  for (;;) {
+    if (stream->chunkPos == stream->chunkLength && !fillChunk(stream)) break;
+
+    start = stream->chunk + stream->chunkPos;
+    end = stream->chunk + stream->chunkLength;
+
+    /* Find end of line */
+    p = (char *)findLineEnd(start, end);
+
+    lineLength += p - start;
+
+    if (p == end) {
+      /* The line goes on in the next chunk */
+      if (!carryText(stream, &carried, start, p - start)) return NULL;
+      carrying = TRUE;
+      stream->chunkPos = stream->chunkLength;
+      continue;
+    }
+
+    if (*p == '\r' && p + 1 == end) {
+      /* A CR closing the chunk may be the first half of a CRLF */
+      if (!carryText(stream, &carried, start, p - start)) return NULL;
+      carrying = TRUE;
+      termLength = 1;
+      ending = EOL_CR;
+
+      if (fillChunk(stream) && stream->chunk[0] == '\n') {
+        stream->chunkPos = 1;
+        termLength = 2;
+        ending = EOL_CRLF;
+      }
+      break;
+    }
+
+    if (*p == '\n') ending = EOL_LF;
+    else ending = (*(p + 1) == '\n') ? EOL_CRLF : EOL_CR;
+    termLength = ENDING_LENGTH(ending);
+    stream->chunkPos = (p - stream->chunk) + termLength;
+
+    if (carrying) {
+      if (!carryText(stream, &carried, start, p - start)) return NULL;
+    } else {
+      /* The whole line is in this chunk, so terminate it where it lies */
+      *p = '\0';
+      line->content = start;
+      line->length = p - start;
+    }
+    break;
+  }
+
+  if (!lineLength && !termLength) return NULL;
+
+  if (carrying) {
+    stream->lineBuffer[carried] = '\0';
+    line->content = stream->lineBuffer;
+    line->length = carried;
+  }
+
+  stream->lineNumber++;
+  line->parent = NULL;
+  line->lineNumber = stream->lineNumber;
+  line->filePosition = stream->filePosition;
+  line->rawLength = lineLength + termLength;
+  line->hasNewline = (BOOL)(termLength > 0);
+  line->ending = ending;
+  line->type = classifyLine(stream->classifier, line->content, line->length);
+
+  stream->filePosition += line->rawLength;
+  return line;
+}
+
+/* Print file information, reading the file twice instead of holding it */
+void printStreamInfo(struct LineStream *stream) {
+  struct TextLine *line;
+  ULONG lineCount;
+
+  if (!stream) return;
+
+  Printf("File: %s\n", stream->filename);
+  Printf("Path: %s\n", stream->fullPath);
+  Printf("Size: %ld bytes\n", stream->fileSize);
+  printFileType(stream->isBinary, stream->fileType);
+
+  if (!stream->isBinary) {
+    /* The first pass only counts, so the total can be printed up front */
+    lineCount = 0;
+    while (nextStreamLine(stream)) lineCount++;
+    if (stream->outOfMemory) return;
+    Printf("Lines: %ld\n", lineCount);
+
+    if (!rewindLineStream(stream)) return;
+
+    while ((line = nextStreamLine(stream))) {
+      printLineInfo(line);
+    }
+  }
+}
+
+/* Check whether a file is too large to be loaded into memory whole */
+BOOL shouldStreamFile(const char *filename) {
+  struct FileInfoBlock *fib;
+  BPTR lock;
+  BOOL tooLarge;
+
+  tooLarge = FALSE;
+
+  lock = Lock(filename, ACCESS_READ);
+  if (!lock) return FALSE;
+
+  fib = AllocDosObject(DOS_FIB, NULL);
+  if (fib) {
+    /* Leave room for the line index and pool overhead on top of the data */
+    if (Examine(lock, fib)) {
+      tooLarge = (BOOL)((ULONG)fib->fib_Size >
+                        AvailMem(MEMF_ANY | MEMF_LARGEST) / 3 * 2);
+    }
+    FreeDosObject(DOS_FIB, fib);
+  }
+
+  UnLock(lock);
+  return tooLarge;
+}
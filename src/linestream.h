@@ -0,0 +1,47 @@
+#ifndef LINESTREAM_H
+#define LINESTREAM_H
+
+#define STREAM_BUFFER_SIZE 16384  /* Bytes read from the file at a time */
+
+/*
+ * A LineStream reads a file in fixed-size chunks and hands out one line at
+ * a time, so files of any size can be analyzed in memory bounded by their
+ * longest line.
+ *
+ * Lines that end inside the current chunk are terminated in place and not
+ * copied. A line that straddles two chunks, including one whose CR/LF pair
+ * is split between them, is carried over in lineBuffer, which grows to
+ * hold the longest line carried. If it cannot grow, nextStreamLine() stops
+ * early and sets outOfMemory, so a line is never handed out cut short.
+ *
+ * Text or binary is judged once when the stream is opened, by sampling
+ * under detectPolicy and reading the whole file only when that is not
+ * conclusive.
+ */
+struct LineStream {
+  BPTR file;                              /* Open file handle */
+  char filename[MAX_FILENAME_LEN];        /* File name */
+  char fullPath[MAX_PATH_LEN];            /* Full path */
+  ULONG fileSize;                         /* Size in bytes */
+  BOOL isBinary;                          /* Binary or text flag */
+  FileType fileType;                      /* What kind of file it is */
+  const struct LineClassifier *classifier;  /* Types its lines */
+  ULONG filePosition;                     /* File offset of the next line */
+  ULONG lineNumber;                       /* Number of the last line */
+  ULONG chunkLength;                      /* Valid bytes in chunk */
+  ULONG chunkPos;                         /* Next unconsumed byte in chunk */
+  struct TextLine line;                   /* The line last handed out */
+  BOOL outOfMemory;                       /* A line was too long to carry */
+  char *lineBuffer;                       /* Carry for straddling lines */
+  ULONG lineBufferSize;                   /* Its size, at least a chunk + 1 */
+  char chunk[STREAM_BUFFER_SIZE];         /* Current chunk of the file */
+};
+
+struct LineStream *openLineStream(const char *filename);
+void closeLineStream(struct LineStream *stream);
+BOOL rewindLineStream(struct LineStream *stream);
+struct TextLine *nextStreamLine(struct LineStream *stream);
+void printStreamInfo(struct LineStream *stream);
+BOOL shouldStreamFile(const char *filename);
+
+#endif
@@ -1,67 +1,57 @@
-#include "textline.h"
-#include "filemetadata.h"
-#include "linetype.h"
-
-LineType determineLineType(struct TextLine *line, AnalyzeLine **analyzers) {
-  AnalyzeLine *analyzer;
-
-  if (!line) {
-    return LINE_UNKNOWN;
-  }
-
-  while (analyzer = *analyzers) {
-    LineType type = analyzer(line, line->parent);
-    analyzer++;
-
-    if (!analyzer) {
-      return type
-    }
-  }
-
-  return LINE_UNKNOWN;
-};
-
-AnalyzeLine *DetectADOSScriptComment(TextLine *line) {
-  char *trimmed;
-
-  trimmed = line->content;
-  /* Skip leading whitespace */
-  while (*trimmed && (*trimmed == ' ' || *trimmed == '\t')) trimmed++;
-
-  if (*trimmed == ';') {
-    return LINE_COMMENT;
+/* linetype.c */
+#include "fileutils.h"
+
+#define CMD LINE_COMMAND
+#define REM LINE_COMMENT
+
+/* Sixteen first bytes that all start a command */
+#define COMMANDS CMD, CMD, CMD, CMD, CMD, CMD, CMD, CMD, \
+                 CMD, CMD, CMD, CMD, CMD, CMD, CMD, CMD
+
+/* AmigaDOS and Installer scripts comment lines out with a semicolon */
+static const struct LineClassifier semicolonComments = {{
+  COMMANDS, COMMANDS,                           /* 0x00-0x1F */
+  COMMANDS,                                     /* 0x20-0x2F */
+  CMD, CMD, CMD, CMD, CMD, CMD, CMD, CMD,       /* 0x30-0x37 */
+  CMD, CMD, CMD, REM, CMD, CMD, CMD, CMD,       /* ';' */
+  COMMANDS, COMMANDS, COMMANDS, COMMANDS,       /* 0x40-0x7F */
+  COMMANDS, COMMANDS, COMMANDS, COMMANDS,       /* 0x80-0xFF */
+  COMMANDS, COMMANDS, COMMANDS, COMMANDS
+}};
+
+/*
+ * C and ARexx comments start with a slash, and the lines inside a block
+ * comment usually with an asterisk
+ */
+static const struct LineClassifier slashComments = {{
+  COMMANDS, COMMANDS,                           /* 0x00-0x1F */
+  CMD, CMD, CMD, CMD, CMD, CMD, CMD, CMD,       /* 0x20-0x27 */
+  CMD, CMD, REM, CMD, CMD, CMD, CMD, REM,       /* '*' and '/' */
+  COMMANDS,                                     /* 0x30-0x3F */
+  COMMANDS, COMMANDS, COMMANDS, COMMANDS,       /* 0x40-0x7F */
+  COMMANDS, COMMANDS, COMMANDS, COMMANDS,       /* 0x80-0xFF */
+  COMMANDS, COMMANDS, COMMANDS, COMMANDS
+}};
+
+/* The classifier for a type of file; text of no known type is a script */
+const struct LineClassifier *selectLineClassifier(FileType type) {
+  switch (type) {
+    case FILE_C_SOURCE:
+    case FILE_AREXX:
+      return &slashComments;
+    default:
+      return &semicolonComments;
   }
-
-  return LINE_UNKNOWN;
 }
 
-AnalyzeLine *DetectADOSScriptCommand(TextLine *line) {
-  char *trimmed;
-
-  trimmed = line->content;
-  /* Skip leading whitespace */
-  while (*trimmed && (*trimmed == ' ' || *trimmed == '\t')) trimmed++;
+/* Type a line from its text */
+LineType classifyLine(const struct LineClassifier *classifier,
+                      const char *text, ULONG length) {
+  const char *end;
 
-  if (!*trimmed && *trimmed != ';') {
-    return LINE_COMMAND;
-  }
+  end = text + length;
+  while (text < end && (*text == ' ' || *text == '\t')) text++;
 
-  /* Maybe also check if the command exists within the path for a smarter
-     approach */
-
-  return LINE_UNKNOWN;
+  if (text == end) return LINE_EMPTY;
+  return (LineType)classifier->firstByte[(UBYTE)*text];
 }
-
-AnalyzeLine *DetectADOSEmptyLine(TextLine *line) {
-  char *trimmed;
-
-  trimmed = line->content;
-  /* Skip leading whitespace */
-  while (*trimmed && (*trimmed == ' ' || *trimmed == '\t')) trimmed++;
-
-  if (!*trimmed) {
-    return LINE_EMPTY;
-  }
-
-  return LINE_UNKNOWN;
-}
\ No newline at end of file
@@ -1,40 +1,29 @@
 #ifndef LINETYPE_H
 #define LINETYPE_H
 
-/* Forward declarations */
-struct TextLine;
-struct FileMetadata;
-
 /* Enum for script line types */
 typedef enum LineType {
   LINE_UNKNOWN,
-  LINE_EMPTY,
-  LINE_COMMENT,  /* Starts with semicolon or is empty */
-  LINE_COMMAND   /* Actual AmigaDOS command */
+  LINE_EMPTY,    /* Nothing but spaces and TABs */
+  LINE_COMMENT,  /* Starts with the file type's comment marker */
+  LINE_COMMAND   /* Actual AmigaDOS command, or code in other types */
 } LineType;
 
 /*!
- * The AnalyzeLine functions are used to determine if a line of a given
- * file is a comment, a command or some other type.
+ * A LineClassifier types the lines of one kind of file. Leading spaces and
+ * TABs are skipped once; a line with nothing else is empty, and any other
+ * line gets the type its first remaining byte maps to. The byte scan looks
+ * the same table up as it passes the first byte of each line.
  *
- * \param line a pointer to a \see struct TextLine. It represents the line
- * in question
- * \param metadata a pointer to a \see struct FileMetadata. It represents
- * the whole file in question.
+ * The classifier is picked once per file from its FileType and kept with
+ * the file, so typing a line costs a single lookup.
  */
-typedef LineType (*AnalyzeLine)(struct TextLine *line);
-
-LineType determineLineType(struct TextLine *line, AnalyzeLine **analyzers);
-
-const AnalyzeLine *DetectADOSScriptComment;
-const AnalyzeLine *DetectADOSScriptCommand;
-const AnalyzeLine *DetectADOSEmptyLine;
+struct LineClassifier {
+  UBYTE firstByte[256];   /* LineType by first byte after the blanks */
+};
 
-const AnalyzeLine ADOSScriptAnalyzers[] = [
-  DetectADOSScriptComment,
-  DetectADOSScriptCommand,
-  DetectADOSEmptyLine,
-  NULL
-];
+const struct LineClassifier *selectLineClassifier(FileType type);
+LineType classifyLine(const struct LineClassifier *classifier,
+                      const char *text, ULONG length);
 
-#endf
\ No newline at end of file
+#endif
@@ -0,0 +1,78 @@
+/* outstream.c */
+#include "fileutils.h"
+
+/* Start gathering output for a file; the buffer is too big for the stack */
+struct OutStream *openOutStream(BPTR file) {
+  struct OutStream *out;
+
+  out = AllocMem(sizeof(struct OutStream), MEMF_ANY);
+  if (!out) return NULL;
+
+  out->file = file;
+  out->length = 0;
+  out->failed = FALSE;
+
+  /* Anything Printf() still holds has to come out first */
+  Flush(file);
+  return out;
+}
+
+/* Write out the rest and free the stream; FALSE if any write failed */
+BOOL closeOutStream(struct OutStream *out) {
+  BOOL success;
+
+  success = flushOutStream(out);
+  FreeMem(out, sizeof(struct OutStream));
+  return success;
+}
+
+/* Write out what has been gathered */
+BOOL flushOutStream(struct OutStream *out) {
+  if (out->length && !out->failed) {
+    if (Write(out->file, out->buffer, out->length) != out->length) {
+      out->failed = TRUE;
+    }
+    COUNT_WRITE(out->length);
+  }
+
+  out->length = 0;
+  return (BOOL)!out->failed;
+}
+
+/* Add text; anything too large for the buffer is written straight out */
+void putChars(struct OutStream *out, const char *text, ULONG length) {
+  if (out->length + length > OUTPUT_BUFFER_SIZE) {
+    flushOutStream(out);
+
+    if (length >= OUTPUT_BUFFER_SIZE) {
+      if (!out->failed) {
+        if (Write(out->file, (APTR)text, length) != length) out->failed = TRUE;
+        COUNT_WRITE(length);
+      }
+      return;
+    }
+  }
+
+  memcpy(out->buffer + out->length, text, length);
+  out->length += length;
+}
+
+void putString(struct OutStream *out, const char *text) {
+  putChars(out, text, strlen(text));
+}
+
+/* Add a number in decimal, right aligned to at least width characters */
+void putNumber(struct OutStream *out, ULONG number, ULONG width) {
+  char digits[24];
+  ULONG start;
+
+  start = sizeof(digits);
+  do {
+    digits[--start] = '0' + number % 10;
+    number /= 10;
+  } while (number);
+
+  while (sizeof(digits) - start < width && start > 0) digits[--start] = ' ';
+
+  putChars(out, digits + start, sizeof(digits) - start);
+}
@@ -0,0 +1,26 @@
+#ifndef OUTSTREAM_H
+#define OUTSTREAM_H
+
+#define OUTPUT_BUFFER_SIZE 4096  /* Bytes gathered before each Write() */
+
+/*
+ * Output gathered in a buffer and written in large blocks, for commands
+ * that print a line per match. Opening a stream flushes what Printf() has
+ * buffered on the same file, so output stays in order as long as the
+ * stream is closed before Printf() is used again.
+ */
+struct OutStream {
+  BPTR file;                       /* Where the output goes */
+  ULONG length;                    /* Bytes waiting in buffer */
+  BOOL failed;                     /* A write failed; the rest is dropped */
+  char buffer[OUTPUT_BUFFER_SIZE];
+};
+
+struct OutStream *openOutStream(BPTR file);
+BOOL closeOutStream(struct OutStream *out);
+void putChars(struct OutStream *out, const char *text, ULONG length);
+void putString(struct OutStream *out, const char *text);
+void putNumber(struct OutStream *out, ULONG number, ULONG width);
+BOOL flushOutStream(struct OutStream *out);
+
+#endif
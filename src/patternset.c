@@ -0,0 +1,320 @@
+/* patternset.c */
+#include "fileutils.h"
+
+/* Set the bit of pattern i in a bit map of patterns */
+#define SET_PATTERN_HIT(hits, i) \
+  ((hits)[(i) / MATCH_WORD_BITS] |= 1UL << ((i) % MATCH_WORD_BITS))
+
+/*
+ * Build the automaton from the patterns' literals: a trie of them first,
+ * then, breadth first, every missing move filled in from the state the
+ * longest proper suffix leads to. State 0 is the root; while the trie is
+ * built a move to 0 means there is none, as nothing moves back to the root
+ * but a fallback.
+ */
+static BOOL buildAutomaton(struct PatternSet *set) {
+  const struct CompiledPattern *compiled;
+  ULONG *fail;
+  ULONG *queue;
+  ULONG maxStates;
+  ULONG state;
+  ULONG child;
+  ULONG head;
+  ULONG tail;
+  ULONG i;
+  ULONG n;
+  ULONG c;
+  UBYTE byte;
+
+  /* Give each byte of a literal a column; without case both cases share one */
+  set->classes = 1;
+  maxStates = 1;
+  for (i = 0; i < set->count; i++) {
+    compiled = set->patterns[i];
+    if (!compiled->literalLength) {
+      SET_PATTERN_HIT(set->always, i);
+      set->literalFree++;
+      continue;
+    }
+
+    maxStates += compiled->literalLength;
+    for (n = 0; n < compiled->literalLength; n++) {
+      byte = compiled->literal[n];
+      if (set->classOf[byte]) continue;
+
+      set->classOf[byte] = set->classes;
+      if (set->noCase && byte >= 'a' && byte <= 'z') {
+        set->classOf[byte - 'a' + 'A'] = set->classes;
+      }
+      set->classes++;
+    }
+  }
+
+  set->next = AllocPooled(set->pool, maxStates * set->classes * sizeof(ULONG));
+  set->output = AllocPooled(set->pool, maxStates * sizeof(ULONG));
+  set->outputLink = AllocPooled(set->pool, maxStates * sizeof(ULONG));
+  set->sameLiteral = AllocPooled(set->pool, set->count * sizeof(ULONG));
+  fail = AllocPooled(set->pool, maxStates * sizeof(ULONG));
+  queue = AllocPooled(set->pool, maxStates * sizeof(ULONG));
+  if (!set->next || !set->output || !set->outputLink || !set->sameLiteral ||
+      !fail || !queue) {
+    return FALSE;
+  }
+
+  /* The trie; patterns with the same literal end in the same state */
+  set->states = 1;
+  for (i = 0; i < set->count; i++) {
+    compiled = set->patterns[i];
+    if (!compiled->literalLength) continue;
+
+    state = 0;
+    for (n = 0; n < compiled->literalLength; n++) {
+      c = set->classOf[(UBYTE)compiled->literal[n]];
+      child = set->next[state * set->classes + c];
+      if (!child) {
+        child = set->states++;
+        set->next[state * set->classes + c] = child;
+      }
+      state = child;
+    }
+
+    set->sameLiteral[i] = set->output[state];
+    set->output[state] = i + 1;
+  }
+
+  /* The root's missing moves already lead back to it */
+  head = 0;
+  tail = 0;
+  for (c = 0; c < set->classes; c++) {
+    child = set->next[c];
+    if (child) queue[tail++] = child;
+  }
+
+  /* A state's fallback is shallower, so its row is complete by now */
+  while (head < tail) {
+    state = queue[head++];
+    for (c = 0; c < set->classes; c++) {
+      child = set->next[state * set->classes + c];
+      if (!child) {
+        set->next[state * set->classes + c] =
+          set->next[fail[state] * set->classes + c];
+        continue;
+      }
+
+      fail[child] = set->next[fail[state] * set->classes + c];
+      set->outputLink[child] = set->output[fail[child]] ?
+                               fail[child] : set->outputLink[fail[child]];
+      queue[tail++] = child;
+    }
+  }
+
+  FreePooled(set->pool, queue, maxStates * sizeof(ULONG));
+  FreePooled(set->pool, fail, maxStates * sizeof(ULONG));
+  return TRUE;
+}
+
+struct PatternSet *compilePatternSet(CONST_STRPTR *patterns, ULONG count,
+                                     BOOL noCase, ULONG *failed) {
+  struct PatternSet *set;
+  APTR pool;
+  ULONG i;
+
+  *failed = count;
+  if (!count) return NULL;
+
+  pool = CreatePool(MEMF_CLEAR, POOL_PUDDLE_SIZE, POOL_THRESH_SIZE);
+  if (!pool) return NULL;
+
+  set = AllocPooled(pool, sizeof(struct PatternSet));
+  if (!set) {
+    DeletePool(pool);
+    return NULL;
+  }
+
+  set->pool = pool;
+  set->count = count;
+  set->words = (count + MATCH_WORD_BITS - 1) / MATCH_WORD_BITS;
+  set->noCase = noCase;
+  set->patterns = AllocPooled(pool, count * sizeof(struct CompiledPattern *));
+  set->always = AllocPooled(pool, set->words * sizeof(ULONG));
+  if (!set->patterns || !set->always) {
+    freePatternSet(set);
+    return NULL;
+  }
+
+  for (i = 0; i < count; i++) {
+    set->patterns[i] = compilePattern(patterns[i], noCase);
+    if (!set->patterns[i]) {
+      *failed = i;
+      freePatternSet(set);
+      return NULL;
+    }
+  }
+
+  if (!buildAutomaton(set)) {
+    freePatternSet(set);
+    return NULL;
+  }
+
+  return set;
+}
+
+/* Read a pattern list; reports the first bad line and returns NULL */
+struct PatternSet *loadPatternSet(const char *filename, CONST_STRPTR first,
+                                  BOOL noCase) {
+  struct FileMetadata *list;
+  struct PatternSet *set;
+  struct TextLine *line;
+  CONST_STRPTR *sources;
+  ULONG *sourceLines;
+  const char *text;
+  STRPTR copy;
+  ULONG count;
+  ULONG failed;
+  ULONG i;
+  ULONG n;
+
+  list = analyzeFile(filename);
+  if (!list) {
+    Printf("Could not read pattern list %s\n", filename);
+    return NULL;
+  }
+
+  if (list->isBinary) {
+    Printf("Pattern list %s is not a text file\n", filename);
+    freeFileMetadata(list);
+    return NULL;
+  }
+
+  /* Everything gathered here goes with the list's pool */
+  sources = AllocPooled(list->pool, (list->lineCount + 1) *
+                                    sizeof(CONST_STRPTR));
+  sourceLines = AllocPooled(list->pool, (list->lineCount + 1) *
+                                        sizeof(ULONG));
+  if (!sources || !sourceLines) {
+    Printf("Not enough memory for pattern list %s\n", filename);
+    freeFileMetadata(list);
+    return NULL;
+  }
+
+  count = 0;
+  if (first) sources[count++] = first;
+
+  for (i = 1; i <= list->lineCount; i++) {
+    line = getLine(list, i);
+
+    /* Blanks can be part of a pattern, so lines are taken as they are */
+    text = lineText(line);
+    if (line->length && text[0] == ';') continue;
+    for (n = 0; n < line->length && (text[n] == ' ' || text[n] == '\t'); n++);
+    if (n == line->length) continue;
+
+    copy = AllocPooled(list->pool, line->length + 1);
+    if (!copy) {
+      Printf("Not enough memory for pattern list %s\n", filename);
+      freeFileMetadata(list);
+      return NULL;
+    }
+    memcpy(copy, text, line->length);
+    copy[line->length] = '\0';
+
+    sourceLines[count] = i;
+    sources[count++] = copy;
+  }
+
+  if (!count) {
+    Printf("Pattern list %s holds no patterns\n", filename);
+    freeFileMetadata(list);
+    return NULL;
+  }
+
+  set = compilePatternSet(sources, count, noCase, &failed);
+  if (!set) {
+    if (failed == count) {
+      Printf("Not enough memory for pattern list %s\n", filename);
+    } else if (first && failed == 0) {
+      Printf("Invalid pattern %s\n", first);
+    } else {
+      Printf("%s line %ld: invalid pattern \"%s\"\n", filename,
+             sourceLines[failed], sources[failed]);
+    }
+  }
+
+  freeFileMetadata(list);
+  return set;
+}
+
+/*
+ * Run the line through the automaton, marking every pattern whose literal
+ * ends at each byte, then confirm the marked ones with the full matcher
+ */
+ULONG matchPatternSet(const struct PatternSet *set, STRPTR string,
+                      ULONG *hits) {
+  const UBYTE *p;
+  ULONG state;
+  ULONG found;
+  ULONG matched;
+  ULONG word;
+  ULONG bits;
+  ULONG bit;
+  ULONG i;
+
+  memcpy(hits, set->always, set->words * sizeof(ULONG));
+
+  state = 0;
+  for (p = (const UBYTE *)string; *p; p++) {
+    state = set->next[state * set->classes + set->classOf[*p]];
+
+    found = set->output[state] ? state : set->outputLink[state];
+    for (; found; found = set->outputLink[found]) {
+      for (i = set->output[found]; i; i = set->sameLiteral[i - 1]) {
+        SET_PATTERN_HIT(hits, i - 1);
+      }
+    }
+  }
+
+  matched = 0;
+  for (word = 0; word < set->words; word++) {
+    bits = hits[word];
+    for (bit = 0; bits; bit++, bits >>= 1) {
+      if (!(bits & 1)) continue;
+
+      i = word * MATCH_WORD_BITS + bit;
+      if (matchCompiledPattern(set->patterns[i], string)) matched++;
+      else hits[word] &= ~(1UL << bit);
+    }
+  }
+
+  return matched;
+}
+
+/*
+ * Run raw data through the automaton and return the last byte of the first
+ * literal found, or NULL if there is none before end. The data may hold
+ * several lines, so a find can run across the end of one.
+ */
+const char *findSetLiteral(const struct PatternSet *set, const char *data,
+                           const char *end) {
+  const UBYTE *p;
+  ULONG state;
+
+  state = 0;
+  for (p = (const UBYTE *)data; p < (const UBYTE *)end; p++) {
+    state = set->next[state * set->classes + set->classOf[*p]];
+    if (set->output[state] || set->outputLink[state]) return (const char *)p;
+  }
+
+  return NULL;
+}
+
+/* Free a set and every pattern compiled for it */
+void freePatternSet(struct PatternSet *set) {
+  ULONG i;
+
+  if (!set) return;
+
+  for (i = 0; set->patterns && i < set->count; i++) {
+    freeCompiledPattern(set->patterns[i]);
+  }
+  DeletePool(set->pool);
+}
@@ -0,0 +1,61 @@
+#ifndef PATTERNSET_H
+#define PATTERNSET_H
+
+/* Forward declarations */
+struct CompiledPattern;
+
+/* Whether pattern i is set in a bit map of patterns */
+#define IS_PATTERN_HIT(hits, i) \
+  (((hits)[(i) / MATCH_WORD_BITS] >> ((i) % MATCH_WORD_BITS)) & 1)
+
+/*
+ * Several patterns matched against a line in one pass. The literal each
+ * pattern requires (see compilePattern()) goes into one Aho-Corasick
+ * automaton, so a line is read once however many patterns there are, and
+ * only the patterns whose literal turned up in it, or that have none, are
+ * matched in full.
+ *
+ * The automaton is a table with a row per state and a column per class
+ * of byte. Bytes in no literal share column 0, so the table stays small
+ * however the literals are spelt.
+ */
+struct PatternSet {
+  APTR pool;                          /* Memory pool owning the set */
+  ULONG count;                        /* Patterns in the set */
+  ULONG words;                        /* ULONGs in a bit map of patterns */
+  BOOL noCase;                        /* Case insensitive matching */
+  struct CompiledPattern **patterns;  /* In the order given */
+  ULONG *always;                      /* Patterns without a literal */
+  ULONG literalFree;                  /* How many of them there are */
+  ULONG classes;                      /* Columns in the table */
+  ULONG states;                       /* Rows in the table */
+  ULONG *next;                        /* State after a byte, by class */
+  ULONG *output;                      /* First pattern ending in a state, +1 */
+  ULONG *outputLink;                  /* Nearest shorter state with output */
+  ULONG *sameLiteral;                 /* Next pattern with the same literal, +1 */
+  UBYTE classOf[256];                 /* Column for each byte */
+};
+
+/*
+ * Compile patterns into a set. On failure *failed is the index of the
+ * pattern that would not compile, or count when memory ran out.
+ */
+struct PatternSet *compilePatternSet(CONST_STRPTR *patterns, ULONG count,
+                                     BOOL noCase, ULONG *failed);
+
+/*
+ * Read a pattern list, one pattern per line, and compile it with an
+ * optional first pattern ahead of it. Blank lines and lines starting
+ * with ; are skipped. Reports what went wrong and returns NULL.
+ */
+struct PatternSet *loadPatternSet(const char *filename, CONST_STRPTR first,
+                                  BOOL noCase);
+
+/* Match a line; sets the bit of every pattern that matched in hits */
+ULONG matchPatternSet(const struct PatternSet *set, STRPTR string,
+                      ULONG *hits);
+const char *findSetLiteral(const struct PatternSet *set, const char *data,
+                           const char *end);
+void freePatternSet(struct PatternSet *set);
+
+#endif
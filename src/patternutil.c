@@ -1,50 +1,334 @@
 /* patternutil.c */
 #include "patternutil.h"
+#include <string.h>
+
+static struct CompiledPattern *patternCache[PATTERN_CACHE_SIZE];
+static ULONG patternClock;
 
 BOOL MatchString(CONST_STRPTR pattern, STRPTR string) {
-  UBYTE *parsedPattern;
-  BOOL result;
-  LONG size;
+  struct CompiledPattern *compiled;
+
+  compiled = obtainPattern(pattern, FALSE);
+  if (!compiled) return FALSE;
 
-  /* Get required buffer size */
-  size = ParsePatternNoCase(pattern, NULL, 0);
-  if (size < 0) return FALSE;
+  return matchCompiledPattern(compiled, string);
+}
+
+BOOL MatchStringNoCase(CONST_STRPTR pattern, STRPTR string) {
+  struct CompiledPattern *compiled;
 
-  /* Allocate pattern buffer */
-  parsedPattern = AllocMem(size, MEMF_CLEAR);
-  if (!parsedPattern) return FALSE;
+  compiled = obtainPattern(pattern, TRUE);
+  if (!compiled) return FALSE;
 
-  /* Parse and match */
-  if (ParsePattern(pattern, parsedPattern, size) >= 0) {
-    result = MatchPattern(parsedPattern, string);
-  } else {
-    result = FALSE;
+  return matchCompiledPattern(compiled, string);
+}
+
+/* Step over one item of a pattern: a character, 'x, [class] or (group) */
+static const char *skipItem(const char *p) {
+  int depth;
+
+  switch (*p) {
+    case '\'':
+      return p[1] ? p + 2 : p + 1;
+    case '#':
+    case '~':
+      return p[1] ? skipItem(p + 1) : p + 1;
+    case '[':
+      for (p++; *p && *p != ']'; p++) {
+        if (*p == '\'' && p[1]) p++;
+      }
+      return *p ? p + 1 : p;
+    case '(':
+      depth = 0;
+      for (; *p; p++) {
+        if (*p == '\'' && p[1]) p++;
+        else if (*p == '(') depth++;
+        else if (*p == ')' && --depth == 0) return p + 1;
+      }
+      return p;
+    default:
+      return p + 1;
   }
+}
 
-  FreeMem(parsedPattern, size);
-  return result;
+/*
+ * How unlikely a byte is in a line of text or script: blanks and the
+ * commonest lower case letters find the most lines, punctuation the least
+ */
+static ULONG byteRarity(UBYTE c) {
+  if (c == ' ' || c == '\t') return 1;
+  if (c >= 'a' && c <= 'z') return strchr("etaoinsrhl", c) ? 2 : 3;
+  if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) return 3;
+  return 4;
 }
 
-BOOL MatchStringNoCase(CONST_STRPTR pattern, STRPTR string) {
-  UBYTE *parsedPattern;
-  BOOL result;
-  LONG size;
+/*
+ * Find the rarest run of plain characters that every match must contain,
+ * and copy it out. Each byte of a run adds its rarity, so a long run of
+ * common letters can still beat a short one of punctuation. Only
+ * characters outside any wildcard item count, and a '~' or '|' outside
+ * parentheses leaves no run at all. '*' ends a run, as it is a wildcard
+ * when dos.library is set up for it. Without case only ASCII letters are
+ * folded, so other bytes end a run too. The literal buffer needs room for
+ * two copies of the pattern; the second holds the run being read. Every
+ * other run goes to runs, each NUL terminated and the list ended by an
+ * empty one, which takes room for two copies as well.
+ */
+static ULONG findLiteral(CONST_STRPTR pattern, BOOL noCase, STRPTR literal,
+                         STRPTR runs) {
+  const char *p;
+  char *run;
+  char *next;
+  char *bestRun;
+  ULONG best;
+  ULONG bestScore;
+  ULONG length;
+  ULONG score;
+  char c;
+
+  run = literal + strlen(pattern) + 1;
+  next = runs;
+  bestRun = NULL;
+  best = 0;
+  bestScore = 0;
+  length = 0;
+  score = 0;
+
+  for (p = pattern; ; p = skipItem(p)) {
+    c = *p;
+    if (c == '~' || c == '|') {
+      best = 0;
+      bestRun = NULL;
+      next = runs;
+      break;
+    }
+
+    if (c == '\'') c = p[1];
+    else if (c && strchr("?#()[]%*", c)) c = '\0';
+    if (noCase && (UBYTE)c >= 0x80) c = '\0';
 
-  /* Get required buffer size */
-  size = ParsePatternNoCase(pattern, NULL, 0);
-  if (size < 0) return FALSE;
+    if (c) {
+      if (noCase && c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+      run[length++] = c;
+      score += byteRarity((UBYTE)c);
+      continue;
+    }
 
-  /* Allocate pattern buffer */
-  parsedPattern = AllocMem(size, MEMF_CLEAR);
-  if (!parsedPattern) return FALSE;
+    /* The run has ended */
+    if (score > bestScore) {
+      memcpy(literal, run, length);
+      best = length;
+      bestScore = score;
+      bestRun = next;
+    }
+    if (length) {
+      memcpy(next, run, length);
+      next[length] = '\0';
+      next += length + 1;
+    }
+    length = 0;
+    score = 0;
+    if (!*p) break;
+  }
 
-  /* Parse and match */
-  if (ParsePatternNoCase(pattern, parsedPattern, size) >= 0) {
-    result = MatchPatternNoCase(parsedPattern, string);
-  } else {
-    result = FALSE;
+  /* The literal is looked for apart, so it leaves the list */
+  if (bestRun) {
+    memmove(bestRun, bestRun + best + 1, next - (bestRun + best + 1));
+    next -= best + 1;
   }
+  *next = '\0';
+
+  literal[best] = '\0';
+  return best;
+}
+
+/* Whether a string holds a run; without case the run is in lower case */
+static BOOL containsRun(const char *string, const char *run, BOOL noCase) {
+  ULONG i;
+  char c;
 
-  FreeMem(parsedPattern, size);
-  return result;
+  if (!noCase) return (BOOL)(strstr(string, run) != NULL);
+
+  for (; *string; string++) {
+    for (i = 0; run[i]; i++) {
+      c = string[i];
+      if (c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+      if (c != run[i]) break;
+    }
+    if (!run[i]) return TRUE;
+  }
+  return FALSE;
+}
+
+/*
+ * Horspool shifts: how far the literal can move on when the byte under its
+ * last character is c. Shifts are capped at 255, which only costs speed.
+ */
+static void setLiteralSkip(struct CompiledPattern *compiled) {
+  ULONG length;
+  ULONG shift;
+  ULONG i;
+  UBYTE c;
+
+  length = compiled->literalLength;
+  memset(compiled->literalSkip, length < 255 ? length : 255, 256);
+
+  for (i = 0; i + 1 < length; i++) {
+    shift = length - 1 - i;
+    if (shift > 255) continue;
+
+    c = (UBYTE)compiled->literal[i];
+    compiled->literalSkip[c] = (UBYTE)shift;
+    if (compiled->noCase && c >= 'a' && c <= 'z') {
+      compiled->literalSkip[c - 'a' + 'A'] = (UBYTE)shift;
+    }
+  }
+}
+
+/* Parse a pattern into a buffer that lives as long as the result */
+struct CompiledPattern *compilePattern(CONST_STRPTR pattern, BOOL noCase) {
+  struct CompiledPattern *compiled;
+  ULONG sourceSize;
+  ULONG parsedSize;
+  ULONG allocSize;
+  LONG wild;
+
+  if (!pattern) return NULL;
+
+  /*
+   * The tokenized form needs at most twice the source plus two bytes, and
+   * finding the literal and the other runs takes room for two runs each
+   */
+  sourceSize = strlen(pattern) + 1;
+  parsedSize = sourceSize * 2;
+  allocSize = sizeof(struct CompiledPattern) + sourceSize * 5 + parsedSize;
+
+  /* Header, source, literal, runs and parsed buffer share one allocation */
+  compiled = AllocMem(allocSize, MEMF_CLEAR);
+  if (!compiled) return NULL;
+
+  compiled->source = (STRPTR)(compiled + 1);
+  compiled->literal = compiled->source + sourceSize;
+  compiled->runs = compiled->literal + sourceSize * 2;
+  compiled->parsed = compiled->runs + sourceSize * 2;
+  compiled->allocSize = allocSize;
+  compiled->noCase = noCase;
+  strcpy(compiled->source, pattern);
+
+  wild = noCase ? ParsePatternNoCase(pattern, compiled->parsed, parsedSize)
+                : ParsePattern(pattern, compiled->parsed, parsedSize);
+  if (wild < 0) {
+    FreeMem(compiled, allocSize);
+    return NULL;
+  }
+
+  compiled->hasWildcards = (BOOL)(wild > 0);
+  compiled->literalLength = findLiteral(pattern, noCase, compiled->literal,
+                                        compiled->runs);
+  setLiteralSkip(compiled);
+  return compiled;
+}
+
+BOOL matchCompiledPattern(const struct CompiledPattern *compiled,
+                          STRPTR string) {
+  const char *run;
+
+  /* Without wildcards a pattern only matches the identical string */
+  if (!compiled->hasWildcards) {
+    return (BOOL)((compiled->noCase ? stricmp(compiled->source, string)
+                                    : strcmp(compiled->source, string)) == 0);
+  }
+
+  /* A line missing any run cannot match, and finding one is cheap */
+  for (run = compiled->runs; *run; run += strlen(run) + 1) {
+    if (!containsRun(string, run, compiled->noCase)) return FALSE;
+  }
+
+  return compiled->noCase ? MatchPatternNoCase(compiled->parsed, string)
+                          : MatchPattern(compiled->parsed, string);
+}
+
+/*
+ * Find the pattern's literal in a stretch of raw data, which need not be
+ * NUL terminated. Returns where it starts, data itself when the pattern
+ * has no literal, or NULL when it is not there.
+ */
+const char *findPatternLiteral(const struct CompiledPattern *compiled,
+                               const char *data, const char *end) {
+  const UBYTE *literal;
+  const UBYTE *p;
+  const UBYTE *last;
+  ULONG length;
+  ULONG i;
+  UBYTE c;
+
+  length = compiled->literalLength;
+  if (!length) return data;
+  if ((ULONG)(end - data) < length) return NULL;
+
+  literal = (const UBYTE *)compiled->literal;
+  if (length == 1 && !compiled->noCase) {
+    return memchr(data, literal[0], end - data);
+  }
+
+  last = (const UBYTE *)end - length;
+  for (p = (const UBYTE *)data; p <= last;
+       p += compiled->literalSkip[p[length - 1]]) {
+    for (i = length; i > 0; i--) {
+      c = p[i - 1];
+      if (compiled->noCase && c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+      if (c != literal[i - 1]) break;
+    }
+    if (!i) return (const char *)p;
+  }
+
+  return NULL;
+}
+
+void freeCompiledPattern(struct CompiledPattern *compiled) {
+  if (compiled) FreeMem(compiled, compiled->allocSize);
+}
+
+/* Look a pattern up in the cache, compiling it on a miss */
+struct CompiledPattern *obtainPattern(CONST_STRPTR pattern, BOOL noCase) {
+  struct CompiledPattern *compiled;
+  ULONG slot;
+  ULONG i;
+
+  if (!pattern) return NULL;
+
+  slot = 0;
+  for (i = 0; i < PATTERN_CACHE_SIZE; i++) {
+    compiled = patternCache[i];
+
+    if (!compiled) {
+      slot = i;
+      break;
+    }
+
+    if (compiled->noCase == noCase && strcmp(compiled->source, pattern) == 0) {
+      compiled->lastUsed = ++patternClock;
+      return compiled;
+    }
+
+    /* Remember the least recently used entry in case this is a miss */
+    if (compiled->lastUsed < patternCache[slot]->lastUsed) slot = i;
+  }
+
+  compiled = compilePattern(pattern, noCase);
+  if (!compiled) return NULL;
+
+  freeCompiledPattern(patternCache[slot]);
+  patternCache[slot] = compiled;
+  compiled->lastUsed = ++patternClock;
+  return compiled;
+}
+
+void flushPatternCache(void) {
+  ULONG i;
+
+  for (i = 0; i < PATTERN_CACHE_SIZE; i++) {
+    freeCompiledPattern(patternCache[i]);
+    patternCache[i] = NULL;
+  }
 }
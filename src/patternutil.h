@@ -2,12 +2,42 @@
 #ifndef PATTERNUTIL_H
 #define PATTERNUTIL_H
 
-#include <exec/types.h>
-#include <dos/dos.h>
-#include <proto/dos.h>
+#include "platform.h"
+
+#define PATTERN_CACHE_SIZE 8  /* Compiled patterns kept by obtainPattern() */
+
+/* A pattern tokenized once by ParsePattern() and matched many times */
+struct CompiledPattern {
+  STRPTR source;                /* The pattern as given */
+  STRPTR parsed;                /* Tokenized form for MatchPattern() */
+  ULONG allocSize;              /* Size of the whole allocation */
+  BOOL noCase;                  /* Case insensitive matching */
+  BOOL hasWildcards;            /* FALSE if the pattern is a plain string */
+  STRPTR literal;               /* Rarest text every match has, or "" */
+  ULONG literalLength;          /* Lower case when noCase */
+  STRPTR runs;                  /* Other text every match has, "" ends */
+  UBYTE literalSkip[256];       /* Horspool shift for each byte */
+  ULONG lastUsed;               /* Cache stamp for LRU eviction */
+};
 
 /* Pattern matching convenience functions */
 BOOL MatchString(CONST_STRPTR pattern, STRPTR string);
 BOOL MatchStringNoCase(CONST_STRPTR pattern, STRPTR string);
 
-#endif
\ No newline at end of file
+/* Compile once, match many times, free once */
+struct CompiledPattern *compilePattern(CONST_STRPTR pattern, BOOL noCase);
+BOOL matchCompiledPattern(const struct CompiledPattern *compiled, STRPTR string);
+const char *findPatternLiteral(const struct CompiledPattern *compiled,
+                               const char *data, const char *end);
+void freeCompiledPattern(struct CompiledPattern *compiled);
+
+/*
+ * Compiled patterns shared through a small LRU cache keyed by pattern and
+ * case mode. The cache owns what it hands out: a pattern stays valid until
+ * PATTERN_CACHE_SIZE other patterns have been obtained or the cache is
+ * flushed, so callers needing many at once should compile their own.
+ */
+struct CompiledPattern *obtainPattern(CONST_STRPTR pattern, BOOL noCase);
+void flushPatternCache(void);
+
+#endif
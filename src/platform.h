@@ -0,0 +1,38 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+/*
+ * Host builds on POSIX systems (Linux and friends) swap in native backends
+ * where those beat the AmigaDOS calls. Everything else builds for AmigaOS.
+ */
+#if defined(__unix__) || defined(__APPLE__)
+#define PLATFORM_POSIX 1
+#endif
+
+/*
+ * The exec and dos calls come from the system on AmigaOS, and from
+ * hostdos.c on a host, which implements them on top of POSIX.
+ */
+#ifdef PLATFORM_POSIX
+#include "hostdos.h"
+#else
+#include <exec/types.h>
+#include <dos/dos.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <clib/alib_protos.h>
+#include <clib/exec_protos.h>
+#include <clib/dos_protos.h>
+#endif
+
+/*
+ * Byte scanning uses the widest vector unit the compiler targets. Define
+ * NO_SIMD to build the portable word-at-a-time code instead.
+ */
+#if !defined(NO_SIMD) && defined(__AVX2__)
+#define SIMD_AVX2 1
+#elif !defined(NO_SIMD) && defined(__SSE2__)
+#define SIMD_SSE2 1
+#endif
+
+#endif
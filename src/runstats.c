@@ -0,0 +1,291 @@
+/* runstats.c */
+#include "fileutils.h"
+
+struct RunStats *runStats = NULL;
+
+/* Names of the phases in the output, in StatsPhase order */
+static const char *const phaseNames[STATS_PHASES] = {
+  "other", "load", "classify", "parse", "match", "save"
+};
+
+#ifdef PLATFORM_POSIX
+
+#include <time.h>
+#include <sys/resource.h>
+
+typedef struct timespec StatsClock;
+typedef unsigned long long StatsTicks;    /* Nanoseconds */
+
+#else
+
+#include <devices/timer.h>
+#include <proto/timer.h>
+
+typedef struct EClockVal StatsClock;
+typedef ULONG StatsTicks;                 /* E clock ticks */
+
+struct Device *TimerBase = NULL;
+
+#endif
+
+struct RunStats {
+  StatsTicks phaseTicks[STATS_PHASES];    /* Time spent in each phase */
+  ULONG phaseEntries[STATS_PHASES];       /* Times each phase was entered */
+  StatsPhase phase;                       /* Phase the main task is in */
+  StatsClock since;                       /* When it got there */
+  StatsClock started;
+  WorkLock lock;                          /* Guards the I/O counts */
+  ULONG bytesRead;
+  ULONG readCalls;
+  ULONG bytesWritten;
+  ULONG writeCalls;
+#ifdef PLATFORM_POSIX
+  pthread_t mainTask;
+  struct HostMemStats memStart;           /* Host counts when STATS began */
+#else
+  struct Task *mainTask;
+  struct timerequest timerRequest;        /* Holds timer.device open */
+  ULONG eclockRate;                       /* E clock ticks per second */
+  ULONG availStart;                       /* Free memory when STATS began */
+  ULONG availLowest;                      /* Least seen free since */
+#endif
+};
+
+#ifdef PLATFORM_POSIX
+
+static BOOL openStatsClock(struct RunStats *stats) {
+  return TRUE;
+}
+
+static void closeStatsClock(struct RunStats *stats) {
+}
+
+static void readStatsClock(StatsClock *clock) {
+  clock_gettime(CLOCK_MONOTONIC, clock);
+}
+
+static StatsTicks clockTicks(const StatsClock *from, const StatsClock *to) {
+  return (StatsTicks)(to->tv_sec - from->tv_sec) * 1000000000ULL +
+         to->tv_nsec - from->tv_nsec;
+}
+
+static ULONG ticksToMicros(const struct RunStats *stats, StatsTicks ticks) {
+  return (ULONG)(ticks / 1000);
+}
+
+static void setMainTask(struct RunStats *stats) {
+  stats->mainTask = pthread_self();
+}
+
+static BOOL isMainTask(const struct RunStats *stats) {
+  return (BOOL)pthread_equal(pthread_self(), stats->mainTask);
+}
+
+static void startMemoryStats(struct RunStats *stats) {
+  getHostMemStats(&stats->memStart);
+  resetHostMemPeak();
+}
+
+/* The host counts every allocation, so there is nothing to sample */
+static void sampleMemory(struct RunStats *stats) {
+}
+
+/* Mapped files are not allocations, so the resident peak is given too */
+static void printMemoryStats(const struct RunStats *stats) {
+  struct HostMemStats mem;
+  struct rusage usage;
+
+  getHostMemStats(&mem);
+  Printf("stats.alloc.count=%ld\n",
+         mem.allocations - stats->memStart.allocations);
+  Printf("stats.alloc.bytes=%ld\n", mem.allocated - stats->memStart.allocated);
+  Printf("stats.memory.peak=%ld\n", mem.peakInUse);
+
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    Printf("stats.memory.resident=%ld\n", (ULONG)usage.ru_maxrss * 1024);
+  }
+}
+
+#else
+
+static BOOL openStatsClock(struct RunStats *stats) {
+  StatsClock clock;
+
+  if (OpenDevice(TIMERNAME, UNIT_ECLOCK,
+                 (struct IORequest *)&stats->timerRequest, 0) != 0) {
+    return FALSE;
+  }
+
+  TimerBase = stats->timerRequest.tr_node.io_Device;
+  stats->eclockRate = ReadEClock(&clock);
+  return TRUE;
+}
+
+static void closeStatsClock(struct RunStats *stats) {
+  CloseDevice((struct IORequest *)&stats->timerRequest);
+  TimerBase = NULL;
+}
+
+static void readStatsClock(StatsClock *clock) {
+  ReadEClock(clock);
+}
+
+/* The low word alone is enough for spans under an hour and a half */
+static StatsTicks clockTicks(const StatsClock *from, const StatsClock *to) {
+  return to->ev_lo - from->ev_lo;
+}
+
+/* In steps that keep every product within 32 bits */
+static ULONG ticksToMicros(const struct RunStats *stats, StatsTicks ticks) {
+  ULONG rate;
+  ULONG rest;
+  ULONG micros;
+
+  rate = stats->eclockRate;
+  micros = ticks / rate * 1000000;
+  rest = ticks % rate * 1000;
+  micros += rest / rate * 1000;
+  micros += rest % rate * 1000 / rate;
+  return micros;
+}
+
+static void setMainTask(struct RunStats *stats) {
+  stats->mainTask = FindTask(NULL);
+}
+
+static BOOL isMainTask(const struct RunStats *stats) {
+  return (BOOL)(FindTask(NULL) == stats->mainTask);
+}
+
+static void startMemoryStats(struct RunStats *stats) {
+  stats->availStart = AvailMem(MEMF_ANY);
+  stats->availLowest = stats->availStart;
+}
+
+/*
+ * Exec keeps no count of a task's allocations, so the peak is how far
+ * free memory fell, seen each time the phase changes. Other tasks
+ * allocating at the same time make it an overestimate.
+ */
+static void sampleMemory(struct RunStats *stats) {
+  ULONG avail;
+
+  avail = AvailMem(MEMF_ANY);
+  if (avail < stats->availLowest) stats->availLowest = avail;
+}
+
+static void printMemoryStats(const struct RunStats *stats) {
+  Printf("stats.memory.peak=%ld\n", stats->availStart - stats->availLowest);
+}
+
+#endif
+
+/* Start counting; FALSE if there is no memory or no clock for it */
+BOOL startRunStats(void) {
+  struct RunStats *stats;
+
+  if (runStats) return TRUE;
+
+  stats = AllocMem(sizeof(struct RunStats), MEMF_ANY | MEMF_CLEAR);
+  if (!stats) return FALSE;
+
+  if (!openStatsClock(stats)) {
+    FreeMem(stats, sizeof(struct RunStats));
+    return FALSE;
+  }
+
+  initWorkLock(&stats->lock);
+  setMainTask(stats);
+  startMemoryStats(stats);
+  stats->phase = PHASE_OTHER;
+  readStatsClock(&stats->started);
+  stats->since = stats->started;
+
+  runStats = stats;
+  return TRUE;
+}
+
+/* Charge the time since the last change to the current phase, then change */
+static void changePhase(struct RunStats *stats, StatsPhase phase) {
+  StatsClock now;
+
+  readStatsClock(&now);
+  stats->phaseTicks[stats->phase] += clockTicks(&stats->since, &now);
+  stats->since = now;
+  stats->phase = phase;
+  sampleMemory(stats);
+}
+
+/* Move the main task into a phase; returns the one to go back to */
+StatsPhase enterStatsPhase(StatsPhase phase) {
+  StatsPhase previous;
+
+  if (!isMainTask(runStats)) return PHASE_OTHER;
+
+  previous = runStats->phase;
+  if (phase != previous) {
+    runStats->phaseEntries[phase]++;
+    changePhase(runStats, phase);
+  }
+  return previous;
+}
+
+void leaveStatsPhase(StatsPhase previous) {
+  if (!isMainTask(runStats) || previous == runStats->phase) return;
+
+  changePhase(runStats, previous);
+}
+
+void countStatsIO(BOOL write, ULONG bytes) {
+  obtainWorkLock(&runStats->lock);
+  if (write) {
+    runStats->bytesWritten += bytes;
+    runStats->writeCalls++;
+  } else {
+    runStats->bytesRead += bytes;
+    runStats->readCalls++;
+  }
+  releaseWorkLock(&runStats->lock);
+}
+
+/* Print every counter as a name=value line, for scripts to pick up */
+void printRunStats(void) {
+  struct RunStats *stats;
+  ULONG i;
+
+  stats = runStats;
+  if (!stats) return;
+
+  /* Close the current phase, so the phases add up to the total */
+  changePhase(stats, stats->phase);
+
+  for (i = 0; i < STATS_PHASES; i++) {
+    Printf("stats.%s.us=%ld\n", phaseNames[i],
+           ticksToMicros(stats, stats->phaseTicks[i]));
+    Printf("stats.%s.entries=%ld\n", phaseNames[i], stats->phaseEntries[i]);
+  }
+  Printf("stats.total.us=%ld\n",
+         ticksToMicros(stats, clockTicks(&stats->started, &stats->since)));
+
+  obtainWorkLock(&stats->lock);
+  Printf("stats.read.bytes=%ld\n", stats->bytesRead);
+  Printf("stats.read.calls=%ld\n", stats->readCalls);
+  Printf("stats.write.bytes=%ld\n", stats->bytesWritten);
+  Printf("stats.write.calls=%ld\n", stats->writeCalls);
+  releaseWorkLock(&stats->lock);
+
+  printMemoryStats(stats);
+}
+
+/* Stop counting and free the counters */
+void stopRunStats(void) {
+  struct RunStats *stats;
+
+  stats = runStats;
+  if (!stats) return;
+
+  runStats = NULL;
+  freeWorkLock(&stats->lock);
+  closeStatsClock(stats);
+  FreeMem(stats, sizeof(struct RunStats));
+}
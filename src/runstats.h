@@ -0,0 +1,45 @@
+#ifndef RUNSTATS_H
+#define RUNSTATS_H
+
+/* Forward declarations */
+struct RunStats;
+
+/* The parts of a run STATS times apart */
+typedef enum StatsPhase {
+  PHASE_OTHER,        /* Anything not below: arguments, edits, printing */
+  PHASE_LOAD,         /* Reading or mapping files */
+  PHASE_CLASSIFY,     /* Sampling for binary files and picking the type */
+  PHASE_PARSE,        /* Scanning for lines and building the index */
+  PHASE_MATCH,        /* Compiling patterns and matching lines */
+  PHASE_SAVE,         /* Writing files and line caches */
+  STATS_PHASES
+} StatsPhase;
+
+/*
+ * Counters for the STATS switch. Only the task that started them moves
+ * between phases; time it spends waiting on workers goes to the phase it
+ * waits in, and phases it enters from inside another are taken out of
+ * that one's time. Reads and writes are counted from any task.
+ *
+ * With STATS off runStats is NULL, and every hook below comes down to
+ * testing it.
+ */
+extern struct RunStats *runStats;
+
+#define ENTER_PHASE(phase, saved) \
+  ((saved) = runStats ? enterStatsPhase(phase) : PHASE_OTHER)
+#define LEAVE_PHASE(saved) \
+  do { if (runStats) leaveStatsPhase(saved); } while (0)
+#define COUNT_READ(bytes) \
+  do { if (runStats) countStatsIO(FALSE, (bytes)); } while (0)
+#define COUNT_WRITE(bytes) \
+  do { if (runStats) countStatsIO(TRUE, (bytes)); } while (0)
+
+BOOL startRunStats(void);
+StatsPhase enterStatsPhase(StatsPhase phase);
+void leaveStatsPhase(StatsPhase previous);
+void countStatsIO(BOOL write, ULONG bytes);
+void printRunStats(void);
+void stopRunStats(void);
+
+#endif
@@ -0,0 +1,379 @@
+/* savewriter.c */
+#include "fileutils.h"
+
+#define TEMP_SUFFIX ".~sav"       /* The new file while it is written */
+
+#ifdef PLATFORM_POSIX
+#define MAX_NAME_CHARS 255        /* Longest name in a directory */
+#else
+#define MAX_NAME_CHARS 30         /* Longest name FFS allows */
+#endif
+
+/* Name a file beside path, cutting the base name short so suffix fits */
+static BOOL sideName(char *buffer, const char *path, const char *suffix) {
+  ULONG pathLength;
+  ULONG baseLength;
+  ULONG suffixLength;
+
+  pathLength = strlen(path);
+  baseLength = strlen(FilePart((STRPTR)path));
+  suffixLength = strlen(suffix);
+
+  if (baseLength + suffixLength > MAX_NAME_CHARS) {
+    pathLength -= baseLength + suffixLength - MAX_NAME_CHARS;
+  }
+  if (pathLength + suffixLength >= MAX_PATH_LEN) return FALSE;
+
+  memcpy(buffer, path, pathLength);
+  strcpy(buffer + pathLength, suffix);
+  return TRUE;
+}
+
+#ifdef PLATFORM_POSIX
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+
+/* Blocks gathered for each writev(); IOV_MAX may be as low as 16 */
+#if defined(IOV_MAX) && IOV_MAX < 256
+#define SAVE_VECTORS IOV_MAX
+#else
+#define SAVE_VECTORS 256
+#endif
+
+struct SaveWriter {
+  int fd;                           /* Temporary file being written */
+  BOOL failed;                      /* A write failed; the rest is dropped */
+  BOOL replacing;                   /* Whether path names a file already */
+  BOOL keepDate;                    /* Give the new file the old one's times */
+  struct stat original;             /* The file being replaced */
+  char path[MAX_PATH_LEN];          /* Where the file ends up */
+  char tempPath[MAX_PATH_LEN];      /* Where it is written */
+  ULONG count;                      /* Blocks gathered in vectors */
+  struct iovec vectors[SAVE_VECTORS];
+};
+
+/* Write out the gathered blocks, picking up after short writes */
+static void flushVectors(struct SaveWriter *writer) {
+  struct iovec *vector;
+  ULONG left;
+  ssize_t written;
+
+  vector = writer->vectors;
+  left = writer->count;
+  writer->count = 0;
+
+  while (left && !writer->failed) {
+    written = writev(writer->fd, vector, left);
+    if (written < 0) {
+      if (errno != EINTR) writer->failed = TRUE;
+      continue;
+    }
+    COUNT_WRITE(written);
+
+    while (left && (size_t)written >= vector->iov_len) {
+      written -= vector->iov_len;
+      vector++;
+      left--;
+    }
+    if (left) {
+      vector->iov_base = (char *)vector->iov_base + written;
+      vector->iov_len -= written;
+    }
+  }
+}
+
+/*
+ * Give the new file what the old one had: owner, mode and, when asked,
+ * times. A new file gets the mode open() would have given it.
+ */
+static void copyAttributes(struct SaveWriter *writer) {
+  struct timespec times[2];
+  mode_t mask;
+
+  if (!writer->replacing) {
+    mask = umask(0);
+    umask(mask);
+    fchmod(writer->fd, 0666 & ~mask);
+    return;
+  }
+
+  /* Only root may give a file away; the group and mode are kept anyway */
+  if (fchown(writer->fd, writer->original.st_uid,
+             writer->original.st_gid) < 0 &&
+      fchown(writer->fd, (uid_t)-1, writer->original.st_gid) < 0) {
+    /* Left with our own group */
+  }
+  fchmod(writer->fd, writer->original.st_mode & 07777);
+
+  if (writer->keepDate) {
+    times[0] = writer->original.st_atim;
+    times[1] = writer->original.st_mtim;
+    futimens(writer->fd, times);
+  }
+}
+
+/* Make the rename itself durable */
+static void syncDirectory(const char *path) {
+  char directory[MAX_PATH_LEN];
+  char *slash;
+  int fd;
+
+  strcpy(directory, path);
+  slash = strrchr(directory, '/');
+  if (slash == directory) slash[1] = '\0';
+  else if (slash) *slash = '\0';
+  else strcpy(directory, ".");
+
+  fd = open(directory, O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+/* Start a temporary file beside path; a link is saved through, not over */
+struct SaveWriter *openSaveWriter(const char *path,
+                                  const struct FileMetadata *source) {
+  struct SaveWriter *writer;
+  struct stat st;
+  char *target;
+
+  writer = AllocMem(sizeof(struct SaveWriter), MEMF_ANY | MEMF_CLEAR);
+  if (!writer) return NULL;
+
+  target = NULL;
+  if (lstat(path, &st) == 0 && S_ISLNK(st.st_mode)) {
+    target = realpath(path, NULL);
+  }
+  if (strlen(target ? target : path) < MAX_PATH_LEN) {
+    strcpy(writer->path, target ? target : path);
+  }
+  free(target);
+
+  writer->replacing = (BOOL)(stat(writer->path, &writer->original) == 0);
+  writer->keepDate = (BOOL)(source != NULL);
+
+  writer->fd = -1;
+  if (writer->path[0] &&
+      sideName(writer->tempPath, writer->path, TEMP_SUFFIX "XXXXXX")) {
+    writer->fd = mkstemp(writer->tempPath);
+  }
+
+  if (writer->fd < 0) {
+    FreeMem(writer, sizeof(struct SaveWriter));
+    return NULL;
+  }
+  return writer;
+}
+
+/* Add a block, merging it with the last one when they touch */
+void writeSpan(struct SaveWriter *writer, const char *data, ULONG length) {
+  struct iovec *last;
+
+  if (!length) return;
+
+  if (writer->count) {
+    last = &writer->vectors[writer->count - 1];
+    if ((char *)last->iov_base + last->iov_len == data) {
+      last->iov_len += length;
+      return;
+    }
+  }
+
+  if (writer->count == SAVE_VECTORS) flushVectors(writer);
+
+  writer->vectors[writer->count].iov_base = (void *)data;
+  writer->vectors[writer->count].iov_len = length;
+  writer->count++;
+}
+
+/*
+ * Write out the rest, get it onto the disk and rename it into place.
+ * FALSE if anything failed, in which case the old file is untouched.
+ */
+BOOL closeSaveWriter(struct SaveWriter *writer) {
+  BOOL success;
+
+  flushVectors(writer);
+  copyAttributes(writer);
+
+  success = (BOOL)!writer->failed;
+  if (fsync(writer->fd) < 0) success = FALSE;
+  if (close(writer->fd) < 0) success = FALSE;
+
+  if (success && rename(writer->tempPath, writer->path) == 0) {
+    syncDirectory(writer->path);
+  } else {
+    unlink(writer->tempPath);
+    success = FALSE;
+  }
+
+  FreeMem(writer, sizeof(struct SaveWriter));
+  return success;
+}
+
+#else
+
+#include <dos/dosextens.h>
+
+#define OLD_SUFFIX ".~old"        /* The old file while the new one moves in */
+
+struct SaveWriter {
+  BPTR file;                        /* Temporary file being written */
+  struct OutStream *out;            /* Buffer for small blocks */
+  const char *pending;              /* Block not yet handed to out */
+  ULONG pendingLength;
+  BOOL replacing;                   /* Whether path names a file already */
+  ULONG protection;                 /* Protection of the file replaced */
+  const struct DateStamp *date;     /* Date for the new file, or NULL */
+  char path[MAX_PATH_LEN];          /* Where the file ends up */
+  char tempPath[MAX_PATH_LEN];      /* Where it is written */
+  char oldPath[MAX_PATH_LEN];       /* Where the old file waits meanwhile */
+};
+
+/* Hand the pending block on; large ones skip the buffer in putChars() */
+static void flushPending(struct SaveWriter *writer) {
+  if (writer->pendingLength) {
+    putChars(writer->out, writer->pending, writer->pendingLength);
+    writer->pendingLength = 0;
+  }
+}
+
+/* Have the file system write out every buffer it holds for a volume */
+static void flushVolume(const char *path) {
+  struct DevProc *devProc;
+
+  devProc = GetDeviceProc((STRPTR)path, NULL);
+  if (devProc) {
+    DoPkt(devProc->dvp_Port, ACTION_FLUSH, 0, 0, 0, 0, 0);
+    FreeDeviceProc(devProc);
+  }
+}
+
+/* Delete a file even if it is protected from deletion */
+static void deleteFile(const char *path) {
+  SetProtection((STRPTR)path, 0);
+  DeleteFile((STRPTR)path);
+}
+
+/* Start a temporary file beside path */
+struct SaveWriter *openSaveWriter(const char *path,
+                                  const struct FileMetadata *source) {
+  struct SaveWriter *writer;
+  struct FileInfoBlock *fib;
+  BPTR lock;
+
+  writer = AllocMem(sizeof(struct SaveWriter), MEMF_ANY | MEMF_CLEAR);
+  if (!writer) return NULL;
+
+  if (strlen(path) >= MAX_PATH_LEN ||
+      !sideName(writer->tempPath, path, TEMP_SUFFIX) ||
+      !sideName(writer->oldPath, path, OLD_SUFFIX)) {
+    FreeMem(writer, sizeof(struct SaveWriter));
+    return NULL;
+  }
+  strcpy(writer->path, path);
+
+  lock = Lock((STRPTR)path, SHARED_LOCK);
+  if (lock) {
+    fib = AllocDosObject(DOS_FIB, NULL);
+    if (fib) {
+      if (Examine(lock, fib)) {
+        writer->replacing = TRUE;
+        writer->protection = fib->fib_Protection;
+      }
+      FreeDosObject(DOS_FIB, fib);
+    }
+    UnLock(lock);
+  }
+
+  if (source) writer->date = &source->dateStamp;
+
+  writer->file = Open(writer->tempPath, MODE_NEWFILE);
+  if (writer->file) {
+    writer->out = openOutStream(writer->file);
+    if (writer->out) return writer;
+    Close(writer->file);
+    DeleteFile(writer->tempPath);
+  }
+
+  FreeMem(writer, sizeof(struct SaveWriter));
+  return NULL;
+}
+
+/* Add a block, merging it with the pending one when they touch */
+void writeSpan(struct SaveWriter *writer, const char *data, ULONG length) {
+  if (!length) return;
+
+  if (writer->pendingLength &&
+      writer->pending + writer->pendingLength == data) {
+    writer->pendingLength += length;
+    return;
+  }
+
+  flushPending(writer);
+  writer->pending = data;
+  writer->pendingLength = length;
+}
+
+/*
+ * Move the finished file into place. Rename() will not replace a file, so
+ * the old one steps aside first and is only deleted once the new one has
+ * its name; if anything goes wrong the old one gets its name back.
+ */
+static BOOL replaceFile(struct SaveWriter *writer) {
+  if (!writer->replacing) return (BOOL)Rename(writer->tempPath, writer->path);
+
+  /* Left over from a save that was cut short */
+  deleteFile(writer->oldPath);
+
+  if (!Rename(writer->path, writer->oldPath)) return FALSE;
+
+  if (!Rename(writer->tempPath, writer->path)) {
+    Rename(writer->oldPath, writer->path);
+    return FALSE;
+  }
+
+  deleteFile(writer->oldPath);
+  return TRUE;
+}
+
+/*
+ * Write out the rest, get it onto the disk and rename it into place.
+ * FALSE if anything failed, in which case the old file is untouched.
+ */
+BOOL closeSaveWriter(struct SaveWriter *writer) {
+  BOOL success;
+
+  flushPending(writer);
+  success = closeOutStream(writer->out);
+  if (!Close(writer->file)) success = FALSE;
+
+  /* The contents have changed, so the archive bit no longer holds */
+  if (success && writer->replacing) {
+    SetProtection(writer->tempPath, writer->protection & ~FIBF_ARCHIVE);
+  }
+  if (success && writer->date) {
+    SetFileDate(writer->tempPath, (struct DateStamp *)writer->date);
+  }
+
+  if (success) {
+    flushVolume(writer->tempPath);
+    success = replaceFile(writer);
+  }
+
+  if (success) flushVolume(writer->path);
+  else DeleteFile(writer->tempPath);
+
+  FreeMem(writer, sizeof(struct SaveWriter));
+  return success;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef SAVEWRITER_H
+#define SAVEWRITER_H
+
+/* Forward declarations */
+struct SaveWriter;
+struct FileMetadata;
+
+/*
+ * Output for saveToFile(). Spans of bytes are handed over in file order;
+ * a span that starts where the last one ended is merged with it, so a run
+ * of unmodified lines goes out as a single block of fileData. POSIX hosts
+ * gather the blocks into writev() calls without copying them; AmigaOS
+ * buffers small blocks and writes large ones straight from where they are.
+ *
+ * Nothing is written to the path itself. The data goes to a temporary file
+ * beside it, which closeSaveWriter() flushes to disk and only then renames
+ * over the path, so a crash or a failed write leaves the old file whole.
+ * A file that is replaced keeps its protection; with a source, the new one
+ * also gets the date stamp the source was loaded with.
+ *
+ * Spans must stay valid until the writer is closed.
+ */
+struct SaveWriter *openSaveWriter(const char *path,
+                                  const struct FileMetadata *source);
+void writeSpan(struct SaveWriter *writer, const char *data, ULONG length);
+BOOL closeSaveWriter(struct SaveWriter *writer);
+
+#endif
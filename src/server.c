@@ -0,0 +1,605 @@
+/* server.c */
+#include "fileutils.h"
+
+/* A file kept loaded between requests */
+struct ServedFile {
+  char path[MAX_PATH_LEN];          /* Canonical path, the key */
+  struct FileMetadata *metadata;    /* The file, or NULL for a free entry */
+  struct FileVersion version;       /* The file on disk when it was loaded */
+  ULONG lastUsed;                   /* Stamp for LRU eviction */
+};
+
+static struct ServedFile *servedFiles;  /* SERVER_MAX_FILES while serving */
+static ULONG serverClock;
+static BOOL quitRequested;
+
+#ifdef PLATFORM_POSIX
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define REQUEST_FDS 2               /* Client's output and current directory */
+
+/*
+ * A request is the length of the words that follow, sent with the
+ * client's descriptors attached, then the words of its command line, each
+ * NUL terminated. The answer is the command's return code.
+ */
+struct ServerPort {
+  int socket;                       /* Listening socket */
+  char path[MAX_PATH_LEN];          /* Where it is bound */
+};
+
+/* Room for the descriptors a request carries */
+union RequestControl {
+  struct cmsghdr header;
+  char space[CMSG_SPACE(sizeof(int) * REQUEST_FDS)];
+};
+
+static BOOL socketAddress(CONST_STRPTR name, struct sockaddr_un *address) {
+  memset(address, 0, sizeof(struct sockaddr_un));
+  address->sun_family = AF_UNIX;
+  if (strlen(name) >= sizeof(address->sun_path)) return FALSE;
+
+  strcpy(address->sun_path, name);
+  return TRUE;
+}
+
+/* Bind the socket; a socket nobody answers on is left from a server gone */
+static BOOL openServerPort(struct ServerPort *port, CONST_STRPTR name) {
+  struct sockaddr_un address;
+  struct stat st;
+  int probe;
+
+  if (!socketAddress(name, &address) || strlen(name) >= MAX_PATH_LEN) {
+    Printf("Port name %s is too long\n", name);
+    return FALSE;
+  }
+
+  probe = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (probe >= 0 &&
+      connect(probe, (struct sockaddr *)&address, sizeof(address)) == 0) {
+    close(probe);
+    Printf("Port %s is already being served\n", name);
+    return FALSE;
+  }
+  if (probe >= 0) close(probe);
+
+  /* Only ever remove a socket, never a file named by mistake */
+  if (lstat(name, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(name);
+
+  port->socket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (port->socket < 0 ||
+      bind(port->socket, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      listen(port->socket, SOMAXCONN) < 0) {
+    if (port->socket >= 0) close(port->socket);
+    Printf("Could not open port %s\n", name);
+    return FALSE;
+  }
+  strcpy(port->path, name);
+
+  /* A client gone while its output is written must not end the server */
+  signal(SIGPIPE, SIG_IGN);
+  return TRUE;
+}
+
+static void closeServerPort(struct ServerPort *port) {
+  close(port->socket);
+  unlink(port->path);
+}
+
+/* Close whatever descriptors came with a request that is turned away */
+static void closePassed(struct msghdr *message) {
+  struct cmsghdr *header;
+  ULONG count;
+  ULONG i;
+  int fd;
+
+  for (header = CMSG_FIRSTHDR(message); header;
+       header = CMSG_NXTHDR(message, header)) {
+    if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+
+    count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (i = 0; i < count; i++) {
+      memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+      close(fd);
+    }
+  }
+}
+
+/* Read the words and descriptors of a request off a connection */
+static BOOL receiveRequest(int client, char *buffer, ULONG *length,
+                           int *fds) {
+  union RequestControl control;
+  struct cmsghdr *header;
+  struct msghdr message;
+  struct iovec vector;
+  ssize_t count;
+  ULONG got;
+
+  memset(&message, 0, sizeof(message));
+  vector.iov_base = length;
+  vector.iov_len = sizeof(ULONG);
+  message.msg_iov = &vector;
+  message.msg_iovlen = 1;
+  message.msg_control = control.space;
+  message.msg_controllen = sizeof(control.space);
+
+  count = recvmsg(client, &message, 0);
+  if (count < 0) return FALSE;
+
+  /* Descriptors may have arrived with a request that is no good */
+  header = CMSG_FIRSTHDR(&message);
+  if (count != sizeof(ULONG) || (message.msg_flags & MSG_CTRUNC) ||
+      !header || header->cmsg_level != SOL_SOCKET ||
+      header->cmsg_type != SCM_RIGHTS ||
+      header->cmsg_len != CMSG_LEN(sizeof(int) * REQUEST_FDS) ||
+      CMSG_NXTHDR(&message, header)) {
+    closePassed(&message);
+    return FALSE;
+  }
+  memcpy(fds, CMSG_DATA(header), sizeof(int) * REQUEST_FDS);
+
+  for (got = 0; *length <= SERVER_MAX_REQUEST && got < *length; got += count) {
+    count = read(client, buffer + got, *length - got);
+    if (count <= 0) break;
+  }
+
+  if (!*length || got != *length || buffer[*length - 1] != '\0') {
+    close(fds[0]);
+    close(fds[1]);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Run a command with the client's output and directory standing in */
+static LONG runRequest(RequestFunction function, int argc, char *argv[],
+                       const int *fds) {
+  int savedOutput;
+  int savedDirectory;
+  LONG result;
+
+  fflush(stdout);
+  savedOutput = dup(STDOUT_FILENO);
+  savedDirectory = open(".", O_RDONLY);
+  if (savedOutput < 0 || savedDirectory < 0) {
+    if (savedOutput >= 0) close(savedOutput);
+    if (savedDirectory >= 0) close(savedDirectory);
+    return RETURN_FAIL;
+  }
+
+  result = RETURN_FAIL;
+  if (dup2(fds[0], STDOUT_FILENO) >= 0) {
+    if (fchdir(fds[1]) == 0) {
+      setHostArgs(argc, argv);
+      result = function(NULL);
+    }
+    fflush(stdout);
+    dup2(savedOutput, STDOUT_FILENO);
+  }
+
+  if (fchdir(savedDirectory) < 0) {
+    Printf("Could not return to the server's directory\n");
+  }
+  close(savedOutput);
+  close(savedDirectory);
+  return result;
+}
+
+/* Take one client and answer it; FALSE when the port itself failed */
+static BOOL serveRequest(struct ServerPort *port, RequestFunction function) {
+  char buffer[SERVER_MAX_REQUEST];
+  char *words[SERVER_MAX_REQUEST + 1];
+  char *p;
+  ULONG length;
+  LONG result;
+  int fds[REQUEST_FDS];
+  int client;
+  int count;
+
+  client = accept(port->socket, NULL, NULL);
+  if (client < 0) return (BOOL)(errno == EINTR || errno == ECONNABORTED);
+
+  if (receiveRequest(client, buffer, &length, fds)) {
+    count = 0;
+    for (p = buffer; p < buffer + length; p += strlen(p) + 1) {
+      words[count++] = p;
+    }
+    words[count] = NULL;
+
+    result = runRequest(function, count, words, fds);
+    close(fds[0]);
+    close(fds[1]);
+
+    /* A client that has gone away gets no answer */
+    send(client, &result, sizeof(result), 0);
+  }
+
+  close(client);
+  return TRUE;
+}
+
+static BOOL sendAll(int sock, const void *data, ULONG length) {
+  ssize_t count;
+  ULONG sent;
+
+  for (sent = 0; sent < length; sent += count) {
+    count = send(sock, (const char *)data + sent, length - sent, 0);
+    if (count <= 0) return FALSE;
+  }
+  return TRUE;
+}
+
+LONG sendRequest(CONST_STRPTR portName, int argc, char *argv[]) {
+  union RequestControl control;
+  struct sockaddr_un address;
+  struct cmsghdr *header;
+  struct msghdr message;
+  struct iovec vector;
+  char buffer[SERVER_MAX_REQUEST];
+  ULONG length;
+  ULONG size;
+  LONG result;
+  int fds[REQUEST_FDS];
+  int sock;
+  int i;
+
+  /* Every word goes, the program name too, as ReadArgs() skips it */
+  length = 0;
+  for (i = 0; i < argc; i++) {
+    size = strlen(argv[i]) + 1;
+    if (length + size > SERVER_MAX_REQUEST) {
+      Printf("Command line too long for port %s\n", portName);
+      return RETURN_ERROR;
+    }
+    memcpy(buffer + length, argv[i], size);
+    length += size;
+  }
+
+  sock = socketAddress(portName, &address) ? socket(AF_UNIX, SOCK_STREAM, 0)
+                                            : -1;
+  if (sock < 0 ||
+      connect(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    if (sock >= 0) close(sock);
+    Printf("No server on port %s\n", portName);
+    return RETURN_FAIL;
+  }
+
+  fds[0] = STDOUT_FILENO;
+  fds[1] = open(".", O_RDONLY);
+  if (fds[1] < 0) {
+    close(sock);
+    Printf("Could not open the current directory\n");
+    return RETURN_FAIL;
+  }
+
+  memset(&message, 0, sizeof(message));
+  memset(&control, 0, sizeof(control));
+  vector.iov_base = &length;
+  vector.iov_len = sizeof(ULONG);
+  message.msg_iov = &vector;
+  message.msg_iovlen = 1;
+  message.msg_control = control.space;
+  message.msg_controllen = sizeof(control.space);
+
+  header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(int) * REQUEST_FDS);
+  memcpy(CMSG_DATA(header), fds, sizeof(int) * REQUEST_FDS);
+
+  /* The server writes straight to our output, after what is buffered */
+  fflush(stdout);
+
+  result = RETURN_FAIL;
+  if (sendmsg(sock, &message, 0) != sizeof(ULONG) ||
+      !sendAll(sock, buffer, length) ||
+      recv(sock, &result, sizeof(result), MSG_WAITALL) != sizeof(result)) {
+    Printf("Server on port %s did not answer\n", portName);
+    result = RETURN_FAIL;
+  }
+
+  close(fds[1]);
+  close(sock);
+  return result;
+}
+
+#else
+
+#include <exec/ports.h>
+#include <dos/dosextens.h>
+#include <dos/rdargs.h>
+#include <rexx/storage.h>
+
+/* A command line sent by a client, replied to once it has run */
+struct ServerRequest {
+  struct Message message;
+  STRPTR line;                      /* Arguments as GetArgStr() gives them */
+  BPTR output;                      /* Where the client's output goes */
+  BPTR directory;                   /* The client's current directory */
+  LONG result;                      /* Return code of the command */
+};
+
+struct ServerPort {
+  struct MsgPort *port;
+  char name[MAX_PATH_LEN];          /* Public name; the port points at it */
+};
+
+static BOOL openServerPort(struct ServerPort *port, CONST_STRPTR name) {
+  if (strlen(name) >= MAX_PATH_LEN) {
+    Printf("Port name %s is too long\n", name);
+    return FALSE;
+  }
+
+  port->port = CreateMsgPort();
+  if (!port->port) {
+    Printf("Could not open port %s\n", name);
+    return FALSE;
+  }
+  strcpy(port->name, name);
+  port->port->mp_Node.ln_Name = port->name;
+  port->port->mp_Node.ln_Pri = 0;
+
+  /* Nobody may add the same name between looking and adding */
+  Forbid();
+  if (FindPort((STRPTR)name)) {
+    Permit();
+    DeleteMsgPort(port->port);
+    Printf("Port %s is already being served\n", name);
+    return FALSE;
+  }
+  AddPort(port->port);
+  Permit();
+  return TRUE;
+}
+
+/* Answer a client, or ARexx, with the command's return code */
+static void replyRequest(struct Message *message, LONG result) {
+  struct RexxMsg *rexx;
+
+  if (IsRexxMsg((struct RexxMsg *)message)) {
+    rexx = (struct RexxMsg *)message;
+    rexx->rm_Result1 = result;
+    rexx->rm_Result2 = 0;
+  } else {
+    ((struct ServerRequest *)message)->result = result;
+  }
+  ReplyMsg(message);
+}
+
+/* Clients find the port under Forbid(), so none can arrive once it is gone */
+static void closeServerPort(struct ServerPort *port) {
+  struct Message *message;
+
+  RemPort(port->port);
+  while ((message = GetMsg(port->port))) replyRequest(message, RETURN_FAIL);
+  DeleteMsgPort(port->port);
+}
+
+/* Run one message's command line with the client's output and directory */
+static LONG runRequest(RequestFunction function, struct Message *message) {
+  struct ServerRequest *request;
+  struct RDArgs *source;
+  char buffer[SERVER_MAX_REQUEST + 2];
+  STRPTR line;
+  BPTR output;
+  BPTR directory;
+  BPTR oldOutput;
+  BPTR oldDirectory;
+  ULONG length;
+  LONG result;
+
+  /* ARexx commands run where the server does */
+  if (IsRexxMsg((struct RexxMsg *)message)) {
+    line = ARG0((struct RexxMsg *)message);
+    output = Output();
+    directory = ((struct Process *)FindTask(NULL))->pr_CurrentDir;
+  } else {
+    request = (struct ServerRequest *)message;
+    line = request->line;
+    output = request->output;
+    directory = request->directory;
+  }
+
+  /* ReadArgs() wants the line to end in a newline */
+  length = line ? strlen(line) : 0;
+  if (length > SERVER_MAX_REQUEST) return RETURN_ERROR;
+  if (length) memcpy(buffer, line, length);
+  if (!length || buffer[length - 1] != '\n') buffer[length++] = '\n';
+  buffer[length] = '\0';
+
+  source = AllocDosObject(DOS_RDARGS, NULL);
+  if (!source) return RETURN_FAIL;
+
+  source->RDA_Source.CS_Buffer = buffer;
+  source->RDA_Source.CS_Length = length;
+  source->RDA_Source.CS_CurChr = 0;
+  source->RDA_Flags |= RDAF_NOPROMPT;
+
+  oldOutput = SelectOutput(output);
+  oldDirectory = CurrentDir(directory);
+  result = function(source);
+  Flush(Output());
+  SelectOutput(oldOutput);
+  CurrentDir(oldDirectory);
+
+  FreeDosObject(DOS_RDARGS, source);
+  return result;
+}
+
+/* Answer what has arrived; FALSE once CTRL-C asks the server to stop */
+static BOOL serveRequest(struct ServerPort *port, RequestFunction function) {
+  struct Message *message;
+  ULONG signals;
+
+  signals = Wait((1UL << port->port->mp_SigBit) | SIGBREAKF_CTRL_C);
+  if (signals & SIGBREAKF_CTRL_C) return FALSE;
+
+  while (!quitRequested && (message = GetMsg(port->port))) {
+    replyRequest(message, runRequest(function, message));
+  }
+  return TRUE;
+}
+
+LONG sendRequest(CONST_STRPTR portName, int argc, char *argv[]) {
+  struct ServerRequest request;
+  struct MsgPort *reply;
+  struct MsgPort *server;
+
+  reply = CreateMsgPort();
+  if (!reply) {
+    Printf("Could not open a reply port\n");
+    return RETURN_FAIL;
+  }
+
+  memset(&request, 0, sizeof(struct ServerRequest));
+  request.message.mn_Node.ln_Type = NT_MESSAGE;
+  request.message.mn_ReplyPort = reply;
+  request.message.mn_Length = sizeof(struct ServerRequest);
+  request.line = GetArgStr();
+  request.output = Output();
+  request.directory = ((struct Process *)FindTask(NULL))->pr_CurrentDir;
+  request.result = RETURN_FAIL;
+
+  /* The server writes straight to our output, after what is buffered */
+  Flush(Output());
+
+  /* The port must not go away between finding it and sending */
+  Forbid();
+  server = FindPort((STRPTR)portName);
+  if (server) PutMsg(server, &request.message);
+  Permit();
+
+  if (server) {
+    WaitPort(reply);
+    GetMsg(reply);
+  } else {
+    Printf("No server on port %s\n", portName);
+  }
+
+  DeleteMsgPort(reply);
+  return request.result;
+}
+
+#endif
+
+BOOL isServing(void) {
+  return (BOOL)(servedFiles != NULL);
+}
+
+/* Make the server stop once the request running now is answered */
+void stopServing(void) {
+  quitRequested = TRUE;
+}
+
+/*
+ * Look a file up among those loaded, loading it on a miss. A file that
+ * changed on disk is taken in again, keeping the lines that did not. The
+ * server owns what it hands out, and it stays valid for the request.
+ */
+struct FileMetadata *obtainServedFile(const char *path) {
+  struct FileMetadata *metadata;
+  struct ServedFile *served;
+  struct FileVersion version;
+  char canonical[MAX_PATH_LEN];
+  ULONG slot;
+  ULONG i;
+
+  if (!servedFiles || !canonicalPath(path, canonical)) return NULL;
+
+  /* Looked at before loading, so a write during the load shows next time */
+  if (!readFileVersion(path, &version)) return NULL;
+
+  slot = 0;
+  for (i = 0; i < SERVER_MAX_FILES; i++) {
+    served = &servedFiles[i];
+
+    if (!served->metadata) {
+      if (servedFiles[slot].metadata) slot = i;
+      continue;
+    }
+
+    if (strcmp(served->path, canonical) == 0) {
+      metadata = served->metadata;
+      served->lastUsed = ++serverClock;
+      if (!sameFileVersion(&served->version, &version)) {
+        if (!reanalyzeFile(metadata, path)) {
+          freeFileMetadata(metadata);
+          served->metadata = NULL;
+          return NULL;
+        }
+        served->version = version;
+      }
+      break;
+    }
+
+    /* Remember the least recently used entry in case this is a miss */
+    if (servedFiles[slot].metadata &&
+        served->lastUsed < servedFiles[slot].lastUsed) {
+      slot = i;
+    }
+  }
+
+  if (i == SERVER_MAX_FILES) {
+    metadata = analyzeFile(path);
+    if (!metadata) return NULL;
+
+    served = &servedFiles[slot];
+    freeFileMetadata(served->metadata);
+    strcpy(served->path, canonical);
+    served->metadata = metadata;
+    served->version = version;
+    served->lastUsed = ++serverClock;
+  }
+
+  /* Messages and SAVE name the file the way this request does */
+  strncpy(metadata->filename, FilePart((STRPTR)path), MAX_FILENAME_LEN - 1);
+  strncpy(metadata->fullPath, path, MAX_PATH_LEN - 1);
+  return metadata;
+}
+
+/*
+ * Serve requests on a port until a request calls stopServing() or, on
+ * AmigaOS, the server gets a CTRL-C. Every file still loaded is freed.
+ */
+LONG serveRequests(CONST_STRPTR portName, RequestFunction function) {
+  struct ServerPort port;
+  ULONG i;
+
+  servedFiles = AllocMem(SERVER_MAX_FILES * sizeof(struct ServedFile),
+                         MEMF_ANY | MEMF_CLEAR);
+  if (!servedFiles) {
+    Printf("Not enough memory to serve\n");
+    return RETURN_FAIL;
+  }
+
+  if (!openServerPort(&port, portName)) {
+    FreeMem(servedFiles, SERVER_MAX_FILES * sizeof(struct ServedFile));
+    servedFiles = NULL;
+    return RETURN_FAIL;
+  }
+
+  Printf("Serving on port %s\n", portName);
+  Flush(Output());
+
+  quitRequested = FALSE;
+  while (!quitRequested && serveRequest(&port, function));
+
+  closeServerPort(&port);
+  for (i = 0; i < SERVER_MAX_FILES; i++) {
+    freeFileMetadata(servedFiles[i].metadata);
+  }
+  FreeMem(servedFiles, SERVER_MAX_FILES * sizeof(struct ServedFile));
+  servedFiles = NULL;
+  return RETURN_OK;
+}
@@ -0,0 +1,40 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/* Forward declarations */
+struct FileMetadata;
+struct RDArgs;
+
+#define SERVER_MAX_FILES 16       /* Files a server keeps loaded */
+#define SERVER_MAX_REQUEST 4096   /* Longest command line it takes */
+
+/*
+ * Resident mode. A server holds a public port and runs the command lines
+ * clients send it, one at a time, keeping the files they load between
+ * requests. A file already loaded is only checked against the version
+ * read by readFileVersion() when it was loaded, and taken in again through
+ * reanalyzeFile() if the file on disk has changed since. Edits
+ * stay in the loaded file until SAVE writes them out; to make room, the
+ * least recently used file is dropped, edits and all.
+ *
+ * On AmigaOS the port is a public message port, which ARexx can address
+ * too; ARexx commands print to the server's own console. On POSIX hosts
+ * it is a Unix domain socket at the path given. A client hands over its
+ * output and current directory with each command, so the output reaches
+ * it and relative paths mean what they mean to it.
+ *
+ * The function is called for each request with what ReadArgs() is to
+ * read: on AmigaOS the command line as a source, on POSIX hosts NULL, as
+ * the words have been handed to setHostArgs() already.
+ */
+typedef LONG (*RequestFunction)(struct RDArgs *source);
+
+LONG serveRequests(CONST_STRPTR portName, RequestFunction function);
+void stopServing(void);
+BOOL isServing(void);
+struct FileMetadata *obtainServedFile(const char *path);
+
+/* Send the command line of this run to a server; returns its result */
+LONG sendRequest(CONST_STRPTR portName, int argc, char *argv[]);
+
+#endif
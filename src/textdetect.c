@@ -0,0 +1,134 @@
+/* textdetect.c */
+#include "fileutils.h"
+
+#define HUNK_UNIT 0x3E7      /* First longword of an object file */
+#define HUNK_HEADER 0x3F3    /* First longword of a load file */
+
+/* Sample a 16K head plus 16 blocks of 4K spread over the rest */
+struct DetectPolicy detectPolicy = {
+  TRUE,     /* sampled */
+  16384,    /* headSize */
+  4096,     /* sampleSize */
+  16,       /* sampleCount */
+  2,        /* textPercent */
+  25,       /* binaryPercent */
+  TRUE      /* nulBlocksText */
+};
+
+/* Read a big-endian longword */
+static ULONG peekLong(const char *p) {
+  const UBYTE *b;
+
+  b = (const UBYTE *)p;
+  return ((ULONG)b[0] << 24) | ((ULONG)b[1] << 16) |
+         ((ULONG)b[2] << 8) | (ULONG)b[3];
+}
+
+/* Check for a four character IFF chunk ID */
+static BOOL isChunkId(const char *p) {
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    if (p[i] < ' ' || p[i] > '~') return FALSE;
+  }
+  return TRUE;
+}
+
+/* Recognize binary formats common on the Amiga by their first bytes */
+DetectResult checkSignature(const char *head, ULONG length, ULONG fileSize) {
+  ULONG formSize;
+
+  /* Executables and object files start with a hunk ID */
+  if (length >= 4 &&
+      (peekLong(head) == HUNK_HEADER || peekLong(head) == HUNK_UNIT)) {
+    return DETECT_BINARY;
+  }
+
+  /* IFF, as long as the size fits the file and a type ID follows */
+  if (length >= 12 && (strncmp(head, "FORM", 4) == 0 ||
+                       strncmp(head, "LIST", 4) == 0 ||
+                       strncmp(head, "CAT ", 4) == 0)) {
+    formSize = peekLong(head + 4);
+    if (formSize >= 4 && formSize <= fileSize - 8 && isChunkId(head + 8)) {
+      return DETECT_BINARY;
+    }
+  }
+
+  /* LhA and LArc archives carry their method as -lh?- or -lz?- */
+  if (length >= 7 && head[2] == '-' && head[3] == 'l' &&
+      (head[4] == 'h' || head[4] == 'z') && head[6] == '-') {
+    return DETECT_BINARY;
+  }
+
+  /* LZX archives */
+  if (length >= 4 && strncmp(head, "LZX", 3) == 0 &&
+      (UBYTE)head[3] < ' ') {
+    return DETECT_BINARY;
+  }
+
+  return DETECT_UNSURE;
+}
+
+/* Add one sampled block to the running totals */
+void addDetectSample(struct DetectSample *sample, const char *data,
+                     ULONG length) {
+  sample->examined += length;
+  sample->nonPrintable += countNonPrintable(data, length);
+  if (!sample->sawNul && memchr(data, 0, length)) sample->sawNul = TRUE;
+}
+
+/* Decide what the samples taken so far say about the file */
+DetectResult judgeDetectSample(const struct DetectSample *sample,
+                               const struct DetectPolicy *policy) {
+  if (!sample->examined) return DETECT_UNSURE;
+
+  if (sample->nonPrintable * 100 > policy->binaryPercent * sample->examined) {
+    return DETECT_BINARY;
+  }
+  if (sample->nonPrintable * 100 <= policy->textPercent * sample->examined) {
+    return policy->nulBlocksText && sample->sawNul ? DETECT_UNSURE :
+                                                     DETECT_TEXT;
+  }
+
+  return DETECT_UNSURE;
+}
+
+/* Check whether sampling reads sufficiently less than a full scan would */
+BOOL worthSampling(ULONG fileSize, const struct DetectPolicy *policy) {
+  ULONG sampled;
+
+  if (!policy->sampled) return FALSE;
+
+  sampled = policy->headSize + policy->sampleCount * policy->sampleSize;
+  return (BOOL)(fileSize / 2 > sampled);
+}
+
+/* Offset of a sampled block; the last one ends at or near the end of file */
+ULONG sampleOffset(ULONG fileSize, ULONG index,
+                   const struct DetectPolicy *policy) {
+  ULONG span;
+
+  span = fileSize - policy->headSize - policy->sampleSize;
+  return policy->headSize + span / policy->sampleCount * (index + 1);
+}
+
+/* Sample a file held in memory; DETECT_UNSURE asks for a full scan */
+DetectResult sampleFileData(const char *data, ULONG size,
+                            const struct DetectPolicy *policy) {
+  struct DetectSample sample;
+  ULONG i;
+
+  if (!worthSampling(size, policy)) return DETECT_UNSURE;
+
+  if (checkSignature(data, size, size) == DETECT_BINARY) return DETECT_BINARY;
+
+  memset(&sample, 0, sizeof(struct DetectSample));
+  addDetectSample(&sample, data, policy->headSize);
+
+  for (i = 0; i < policy->sampleCount; i++) {
+    addDetectSample(&sample, data + sampleOffset(size, i, policy),
+                    policy->sampleSize);
+  }
+
+  return judgeDetectSample(&sample, policy);
+}
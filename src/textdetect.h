@@ -0,0 +1,55 @@
+#ifndef TEXTDETECT_H
+#define TEXTDETECT_H
+
+/* What a look at part of a file says about it */
+typedef enum DetectResult {
+  DETECT_UNSURE,  /* Only a full scan can tell */
+  DETECT_TEXT,
+  DETECT_BINARY
+} DetectResult;
+
+/*
+ * How to tell text from binary without reading all of a large file. The
+ * head of the file is checked for known binary signatures, then the head
+ * and sampleCount blocks spread evenly over the rest are counted for
+ * non-printable bytes. Shares that fall between textPercent and
+ * binaryPercent are ambiguous and fall back to a full scan, as do files too
+ * small for sampling to save anything. A NUL is not proof on its own, as
+ * text files can carry a stray one, so with nulBlocksText set a sampled
+ * NUL only keeps a low share from being called text.
+ *
+ * A full scan calls a file binary when over BINARY_THRESHOLD of its bytes
+ * are non-printable. Samples can disagree with that, so loaded files still
+ * get their full scan unless the samples say binary.
+ */
+struct DetectPolicy {
+  BOOL sampled;          /* FALSE always scans the whole file */
+  ULONG headSize;        /* Bytes sampled from the start of the file */
+  ULONG sampleSize;      /* Bytes in each block sampled after the head */
+  ULONG sampleCount;     /* Blocks sampled after the head */
+  ULONG textPercent;     /* Non-printable share the samples call text */
+  ULONG binaryPercent;   /* Share over which the samples call binary */
+  BOOL nulBlocksText;    /* A NUL sampled leaves text to a full scan */
+};
+
+/* Running totals over the sampled blocks */
+struct DetectSample {
+  ULONG examined;        /* Bytes sampled so far */
+  ULONG nonPrintable;    /* Non-printable bytes among them */
+  BOOL sawNul;           /* Whether any of them was NUL */
+};
+
+extern struct DetectPolicy detectPolicy;
+
+DetectResult checkSignature(const char *head, ULONG length, ULONG fileSize);
+void addDetectSample(struct DetectSample *sample, const char *data,
+                     ULONG length);
+DetectResult judgeDetectSample(const struct DetectSample *sample,
+                               const struct DetectPolicy *policy);
+BOOL worthSampling(ULONG fileSize, const struct DetectPolicy *policy);
+ULONG sampleOffset(ULONG fileSize, ULONG index,
+                   const struct DetectPolicy *policy);
+DetectResult sampleFileData(const char *data, ULONG size,
+                            const struct DetectPolicy *policy);
+
+#endif
@@ -4,20 +4,44 @@
 /* Forward declarations */
 struct FileMetadata;
 
+/* How a line is terminated */
+typedef enum LineEnding {
+  EOL_NONE,      /* Last line of a file without a final newline */
+  EOL_LF,
+  EOL_CR,
+  EOL_CRLF
+} LineEnding;
+
+#define ENDING_LENGTH(e) ((e) == EOL_CRLF ? 2 : (e) == EOL_NONE ? 0 : 1)
+
 /* Structure to represent a single line in a text file */
 struct TextLine {
   struct FileMetadata *parent; /* The file this line belongs to */
-  char *content;               /* The actual line content */
+  char *content;               /* Owned copy once modified, else NULL */
   ULONG lineNumber;            /* Line number in file (1-based) */
   ULONG length;                /* Length of the line */
   ULONG filePosition;          /* Position in file where line starts */
   ULONG rawLength;             /* Length including newline chars */
   BOOL hasNewline;             /* Whether line ends with newline */
+  LineEnding ending;           /* Which newline it ends with */
   LineType type;               /* Type of line (for script files) */
-  struct TextLine *next;       /* Pointer to next line (if needed) */
 };
 
-struct TextLine *parseLine(const char *lineStart, ULONG lineNum, ULONG filePos);
+/*
+ * Unmodified lines are views into parent->fileData: filePosition and
+ * length locate the text and content stays NULL. A line only gets its own
+ * storage once insertLine() or setLineContent() gives it new text.
+ */
+void parseLine(
+  struct TextLine *line,
+  const char *lineStart, const char *dataEnd,
+  ULONG lineNum, ULONG filePos
+);
+const char *lineText(const struct TextLine *line);
+STRPTR lineString(const struct TextLine *line);
+STRPTR copyLineString(const struct TextLine *line, char *buffer);
+BOOL setLineContent(struct TextLine *line, const char *content);
+void printLineInfo(const struct TextLine *line);
 struct TextLine *findLineByPattern(
   const struct FileMetadata *metadata,
   const char *pattern, BOOL noCase
@@ -0,0 +1,371 @@
+/* workpool.c */
+#include "fileutils.h"
+
+#define MAX_WORKERS 64        /* Upper bound on workers in one pool */
+
+/* Append an item to a queue */
+static void appendItem(struct WorkItem **head, struct WorkItem **tail,
+                       struct WorkItem *item) {
+  item->next = NULL;
+  if (*tail) (*tail)->next = item;
+  else *head = item;
+  *tail = item;
+}
+
+/* Take the first item off a queue, or NULL if it is empty */
+static struct WorkItem *removeItem(struct WorkItem **head,
+                                   struct WorkItem **tail) {
+  struct WorkItem *item;
+
+  item = *head;
+  if (item) {
+    *head = item->next;
+    if (!*head) *tail = NULL;
+  }
+  return item;
+}
+
+#ifdef PLATFORM_POSIX
+
+#include <unistd.h>
+
+struct WorkPool {
+  pthread_mutex_t lock;         /* Guards everything below */
+  pthread_cond_t queued;        /* Signalled when work is queued or on quit */
+  pthread_cond_t finished;      /* Signalled when an item is done */
+  struct WorkItem *pendingHead; /* Items waiting for a worker */
+  struct WorkItem *pendingTail;
+  struct WorkItem *doneHead;    /* Items done but not yet collected */
+  struct WorkItem *doneTail;
+  BOOL quit;                    /* Workers stop once pending is empty */
+  ULONG workerCount;            /* Threads running */
+  pthread_t threads[MAX_WORKERS];
+};
+
+/* Thread body: run queued items until the pool is deleted */
+static void *workerThread(void *data) {
+  struct WorkPool *pool;
+  struct WorkItem *item;
+
+  pool = data;
+  pthread_mutex_lock(&pool->lock);
+
+  for (;;) {
+    while (!pool->pendingHead && !pool->quit) {
+      pthread_cond_wait(&pool->queued, &pool->lock);
+    }
+
+    item = removeItem(&pool->pendingHead, &pool->pendingTail);
+    if (!item) break;
+
+    pthread_mutex_unlock(&pool->lock);
+    item->function(item);
+    pthread_mutex_lock(&pool->lock);
+
+    appendItem(&pool->doneHead, &pool->doneTail, item);
+    pthread_cond_signal(&pool->finished);
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/* Start a pool of threads; fewer may start than asked for */
+struct WorkPool *createWorkPool(ULONG workers) {
+  struct WorkPool *pool;
+
+  if (workers < 1) workers = 1;
+  if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+
+  pool = AllocMem(sizeof(struct WorkPool), MEMF_CLEAR);
+  if (!pool) return NULL;
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->queued, NULL);
+  pthread_cond_init(&pool->finished, NULL);
+
+  while (pool->workerCount < workers &&
+         pthread_create(&pool->threads[pool->workerCount], NULL,
+                        workerThread, pool) == 0) {
+    pool->workerCount++;
+  }
+
+  if (!pool->workerCount) {
+    deleteWorkPool(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+/* Queue an item for the next free worker */
+void submitWork(struct WorkPool *pool, struct WorkItem *item,
+                WorkFunction function) {
+  item->function = function;
+
+  pthread_mutex_lock(&pool->lock);
+  appendItem(&pool->pendingHead, &pool->pendingTail, item);
+  pthread_cond_signal(&pool->queued);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* Wait for the next item to be done; there must be one outstanding */
+struct WorkItem *waitWork(struct WorkPool *pool) {
+  struct WorkItem *item;
+
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->doneHead) pthread_cond_wait(&pool->finished, &pool->lock);
+  item = removeItem(&pool->doneHead, &pool->doneTail);
+  pthread_mutex_unlock(&pool->lock);
+
+  return item;
+}
+
+/* Stop the workers once they run out of work, and free the pool */
+void deleteWorkPool(struct WorkPool *pool) {
+  ULONG i;
+
+  if (!pool) return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = TRUE;
+  pthread_cond_broadcast(&pool->queued);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < pool->workerCount; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&pool->finished);
+  pthread_cond_destroy(&pool->queued);
+  pthread_mutex_destroy(&pool->lock);
+  FreeMem(pool, sizeof(struct WorkPool));
+}
+
+/* One worker per online CPU */
+ULONG defaultWorkerCount(void) {
+  long cpus;
+
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 1) return 1;
+  if (cpus > MAX_WORKERS) return MAX_WORKERS;
+  return (ULONG)cpus;
+}
+
+void initWorkLock(WorkLock *lock) {
+  pthread_mutex_init(lock, NULL);
+}
+
+void obtainWorkLock(WorkLock *lock) {
+  pthread_mutex_lock(lock);
+}
+
+void releaseWorkLock(WorkLock *lock) {
+  pthread_mutex_unlock(lock);
+}
+
+void freeWorkLock(WorkLock *lock) {
+  pthread_mutex_destroy(lock);
+}
+
+#else
+
+#include <dos/dostags.h>
+#include <dos/dosextens.h>
+
+#define WORKER_STACK_SIZE 16384   /* Stack of each worker process */
+#define DEFAULT_WORKERS 2         /* Enough to overlap one load with another */
+
+/* Worker entry points must set up the data base register themselves */
+#if defined(__SASC) || defined(__GNUC__)
+#define WORKER_ENTRY __saveds
+#else
+#define WORKER_ENTRY
+#endif
+
+/* A worker process; its message starts it up and later shuts it down */
+struct Worker {
+  struct Message message;       /* Startup and shutdown handshake */
+  struct MsgPort *port;         /* Port the worker takes items from */
+  BOOL busy;                    /* Whether an item is out with it */
+};
+
+struct WorkPool {
+  struct MsgPort *replyPort;    /* Every worker replies its items here */
+  struct WorkItem *pendingHead; /* Items waiting for a free worker */
+  struct WorkItem *pendingTail;
+  ULONG workerCount;            /* Workers running */
+  struct Worker workers[MAX_WORKERS];
+};
+
+/* Get the next message from a port, waiting for one if need be */
+static struct Message *nextMessage(struct MsgPort *port) {
+  struct Message *message;
+
+  while (!(message = GetMsg(port))) WaitPort(port);
+  return message;
+}
+
+/*
+ * Process body. The startup message arrives on the process port and is
+ * answered with a private port, which then carries the items; the same
+ * message coming back there is the signal to quit.
+ */
+static void WORKER_ENTRY workerEntry(void) {
+  struct Process *self;
+  struct Worker *worker;
+  struct Message *message;
+  struct WorkItem *item;
+
+  self = (struct Process *)FindTask(NULL);
+  worker = (struct Worker *)nextMessage(&self->pr_MsgPort);
+
+  worker->port = CreateMsgPort();
+  if (worker->port) {
+    ReplyMsg(&worker->message);
+
+    while ((message = nextMessage(worker->port)) != &worker->message) {
+      item = (struct WorkItem *)message;
+      item->function(item);
+      ReplyMsg(message);
+    }
+
+    DeleteMsgPort(worker->port);
+  }
+
+  /* Stay in Forbid() so our code cannot be unloaded before we are gone */
+  Forbid();
+  ReplyMsg(&worker->message);
+}
+
+/* Hand an item to an idle worker */
+static void dispatchItem(struct WorkPool *pool, struct Worker *worker,
+                         struct WorkItem *item) {
+  item->message.mn_ReplyPort = pool->replyPort;
+  item->message.mn_Length = sizeof(struct WorkItem);
+  item->port = worker->port;
+
+  worker->busy = TRUE;
+  PutMsg(worker->port, &item->message);
+}
+
+/* Start a pool of worker processes; fewer may start than asked for */
+struct WorkPool *createWorkPool(ULONG workers) {
+  struct WorkPool *pool;
+  struct Worker *worker;
+  struct Process *process;
+
+  if (workers < 1) workers = 1;
+  if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+
+  pool = AllocMem(sizeof(struct WorkPool), MEMF_PUBLIC | MEMF_CLEAR);
+  if (!pool) return NULL;
+
+  pool->replyPort = CreateMsgPort();
+  if (!pool->replyPort) {
+    FreeMem(pool, sizeof(struct WorkPool));
+    return NULL;
+  }
+
+  while (pool->workerCount < workers) {
+    process = CreateNewProcTags(NP_Entry, (ULONG)workerEntry,
+                                NP_Name, (ULONG)"Analyze worker",
+                                NP_StackSize, WORKER_STACK_SIZE,
+                                TAG_DONE);
+    if (!process) break;
+
+    /* The reply says whether the worker got a port of its own */
+    worker = &pool->workers[pool->workerCount];
+    worker->message.mn_ReplyPort = pool->replyPort;
+    worker->message.mn_Length = sizeof(struct Worker);
+    PutMsg(&process->pr_MsgPort, &worker->message);
+    nextMessage(pool->replyPort);
+
+    if (!worker->port) break;
+    pool->workerCount++;
+  }
+
+  if (!pool->workerCount) {
+    deleteWorkPool(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+/* Send an item to an idle worker, or queue it until one is free */
+void submitWork(struct WorkPool *pool, struct WorkItem *item,
+                WorkFunction function) {
+  ULONG i;
+
+  item->function = function;
+
+  for (i = 0; i < pool->workerCount; i++) {
+    if (!pool->workers[i].busy) {
+      dispatchItem(pool, &pool->workers[i], item);
+      return;
+    }
+  }
+
+  appendItem(&pool->pendingHead, &pool->pendingTail, item);
+}
+
+/* Wait for the next item to be done; there must be one outstanding */
+struct WorkItem *waitWork(struct WorkPool *pool) {
+  struct WorkItem *item;
+  struct WorkItem *next;
+  ULONG i;
+
+  item = (struct WorkItem *)nextMessage(pool->replyPort);
+
+  /* The worker that did it takes the next queued item, if any */
+  for (i = 0; i < pool->workerCount; i++) {
+    if (pool->workers[i].port == item->port) {
+      next = removeItem(&pool->pendingHead, &pool->pendingTail);
+      if (next) dispatchItem(pool, &pool->workers[i], next);
+      else pool->workers[i].busy = FALSE;
+      break;
+    }
+  }
+
+  return item;
+}
+
+/* Stop the workers and free the pool; no item may be outstanding */
+void deleteWorkPool(struct WorkPool *pool) {
+  struct Worker *worker;
+  ULONG i;
+
+  if (!pool) return;
+
+  for (i = 0; i < pool->workerCount; i++) {
+    worker = &pool->workers[i];
+    PutMsg(worker->port, &worker->message);
+    nextMessage(pool->replyPort);
+  }
+
+  DeleteMsgPort(pool->replyPort);
+  FreeMem(pool, sizeof(struct WorkPool));
+}
+
+/* There is one CPU, so more workers only add seeking */
+ULONG defaultWorkerCount(void) {
+  return DEFAULT_WORKERS;
+}
+
+/* The semaphore must sit in cleared memory that all workers can reach */
+void initWorkLock(WorkLock *lock) {
+  InitSemaphore(lock);
+}
+
+void obtainWorkLock(WorkLock *lock) {
+  ObtainSemaphore(lock);
+}
+
+void releaseWorkLock(WorkLock *lock) {
+  ReleaseSemaphore(lock);
+}
+
+/* A semaphore holds no resources once nobody uses it */
+void freeWorkLock(WorkLock *lock) {
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#ifdef PLATFORM_POSIX
+#include <pthread.h>
+#else
+#include <exec/ports.h>
+#include <exec/semaphores.h>
+#endif
+
+/* Forward declarations */
+struct WorkPool;
+struct WorkItem;
+
+typedef void (*WorkFunction)(struct WorkItem *item);
+
+/* A lock for state that workers share while they run */
+#ifdef PLATFORM_POSIX
+typedef pthread_mutex_t WorkLock;
+#else
+typedef struct SignalSemaphore WorkLock;
+#endif
+
+/*
+ * A piece of work for the pool, embedded at the start of a caller's own
+ * structure. On AmigaOS it travels to a worker process as a message and
+ * comes back as the reply.
+ */
+struct WorkItem {
+#ifndef PLATFORM_POSIX
+  struct Message message;   /* Sent to the worker, replied when done */
+  struct MsgPort *port;     /* Port of the worker it was sent to */
+#endif
+  struct WorkItem *next;    /* Link in the pool's queues */
+  WorkFunction function;    /* What the worker calls with the item */
+};
+
+/*
+ * A fixed number of workers running items handed to submitWork(). POSIX
+ * hosts use threads; AmigaOS uses child processes that all reply to the
+ * pool's one port. Items finish in any order; waitWork() returns them as
+ * they do, and the caller puts them back in order if it needs to.
+ *
+ * Functions run on a worker must not print or touch unguarded globals
+ * such as the pattern cache.
+ */
+struct WorkPool *createWorkPool(ULONG workers);
+void submitWork(struct WorkPool *pool, struct WorkItem *item,
+                WorkFunction function);
+struct WorkItem *waitWork(struct WorkPool *pool);
+void deleteWorkPool(struct WorkPool *pool);
+ULONG defaultWorkerCount(void);
+
+void initWorkLock(WorkLock *lock);
+void obtainWorkLock(WorkLock *lock);
+void releaseWorkLock(WorkLock *lock);
+void freeWorkLock(WorkLock *lock);
+
+#endif